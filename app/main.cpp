@@ -3,10 +3,16 @@
 #include "data/Store.h"
 #include "persistence/Snapshot.h"
 #include "core/Common.h"
+#include "cluster/Cluster.h"
+#include <csignal>
 #include <thread>
 #include <iostream>
 
 int main() {
+    // Writes to a peer that already went away must fail with EPIPE rather
+    // than kill the server.
+    signal(SIGPIPE, SIG_IGN);
+
     if (!config::load()) {
         std::cout << "Unable to read config\n"
                   << "Please ensure config.json exists and is correctly setup"
@@ -22,6 +28,11 @@ int main() {
     }
 
     std::thread snapshotThread(Snapshot::periodicSave);
+    std::thread maintenanceThread(&Store::periodicMaintenance, &Store::getInstance());
+    if (cluster::enabled()) {
+        cluster::init();
+        std::thread(cluster::gossipLoop).detach();
+    }
     int serverFd = setupServer();
     handleClients(serverFd);
     if (close(serverFd)) {
@@ -29,6 +40,7 @@ int main() {
     }
 
     snapshotThread.join();
+    maintenanceThread.join();
     Store::deleteInstance();
 
     return 0;
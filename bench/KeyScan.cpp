@@ -0,0 +1,278 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <iomanip>
+#include <iostream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include "KeyScan.h"
+#include "protocol/Response.h"
+
+// Keys SCAN is asked for per batch.
+#define KEY_SCAN_BATCH 1000
+
+namespace {
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 6379;
+    size_t top = 10;
+    double interval = 0;
+};
+
+Options parseOptions(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string flag = argv[i];
+        if (i + 1 >= argc) {
+            throw std::invalid_argument("missing value for " + flag);
+        }
+        std::string value = argv[++i];
+        if (flag == "-h") {
+            options.host = value;
+        }
+        else if (flag == "-p") {
+            options.port = std::stoi(value);
+        }
+        else if (flag == "-n") {
+            options.top = std::max(1ul, std::stoul(value));
+        }
+        else if (flag == "-i") {
+            options.interval = std::stod(value);
+        }
+        else {
+            throw std::invalid_argument("unknown option " + flag);
+        }
+    }
+
+    return options;
+}
+
+// A parsed RESP2 reply.
+struct Reply {
+    char type = 0;
+    std::string text;       // simple string, error or bulk string
+    long long integer = 0;  // also the length of a null bulk string or array
+    std::vector<Reply> elements;
+};
+
+// A blocking connection that reads replies one at a time. Throws
+// std::runtime_error when the server goes away.
+class Client {
+public:
+    explicit Client(const Options& options) {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(options.port);
+        if (fd < 0 || inet_pton(AF_INET, options.host.c_str(), &addr.sin_addr) != 1 ||
+            connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            throw std::runtime_error("cannot connect to " + options.host + ":" + std::to_string(options.port));
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    ~Client() {
+        close(fd);
+    }
+
+    Client(const Client&) = delete;
+    Client& operator=(const Client&) = delete;
+
+    void send(const std::string& data) {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) {
+                throw std::runtime_error("connection lost");
+            }
+            sent += n;
+        }
+    }
+
+    Reply read() {
+        Reply reply;
+        std::string line = readLine();
+        reply.type = line[0];
+        if (reply.type == '+' || reply.type == '-') {
+            reply.text = line.substr(1);
+        }
+        else if (reply.type == ':') {
+            reply.integer = std::stoll(line.substr(1));
+        }
+        else if (reply.type == '$') {
+            reply.integer = std::stoll(line.substr(1));
+            if (reply.integer >= 0) {
+                fill(reply.integer + 2);
+                reply.text = buf.substr(start, reply.integer);
+                start += reply.integer + 2;
+            }
+        }
+        else if (reply.type == '*') {
+            reply.integer = std::stoll(line.substr(1));
+            for (long long i = 0; i < reply.integer; i++) {
+                reply.elements.push_back(read());
+            }
+        }
+        else {
+            throw std::runtime_error("unexpected reply " + line);
+        }
+        return reply;
+    }
+
+private:
+    // Buffers at least `n` unread bytes.
+    void fill(size_t n) {
+        while (buf.size() - start < n) {
+            buf.erase(0, start);
+            start = 0;
+            char chunk[65536];
+            ssize_t got = recv(fd, chunk, sizeof(chunk), 0);
+            if (got <= 0) {
+                throw std::runtime_error("connection lost");
+            }
+            buf.append(chunk, got);
+        }
+    }
+
+    std::string readLine() {
+        size_t eol;
+        while ((eol = buf.find("\r\n", start)) == std::string::npos) {
+            fill(buf.size() - start + 1);
+        }
+        std::string line = buf.substr(start, eol - start);
+        start = eol + 2;
+        if (line.empty()) {
+            throw std::runtime_error("empty reply line");
+        }
+        return line;
+    }
+
+    int fd;
+    std::string buf;
+    size_t start = 0;
+};
+
+struct TypeTotals {
+    explicit TypeTotals(const char* name) : name(name) {}
+
+    const char* name;
+    size_t keys = 0;
+    unsigned long long sum = 0;
+    std::string biggestKey;
+    long long biggest = -1;
+};
+
+// Keeps the `limit` keys with the highest scores seen.
+class TopKeys {
+public:
+    explicit TopKeys(size_t limit) : limit(limit) {}
+
+    void offer(const std::string& key, const char* type, long long score) {
+        if (keys.size() == limit && score <= keys.back().score) {
+            return;
+        }
+        Entry entry{key, type, score};
+        keys.insert(std::upper_bound(keys.begin(), keys.end(), entry, [](const Entry& a, const Entry& b) {
+            return a.score > b.score;
+        }), entry);
+        if (keys.size() > limit) {
+            keys.pop_back();
+        }
+    }
+
+    void print(const char* unit) const {
+        for (const Entry& entry : keys) {
+            std::cout << std::setw(14) << entry.score << " " << unit << "  " << std::left << std::setw(8)
+                      << entry.type << std::right << entry.key << std::endl;
+        }
+    }
+
+private:
+    struct Entry {
+        std::string key;
+        const char* type;
+        long long score;
+    };
+
+    size_t limit;
+    std::vector<Entry> keys;
+};
+
+}
+
+int runKeyScan(int argc, char** argv) {
+    std::string mode = argv[0];
+    Options options = parseOptions(argc, argv);
+    bool big = mode == "bigkeys";
+    const char* unit = big ? "bytes" : "accesses";
+    Client client(options);
+
+    std::vector<TypeTotals> types = {TypeTotals("string"), TypeTotals("list"), TypeTotals("stream")};
+    TopKeys top(options.top);
+    size_t scanned = 0;
+    for (TypeTotals& type : types) {
+        std::string cursor = "0";
+        do {
+            client.send(resp::encodeCommand({"SCAN", cursor, "COUNT", std::to_string(KEY_SCAN_BATCH), "TYPE", type.name}));
+            Reply page = client.read();
+            if (page.type != '*' || page.elements.size() != 2) {
+                throw std::runtime_error("SCAN failed: " + page.text);
+            }
+            cursor = page.elements[0].text;
+            const std::vector<Reply>& keys = page.elements[1].elements;
+
+            std::string batch;
+            for (const Reply& key : keys) {
+                batch += big ? resp::encodeCommand({"MEMORY", "USAGE", key.text})
+                             : resp::encodeCommand({"OBJECT", "FREQ", key.text});
+            }
+            client.send(batch);
+            for (const Reply& key : keys) {
+                Reply score = client.read();
+                if (score.type == '-') {
+                    throw std::runtime_error((big ? "MEMORY USAGE failed: " : "OBJECT FREQ failed: ") + score.text);
+                }
+                // Null when the key went away since SCAN returned it.
+                if (score.type != ':') {
+                    continue;
+                }
+                type.keys++;
+                type.sum += score.integer;
+                if (score.integer > type.biggest) {
+                    type.biggest = score.integer;
+                    type.biggestKey = key.text;
+                }
+                top.offer(key.text, type.name, score.integer);
+            }
+
+            scanned += keys.size();
+            if (options.interval > 0) {
+                std::this_thread::sleep_for(std::chrono::duration<double>(options.interval));
+            }
+        } while (cursor != "0");
+    }
+
+    std::cout << "scanned " << scanned << " keys for " << (big ? "size" : "access frequency") << "\n\n";
+    std::cout << (big ? "biggest keys" : "hottest keys") << ":\n";
+    top.print(unit);
+    std::cout << "\n";
+    for (const TypeTotals& type : types) {
+        if (type.keys == 0) {
+            std::cout << "0 " << type.name << " keys\n";
+            continue;
+        }
+        std::cout << type.keys << " " << type.name << " keys with " << type.sum << " " << unit << " (avg "
+                  << std::fixed << std::setprecision(1) << double(type.sum) / type.keys << "), "
+                  << (big ? "biggest" : "hottest") << " '" << type.biggestKey << "' with " << type.biggest << " "
+                  << unit << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef KEY_SCAN_H
+#define KEY_SCAN_H
+
+// Keyspace scans of a running server, in the manner of redis-cli's
+// --bigkeys and --hotkeys.
+//
+// The whole keyspace is walked with SCAN, one type at a time, and each page
+// of keys is sized with a pipelined MEMORY USAGE (bigkeys) or rated with
+// OBJECT FREQ (hotkeys). The report lists the largest or hottest keys and
+// per-type totals. SCAN takes no lock for long, so this is safe to run
+// against a live server; -i spaces the batches out further. For hot keys,
+// HOTKEYS returns the server's own top list without a scan, but only for
+// keys hot enough to have entered it.
+
+#define KEY_SCAN_USAGE \
+    "  -h host         server address (127.0.0.1)\n" \
+    "  -p port         server port (6379)\n" \
+    "  -n keys         keys listed (10)\n" \
+    "  -i seconds      pause between SCAN batches (0)\n"
+
+// argv[0] is "bigkeys" or "hotkeys".
+int runKeyScan(int argc, char** argv);
+
+#endif // KEY_SCAN_H
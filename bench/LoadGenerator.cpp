@@ -0,0 +1,420 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <random>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include "LoadGenerator.h"
+#include "protocol/Response.h"
+
+namespace {
+
+using LoadClock = std::chrono::steady_clock;
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 6379;
+    size_t clients = 50;
+    size_t pipeline = 1;
+    uint64_t requests = 100000;
+    double seconds = 0;
+    std::vector<std::string> tests = {"get", "set"};
+    size_t keyspace = 10000;
+    size_t valueSize = 16;
+    double rate = 0;
+};
+
+// Shared by every connection thread.
+struct Run {
+    Options options;
+    LoadClock::time_point start;
+    LoadClock::time_point deadline;
+    std::atomic<uint64_t> issued{0};
+    std::atomic<uint64_t> errors{0};
+    std::atomic<bool> failed{false};
+};
+
+Options parseOptions(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string flag = argv[i];
+        if (i + 1 >= argc) {
+            throw std::invalid_argument("missing value for " + flag);
+        }
+        std::string value = argv[++i];
+        if (flag == "-h") {
+            options.host = value;
+        }
+        else if (flag == "-p") {
+            options.port = std::stoi(value);
+        }
+        else if (flag == "-c") {
+            options.clients = std::max(1ul, std::stoul(value));
+        }
+        else if (flag == "-P") {
+            options.pipeline = std::max(1ul, std::stoul(value));
+        }
+        else if (flag == "-n") {
+            options.requests = std::stoull(value);
+        }
+        else if (flag == "-d") {
+            options.seconds = std::stod(value);
+        }
+        else if (flag == "-t") {
+            options.tests.clear();
+            size_t pos = 0;
+            while (pos <= value.size()) {
+                size_t comma = std::min(value.find(',', pos), value.size());
+                std::string test = value.substr(pos, comma - pos);
+                if (test != "get" && test != "set" && test != "incr" && test != "ping") {
+                    throw std::invalid_argument("unknown test " + test);
+                }
+                options.tests.push_back(test);
+                pos = comma + 1;
+            }
+        }
+        else if (flag == "-r") {
+            options.keyspace = std::max(1ul, std::stoul(value));
+        }
+        else if (flag == "-s") {
+            options.valueSize = std::stoul(value);
+        }
+        else if (flag == "--rate") {
+            options.rate = std::stod(value);
+        }
+        else {
+            throw std::invalid_argument("unknown option " + flag);
+        }
+    }
+
+    return options;
+}
+
+int connectTo(const Options& options) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(options.port);
+    if (fd < 0 || inet_pton(AF_INET, options.host.c_str(), &addr.sin_addr) != 1 ||
+        connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+// Builds the next request of the test mix.
+class RequestMaker {
+public:
+    RequestMaker(const Options& options, uint64_t seed)
+        : options(options), rng(seed), value(options.valueSize, 'x') {}
+
+    void append(std::string& out) {
+        const std::string& test = options.tests[next++ % options.tests.size()];
+        std::string key = std::to_string(rng() % options.keyspace);
+        if (test == "get") {
+            out += resp::encodeCommand({"GET", "key:" + key});
+        }
+        else if (test == "set") {
+            out += resp::encodeCommand({"SET", "key:" + key, value});
+        }
+        else if (test == "incr") {
+            out += resp::encodeCommand({"INCR", "counter:" + key});
+        }
+        else {
+            out += resp::encodeCommand({"PING"});
+        }
+    }
+
+private:
+    const Options& options;
+    std::mt19937_64 rng;
+    std::string value;
+    size_t next = 0;
+};
+
+// Incremental reader of server replies. Understands RESP2 and the RESP3
+// types, so it also works against a connection switched with HELLO 3.
+class ReplyReader {
+public:
+    explicit ReplyReader(int fd) : fd(fd) {}
+
+    // Blocks until at least one complete reply is buffered; returns how
+    // many were consumed, and counts errors among them. 0 on a closed
+    // connection.
+    size_t read(uint64_t& errors) {
+        while (true) {
+            size_t replies = 0;
+            size_t pos = start;
+            while (true) {
+                size_t end = pos;
+                if (!skip(end)) {
+                    break;
+                }
+                errors += buf[pos] == '-';
+                pos = end;
+                replies++;
+            }
+            start = pos;
+            if (replies != 0) {
+                return replies;
+            }
+
+            buf.erase(0, start);
+            start = 0;
+            char chunk[65536];
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if (n <= 0) {
+                return 0;
+            }
+            buf.append(chunk, n);
+        }
+    }
+
+private:
+    // Advances `pos` past one complete reply; false if it is not all here.
+    bool skip(size_t& pos) const {
+        size_t eol = buf.find("\r\n", pos);
+        if (eol == std::string::npos) {
+            return false;
+        }
+        char type = buf[pos];
+        long n = 0;
+        if (type == '$' || type == '=' || type == '*' || type == '%' || type == '~' || type == '>') {
+            n = std::stol(buf.substr(pos + 1, eol - pos - 1));
+        }
+        pos = eol + 2;
+
+        if (type == '$' || type == '=') {
+            if (n < 0) {
+                return true;
+            }
+            if (buf.size() < pos + n + 2) {
+                return false;
+            }
+            pos += n + 2;
+            return true;
+        }
+        if (type == '*' || type == '%' || type == '~' || type == '>') {
+            long elements = type == '%' ? n * 2 : n;
+            for (long i = 0; i < elements; i++) {
+                if (!skip(pos)) {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    int fd;
+    std::string buf;
+    size_t start = 0;
+};
+
+bool moreToSend(Run& run, size_t count) {
+    if (run.options.seconds > 0) {
+        return LoadClock::now() < run.deadline;
+    }
+    return run.issued.fetch_add(count) < run.options.requests;
+}
+
+void sendAll(int fd, const std::string& data, Run& run) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            run.failed = true;
+            return;
+        }
+        sent += n;
+    }
+}
+
+// Send a batch, wait for its replies, repeat.
+void closedLoop(Run& run, int fd, size_t index, std::vector<uint64_t>& latencies) {
+    RequestMaker maker(run.options, index + 1);
+    ReplyReader reader(fd);
+    uint64_t errors = 0;
+    std::string batch;
+    while (!run.failed && moreToSend(run, run.options.pipeline)) {
+        batch.clear();
+        for (size_t i = 0; i < run.options.pipeline; i++) {
+            maker.append(batch);
+        }
+
+        LoadClock::time_point sent = LoadClock::now();
+        sendAll(fd, batch, run);
+        for (size_t pending = run.options.pipeline; pending > 0 && !run.failed;) {
+            size_t replies = reader.read(errors);
+            if (replies == 0) {
+                run.failed = true;
+                break;
+            }
+            uint64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(LoadClock::now() - sent).count();
+            latencies.insert(latencies.end(), std::min(replies, pending), nanos);
+            pending -= std::min(replies, pending);
+        }
+    }
+
+    run.errors += errors;
+}
+
+// Send on a fixed schedule from this thread, collect replies on another.
+// Latency runs from the time each batch was due.
+void openLoop(Run& run, int fd, size_t index, std::vector<uint64_t>& latencies) {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<LoadClock::time_point> due;
+    bool done = false;
+
+    std::thread receiver([&]() {
+        ReplyReader reader(fd);
+        uint64_t errors = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&]() { return done || !due.empty(); });
+                if (due.empty()) {
+                    break;
+                }
+            }
+            size_t replies = reader.read(errors);
+            if (replies == 0) {
+                run.failed = true;
+                break;
+            }
+            LoadClock::time_point now = LoadClock::now();
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 0; i < replies && !due.empty(); i++) {
+                latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(now - due.front()).count());
+                due.pop_front();
+            }
+        }
+        run.errors += errors;
+    });
+
+    RequestMaker maker(run.options, index + 1);
+    double perConnection = run.options.rate / run.options.clients;
+    auto interval = std::chrono::duration_cast<LoadClock::duration>(
+        std::chrono::duration<double>(run.options.pipeline / perConnection));
+    // Connections start staggered across one interval.
+    LoadClock::time_point next = run.start + interval * index / run.options.clients;
+    std::string batch;
+    while (!run.failed && moreToSend(run, run.options.pipeline)) {
+        std::this_thread::sleep_until(next);
+        batch.clear();
+        for (size_t i = 0; i < run.options.pipeline; i++) {
+            maker.append(batch);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            due.insert(due.end(), run.options.pipeline, next);
+        }
+        cv.notify_one();
+        sendAll(fd, batch, run);
+        next += interval;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+    }
+    cv.notify_one();
+    if (run.failed) {
+        shutdown(fd, SHUT_RDWR);
+    }
+    receiver.join();
+}
+
+double percentile(const std::vector<uint64_t>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t rank = std::min(sorted.size() - 1, static_cast<size_t>(p / 100 * sorted.size()));
+    return sorted[rank] / 1000.0;
+}
+
+}
+
+int runLoad(int argc, char** argv) {
+    Run run;
+    run.options = parseOptions(argc, argv);
+    const Options& options = run.options;
+
+    std::vector<int> fds;
+    for (size_t i = 0; i < options.clients; i++) {
+        int fd = connectTo(options);
+        if (fd < 0) {
+            std::cerr << "cannot connect to " << options.host << ":" << options.port << std::endl;
+            for (int open : fds) {
+                close(open);
+            }
+            return 1;
+        }
+        fds.push_back(fd);
+    }
+
+    std::vector<std::vector<uint64_t>> latencies(options.clients);
+    std::vector<std::thread> threads;
+    run.start = LoadClock::now();
+    run.deadline = run.start + std::chrono::duration_cast<LoadClock::duration>(std::chrono::duration<double>(options.seconds));
+    for (size_t i = 0; i < options.clients; i++) {
+        threads.emplace_back([&, i]() {
+            if (options.rate > 0) {
+                openLoop(run, fds[i], i, latencies[i]);
+            }
+            else {
+                closedLoop(run, fds[i], i, latencies[i]);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double elapsed = std::chrono::duration<double>(LoadClock::now() - run.start).count();
+    for (int fd : fds) {
+        close(fd);
+    }
+
+    std::vector<uint64_t> all;
+    for (const auto& list : latencies) {
+        all.insert(all.end(), list.begin(), list.end());
+    }
+    std::sort(all.begin(), all.end());
+
+    std::string tests;
+    for (const std::string& test : options.tests) {
+        tests += (tests.empty() ? "" : ",") + test;
+    }
+    std::cout << "tests=" << tests << " clients=" << options.clients << " pipeline=" << options.pipeline
+              << " keyspace=" << options.keyspace << " value=" << options.valueSize << "B"
+              << " mode=" << (options.rate > 0 ? "open@" + std::to_string(static_cast<uint64_t>(options.rate)) + "/s" : "closed")
+              << std::endl;
+    std::cout << std::fixed << std::setprecision(1)
+              << "requests=" << all.size() << " errors=" << run.errors.load()
+              << " seconds=" << std::setprecision(2) << elapsed
+              << " throughput=" << std::setprecision(0) << all.size() / elapsed << " ops/s" << std::endl;
+    std::cout << std::setprecision(1)
+              << "latency_us p50=" << percentile(all, 50) << " p99=" << percentile(all, 99)
+              << " p99.9=" << percentile(all, 99.9) << " max=" << (all.empty() ? 0 : all.back() / 1000.0) << std::endl;
+
+    if (run.failed) {
+        std::cerr << "connection lost during the run" << std::endl;
+        return 1;
+    }
+    return 0;
+}
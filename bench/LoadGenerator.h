@@ -0,0 +1,32 @@
+#ifndef LOAD_GENERATOR_H
+#define LOAD_GENERATOR_H
+
+// Load generator for a running server.
+//
+// Each connection runs on its own thread. In closed loop (the default) a
+// connection sends a batch of `pipeline` requests, waits for all of their
+// replies and sends the next, so throughput is whatever the server
+// sustains. With --rate the load is open loop: requests are issued on a
+// fixed schedule whether or not earlier replies have arrived, and latency
+// is measured from the time a request was due rather than sent, so a
+// stalled server shows up in the tail instead of slowing the clock down.
+//
+// Latencies of every request are kept and reported as p50/p99/p99.9/max
+// alongside the throughput.
+
+#define LOAD_USAGE \
+    "  -h host         server address (127.0.0.1)\n" \
+    "  -p port         server port (6379)\n" \
+    "  -c clients      parallel connections (50)\n" \
+    "  -P pipeline     requests in flight per connection batch (1)\n" \
+    "  -n requests     total requests (100000)\n" \
+    "  -d seconds      run for a duration instead of -n\n" \
+    "  -t tests        comma-separated mix of get,set,incr,ping (get,set)\n" \
+    "  -r keyspace     distinct keys (10000)\n" \
+    "  -s bytes        SET value size (16)\n" \
+    "  --rate ops      open loop at this total rate per second\n"
+
+// argv[0] is "load".
+int runLoad(int argc, char** argv);
+
+#endif // LOAD_GENERATOR_H
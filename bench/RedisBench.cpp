@@ -0,0 +1,505 @@
+// Benchmark suite: micro-benchmarks of the core modules, and a load
+// generator for a running server.
+//
+// usage: redis_bench micro [millis-per-case]
+//        redis_bench load [options]   (see LoadGenerator.h)
+//        redis_bench bigkeys|hotkeys [options]   (see KeyScan.h)
+
+#include <atomic>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <thread>
+#include <unistd.h>
+#include "KeyScan.h"
+#include "LoadGenerator.h"
+#include "commands/Handler.h"
+#include "config/Config.h"
+#include "core/Bits.h"
+#include "core/Lz4.h"
+#include "data/HyperLogLog.h"
+#include "data/Store.h"
+#include "data/Tier.h"
+#include "persistence/Snapshot.h"
+#include "protocol/RESPParser.h"
+#include "protocol/Response.h"
+#include "stats/HotKeys.h"
+
+#define SNAPSHOT_BENCH_FILE "bench_snapshot.json"
+
+using BenchClock = std::chrono::steady_clock;
+
+static std::string keyName(size_t i) {
+    return "key:" + std::to_string(i);
+}
+
+static double secondsSince(BenchClock::time_point start) {
+    return std::chrono::duration<double>(BenchClock::now() - start).count();
+}
+
+static void report(const std::string& name, uint64_t ops, double seconds) {
+    std::cout << std::left << std::setw(36) << name << std::right
+              << std::setw(14) << static_cast<uint64_t>(ops / seconds) << " ops/s"
+              << std::setw(10) << std::fixed << std::setprecision(1) << seconds * 1e9 / ops << " ns/op"
+              << std::endl;
+}
+
+static void reportBytes(const std::string& name, size_t bytes, double seconds) {
+    std::cout << std::left << std::setw(36) << name << std::right
+              << std::setw(14) << std::fixed << std::setprecision(1) << bytes / seconds / 1e6 << " MB/s"
+              << std::setw(12) << bytes << " bytes" << std::endl;
+}
+
+// Calls `fn` in batches until `millis` have passed; returns the calls made.
+template <typename Fn>
+static uint64_t repeatFor(int millis, Fn fn) {
+    BenchClock::time_point deadline = BenchClock::now() + std::chrono::milliseconds(millis);
+    uint64_t ops = 0;
+    while (BenchClock::now() < deadline) {
+        for (int i = 0; i < 256; i++) {
+            fn(ops + i);
+        }
+        ops += 256;
+    }
+
+    return ops;
+}
+
+// Parses a file of pipelined requests, the way a client thread parses its
+// socket.
+static void benchParser(size_t argCount, size_t argSize, size_t requests) {
+    std::vector<std::string> args(argCount, std::string(argSize, 'x'));
+    args[0] = "set";
+    std::string request = resp::encodeCommand(args);
+
+    std::string path = (std::filesystem::temp_directory_path() / "redis_bench_parser.resp").string();
+    {
+        std::ofstream out(path, std::ios::binary);
+        for (size_t i = 0; i < requests; i++) {
+            out << request;
+        }
+    }
+
+    int fd = open(path.c_str(), O_RDONLY);
+    RESPParser parser(fd);
+    BenchClock::time_point start = BenchClock::now();
+    for (size_t i = 0; i < requests; i++) {
+        parser.readNewRequest();
+    }
+    double seconds = secondsSince(start);
+    close(fd);
+    std::filesystem::remove(path);
+
+    reportBytes("parser " + std::to_string(argCount) + "x" + std::to_string(argSize) + "B", request.size() * requests, seconds);
+}
+
+static void benchDispatch(int millis) {
+    std::vector<std::string> names = {"get", "set", "ping", "lrange", "publish", "eval"};
+    uint64_t ops = repeatFor(millis, [&names](uint64_t i) {
+        getHandler(names[i % names.size()]);
+    });
+    report("dispatch getHandler", ops, millis / 1000.0);
+
+    std::vector<std::string> ping = {"ping"};
+    CmdFunc handler = getHandler("ping");
+    ops = repeatFor(millis, [&](uint64_t) {
+        handler(ping)->serialize();
+    });
+    report("dispatch ping + serialize", ops, millis / 1000.0);
+}
+
+// Runs `op` on `threads` threads at once for `millis`; returns total ops/s.
+template <typename Op>
+static uint64_t runThreads(size_t threads, int millis, Op op) {
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> total{0};
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            std::mt19937_64 rng(t + 1);
+            std::string scratch;
+            uint64_t ops = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                for (int i = 0; i < 256; i++) {
+                    op(rng, scratch);
+                }
+                ops += 256;
+            }
+            total.fetch_add(ops);
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(millis));
+    stop.store(true);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    return total.load() * 1000 / millis;
+}
+
+// Sketch updates on their own, uniform and skewed, then what sampling
+// leaves of them on the command path, and updates racing on one hot key.
+static void benchHotkeys(int millis) {
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < 100000; i++) {
+        keys.push_back(keyName(i));
+    }
+    uint64_t ops = repeatFor(millis, [&](uint64_t i) {
+        hotkeys::record(keys[(i * 7919) % keys.size()]);
+    });
+    report("hotkeys record uniform", ops, millis / 1000.0);
+    ops = repeatFor(millis, [&](uint64_t i) {
+        hotkeys::record(keys[i % 10 == 0 ? (i * 7919) % keys.size() : i % 8]);
+    });
+    report("hotkeys record skewed", ops, millis / 1000.0);
+
+    const Command& get = *lookupCommand("get");
+    std::vector<std::vector<std::string>> requests;
+    for (size_t i = 0; i < 1024; i++) {
+        requests.push_back({"get", keys[i]});
+    }
+    int rate = config::GlobalConfig.hotkeysSampleRate;
+    for (int sampleRate : {0, 16, 1}) {
+        config::GlobalConfig.hotkeysSampleRate = sampleRate;
+        ops = repeatFor(millis, [&](uint64_t i) {
+            sampleKeys(get, requests[i % requests.size()]);
+        });
+        report("hotkeys sampleKeys " + (sampleRate == 0 ? std::string("off") : "1/" + std::to_string(sampleRate)),
+               ops, millis / 1000.0);
+    }
+    config::GlobalConfig.hotkeysSampleRate = rate;
+
+    for (size_t threads : {1, 4}) {
+        uint64_t perSecond = runThreads(threads, millis, [&](std::mt19937_64&, std::string&) {
+            hotkeys::record(keys[0]);
+        });
+        report("hotkeys record one key x" + std::to_string(threads), perSecond, 1.0);
+    }
+    hotkeys::reset();
+}
+
+static void benchStore(int millis) {
+    Store& store = Store::getInstance();
+    std::cout << std::setw(8) << "keys" << std::setw(8) << "threads"
+              << std::setw(14) << "get/s" << std::setw(14) << "set/s" << std::setw(14) << "incr/s" << std::endl;
+
+    for (size_t keys : {1000, 100000, 1000000}) {
+        store.clear();
+        for (size_t i = 0; i < keys; i++) {
+            store.set(keyName(i), std::string(32, 'v'));
+        }
+        // INCR needs integer values; they live under their own names.
+        for (size_t i = 0; i < keys; i++) {
+            store.set("n:" + std::to_string(i), "0");
+        }
+
+        for (size_t threads = 1; threads <= 16; threads *= 2) {
+            uint64_t gets = runThreads(threads, millis, [&](std::mt19937_64& rng, std::string& scratch) {
+                store.get(keyName(rng() % keys), scratch);
+            });
+            uint64_t sets = runThreads(threads, millis, [&](std::mt19937_64& rng, std::string&) {
+                store.set(keyName(rng() % keys), std::string(32, 'w'));
+            });
+            uint64_t incrs = runThreads(threads, millis, [&](std::mt19937_64& rng, std::string&) {
+                store.incr("n:" + std::to_string(rng() % keys));
+            });
+            std::cout << std::setw(8) << keys << std::setw(8) << threads
+                      << std::setw(14) << gets << std::setw(14) << sets << std::setw(14) << incrs << std::endl;
+        }
+    }
+}
+
+// Appends `entries` small entries with XADD-style IDs, then seeks ranges of
+// 10 at random positions.
+static void benchStream(size_t entries) {
+    Stream stream;
+    StreamFields fields = {{"sensor", "17"}, {"temperature", "21.5"}, {"unit", "C"}};
+    size_t payload = 0;
+    for (const auto& [name, value] : fields) {
+        payload += name.size() + value.size();
+    }
+
+    BenchClock::time_point start = BenchClock::now();
+    for (size_t i = 0; i < entries; i++) {
+        stream.append({1700000000000 + i / 8, i % 8}, fields);
+    }
+    std::string label = std::to_string(entries);
+    report("stream append " + label, entries, secondsSince(start));
+    std::cout << std::left << std::setw(36) << "stream bytes/entry " + label << std::right << std::setw(14)
+              << std::fixed << std::setprecision(1) << static_cast<double>(stream.memoryUsage()) / entries
+              << " (payload " << payload << ")" << std::endl;
+
+    std::mt19937_64 rng(1);
+    size_t seeks = 200000;
+    size_t found = 0;
+    start = BenchClock::now();
+    for (size_t i = 0; i < seeks; i++) {
+        size_t at = rng() % entries;
+        found += stream.range({1700000000000 + at / 8, at % 8}, StreamID::max(), 10).size();
+    }
+    report("stream range 10 " + label, seeks, secondsSince(start));
+    if (found == 0) {
+        std::cout << "stream range found nothing" << std::endl;
+    }
+}
+
+// BITCOUNT, BITOP and BITPOS kernels over a `bytes`-long bitmap, in bytes
+// of bitmap processed per second.
+static void benchBits(size_t bytes, int millis) {
+    std::vector<uint8_t> a(bytes), b(bytes);
+    std::mt19937_64 rng(1);
+    for (size_t i = 0; i < bytes; i++) {
+        a[i] = rng();
+        b[i] = rng();
+    }
+    std::string label = std::to_string(bytes >> 20) + "MB";
+
+    uint64_t bits = 0;
+    BenchClock::time_point start = BenchClock::now();
+    uint64_t passes = 0;
+    for (; passes == 0 || secondsSince(start) * 1000 < millis; passes++) {
+        bits += bits::popcount(a.data(), bytes);
+    }
+    reportBytes(std::string("popcount ") + bits::kernels() + " " + label, bytes * passes, secondsSince(start));
+
+    start = BenchClock::now();
+    for (passes = 0; passes == 0 || secondsSince(start) * 1000 < millis; passes++) {
+        bits::combine(bits::Op::Xor, a.data(), b.data(), bytes);
+    }
+    reportBytes(std::string("bitop xor ") + bits::kernels() + " " + label, bytes * passes, secondsSince(start));
+
+    std::fill(a.begin(), a.end(), 0);
+    start = BenchClock::now();
+    for (passes = 0; passes == 0 || secondsSince(start) * 1000 < millis; passes++) {
+        bits += bits::findByteNot(a.data(), bytes, 0);
+    }
+    reportBytes(std::string("bitpos scan ") + bits::kernels() + " " + label, bytes * passes, secondsSince(start));
+    if (bits == 0) {
+        std::cout << "bit kernels counted nothing" << std::endl;
+    }
+}
+
+// PFADD into a sparse and a dense sketch, a full (uncached) count and the
+// register merge behind PFMERGE and multi-key PFCOUNT.
+static void benchHll(int millis) {
+    std::vector<std::string> one(1);
+    std::string sparse = hll::create();
+    BenchClock::time_point start = BenchClock::now();
+    uint64_t ops = repeatFor(millis, [&](uint64_t i) {
+        one[0] = keyName(i % 500);
+        hll::add(sparse, one, 3000);
+    });
+    report("hll add sparse (500 distinct)", ops, secondsSince(start));
+
+    std::string dense = hll::create();
+    start = BenchClock::now();
+    ops = repeatFor(millis, [&](uint64_t i) {
+        one[0] = keyName(i);
+        hll::add(dense, one, 3000);
+    });
+    report("hll add dense", ops, secondsSince(start));
+
+    uint64_t total = 0;
+    start = BenchClock::now();
+    ops = repeatFor(millis, [&](uint64_t) { total += hll::count(dense); });
+    report("hll count dense", ops, secondsSince(start));
+
+    uint8_t registers[HLL_REGISTERS] = {};
+    start = BenchClock::now();
+    ops = repeatFor(millis, [&](uint64_t) { hll::merge(dense, registers); });
+    report("hll merge dense", ops, secondsSince(start));
+    if (total == 0) {
+        std::cout << "hll counted nothing" << std::endl;
+    }
+}
+
+// Spilling values to a tier file in the working directory, and reading them
+// back at random: the cost of a cold GET beyond the lookup, out of the page
+// cache here, which bounds what a device read adds on top.
+static void benchTier(size_t values, size_t valueSize, int millis) {
+    Tier tier;
+    tier.open(".", 0);
+    std::vector<Tier::Ref> refs;
+    std::string value(valueSize, 'v');
+    BenchClock::time_point start = BenchClock::now();
+    for (size_t i = 0; i < values; i++) {
+        refs.push_back(tier.append(keyName(i), value));
+    }
+    tier.flush();
+    std::string label = std::to_string(values) + "x" + std::to_string(valueSize) + "B";
+    reportBytes("tier spill " + label, tier.size(), secondsSince(start));
+
+    std::mt19937_64 rng(1);
+    std::string out;
+    start = BenchClock::now();
+    uint64_t ops = repeatFor(millis, [&](uint64_t) {
+        size_t i = rng() % values;
+        tier.read(refs[i], keyName(i), out);
+    });
+    report("tier read " + label, ops, secondsSince(start));
+}
+
+// A JSON document of about `size` bytes shaped like its siblings: the same
+// field names in the same order, with varying values.
+static std::string jsonDocument(std::mt19937_64& rng, size_t size) {
+    const char* fields[] = {"id", "name", "email", "created_at", "status", "score", "tags", "address"};
+    std::string doc = "{";
+    for (size_t i = 0; doc.size() < size; i++) {
+        doc += "\"" + std::string(fields[i % 8]) + "\": \"" + std::to_string(rng() % 1000000) + "-" +
+               std::to_string(rng() % 100) + "\", ";
+    }
+    return doc + "}";
+}
+
+// LZ4 block compression of similar JSON values, without and with a
+// dictionary trained from others like them.
+static void benchCompression(size_t valueSize, int millis) {
+    std::mt19937_64 rng(1);
+    std::vector<std::string> samples;
+    std::vector<std::string> values;
+    for (size_t i = 0; i < 1000; i++) {
+        samples.push_back(jsonDocument(rng, valueSize));
+        values.push_back(jsonDocument(rng, valueSize));
+    }
+    lz4::Dictionary trained(lz4::train(samples, 32768));
+    std::string label = std::to_string(valueSize) + "B json";
+
+    const lz4::Dictionary* dicts[] = {nullptr, &trained};
+    for (const lz4::Dictionary* dict : dicts) {
+        std::string suffix = dict ? " dict" : "";
+        std::vector<std::string> compressed;
+        size_t rawBytes = 0;
+        size_t storedBytes = 0;
+        for (const std::string& value : values) {
+            std::string out(lz4::compressBound(value.size()), '\0');
+            out.resize(lz4::compress(value.data(), value.size(), &out[0], dict));
+            rawBytes += value.size();
+            storedBytes += out.size();
+            compressed.push_back(std::move(out));
+        }
+        std::cout << std::left << std::setw(36) << "lz4 ratio " + label + suffix << std::right << std::setw(14)
+                  << std::fixed << std::setprecision(2) << double(rawBytes) / storedBytes << std::endl;
+
+        std::string out(lz4::compressBound(valueSize * 2), '\0');
+        BenchClock::time_point start = BenchClock::now();
+        uint64_t ops = repeatFor(millis, [&](uint64_t i) {
+            const std::string& value = values[i % values.size()];
+            lz4::compress(value.data(), value.size(), &out[0], dict);
+        });
+        reportBytes("lz4 compress " + label + suffix, ops * rawBytes / values.size(), secondsSince(start));
+
+        start = BenchClock::now();
+        ops = repeatFor(millis, [&](uint64_t i) {
+            const std::string& value = values[i % values.size()];
+            const std::string& block = compressed[i % values.size()];
+            lz4::decompress(block.data(), block.size(), &out[0], value.size(), dict);
+        });
+        reportBytes("lz4 decompress " + label + suffix, ops * rawBytes / values.size(), secondsSince(start));
+    }
+}
+
+static void benchSnapshot(size_t keys, size_t valueSize) {
+    Store& store = Store::getInstance();
+    store.clear();
+    for (size_t i = 0; i < keys; i++) {
+        store.set(keyName(i), std::string(valueSize, 'v'));
+    }
+
+    BenchClock::time_point start = BenchClock::now();
+    bool saved = Snapshot::save(SNAPSHOT_BENCH_FILE);
+    double saveSeconds = secondsSince(start);
+    if (!saved) {
+        std::cout << "snapshot save failed" << std::endl;
+        return;
+    }
+    size_t bytes = std::filesystem::file_size(SNAPSHOT_BENCH_FILE);
+
+    start = BenchClock::now();
+    bool loaded = Snapshot::load(SNAPSHOT_BENCH_FILE);
+    double loadSeconds = secondsSince(start);
+    std::filesystem::remove(SNAPSHOT_BENCH_FILE);
+    if (!loaded) {
+        std::cout << "snapshot load failed" << std::endl;
+        return;
+    }
+
+    std::string label = std::to_string(keys) + "x" + std::to_string(valueSize) + "B";
+    reportBytes("snapshot save " + label, bytes, saveSeconds);
+    reportBytes("snapshot load " + label, bytes, loadSeconds);
+
+    std::string records;
+    start = BenchClock::now();
+    Snapshot::encodeKeyspace(records);
+    reportBytes("diskless encode " + label, records.size(), secondsSince(start));
+}
+
+static int runMicro(int argc, char** argv) {
+    int millis = argc > 2 ? std::stoi(argv[2]) : 200;
+    std::cout << "hw_threads=" << std::thread::hardware_concurrency() << " millis_per_case=" << millis << std::endl;
+
+    std::cout << "\n# parser" << std::endl;
+    benchParser(3, 16, 200000);
+    benchParser(3, 4096, 20000);
+    benchParser(32, 64, 20000);
+
+    std::cout << "\n# dispatch" << std::endl;
+    benchDispatch(millis);
+
+    std::cout << "\n# store" << std::endl;
+    benchStore(millis);
+
+    std::cout << "\n# hot keys" << std::endl;
+    benchHotkeys(millis);
+
+    std::cout << "\n# stream" << std::endl;
+    benchStream(100000);
+    benchStream(1000000);
+
+    std::cout << "\n# bits" << std::endl;
+    benchBits(1 << 20, millis);
+    benchBits(100 << 20, millis);
+
+    std::cout << "\n# hyperloglog" << std::endl;
+    benchHll(millis);
+
+    std::cout << "\n# tiered storage" << std::endl;
+    benchTier(100000, 256, millis);
+    benchTier(10000, 4096, millis);
+
+    std::cout << "\n# compression" << std::endl;
+    benchCompression(1024, millis);
+    benchCompression(8192, millis);
+
+    std::cout << "\n# snapshot" << std::endl;
+    benchSnapshot(100000, 64);
+    benchSnapshot(10000, 4096);
+
+    Store::deleteInstance();
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    std::string mode = argc > 1 ? argv[1] : "";
+    try {
+        if (mode == "micro") {
+            return runMicro(argc, argv);
+        }
+        if (mode == "load") {
+            return runLoad(argc - 1, argv + 1);
+        }
+        if (mode == "bigkeys" || mode == "hotkeys") {
+            return runKeyScan(argc - 1, argv + 1);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    std::cerr << "usage: redis_bench micro [millis-per-case]\n"
+              << "       redis_bench load [options]\n" << LOAD_USAGE
+              << "       redis_bench bigkeys|hotkeys [options]\n" << KEY_SCAN_USAGE;
+    return 1;
+}
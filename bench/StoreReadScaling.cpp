@@ -0,0 +1,76 @@
+// Measures Store::get throughput as reader threads scale from 1 to 64,
+// optionally with background writers overwriting the same keyspace.
+//
+// usage: store_read_bench [keys] [millis-per-step] [writers]
+
+#include <atomic>
+#include <iomanip>
+#include <random>
+#include <thread>
+#include "data/Store.h"
+
+static std::string keyName(size_t i) {
+    return "key:" + std::to_string(i);
+}
+
+static uint64_t runStep(size_t readers, size_t writers, size_t keys, int millis) {
+    Store& store = Store::getInstance();
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> totalReads{0};
+    std::vector<std::thread> threads;
+
+    for (size_t t = 0; t < readers; t++) {
+        threads.emplace_back([&, t]() {
+            std::mt19937_64 rng(t + 1);
+            std::string value;
+            uint64_t reads = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                for (int i = 0; i < 256; i++) {
+                    store.get(keyName(rng() % keys), value);
+                }
+                reads += 256;
+            }
+            totalReads.fetch_add(reads);
+        });
+    }
+
+    for (size_t t = 0; t < writers; t++) {
+        threads.emplace_back([&, t]() {
+            std::mt19937_64 rng(1000 + t);
+            while (!stop.load(std::memory_order_relaxed)) {
+                store.set(keyName(rng() % keys), std::to_string(rng()));
+            }
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(millis));
+    stop.store(true);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    return totalReads.load() * 1000 / millis;
+}
+
+int main(int argc, char** argv) {
+    size_t keys = argc > 1 ? std::stoul(argv[1]) : 100000;
+    int millis = argc > 2 ? std::stoi(argv[2]) : 1000;
+    size_t writers = argc > 3 ? std::stoul(argv[3]) : 0;
+
+    Store& store = Store::getInstance();
+    for (size_t i = 0; i < keys; i++) {
+        store.set(keyName(i), std::string(32, 'v'));
+    }
+
+    std::cout << "keys=" << keys << " writers=" << writers
+              << " hw_threads=" << std::thread::hardware_concurrency() << std::endl;
+    std::cout << std::setw(8) << "readers" << std::setw(16) << "gets/s" << std::setw(16) << "gets/s/thread" << std::endl;
+
+    for (size_t readers = 1; readers <= 64; readers *= 2) {
+        uint64_t rate = runStep(readers, writers, keys, millis);
+        std::cout << std::setw(8) << readers << std::setw(16) << rate << std::setw(16) << rate / readers << std::endl;
+    }
+
+    Store::deleteInstance();
+    return 0;
+}
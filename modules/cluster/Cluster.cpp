@@ -0,0 +1,583 @@
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <shared_mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <nlohmann/json.hpp>
+#include "Cluster.h"
+#include "config/Config.h"
+#include "data/Store.h"
+#include "protocol/RESPParser.h"
+#include "protocol/Response.h"
+
+namespace {
+
+struct Node {
+    std::string id;
+    std::string ip;
+    int port;
+    uint64_t epoch;
+    bool linked;
+};
+
+// Nodes are never removed, so an index into `nodeTable` is a stable handle.
+// Index 0 is this node.
+std::shared_mutex stateMutex;
+std::vector<Node> nodeTable;
+int16_t owner[CLUSTER_SLOTS];
+int16_t migrating[CLUSTER_SLOTS];
+int16_t importing[CLUSTER_SLOTS];
+uint64_t currentEpoch = 0;
+
+thread_local bool asking = false;
+
+std::string randomId() {
+    static const char hex[] = "0123456789abcdef";
+    std::random_device rd;
+    std::mt19937_64 gen((static_cast<uint64_t>(rd()) << 32) | rd());
+    std::string id(40, '0');
+    for (char& c : id) {
+        c = hex[gen() & 15];
+    }
+
+    return id;
+}
+
+int findNode(const std::string& id) {
+    for (size_t i = 0; i < nodeTable.size(); i++) {
+        if (nodeTable[i].id == id) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+std::string address(int node) {
+    return nodeTable[node].ip + ":" + std::to_string(nodeTable[node].port);
+}
+
+// Caller holds stateMutex.
+void saveConfig() {
+    nlohmann::json json;
+    json["myself"] = nodeTable[0].id;
+    json["current_epoch"] = currentEpoch;
+    json["nodes"] = nlohmann::json::array();
+    for (size_t i = 0; i < nodeTable.size(); i++) {
+        nlohmann::json ranges = nlohmann::json::array();
+        for (unsigned s = 0; s < CLUSTER_SLOTS; s++) {
+            if (owner[s] != static_cast<int16_t>(i)) {
+                continue;
+            }
+            unsigned e = s;
+            while (e + 1 < CLUSTER_SLOTS && owner[e + 1] == static_cast<int16_t>(i)) {
+                e++;
+            }
+            ranges.push_back({s, e});
+            s = e;
+        }
+        json["nodes"].push_back({{"id", nodeTable[i].id}, {"ip", nodeTable[i].ip}, {"port", nodeTable[i].port},
+                                 {"epoch", nodeTable[i].epoch}, {"slots", ranges}});
+    }
+
+    std::ofstream out(std::filesystem::current_path() / CLUSTER_CONFIG_FILE);
+    out << json.dump(4) << std::endl;
+}
+
+// Same layout as Redis: id addr flags master ping pong epoch link slots...
+std::string describeNodes() {
+    std::ostringstream out;
+    for (size_t i = 0; i < nodeTable.size(); i++) {
+        const Node& node = nodeTable[i];
+        out << node.id << " " << address(i) << "@" << node.port + CLUSTER_BUS_PORT_OFFSET << " "
+            << (i == 0 ? "myself,master" : "master") << " - 0 0 " << node.epoch << " "
+            << (i == 0 || node.linked ? "connected" : "disconnected");
+        for (unsigned s = 0; s < CLUSTER_SLOTS; s++) {
+            if (owner[s] != static_cast<int16_t>(i)) {
+                continue;
+            }
+            unsigned e = s;
+            while (e + 1 < CLUSTER_SLOTS && owner[e + 1] == static_cast<int16_t>(i)) {
+                e++;
+            }
+            out << " " << s;
+            if (e != s) {
+                out << "-" << e;
+            }
+            s = e;
+        }
+        if (i == 0) {
+            for (unsigned s = 0; s < CLUSTER_SLOTS; s++) {
+                if (migrating[s] >= 0) {
+                    out << " [" << s << "->-" << nodeTable[migrating[s]].id << "]";
+                }
+                if (importing[s] >= 0) {
+                    out << " [" << s << "-<-" << nodeTable[importing[s]].id << "]";
+                }
+            }
+        }
+        out << "\n";
+    }
+
+    return out.str();
+}
+
+// Caller holds stateMutex exclusively.
+int addNode(const std::string& id, const std::string& ip, int port) {
+    int idx = findNode(id);
+    if (idx < 0) {
+        nodeTable.push_back({id, ip, port, 0, false});
+        idx = nodeTable.size() - 1;
+        std::cout << "Cluster: learned node " << id << " at " << ip << ":" << port << std::endl;
+    }
+
+    return idx;
+}
+
+// Folds a peer's CLUSTER NODES reply into our view. Only a node's claims
+// about its own slots are taken; other lines just introduce nodeTable.
+void merge(const std::string& text) {
+    std::unique_lock<std::shared_mutex> lock(stateMutex);
+    bool changed = false;
+    std::istringstream lines(text);
+    std::string line;
+    while (std::getline(lines, line)) {
+        std::istringstream fields(line);
+        std::string id, addr, flags, master, ping, pong, link;
+        uint64_t epoch;
+        if (!(fields >> id >> addr >> flags >> master >> ping >> pong >> epoch >> link) || id == nodeTable[0].id) {
+            continue;
+        }
+
+        size_t colon = addr.rfind(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        size_t known = nodeTable.size();
+        int idx = addNode(id, addr.substr(0, colon), std::atoi(addr.c_str() + colon + 1));
+        changed |= nodeTable.size() != known;
+        if (flags.find("myself") == std::string::npos) {
+            continue;
+        }
+
+        Node& node = nodeTable[idx];
+        node.linked = true;
+        if (epoch != node.epoch) {
+            node.epoch = epoch;
+            changed = true;
+        }
+        currentEpoch = std::max(currentEpoch, epoch);
+
+        std::string range;
+        while (fields >> range) {
+            if (range[0] == '[') {
+                continue;
+            }
+            size_t dash = range.find('-');
+            unsigned start = std::stoul(range.substr(0, dash));
+            unsigned end = dash == std::string::npos ? start : std::stoul(range.substr(dash + 1));
+            for (unsigned s = start; s <= end && s < CLUSTER_SLOTS; s++) {
+                int current = owner[s];
+                if (current == idx || (current >= 0 && nodeTable[current].epoch >= node.epoch)) {
+                    continue;
+                }
+                if (current == 0) {
+                    std::cout << "Cluster: slot " << s << " taken over by " << id << std::endl;
+                    migrating[s] = -1;
+                }
+                owner[s] = idx;
+                importing[s] = -1;
+                changed = true;
+            }
+        }
+    }
+
+    if (changed) {
+        saveConfig();
+    }
+}
+
+// Sends one command to a peer and returns the bulk string reply.
+std::string askPeer(int fd, const std::vector<std::string>& req) {
+    std::string out = resp::encodeCommand(req);
+    if (writeExactly(fd, out.c_str(), out.size()) < 0) {
+        throw SysCallFailure("send to peer failed!");
+    }
+
+    RESPParser parser(fd);
+    std::string header = parser.readLine();
+    if (header.empty() || header[0] != '$') {
+        throw IncorrectProtocol("unexpected reply from peer: " + header);
+    }
+
+    std::string body;
+    parser.readPayload(std::stoul(header.substr(1)) + 2, [&body](const char* data, size_t n) {
+        body.append(data, n);
+    });
+    body.resize(body.size() - 2);
+    return body;
+}
+
+int connectPeer(const std::string& ip, int port) {
+    int fd = connectTcp(ip, port);
+    if (fd >= 0) {
+        struct timeval tv;
+        tv.tv_sec = CLUSTER_GOSSIP_TIMEOUT_MS / 1000;
+        tv.tv_usec = (CLUSTER_GOSSIP_TIMEOUT_MS % 1000) * 1000;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+
+    return fd;
+}
+
+bool validSlot(unsigned slot) {
+    return slot < CLUSTER_SLOTS;
+}
+
+}
+
+bool cluster::enabled() {
+    return config::GlobalConfig.clusterEnabled;
+}
+
+void cluster::init() {
+    Store::getInstance().indexSlots();
+
+    std::unique_lock<std::shared_mutex> lock(stateMutex);
+    std::fill(std::begin(owner), std::end(owner), -1);
+    std::fill(std::begin(migrating), std::end(migrating), -1);
+    std::fill(std::begin(importing), std::end(importing), -1);
+    nodeTable.clear();
+
+    try {
+        std::ifstream in(std::filesystem::current_path() / CLUSTER_CONFIG_FILE);
+        nlohmann::json json = nlohmann::json::parse(in);
+        std::string myself = json["myself"];
+        currentEpoch = json["current_epoch"];
+        // Myself goes first so that index 0 keeps meaning this node.
+        for (int pass = 0; pass < 2; pass++) {
+            for (const auto& entry : json["nodes"]) {
+                if ((entry["id"] == myself) != (pass == 0)) {
+                    continue;
+                }
+                nodeTable.push_back({entry["id"], entry["ip"], entry["port"], entry["epoch"], false});
+                for (const auto& range : entry["slots"]) {
+                    for (unsigned s = range[0]; s <= range[1] && s < CLUSTER_SLOTS; s++) {
+                        owner[s] = nodeTable.size() - 1;
+                    }
+                }
+            }
+        }
+    } catch (const std::exception& e) {
+        nodeTable.clear();
+        std::fill(std::begin(owner), std::end(owner), -1);
+    }
+
+    if (nodeTable.empty()) {
+        nodeTable.push_back({randomId(), config::GlobalConfig.clusterAnnounceIp, config::GlobalConfig.port, 0, true});
+        currentEpoch = 0;
+    }
+
+    // The address may have changed since the file was written.
+    nodeTable[0].ip = config::GlobalConfig.clusterAnnounceIp;
+    nodeTable[0].port = config::GlobalConfig.port;
+    saveConfig();
+    std::cout << "Cluster node " << nodeTable[0].id << std::endl;
+}
+
+void cluster::gossipLoop() {
+    std::unordered_map<std::string, int> links;
+    while (true) {
+        std::vector<Node> peers;
+        {
+            std::shared_lock<std::shared_mutex> lock(stateMutex);
+            peers.assign(nodeTable.begin() + 1, nodeTable.end());
+        }
+
+        for (const Node& peer : peers) {
+            int& fd = links.emplace(peer.id, -1).first->second;
+            if (fd < 0) {
+                fd = connectPeer(peer.ip, peer.port);
+            }
+
+            std::string text;
+            bool ok = false;
+            if (fd >= 0) {
+                try {
+                    text = askPeer(fd, {"CLUSTER", "NODES"});
+                    ok = true;
+                } catch (const std::exception& e) {
+                    close(fd);
+                    fd = -1;
+                }
+            }
+
+            if (ok) {
+                merge(text);
+            }
+            else {
+                std::unique_lock<std::shared_mutex> lock(stateMutex);
+                int idx = findNode(peer.id);
+                if (idx > 0) {
+                    nodeTable[idx].linked = false;
+                }
+            }
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(CLUSTER_GOSSIP_PERIOD_MS));
+    }
+}
+
+std::string cluster::route(const std::vector<std::string>& keys, bool asking) {
+    unsigned slot = keyHashSlot(keys[0]);
+    for (size_t i = 1; i < keys.size(); i++) {
+        if (keyHashSlot(keys[i]) != slot) {
+            return "CROSSSLOT Keys in request don't hash to the same slot";
+        }
+    }
+
+    std::shared_lock<std::shared_mutex> lock(stateMutex);
+    int node = owner[slot];
+    if (node == 0) {
+        // While a slot migrates, keys that already left are served by the
+        // target; the client is sent there for this one command.
+        if (migrating[slot] >= 0) {
+            size_t missing = 0;
+            for (const std::string& key : keys) {
+                missing += !Store::getInstance().exists(key);
+            }
+            if (missing == keys.size()) {
+                return "ASK " + std::to_string(slot) + " " + address(migrating[slot]);
+            }
+            if (missing > 0) {
+                return "TRYAGAIN Multiple keys request during rehashing of slot";
+            }
+        }
+        return "";
+    }
+
+    if (asking && importing[slot] >= 0) {
+        return "";
+    }
+    if (node < 0) {
+        return "CLUSTERDOWN Hash slot not served";
+    }
+
+    return "MOVED " + std::to_string(slot) + " " + address(node);
+}
+
+void cluster::setAsking() {
+    asking = true;
+}
+
+bool cluster::takeAsking() {
+    bool was = asking;
+    asking = false;
+    return was;
+}
+
+std::string cluster::myId() {
+    std::shared_lock<std::shared_mutex> lock(stateMutex);
+    return nodeTable[0].id;
+}
+
+std::string cluster::nodes() {
+    std::shared_lock<std::shared_mutex> lock(stateMutex);
+    return describeNodes();
+}
+
+std::string cluster::info() {
+    std::shared_lock<std::shared_mutex> lock(stateMutex);
+    size_t assigned = 0;
+    std::vector<bool> serving(nodeTable.size());
+    for (unsigned s = 0; s < CLUSTER_SLOTS; s++) {
+        if (owner[s] >= 0) {
+            assigned++;
+            serving[owner[s]] = true;
+        }
+    }
+
+    std::ostringstream out;
+    out << "cluster_enabled:1\r\n"
+        << "cluster_state:" << (assigned == CLUSTER_SLOTS ? "ok" : "fail") << "\r\n"
+        << "cluster_slots_assigned:" << assigned << "\r\n"
+        << "cluster_known_nodes:" << nodeTable.size() << "\r\n"
+        << "cluster_size:" << std::count(serving.begin(), serving.end(), true) << "\r\n"
+        << "cluster_current_epoch:" << currentEpoch << "\r\n"
+        << "cluster_my_epoch:" << nodeTable[0].epoch << "\r\n";
+    return out.str();
+}
+
+std::vector<cluster::SlotRange> cluster::slotRanges() {
+    std::shared_lock<std::shared_mutex> lock(stateMutex);
+    std::vector<SlotRange> ranges;
+    for (unsigned s = 0; s < CLUSTER_SLOTS; s++) {
+        int node = owner[s];
+        if (node < 0) {
+            continue;
+        }
+        unsigned e = s;
+        while (e + 1 < CLUSTER_SLOTS && owner[e + 1] == node) {
+            e++;
+        }
+        ranges.push_back({s, e, nodeTable[node].ip, nodeTable[node].port, nodeTable[node].id});
+        s = e;
+    }
+
+    return ranges;
+}
+
+std::string cluster::meet(const std::string& ip, int port) {
+    int fd = connectPeer(ip, port);
+    if (fd < 0) {
+        return "ERR could not connect to " + ip + ":" + std::to_string(port);
+    }
+
+    std::string me;
+    std::string myIp;
+    try {
+        std::string id = askPeer(fd, {"CLUSTER", "MYID"});
+        bool known;
+        {
+            std::unique_lock<std::shared_mutex> lock(stateMutex);
+            known = findNode(id) >= 0;
+            if (!known && id != nodeTable[0].id) {
+                addNode(id, ip, port);
+                saveConfig();
+            }
+            me = nodeTable[0].id;
+            myIp = nodeTable[0].ip;
+        }
+
+        // Introduce ourselves back so the handshake is symmetric; the peer
+        // already knows us by then if this MEET came from it.
+        if (!known && id != me) {
+            std::string out = resp::encodeCommand({"CLUSTER", "MEET", myIp, std::to_string(config::GlobalConfig.port)});
+            writeExactly(fd, out.c_str(), out.size());
+            RESPParser(fd).readLine();
+        }
+    } catch (const std::exception& e) {
+        close(fd);
+        return "ERR handshake with " + ip + ":" + std::to_string(port) + " failed";
+    }
+
+    close(fd);
+    return "";
+}
+
+std::string cluster::addSlots(const std::vector<unsigned>& slots) {
+    std::unique_lock<std::shared_mutex> lock(stateMutex);
+    for (unsigned s : slots) {
+        if (!validSlot(s)) {
+            return "ERR Invalid or out of range slot";
+        }
+        if (owner[s] >= 0) {
+            return "ERR Slot " + std::to_string(s) + " is already busy";
+        }
+    }
+
+    for (unsigned s : slots) {
+        owner[s] = 0;
+        importing[s] = -1;
+    }
+    saveConfig();
+    return "";
+}
+
+std::string cluster::delSlots(const std::vector<unsigned>& slots) {
+    std::unique_lock<std::shared_mutex> lock(stateMutex);
+    for (unsigned s : slots) {
+        if (!validSlot(s)) {
+            return "ERR Invalid or out of range slot";
+        }
+        if (owner[s] < 0) {
+            return "ERR Slot " + std::to_string(s) + " is already unassigned";
+        }
+    }
+
+    for (unsigned s : slots) {
+        owner[s] = -1;
+        migrating[s] = -1;
+        importing[s] = -1;
+    }
+    saveConfig();
+    return "";
+}
+
+std::string cluster::setSlot(unsigned slot, const std::string& action, const std::string& nodeId) {
+    if (!validSlot(slot)) {
+        return "ERR Invalid or out of range slot";
+    }
+
+    std::unique_lock<std::shared_mutex> lock(stateMutex);
+    if (action == "stable") {
+        migrating[slot] = -1;
+        importing[slot] = -1;
+        return "";
+    }
+
+    int node = findNode(nodeId);
+    if (node < 0) {
+        return "ERR I don't know about node " + nodeId;
+    }
+
+    if (action == "migrating") {
+        if (owner[slot] != 0) {
+            return "ERR I'm not the owner of hash slot " + std::to_string(slot);
+        }
+        if (node == 0) {
+            return "ERR I can't migrate a slot to myself";
+        }
+        migrating[slot] = node;
+        return "";
+    }
+    if (action == "importing") {
+        if (owner[slot] == 0) {
+            return "ERR I'm already the owner of hash slot " + std::to_string(slot);
+        }
+        if (node == 0) {
+            return "ERR I can't import a slot from myself";
+        }
+        importing[slot] = node;
+        return "";
+    }
+    if (action == "node") {
+        if (owner[slot] == 0 && node != 0 && countKeysInSlot(slot) > 0) {
+            return "ERR Can't assign hashslot " + std::to_string(slot) +
+                   " to a different node while I still hold keys for this hash slot.";
+        }
+
+        // Taking a slot over needs an epoch no one else has, or gossip from
+        // the previous owner would take it back.
+        if (node == 0 && owner[slot] != 0) {
+            uint64_t maxEpoch = 0;
+            for (const Node& n : nodeTable) {
+                maxEpoch = std::max(maxEpoch, n.epoch);
+            }
+            if (nodeTable[0].epoch == 0 || nodeTable[0].epoch != maxEpoch) {
+                currentEpoch = std::max(currentEpoch, maxEpoch) + 1;
+                nodeTable[0].epoch = currentEpoch;
+            }
+        }
+
+        owner[slot] = node;
+        migrating[slot] = -1;
+        importing[slot] = -1;
+        saveConfig();
+        return "";
+    }
+
+    return "ERR Invalid CLUSTER SETSLOT action or number of arguments";
+}
+
+size_t cluster::countKeysInSlot(unsigned slot) {
+    return Store::getInstance().countKeysInSlot(slot);
+}
+
+std::vector<std::string> cluster::getKeysInSlot(unsigned slot, size_t count) {
+    return Store::getInstance().getKeysInSlot(slot, count);
+}
@@ -0,0 +1,70 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "HashSlot.h"
+
+#define CLUSTER_CONFIG_FILE "nodes.json"
+#define CLUSTER_GOSSIP_PERIOD_MS 1000
+#define CLUSTER_GOSSIP_TIMEOUT_MS 1000
+#define CLUSTER_BUS_PORT_OFFSET 10000
+
+// Cluster mode: the keyspace is split into CLUSTER_SLOTS hash slots and
+// every node serves the slots it owns.
+//
+// Each node is authoritative only for its own slot claims. Once a second,
+// the gossip thread pulls CLUSTER NODES from every known peer over the
+// regular client port, learns nodes it has not met yet, and adopts a peer's
+// claim on a slot when the peer's config epoch is higher than the current
+// owner's. A node that takes over a slot with CLUSTER SETSLOT NODE bumps its
+// epoch, so its claim wins everywhere once gossip has spread it.
+//
+// Topology and slot ownership persist in CLUSTER_CONFIG_FILE.
+namespace cluster {
+
+bool enabled();
+
+// Loads the node table or starts a fresh one with a new node ID.
+void init();
+void gossipLoop();
+
+// Decides whether this node may run a command on `keys`. Returns an empty
+// string if so; otherwise the error to reply with: MOVED or ASK to the
+// node that serves the slot, CROSSSLOT, TRYAGAIN or CLUSTERDOWN.
+// `asking` is whether the connection sent ASKING right before.
+std::string route(const std::vector<std::string>& keys, bool asking);
+
+// ASKING applies to the next command on the same connection only.
+void setAsking();
+bool takeAsking();
+
+struct SlotRange {
+    unsigned start;
+    unsigned end;
+    std::string ip;
+    int port;
+    std::string id;
+};
+
+std::string myId();
+std::string nodes();
+std::string info();
+std::vector<SlotRange> slotRanges();
+
+// Administrative commands. Each returns an empty string on success or an
+// error message.
+std::string meet(const std::string& ip, int port);
+std::string addSlots(const std::vector<unsigned>& slots);
+std::string delSlots(const std::vector<unsigned>& slots);
+std::string setSlot(unsigned slot, const std::string& action, const std::string& nodeId);
+
+// Number of keys this node holds in `slot`, and up to `count` of them.
+// Both read the store's slot index rather than walking the keyspace.
+size_t countKeysInSlot(unsigned slot);
+std::vector<std::string> getKeysInSlot(unsigned slot, size_t count);
+
+}
+
+#endif // CLUSTER_H
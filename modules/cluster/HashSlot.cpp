@@ -0,0 +1,42 @@
+#include <array>
+#include "HashSlot.h"
+
+namespace {
+
+constexpr std::array<uint16_t, 256> makeTable() {
+    std::array<uint16_t, 256> table{};
+    for (int i = 0; i < 256; i++) {
+        uint16_t crc = static_cast<uint16_t>(i << 8);
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x1021) : static_cast<uint16_t>(crc << 1);
+        }
+        table[i] = crc;
+    }
+
+    return table;
+}
+
+constexpr std::array<uint16_t, 256> CRC16_TABLE = makeTable();
+
+}
+
+uint16_t cluster::crc16(const char* buf, size_t len) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc = static_cast<uint16_t>((crc << 8) ^ CRC16_TABLE[((crc >> 8) ^ static_cast<uint8_t>(buf[i])) & 0xff]);
+    }
+
+    return crc;
+}
+
+unsigned cluster::keyHashSlot(std::string_view key) {
+    size_t open = key.find('{');
+    if (open != std::string_view::npos) {
+        size_t close = key.find('}', open + 1);
+        if (close != std::string_view::npos && close != open + 1) {
+            key = key.substr(open + 1, close - open - 1);
+        }
+    }
+
+    return crc16(key.data(), key.size()) & (CLUSTER_SLOTS - 1);
+}
@@ -0,0 +1,21 @@
+#ifndef HASHSLOT_H
+#define HASHSLOT_H
+
+#include <cstdint>
+#include <string_view>
+
+#define CLUSTER_SLOTS 16384
+
+namespace cluster {
+
+// CRC16-CCITT (XMODEM), the checksum Redis Cluster uses for key slots.
+uint16_t crc16(const char* buf, size_t len);
+
+// Slot of `key`. If the key contains a non-empty `{...}` section, only the
+// part between the first `{` and the next `}` is hashed, so related keys can
+// be forced into the same slot.
+unsigned keyHashSlot(std::string_view key);
+
+}
+
+#endif // HASHSLOT_H
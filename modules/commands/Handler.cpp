@@ -1,28 +1,177 @@
 #include "Handler.h"
 #include "data/Store.h"
+#include "data/HyperLogLog.h"
 #include "persistence/Snapshot.h"
+#include "data/Slab.h"
+#include "data/LazyFree.h"
+#include "core/Bits.h"
+#include "core/Glob.h"
+#include "replication/Replication.h"
+#include "cluster/Cluster.h"
+#include "pubsub/PubSub.h"
+#include "transaction/Transaction.h"
+#include "scripting/Scripting.h"
+#include "tracking/Tracking.h"
+#include "network/Connection.h"
+#include "protocol/RESPParser.h"
+#include "stats/Stats.h"
+#include "stats/HotKeys.h"
+#include "stats/SlowLog.h"
+#include "stats/Latency.h"
+#include "config/Config.h"
+#include <fstream>
 #include <unordered_map>
+#include <unordered_set>
 
-std::unordered_map<std::string, CmdFunc> cmdMap = {
-    {"ping", cmdPing},
-    {"echo", cmdEcho},
-    {"set", cmdSet},
-    {"get", cmdGet},
-    {"exists", cmdExists},
-    {"del", cmdDel},
-    {"incr", cmdIncr},
-    {"decr", cmdDecr},
-    {"lpush", cmdLpush},
-    {"rpush", cmdRpush},
-    {"lrange", cmdLrange},
-    {"save", cmdSave},
-    {"config", cmdConfig}
+std::unordered_map<std::string, Command> cmdMap = {
+    {"ping", {cmdPing, CMD_PUBSUB}},
+    {"echo", {cmdEcho, 0}},
+    {"set", {cmdSet, CMD_WRITE, 1, 1, 1}},
+    {"get", {cmdGet, 0, 1, 1, 1}},
+    {"mget", {cmdMget, 0, 1, -1, 1}},
+    {"mset", {cmdMset, CMD_WRITE, 1, -1, 2}},
+    {"msetnx", {cmdMsetnx, CMD_WRITE, 1, -1, 2}},
+    {"exists", {cmdExists, 0, 1, -1, 1}},
+    {"del", {cmdDel, CMD_WRITE, 1, -1, 1}},
+    {"unlink", {cmdUnlink, CMD_WRITE, 1, -1, 1}},
+    {"incr", {cmdIncr, CMD_WRITE, 1, 1, 1}},
+    {"decr", {cmdDecr, CMD_WRITE, 1, 1, 1}},
+    {"lpush", {cmdLpush, CMD_WRITE, 1, 1, 1}},
+    {"rpush", {cmdRpush, CMD_WRITE, 1, 1, 1}},
+    {"lrange", {cmdLrange, 0, 1, 1, 1}},
+    {"save", {cmdSave, 0}},
+    {"config", {cmdConfig, 0}},
+    {"memory", {cmdMemory, CMD_NOTOUCH, 2, 2, 1}},
+    {"flushall", {cmdFlushall, CMD_WRITE}},
+    {"flushdb", {cmdFlushdb, CMD_WRITE}},
+    {"scan", {cmdScan, 0}},
+    {"keys", {cmdKeys, 0}},
+    {"replicaof", {cmdReplicaof, CMD_NOSCRIPT}},
+    {"replconf", {cmdReplconf, 0}},
+    {"role", {cmdRole, 0}},
+    {"cluster", {cmdCluster, 0}},
+    {"asking", {cmdAsking, 0}},
+    {"dump", {cmdDump, 0, 1, 1, 1}},
+    {"restore", {cmdRestore, CMD_WRITE, 1, 1, 1}},
+    {"migrate", {cmdMigrate, CMD_WRITE | CMD_EFFECTS | CMD_NOSCRIPT | CMD_BLOCKING}},
+    {"subscribe", {cmdSubscribe, CMD_PUBSUB | CMD_NOSCRIPT}},
+    {"unsubscribe", {cmdUnsubscribe, CMD_PUBSUB | CMD_NOSCRIPT}},
+    {"psubscribe", {cmdPsubscribe, CMD_PUBSUB | CMD_NOSCRIPT}},
+    {"punsubscribe", {cmdPunsubscribe, CMD_PUBSUB | CMD_NOSCRIPT}},
+    {"publish", {cmdPublish, 0}},
+    {"pubsub", {cmdPubsub, 0}},
+    {"multi", {cmdMulti, CMD_TRANSACTION | CMD_NOSCRIPT}},
+    {"exec", {cmdExec, CMD_TRANSACTION | CMD_NOSCRIPT}},
+    {"discard", {cmdDiscard, CMD_TRANSACTION | CMD_NOSCRIPT}},
+    {"watch", {cmdWatch, CMD_TRANSACTION | CMD_NOSCRIPT, 1, -1, 1}},
+    {"unwatch", {cmdUnwatch, CMD_NOSCRIPT}},
+    {"eval", {cmdEval, CMD_WRITE | CMD_EFFECTS | CMD_KEYNUM | CMD_NOSCRIPT, 3, 0, 1}},
+    {"evalsha", {cmdEvalsha, CMD_WRITE | CMD_EFFECTS | CMD_KEYNUM | CMD_NOSCRIPT, 3, 0, 1}},
+    {"eval_ro", {cmdEvalRo, CMD_KEYNUM | CMD_NOSCRIPT, 3, 0, 1}},
+    {"evalsha_ro", {cmdEvalshaRo, CMD_KEYNUM | CMD_NOSCRIPT, 3, 0, 1}},
+    {"script", {cmdScript, CMD_NOSCRIPT}},
+    {"hello", {cmdHello, CMD_NOSCRIPT}},
+    {"client", {cmdClient, CMD_NOSCRIPT}},
+    {"info", {cmdInfo, 0}},
+    {"slowlog", {cmdSlowlog, 0}},
+    {"latency", {cmdLatency, 0}},
+    {"xadd", {cmdXadd, CMD_WRITE | CMD_EFFECTS, 1, 1, 1}},
+    {"xrange", {cmdXrange, 0, 1, 1, 1}},
+    {"xlen", {cmdXlen, 0, 1, 1, 1}},
+    {"xread", {cmdXread, CMD_STREAMS | CMD_BLOCKING, 1, -1, 1}},
+    {"xgroup", {cmdXgroup, CMD_WRITE | CMD_EFFECTS, 2, 2, 1}},
+    {"xreadgroup", {cmdXreadgroup, CMD_WRITE | CMD_EFFECTS | CMD_STREAMS | CMD_BLOCKING, 4, -1, 1}},
+    {"xack", {cmdXack, CMD_WRITE, 1, 1, 1}},
+    {"xtrim", {cmdXtrim, CMD_WRITE | CMD_EFFECTS, 1, 1, 1}},
+    {"setbit", {cmdSetbit, CMD_WRITE, 1, 1, 1}},
+    {"getbit", {cmdGetbit, 0, 1, 1, 1}},
+    {"bitcount", {cmdBitcount, 0, 1, 1, 1}},
+    {"bitpos", {cmdBitpos, 0, 1, 1, 1}},
+    {"bitop", {cmdBitop, CMD_WRITE, 2, -1, 1}},
+    {"bitfield", {cmdBitfield, CMD_WRITE, 1, 1, 1}},
+    {"bitfield_ro", {cmdBitfieldRo, 0, 1, 1, 1}},
+    {"pfadd", {cmdPfadd, CMD_WRITE, 1, 1, 1}},
+    {"pfcount", {cmdPfcount, 0, 1, -1, 1}},
+    {"pfmerge", {cmdPfmerge, CMD_WRITE, 1, -1, 1}},
+    {"object", {cmdObject, CMD_NOTOUCH, 2, 2, 1}},
+    {"hotkeys", {cmdHotkeys, 0}}
 };
 
-CmdFunc getHandler(const std::string& cmdName) {
+// Numbers the table once it is built, for stats::record().
+static const bool commandsNumbered = []() {
+    int id = 0;
+    for (auto& [name, cmd] : cmdMap) {
+        cmd.id = id++;
+    }
+    return true;
+}();
+
+static const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+const Command* lookupCommand(const std::string& cmdName) {
     auto it = cmdMap.find(cmdName);
     if (it != cmdMap.end()) {
-        return it->second;
+        return &it->second;
+    }
+
+    return nullptr;
+}
+
+std::vector<std::string> commandKeys(const Command& cmd, const std::vector<std::string>& req) {
+    std::vector<std::string> keys;
+    if (cmd.firstKey == 0) {
+        return keys;
+    }
+
+    if (cmd.flags & CMD_STREAMS) {
+        for (size_t i = cmd.firstKey; i < req.size(); i++) {
+            if (toLower(req[i]) == "streams") {
+                size_t count = (req.size() - i - 1) / 2;
+                keys.assign(req.begin() + i + 1, req.begin() + i + 1 + count);
+                break;
+            }
+        }
+        return keys;
+    }
+
+    int last = cmd.lastKey < 0 ? static_cast<int>(req.size()) + cmd.lastKey : cmd.lastKey;
+    if (cmd.flags & CMD_KEYNUM) {
+        try {
+            last = cmd.firstKey - 1 + std::stoi(req.at(cmd.firstKey - 1));
+        }
+        catch (const std::exception& e) {
+            return keys;
+        }
+    }
+    for (int i = cmd.firstKey; i <= last && i < static_cast<int>(req.size()); i += cmd.keyStep) {
+        keys.push_back(req[i]);
+    }
+
+    return keys;
+}
+
+void sampleKeys(const Command& cmd, const std::vector<std::string>& req) {
+    if (cmd.firstKey == 0 || (cmd.flags & CMD_NOTOUCH) || !hotkeys::sample()) {
+        return;
+    }
+    for (const std::string& key : commandKeys(cmd, req)) {
+        hotkeys::record(key);
+    }
+}
+
+// Added to by waitForStreams.
+static thread_local uint64_t blockedNanos = 0;
+
+uint64_t takeBlockedNanos() {
+    uint64_t nanos = blockedNanos;
+    blockedNanos = 0;
+    return nanos;
+}
+
+CmdFunc getHandler(const std::string& cmdName) {
+    const Command* cmd = lookupCommand(cmdName);
+    if (cmd != nullptr) {
+        return cmd->func;
     }
 
     throw RedisServerError(cmdName + " not found!");
@@ -35,6 +184,15 @@ CmdResult cmdPing(const std::vector<std::string>& req) {
     if (req.size() > 2) {
         return std::make_unique<resp::Error>("ERR wrong number of arguments for 'ping command");
     }
+    // In subscribed mode a RESP2 reply has to look like a message; RESP3
+    // tells pushes and replies apart by type.
+    Connection* conn = Connection::current();
+    if (pubsub::subscribed() && (conn == nullptr || conn->protocol() == 2)) {
+        std::unique_ptr<resp::Array> arr = std::make_unique<resp::Array>();
+        arr->addElement(std::make_unique<resp::BulkString>("pong"));
+        arr->addElement(std::make_unique<resp::BulkString>(req.size() == 2 ? req[1] : ""));
+        return arr;
+    }
     if (req.size() == 1) {
         return std::make_unique<resp::SimpleString>("PONG");
     }
@@ -50,7 +208,7 @@ CmdResult cmdEcho(const std::vector<std::string>& req) {
         return std::make_unique<resp::Error>("ERR wrong number of arguments for 'echo' command");
     }
 
-    return std::make_unique<resp::SimpleString>(req[1]);
+    return std::make_unique<resp::BulkString>(req[1]);
 }
 
 CmdResult cmdSet(const std::vector<std::string>& req) {
@@ -149,7 +307,70 @@ CmdResult cmdGet(const std::vector<std::string>& req) {
         return std::make_unique<resp::NullString>();
     }
 
-    return std::make_unique<resp::SimpleString>(output);
+    return std::make_unique<resp::BulkString>(output);
+}
+
+CmdResult cmdMget(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "mget") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() < 2) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'mget' command");
+    }
+
+    std::vector<std::string> keys(req.begin() + 1, req.end());
+    std::vector<std::optional<std::string>> values = Store::getInstance().mget(keys);
+    std::unique_ptr<resp::Array> arr = std::make_unique<resp::Array>();
+    for (const auto& value : values) {
+        if (value) {
+            arr->addElement(std::make_unique<resp::BulkString>(*value));
+        }
+        else {
+            arr->addElement(std::make_unique<resp::NullString>());
+        }
+    }
+
+    return arr;
+}
+
+static bool parseKeyValuePairs(const std::vector<std::string>& req, std::vector<std::pair<std::string, std::string>>& pairs) {
+    if (req.size() < 3 || req.size() % 2 == 0) {
+        return false;
+    }
+
+    for (size_t i = 1; i + 1 < req.size(); i += 2) {
+        pairs.emplace_back(req[i], req[i + 1]);
+    }
+
+    return true;
+}
+
+CmdResult cmdMset(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "mset") {
+        throw RedisServerError("Bad input");
+    }
+
+    std::vector<std::pair<std::string, std::string>> pairs;
+    if (!parseKeyValuePairs(req, pairs)) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'mset' command");
+    }
+
+    Store::getInstance().mset(pairs);
+    return std::make_unique<resp::SimpleString>("OK");
+}
+
+CmdResult cmdMsetnx(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "msetnx") {
+        throw RedisServerError("Bad input");
+    }
+
+    std::vector<std::pair<std::string, std::string>> pairs;
+    if (!parseKeyValuePairs(req, pairs)) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'msetnx' command");
+    }
+
+    bool applied = Store::getInstance().msetnx(pairs);
+    return std::make_unique<resp::Integer>(applied ? 1 : 0);
 }
 
 CmdResult cmdExists(const std::vector<std::string>& req) {
@@ -193,6 +414,22 @@ CmdResult cmdDel(const std::vector<std::string>& req) {
     return std::make_unique<resp::Integer>(count);
 }
 
+CmdResult cmdUnlink(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "unlink") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() < 2) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'unlink' command");
+    }
+
+    int count = 0;
+    for (size_t i = 1; i < req.size(); ++i) {
+        count += Store::getInstance().erase(req[i], true);
+    }
+
+    return std::make_unique<resp::Integer>(count);
+}
+
 CmdResult cmdIncr(const std::vector<std::string>& req) {
     if (req.size() == 0 || req[0] != "incr") {
         throw RedisServerError("Bad input");
@@ -306,18 +543,2898 @@ CmdResult cmdSave(const std::vector<std::string>& req) {
     return std::make_unique<resp::Error>("Couldn't save! Make sure statefile path exists!");
 }
 
-CmdResult cmdConfigGet(const std::vector<std::string>& req) {
-    std::unique_ptr<resp::Array> arr = std::make_unique<resp::Array>();
-    arr->addElement(std::make_unique<resp::BulkString>("900"));
-    arr->addElement(std::make_unique<resp::BulkString>("1"));
+static CmdResult configGet(const std::vector<std::string>& req) {
+    std::vector<GlobPattern> globs;
+    for (size_t i = 2; i < req.size(); i++) {
+        globs.emplace_back(toLower(req[i]));
+    }
 
-    return arr;
+    std::unique_ptr<resp::Map> map = std::make_unique<resp::Map>();
+    for (const auto& [name, value] : config::parameters()) {
+        for (const GlobPattern& glob : globs) {
+            if (glob.matches(name)) {
+                map->addEntry(name, std::make_unique<resp::BulkString>(value));
+                break;
+            }
+        }
+    }
+
+    return map;
 }
 
 CmdResult cmdConfig(const std::vector<std::string>& req) {
     if (req.size() == 0 || req[0] != "config") {
         throw RedisServerError("Bad input");
     }
+    if (req.size() < 2) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'config' command");
+    }
+
+    std::string sub = toLower(req[1]);
+    if (sub == "get" && req.size() >= 3) {
+        return configGet(req);
+    }
+    if (sub == "resetstat" && req.size() == 2) {
+        stats::reset();
+        hotkeys::reset();
+        return std::make_unique<resp::SimpleString>("OK");
+    }
+
+    return std::make_unique<resp::Error>("ERR unknown subcommand or wrong number of arguments for '" + req[1] + "'");
+}
+
+// MEMORY USAGE key [SAMPLES count]
+static CmdResult memoryUsage(const std::vector<std::string>& req) {
+    if (req.size() != 3 && req.size() != 5) {
+        return std::make_unique<resp::Error>("ERR syntax error");
+    }
+
+    long long samples = MEMORY_USAGE_SAMPLES;
+    if (req.size() == 5) {
+        if (toLower(req[3]) != "samples") {
+            return std::make_unique<resp::Error>("ERR syntax error");
+        }
+        try {
+            samples = std::stoll(req[4]);
+        } catch (const std::exception& e) {
+            return std::make_unique<resp::Error>("ERR value is not an integer or out of range");
+        }
+        if (samples < 0) {
+            return std::make_unique<resp::Error>("ERR syntax error");
+        }
+    }
+
+    std::optional<Store::KeyInfo> info = Store::getInstance().inspect(req[2], samples);
+    if (!info) {
+        return std::make_unique<resp::NullString>();
+    }
+    return std::make_unique<resp::Integer>(info->bytes);
+}
+
+CmdResult cmdMemory(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "memory") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() < 2) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'memory' command");
+    }
+
+    std::string sub = toLower(req[1]);
+    if (sub == "usage") {
+        return memoryUsage(req);
+    }
+    if (req.size() != 2) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'memory' command");
+    }
+
+    slab::Stats stats = slab::stats();
+    if (sub == "stats") {
+        std::unique_ptr<resp::Map> map = std::make_unique<resp::Map>();
+        auto addField = [&map](const std::string& name, std::unique_ptr<resp::Response> value) {
+            map->addEntry(name, std::move(value));
+        };
+
+        size_t keys = Store::getInstance().size();
+        Store::TierStats tier = Store::getInstance().tierStats();
+        addField("allocator.requested", std::make_unique<resp::Integer>(stats.requestedBytes));
+        addField("allocator.allocated", std::make_unique<resp::Integer>(stats.allocatedBytes));
+        addField("allocator.slab", std::make_unique<resp::Integer>(stats.slabBytes));
+        addField("allocator.large", std::make_unique<resp::Integer>(stats.largeBytes));
+        addField("allocator.fragmentation", std::make_unique<resp::Double>(stats.fragmentation()));
+        addField("keys.count", std::make_unique<resp::Integer>(keys));
+        addField("keys.bytes-per-key", std::make_unique<resp::Integer>(keys == 0 ? 0 : stats.requestedBytes / keys));
+        addField("tiered.keys", std::make_unique<resp::Integer>(tier.keys));
+        addField("tiered.bytes", std::make_unique<resp::Integer>(tier.liveBytes));
+        addField("defrag.hits", std::make_unique<resp::Integer>(stats.defragHits));
+        addField("defrag.misses", std::make_unique<resp::Integer>(stats.defragMisses));
+        addField("lazyfree.pending", std::make_unique<resp::Integer>(lazyfree::pending()));
+        addField("lazyfree.freed", std::make_unique<resp::Integer>(lazyfree::completed()));
+        return map;
+    }
+    if (sub == "malloc-stats") {
+        return std::make_unique<resp::BulkString>(slab::formatStats(stats));
+    }
+
+    return std::make_unique<resp::Error>("ERR unknown subcommand '" + req[1] + "'");
+}
+
+// OBJECT FREQ|IDLETIME|ENCODING key. FREQ is the hot-key estimate, which
+// needs hotkeys_sample_rate; IDLETIME is only kept for string keys, and is
+// 0 for the others.
+CmdResult cmdObject(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "object") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() != 3) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'object' command");
+    }
+
+    std::string sub = toLower(req[1]);
+    if (sub != "freq" && sub != "idletime" && sub != "encoding") {
+        return std::make_unique<resp::Error>("ERR unknown subcommand '" + req[1] + "'");
+    }
+    std::optional<Store::KeyInfo> info = Store::getInstance().inspect(req[2], 1);
+    if (!info) {
+        return std::make_unique<resp::NullString>();
+    }
+
+    if (sub == "freq") {
+        if (config::GlobalConfig.hotkeysSampleRate <= 0) {
+            return std::make_unique<resp::Error>("ERR hot-key counting is off, set hotkeys_sample_rate to enable it");
+        }
+        return std::make_unique<resp::Integer>(hotkeys::estimate(req[2]));
+    }
+    if (sub == "idletime") {
+        return std::make_unique<resp::Integer>(info->idle);
+    }
+    return std::make_unique<resp::BulkString>(info->encoding);
+}
+
+// HOTKEYS [count]: the hottest keys seen lately with their estimated
+// accesses, hottest first.
+CmdResult cmdHotkeys(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "hotkeys") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() > 2) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'hotkeys' command");
+    }
+    if (config::GlobalConfig.hotkeysSampleRate <= 0) {
+        return std::make_unique<resp::Error>("ERR hot-key counting is off, set hotkeys_sample_rate to enable it");
+    }
+
+    long long count = HOTKEYS_DEFAULT_COUNT;
+    if (req.size() == 2) {
+        try {
+            count = std::stoll(req[1]);
+        } catch (const std::exception& e) {
+            return std::make_unique<resp::Error>("ERR value is not an integer or out of range");
+        }
+        if (count < 1) {
+            return std::make_unique<resp::Error>("ERR value is out of range, must be positive");
+        }
+    }
+
+    std::unique_ptr<resp::Map> map = std::make_unique<resp::Map>();
+    for (auto& [key, estimate] : hotkeys::top(count)) {
+        map->addEntry(key, std::make_unique<resp::Integer>(estimate));
+    }
+    return map;
+}
+
+// There is a single database, so FLUSHALL and FLUSHDB are the same command.
+static CmdResult flush(const std::vector<std::string>& req) {
+    bool async = false;
+    if (req.size() == 2) {
+        std::string mode = toLower(req[1]);
+        if (mode == "async") {
+            async = true;
+        }
+        else if (mode != "sync") {
+            return std::make_unique<resp::Error>("ERR syntax error");
+        }
+    }
+    else if (req.size() > 2) {
+        return std::make_unique<resp::Error>("ERR syntax error");
+    }
+
+    Store::getInstance().clear(async);
+    return std::make_unique<resp::SimpleString>("OK");
+}
+
+CmdResult cmdFlushall(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "flushall") {
+        throw RedisServerError("Bad input");
+    }
+
+    return flush(req);
+}
+
+CmdResult cmdFlushdb(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "flushdb") {
+        throw RedisServerError("Bad input");
+    }
+
+    return flush(req);
+}
+
+CmdResult cmdScan(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "scan") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() < 2 || req.size() % 2 != 0) {
+        return std::make_unique<resp::Error>("ERR syntax error");
+    }
+
+    uint64_t cursor;
+    try {
+        size_t parsed;
+        cursor = std::stoull(req[1], &parsed);
+        if (parsed != req[1].size() || req[1][0] == '-') {
+            return std::make_unique<resp::Error>("ERR invalid cursor");
+        }
+    } catch (const std::exception& e) {
+        return std::make_unique<resp::Error>("ERR invalid cursor");
+    }
+
+    std::string pattern = "*";
+    long long count = 10;
+    KeyType type = KeyType::Any;
+    for (size_t i = 2; i < req.size(); i += 2) {
+        std::string option = toLower(req[i]);
+        if (option == "match") {
+            pattern = req[i + 1];
+        }
+        else if (option == "count") {
+            try {
+                count = std::stoll(req[i + 1]);
+            } catch (const std::exception& e) {
+                return std::make_unique<resp::Error>("ERR value is not an integer or out of range");
+            }
+            if (count < 1) {
+                return std::make_unique<resp::Error>("ERR syntax error");
+            }
+        }
+        else if (option == "type") {
+            std::string name = toLower(req[i + 1]);
+            if (name == "string") {
+                type = KeyType::String;
+            }
+            else if (name == "list") {
+                type = KeyType::List;
+            }
+            else if (name == "stream") {
+                type = KeyType::Stream;
+            }
+            else {
+                return std::make_unique<resp::Error>("ERR unknown type name '" + req[i + 1] + "'");
+            }
+        }
+        else {
+            return std::make_unique<resp::Error>("ERR syntax error");
+        }
+    }
+
+    GlobPattern glob(pattern);
+    std::vector<std::string> keys;
+    cursor = Store::getInstance().scan(cursor, count, type, [&glob](std::string_view key) {
+        return glob.matches(key);
+    }, keys);
+
+    std::unique_ptr<resp::Array> page = std::make_unique<resp::Array>();
+    for (const std::string& key : keys) {
+        page->addElement(std::make_unique<resp::BulkString>(key));
+    }
+
+    std::unique_ptr<resp::Array> arr = std::make_unique<resp::Array>();
+    arr->addElement(std::make_unique<resp::BulkString>(std::to_string(cursor)));
+    arr->addElement(std::move(page));
+    return arr;
+}
+
+// KEYS walks the keyspace with the same cursor as SCAN, so it never holds a
+// lock for longer than one batch; it is still O(N) for the calling client.
+CmdResult cmdKeys(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "keys") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() != 2) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'keys' command");
+    }
+
+    GlobPattern glob(req[1]);
+    std::vector<std::string> keys;
+    if (glob.isLiteral()) {
+        if (Store::getInstance().exists(glob.literal())) {
+            keys.push_back(glob.literal());
+        }
+    }
+    else {
+        uint64_t cursor = 0;
+        do {
+            cursor = Store::getInstance().scan(cursor, KEYS_BATCH_SIZE, KeyType::Any, [&glob](std::string_view key) {
+                return glob.matches(key);
+            }, keys);
+        } while (cursor != 0);
+
+        // A table that grew mid-walk can report a key twice.
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    }
+
+    std::unique_ptr<resp::Array> arr = std::make_unique<resp::Array>();
+    for (const std::string& key : keys) {
+        arr->addElement(std::make_unique<resp::BulkString>(key));
+    }
+
+    return arr;
+}
+
+CmdResult cmdReplicaof(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "replicaof") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() != 3) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'replicaof' command");
+    }
+
+    if (toLower(req[1]) == "no" && toLower(req[2]) == "one") {
+        replication::promote();
+        return std::make_unique<resp::SimpleString>("OK");
+    }
+
+    int port;
+    try {
+        port = std::stoi(req[2]);
+    } catch (const std::exception& e) {
+        return std::make_unique<resp::Error>("ERR Invalid master port");
+    }
+    if (port <= 0 || port > 65535) {
+        return std::make_unique<resp::Error>("ERR Invalid master port");
+    }
+
+    replication::replicaOf(req[1], port);
+    return std::make_unique<resp::SimpleString>("OK");
+}
+
+CmdResult cmdReplconf(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "replconf") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() % 2 == 0) {
+        return std::make_unique<resp::Error>("ERR syntax error");
+    }
+
+    for (size_t i = 1; i < req.size(); i += 2) {
+        if (toLower(req[i]) == "listening-port") {
+            try {
+                replication::setAnnouncedPort(std::stoi(req[i + 1]));
+            } catch (const std::exception& e) {
+                return std::make_unique<resp::Error>("ERR value is not an integer or out of range");
+            }
+        }
+    }
+
+    return std::make_unique<resp::SimpleString>("OK");
+}
+
+CmdResult cmdRole(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "role") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() != 1) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'role' command");
+    }
 
-    return cmdConfigGet(req);
+    replication::Status status = replication::status();
+    std::unique_ptr<resp::Array> arr = std::make_unique<resp::Array>();
+    if (status.replica) {
+        arr->addElement(std::make_unique<resp::BulkString>("slave"));
+        arr->addElement(std::make_unique<resp::BulkString>(status.masterHost));
+        arr->addElement(std::make_unique<resp::Integer>(status.masterPort));
+        arr->addElement(std::make_unique<resp::BulkString>(status.linkState));
+        arr->addElement(std::make_unique<resp::Integer>(status.offset));
+        return arr;
+    }
+
+    std::unique_ptr<resp::Array> replicas = std::make_unique<resp::Array>();
+    for (const replication::ReplicaInfo& info : status.replicas) {
+        std::unique_ptr<resp::Array> entry = std::make_unique<resp::Array>();
+        entry->addElement(std::make_unique<resp::BulkString>(info.ip));
+        entry->addElement(std::make_unique<resp::BulkString>(std::to_string(info.port)));
+        entry->addElement(std::make_unique<resp::BulkString>(std::to_string(info.offset)));
+        replicas->addElement(std::move(entry));
+    }
+
+    arr->addElement(std::make_unique<resp::BulkString>("master"));
+    arr->addElement(std::make_unique<resp::Integer>(status.offset));
+    arr->addElement(std::move(replicas));
+    return arr;
+}
+
+static std::unique_ptr<resp::Array> slotsReply() {
+    std::unique_ptr<resp::Array> arr = std::make_unique<resp::Array>();
+    for (const cluster::SlotRange& range : cluster::slotRanges()) {
+        std::unique_ptr<resp::Array> node = std::make_unique<resp::Array>();
+        node->addElement(std::make_unique<resp::BulkString>(range.ip));
+        node->addElement(std::make_unique<resp::Integer>(range.port));
+        node->addElement(std::make_unique<resp::BulkString>(range.id));
+
+        std::unique_ptr<resp::Array> entry = std::make_unique<resp::Array>();
+        entry->addElement(std::make_unique<resp::Integer>(range.start));
+        entry->addElement(std::make_unique<resp::Integer>(range.end));
+        entry->addElement(std::move(node));
+        arr->addElement(std::move(entry));
+    }
+
+    return arr;
+}
+
+static bool parseSlot(const std::string& arg, unsigned& slot) {
+    try {
+        long value = std::stol(arg);
+        if (value < 0 || value >= CLUSTER_SLOTS) {
+            return false;
+        }
+        slot = value;
+    } catch (const std::exception& e) {
+        return false;
+    }
+
+    return true;
+}
+
+CmdResult cmdCluster(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "cluster") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() < 2) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'cluster' command");
+    }
+
+    std::string sub = toLower(req[1]);
+    if (sub == "keyslot") {
+        if (req.size() != 3) {
+            return std::make_unique<resp::Error>("ERR wrong number of arguments for 'cluster|keyslot' command");
+        }
+        return std::make_unique<resp::Integer>(cluster::keyHashSlot(req[2]));
+    }
+    if (!cluster::enabled()) {
+        return std::make_unique<resp::Error>("ERR This instance has cluster support disabled");
+    }
+
+    std::string err;
+    if (sub == "myid" && req.size() == 2) {
+        return std::make_unique<resp::BulkString>(cluster::myId());
+    }
+    else if (sub == "info" && req.size() == 2) {
+        return std::make_unique<resp::BulkString>(cluster::info());
+    }
+    else if (sub == "nodes" && req.size() == 2) {
+        return std::make_unique<resp::BulkString>(cluster::nodes());
+    }
+    else if (sub == "slots" && req.size() == 2) {
+        return slotsReply();
+    }
+    else if (sub == "meet" && req.size() == 4) {
+        int port;
+        try {
+            port = std::stoi(req[3]);
+        } catch (const std::exception& e) {
+            return std::make_unique<resp::Error>("ERR Invalid node port");
+        }
+        err = cluster::meet(req[2], port);
+    }
+    else if ((sub == "addslots" || sub == "delslots") && req.size() > 2) {
+        std::vector<unsigned> slots(req.size() - 2);
+        for (size_t i = 2; i < req.size(); i++) {
+            if (!parseSlot(req[i], slots[i - 2])) {
+                return std::make_unique<resp::Error>("ERR Invalid or out of range slot");
+            }
+        }
+        err = sub == "addslots" ? cluster::addSlots(slots) : cluster::delSlots(slots);
+    }
+    else if ((sub == "addslotsrange" || sub == "delslotsrange") && req.size() > 2 && req.size() % 2 == 0) {
+        std::vector<unsigned> slots;
+        for (size_t i = 2; i < req.size(); i += 2) {
+            unsigned start, end;
+            if (!parseSlot(req[i], start) || !parseSlot(req[i + 1], end) || start > end) {
+                return std::make_unique<resp::Error>("ERR Invalid or out of range slot");
+            }
+            for (unsigned s = start; s <= end; s++) {
+                slots.push_back(s);
+            }
+        }
+        err = sub == "addslotsrange" ? cluster::addSlots(slots) : cluster::delSlots(slots);
+    }
+    else if (sub == "setslot" && req.size() >= 4) {
+        unsigned slot;
+        if (!parseSlot(req[2], slot)) {
+            return std::make_unique<resp::Error>("ERR Invalid or out of range slot");
+        }
+        std::string action = toLower(req[3]);
+        if ((action == "stable") != (req.size() == 4)) {
+            return std::make_unique<resp::Error>("ERR Invalid CLUSTER SETSLOT action or number of arguments");
+        }
+        err = cluster::setSlot(slot, action, req.size() > 4 ? req[4] : "");
+    }
+    else if (sub == "countkeysinslot" && req.size() == 3) {
+        unsigned slot;
+        if (!parseSlot(req[2], slot)) {
+            return std::make_unique<resp::Error>("ERR Invalid slot");
+        }
+        return std::make_unique<resp::Integer>(cluster::countKeysInSlot(slot));
+    }
+    else if (sub == "getkeysinslot" && req.size() == 4) {
+        unsigned slot;
+        long count;
+        try {
+            count = std::stol(req[3]);
+        } catch (const std::exception& e) {
+            count = -1;
+        }
+        if (!parseSlot(req[2], slot) || count < 0) {
+            return std::make_unique<resp::Error>("ERR Invalid slot or number of keys");
+        }
+        std::unique_ptr<resp::Array> arr = std::make_unique<resp::Array>();
+        for (const std::string& key : cluster::getKeysInSlot(slot, count)) {
+            arr->addElement(std::make_unique<resp::BulkString>(key));
+        }
+        return arr;
+    }
+    else {
+        return std::make_unique<resp::Error>("ERR unknown subcommand or wrong number of arguments for '" + req[1] + "'");
+    }
+
+    if (!err.empty()) {
+        return std::make_unique<resp::Error>(err);
+    }
+    return std::make_unique<resp::SimpleString>("OK");
+}
+
+CmdResult cmdAsking(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "asking") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() != 1) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'asking' command");
+    }
+    if (!cluster::enabled()) {
+        return std::make_unique<resp::Error>("ERR This instance has cluster support disabled");
+    }
+
+    cluster::setAsking();
+    return std::make_unique<resp::SimpleString>("OK");
+}
+
+// DUMP payloads are a RESP array: `string <value>`, `list <elements...>` or
+// `stream <Stream::toRecord()...>`, as in snapshots. `ttlMs` is the
+// remaining time to live, 0 for none.
+static bool dumpKey(const std::string& key, std::string& payload, int64_t& ttlMs) {
+    std::optional<ValueEntry> entry = Store::getInstance().getEntry(key);
+    if (entry.has_value()) {
+        payload = resp::encodeCommand({"string", entry->val});
+        ttlMs = 0;
+        if (entry->expiryEpoch != LONG_MAX) {
+            std::time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+            ttlMs = std::max<int64_t>(1, (entry->expiryEpoch - now) * 1000);
+        }
+        return true;
+    }
+
+    std::vector<std::string> record;
+    Store::getInstance().readStream(key, [&record](const Stream* stream) {
+        if (stream != nullptr) {
+            record.push_back("stream");
+            stream->toRecord(record);
+        }
+    });
+    if (!record.empty()) {
+        payload = resp::encodeCommand(record);
+        ttlMs = 0;
+        return true;
+    }
+
+    if (!Store::getInstance().exists(key)) {
+        return false;
+    }
+
+    std::vector<std::string> args = Store::getInstance().lrange(key, 0, -1);
+    args.insert(args.begin(), "list");
+    payload = resp::encodeCommand(args);
+    ttlMs = 0;
+    return true;
+}
+
+CmdResult cmdDump(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "dump") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() != 2) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'dump' command");
+    }
+
+    std::string payload;
+    int64_t ttlMs;
+    if (!dumpKey(req[1], payload, ttlMs)) {
+        return std::make_unique<resp::NullString>();
+    }
+
+    return std::make_unique<resp::BulkString>(payload);
+}
+
+CmdResult cmdRestore(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "restore") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() < 4) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'restore' command");
+    }
+
+    bool replace = false;
+    bool absTtl = false;
+    for (size_t i = 4; i < req.size(); i++) {
+        std::string option = toLower(req[i]);
+        if (option == "replace") {
+            replace = true;
+        }
+        else if (option == "absttl") {
+            absTtl = true;
+        }
+        else {
+            return std::make_unique<resp::Error>("ERR syntax error");
+        }
+    }
+
+    int64_t ttl;
+    try {
+        ttl = std::stoll(req[2]);
+    } catch (const std::exception& e) {
+        return std::make_unique<resp::Error>("ERR value is not an integer or out of range");
+    }
+    if (ttl < 0) {
+        return std::make_unique<resp::Error>("ERR Invalid TTL value, must be >= 0");
+    }
+
+    std::vector<std::string> value;
+    std::unique_ptr<Stream> stream;
+    bool decoded = resp::decodeCommand(req[3], value) && !value.empty();
+    if (decoded && value[0] == "stream") {
+        try {
+            size_t pos = 1;
+            stream = Stream::fromRecord(value, pos);
+            if (pos != value.size()) {
+                stream.reset();
+            }
+        } catch (const std::exception& e) {
+            stream.reset();
+        }
+    }
+    if (!decoded || !((value[0] == "string" && value.size() == 2) || (value[0] == "list" && value.size() > 1) ||
+                           stream != nullptr)) {
+        return std::make_unique<resp::Error>("ERR DUMP payload version or checksum are wrong");
+    }
+
+    Store& store = Store::getInstance();
+    if (store.exists(req[1])) {
+        if (!replace) {
+            return std::make_unique<resp::Error>("BUSYKEY Target key name already exists.");
+        }
+        store.erase(req[1]);
+    }
+
+    if (value[0] == "string") {
+        std::time_t expiryEpoch = LONG_MAX;
+        if (ttl > 0) {
+            std::time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+            expiryEpoch = absTtl ? ttl / 1000 : now + (ttl + 999) / 1000;
+        }
+        store.set(req[1], value[1], expiryEpoch);
+    }
+    else if (stream != nullptr) {
+        store.writeStream(req[1], [&stream](std::unique_ptr<Stream>& slot) {
+            slot = std::move(stream);
+            return true;
+        });
+    }
+    else {
+        store.lpush(req[1], std::vector<std::string>(value.begin() + 1, value.end()), true);
+    }
+
+    return std::make_unique<resp::SimpleString>("OK");
+}
+
+// Sends `out` to host:port and reads `replies` replies to it, with
+// `timeoutMs` for each read and write. Returns the error to reply with, or
+// an empty string if every reply was a success.
+static std::string sendToTarget(const std::string& host, int port, long timeoutMs, const std::string& out,
+                                size_t replies) {
+    int fd = connectTcp(host, port);
+    if (fd < 0) {
+        return "IOERR error or timeout connecting to the client";
+    }
+
+    struct timeval tv;
+    tv.tv_sec = timeoutMs / 1000;
+    tv.tv_usec = (timeoutMs % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    std::string error;
+    try {
+        if (writeExactly(fd, out.c_str(), out.size()) < 0) {
+            throw SysCallFailure("send");
+        }
+        RESPParser parser(fd);
+        for (size_t i = 0; i < replies; i++) {
+            std::string reply = parser.readLine();
+            if (!reply.empty() && reply[0] == '-' && error.empty()) {
+                error = "ERR Target instance replied with error: " + reply.substr(1);
+            }
+        }
+    } catch (const std::exception& e) {
+        error = "IOERR error or timeout writing to target instance";
+    }
+    close(fd);
+    return error;
+}
+
+// MIGRATE host port key|"" db timeout [COPY] [REPLACE] [KEYS key...]
+//
+// Keys are sent as ASKING + RESTORE pairs over one pipelined connection, so
+// the target accepts them while it is importing the slot, and are removed
+// locally once the target has acknowledged every one of them. They are
+// watched from before the dump, and one written meanwhile is kept rather
+// than deleted along with the write the target never got. The exchange
+// with the target holds no lock; only the removal is a write.
+CmdResult cmdMigrate(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "migrate") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() < 6) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'migrate' command");
+    }
+
+    bool copy = false;
+    bool replace = false;
+    std::vector<std::string> keys;
+    for (size_t i = 6; i < req.size(); i++) {
+        std::string option = toLower(req[i]);
+        if (option == "copy") {
+            copy = true;
+        }
+        else if (option == "replace") {
+            replace = true;
+        }
+        else if (option == "keys" && req[3].empty()) {
+            keys.assign(req.begin() + i + 1, req.end());
+            break;
+        }
+        else {
+            return std::make_unique<resp::Error>("ERR syntax error");
+        }
+    }
+    if (!req[3].empty()) {
+        keys.push_back(req[3]);
+    }
+
+    int port;
+    long timeoutMs;
+    try {
+        port = std::stoi(req[2]);
+        timeoutMs = std::stol(req[5]);
+    } catch (const std::exception& e) {
+        return std::make_unique<resp::Error>("ERR value is not an integer or out of range");
+    }
+
+    Store& store = Store::getInstance();
+    std::string out;
+    std::vector<std::string> found;
+    std::vector<uint64_t> versions;
+    for (const std::string& key : keys) {
+        uint64_t version = copy ? 0 : store.watch(key);
+        std::string payload;
+        int64_t ttlMs;
+        if (!dumpKey(key, payload, ttlMs)) {
+            if (!copy) {
+                store.unwatch(key);
+            }
+            continue;
+        }
+        out += resp::encodeCommand({"ASKING"});
+        std::vector<std::string> restore = {"RESTORE", key, std::to_string(ttlMs), payload};
+        if (replace) {
+            restore.push_back("REPLACE");
+        }
+        out += resp::encodeCommand(restore);
+        found.push_back(key);
+        versions.push_back(version);
+    }
+    if (found.empty()) {
+        return std::make_unique<resp::SimpleString>("NOKEY");
+    }
+
+    std::string error = sendToTarget(req[1], port, timeoutMs, out, found.size() * 2);
+    std::vector<std::string> del = {"del"};
+    if (!copy && error.empty()) {
+        replication::WriteScope scope;
+        store.runLocked(found, false, [&]() {
+            for (size_t i = 0; i < found.size(); i++) {
+                if (store.keyVersion(found[i]) != versions[i]) {
+                    if (error.empty()) {
+                        error = "ERR Key '" + found[i] + "' was written during MIGRATE and was kept; "
+                                "migrate it again with REPLACE";
+                    }
+                    continue;
+                }
+                if (store.erase(found[i])) {
+                    del.push_back(found[i]);
+                }
+            }
+        });
+        if (del.size() > 1) {
+            scope.propagate(del);
+        }
+    }
+    for (size_t i = 0; i < found.size() && !copy; i++) {
+        store.unwatch(found[i]);
+    }
+
+    if (!error.empty()) {
+        return std::make_unique<resp::Error>(error);
+    }
+    return std::make_unique<resp::SimpleString>("OK");
+}
+
+// Confirmations are pushes, so that a RESP3 client sees them in the same
+// stream as the messages that follow.
+static std::unique_ptr<resp::Push> subscriptionReply(const std::string& kind, const std::string* name, size_t count) {
+    std::unique_ptr<resp::Push> arr = std::make_unique<resp::Push>();
+    arr->addElement(std::make_unique<resp::BulkString>(kind));
+    if (name != nullptr) {
+        arr->addElement(std::make_unique<resp::BulkString>(*name));
+    }
+    else {
+        arr->addElement(std::make_unique<resp::NullString>());
+    }
+    arr->addElement(std::make_unique<resp::Integer>(count));
+    return arr;
+}
+
+// SUBSCRIBE, UNSUBSCRIBE and their pattern variants answer once per
+// argument. Unsubscribing without arguments drops every subscription of
+// that kind.
+static CmdResult subscriptionCommand(const std::vector<std::string>& req, const std::string& kind,
+                                     const std::function<size_t(const std::string&)>& apply,
+                                     const std::function<std::vector<std::string>()>& all) {
+    std::vector<std::string> names(req.begin() + 1, req.end());
+    if (names.empty() && all != nullptr) {
+        names = all();
+        if (names.empty()) {
+            std::unique_ptr<resp::Replies> replies = std::make_unique<resp::Replies>();
+            replies->addReply(subscriptionReply(kind, nullptr, pubsub::channels().size() + pubsub::patterns().size()));
+            return replies;
+        }
+    }
+    if (names.empty()) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for '" + req[0] + "' command");
+    }
+
+    std::unique_ptr<resp::Replies> replies = std::make_unique<resp::Replies>();
+    for (const std::string& name : names) {
+        size_t count = apply(name);
+        replies->addReply(subscriptionReply(kind, &name, count));
+    }
+    return replies;
+}
+
+CmdResult cmdSubscribe(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "subscribe") {
+        throw RedisServerError("Bad input");
+    }
+
+    return subscriptionCommand(req, "subscribe", pubsub::subscribe, nullptr);
+}
+
+CmdResult cmdUnsubscribe(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "unsubscribe") {
+        throw RedisServerError("Bad input");
+    }
+
+    return subscriptionCommand(req, "unsubscribe", pubsub::unsubscribe, pubsub::channels);
+}
+
+CmdResult cmdPsubscribe(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "psubscribe") {
+        throw RedisServerError("Bad input");
+    }
+
+    return subscriptionCommand(req, "psubscribe", pubsub::psubscribe, nullptr);
+}
+
+CmdResult cmdPunsubscribe(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "punsubscribe") {
+        throw RedisServerError("Bad input");
+    }
+
+    return subscriptionCommand(req, "punsubscribe", pubsub::punsubscribe, pubsub::patterns);
+}
+
+CmdResult cmdPublish(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "publish") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() != 3) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'publish' command");
+    }
+
+    return std::make_unique<resp::Integer>(pubsub::publish(req[1], req[2]));
+}
+
+CmdResult cmdPubsub(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "pubsub") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() < 2) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'pubsub' command");
+    }
+
+    std::string sub = toLower(req[1]);
+    if (sub == "channels" && req.size() <= 3) {
+        std::unique_ptr<resp::Array> arr = std::make_unique<resp::Array>();
+        for (const std::string& channel : pubsub::activeChannels(req.size() == 3 ? req[2] : "*")) {
+            arr->addElement(std::make_unique<resp::BulkString>(channel));
+        }
+        return arr;
+    }
+    if (sub == "numsub") {
+        std::unique_ptr<resp::Map> map = std::make_unique<resp::Map>();
+        for (const auto& [channel, count] : pubsub::numSubscribers(std::vector<std::string>(req.begin() + 2, req.end()))) {
+            map->addEntry(channel, std::make_unique<resp::Integer>(count));
+        }
+        return map;
+    }
+    if (sub == "numpat" && req.size() == 2) {
+        return std::make_unique<resp::Integer>(pubsub::numPatterns());
+    }
+
+    return std::make_unique<resp::Error>("ERR unknown subcommand or wrong number of arguments for '" + req[1] + "'");
+}
+
+CmdResult cmdMulti(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "multi") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() != 1) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'multi' command");
+    }
+    if (!transaction::begin()) {
+        return std::make_unique<resp::Error>("ERR MULTI calls can not be nested");
+    }
+
+    return std::make_unique<resp::SimpleString>("OK");
+}
+
+CmdResult cmdExec(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "exec") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() != 1) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'exec' command");
+    }
+    if (!transaction::active()) {
+        return std::make_unique<resp::Error>("ERR EXEC without MULTI");
+    }
+
+    return transaction::exec();
+}
+
+CmdResult cmdDiscard(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "discard") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() != 1) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'discard' command");
+    }
+    if (!transaction::active()) {
+        return std::make_unique<resp::Error>("ERR DISCARD without MULTI");
+    }
+
+    transaction::discard();
+    return std::make_unique<resp::SimpleString>("OK");
+}
+
+CmdResult cmdWatch(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "watch") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() < 2) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'watch' command");
+    }
+    if (transaction::active()) {
+        return std::make_unique<resp::Error>("ERR WATCH inside MULTI is not allowed");
+    }
+
+    transaction::watch(std::vector<std::string>(req.begin() + 1, req.end()));
+    return std::make_unique<resp::SimpleString>("OK");
+}
+
+CmdResult cmdUnwatch(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "unwatch") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() != 1) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'unwatch' command");
+    }
+
+    transaction::unwatch();
+    return std::make_unique<resp::SimpleString>("OK");
+}
+
+CmdResult cmdEval(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "eval") {
+        throw RedisServerError("Bad input");
+    }
+
+    return scripting::eval(req, false, false);
+}
+
+CmdResult cmdEvalsha(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "evalsha") {
+        throw RedisServerError("Bad input");
+    }
+
+    return scripting::eval(req, true, false);
+}
+
+CmdResult cmdEvalRo(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "eval_ro") {
+        throw RedisServerError("Bad input");
+    }
+
+    return scripting::eval(req, false, true);
+}
+
+CmdResult cmdEvalshaRo(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "evalsha_ro") {
+        throw RedisServerError("Bad input");
+    }
+
+    return scripting::eval(req, true, true);
+}
+
+CmdResult cmdScript(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "script") {
+        throw RedisServerError("Bad input");
+    }
+
+    return scripting::script(req);
+}
+
+CmdResult cmdHello(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "hello") {
+        throw RedisServerError("Bad input");
+    }
+
+    Connection* conn = Connection::current();
+    int protocol = conn != nullptr ? conn->protocol() : 2;
+    if (req.size() > 1) {
+        if (req[1] != "2" && req[1] != "3") {
+            return std::make_unique<resp::Error>("NOPROTO unsupported protocol version");
+        }
+        protocol = req[1][0] - '0';
+    }
+    // There are no users or client names to set; the options are accepted
+    // for compatibility with clients that always send them.
+    for (size_t i = 2; i < req.size(); i++) {
+        std::string option = toLower(req[i]);
+        if (option == "auth" && i + 2 < req.size()) {
+            i += 2;
+        }
+        else if (option == "setname" && i + 1 < req.size()) {
+            i += 1;
+        }
+        else {
+            return std::make_unique<resp::Error>("ERR Syntax error in HELLO option '" + req[i] + "'");
+        }
+    }
+
+    if (conn != nullptr) {
+        // Invalidations are pushes, which a RESP2 client cannot tell apart
+        // from replies.
+        if (protocol == 2) {
+            tracking::disable();
+        }
+        conn->setProtocol(protocol);
+    }
+
+    auto map = std::make_unique<resp::Map>();
+    map->addEntry("server", std::make_unique<resp::BulkString>("redis"));
+    map->addEntry("version", std::make_unique<resp::BulkString>("7.0.0"));
+    map->addEntry("proto", std::make_unique<resp::Integer>(protocol));
+    map->addEntry("id", std::make_unique<resp::Integer>(conn != nullptr ? conn->id() : 0));
+    map->addEntry("mode", std::make_unique<resp::BulkString>(cluster::enabled() ? "cluster" : "standalone"));
+    map->addEntry("role", std::make_unique<resp::BulkString>(replication::isReplica() ? "replica" : "master"));
+    map->addEntry("modules", std::make_unique<resp::Array>());
+    return map;
+}
+
+static CmdResult clientTracking(const std::vector<std::string>& req) {
+    if (req.size() < 3) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'client|tracking' command");
+    }
+
+    std::string state = toLower(req[2]);
+    if (state == "off" && req.size() == 3) {
+        tracking::disable();
+        return std::make_unique<resp::SimpleString>("OK");
+    }
+    if (state != "on") {
+        return std::make_unique<resp::Error>("ERR syntax error");
+    }
+
+    tracking::Options options;
+    for (size_t i = 3; i < req.size(); i++) {
+        std::string option = toLower(req[i]);
+        if (option == "bcast") {
+            options.bcast = true;
+        }
+        else if (option == "noloop") {
+            options.noloop = true;
+        }
+        else if (option == "prefix" && i + 1 < req.size()) {
+            options.prefixes.push_back(req[++i]);
+        }
+        else if (option == "redirect" || option == "optin" || option == "optout") {
+            return std::make_unique<resp::Error>("ERR CLIENT TRACKING " + req[i] + " is not supported");
+        }
+        else {
+            return std::make_unique<resp::Error>("ERR syntax error");
+        }
+    }
+    if (!options.bcast && !options.prefixes.empty()) {
+        return std::make_unique<resp::Error>("ERR PREFIX option requires BCAST mode to be enabled");
+    }
+
+    Connection* conn = Connection::current();
+    if (conn == nullptr || conn->protocol() != 3) {
+        return std::make_unique<resp::Error>("ERR CLIENT TRACKING needs RESP3: switch the connection with HELLO 3 first");
+    }
+
+    tracking::enable(options);
+    return std::make_unique<resp::SimpleString>("OK");
+}
+
+CmdResult cmdClient(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "client") {
+        throw RedisServerError("Bad input");
+    }
+
+    std::string sub = req.size() > 1 ? toLower(req[1]) : "";
+    Connection* conn = Connection::current();
+    if (sub == "tracking") {
+        return clientTracking(req);
+    }
+    if (sub == "trackinginfo" && req.size() == 2) {
+        tracking::Options options = tracking::options();
+        auto flags = std::make_unique<resp::Set>();
+        if (!tracking::enabled()) {
+            flags->addElement(std::make_unique<resp::BulkString>("off"));
+        }
+        else {
+            flags->addElement(std::make_unique<resp::BulkString>("on"));
+            if (options.bcast) {
+                flags->addElement(std::make_unique<resp::BulkString>("bcast"));
+            }
+            if (options.noloop) {
+                flags->addElement(std::make_unique<resp::BulkString>("noloop"));
+            }
+        }
+        auto prefixes = std::make_unique<resp::Array>();
+        for (const std::string& prefix : options.prefixes) {
+            prefixes->addElement(std::make_unique<resp::BulkString>(prefix));
+        }
+
+        auto map = std::make_unique<resp::Map>();
+        map->addEntry("flags", std::move(flags));
+        map->addEntry("redirect", std::make_unique<resp::Integer>(tracking::enabled() ? 0 : -1));
+        map->addEntry("prefixes", std::move(prefixes));
+        return map;
+    }
+    if (sub == "id" && req.size() == 2) {
+        return std::make_unique<resp::Integer>(conn != nullptr ? conn->id() : 0);
+    }
+
+    return std::make_unique<resp::Error>("ERR unknown subcommand or wrong number of arguments for '" +
+                                         (req.size() > 1 ? req[1] : std::string()) + "'");
+}
+
+// 1.50K, 2.31M: the human-readable sizes INFO memory pairs with raw bytes.
+static std::string humanBytes(double bytes) {
+    const char* units[] = {"B", "K", "M", "G", "T"};
+    size_t unit = 0;
+    while (bytes >= 1024 && unit < 4) {
+        bytes /= 1024;
+        unit++;
+    }
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), unit == 0 ? "%.0f%s" : "%.2f%s", bytes, units[unit]);
+    return buf;
+}
+
+static size_t residentBytes() {
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0;
+    size_t resident = 0;
+    statm >> pages >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+using InfoFields = std::vector<std::pair<std::string, std::string>>;
+
+static InfoFields infoServer() {
+    long uptime = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - startTime).count();
+    return {
+        {"redis_version", "7.0.0"},
+        {"redis_mode", cluster::enabled() ? "cluster" : "standalone"},
+        {"process_id", std::to_string(getpid())},
+        {"tcp_port", std::to_string(config::GlobalConfig.port)},
+        {"uptime_in_seconds", std::to_string(uptime)},
+        {"uptime_in_days", std::to_string(uptime / 86400)},
+    };
+}
+
+static InfoFields infoClients() {
+    return {
+        {"connected_clients", std::to_string(Connection::openCount())},
+        {"tracking_total_keys", std::to_string(tracking::trackedKeys())},
+        {"pubsub_channels", std::to_string(pubsub::activeChannels("*").size())},
+        {"pubsub_patterns", std::to_string(pubsub::numPatterns())},
+    };
+}
+
+static InfoFields infoMemory() {
+    slab::Stats slabs = slab::stats();
+    size_t used = slabs.slabBytes + slabs.largeBytes;
+    size_t rss = residentBytes();
+    char ratio[32];
+    snprintf(ratio, sizeof(ratio), "%.2f", slabs.fragmentation());
+    return {
+        {"used_memory", std::to_string(used)},
+        {"used_memory_human", humanBytes(used)},
+        {"used_memory_dataset", std::to_string(slabs.requestedBytes)},
+        {"used_memory_rss", std::to_string(rss)},
+        {"used_memory_rss_human", humanBytes(rss)},
+        {"allocator_fragmentation_ratio", ratio},
+        {"lazyfree_pending_objects", std::to_string(lazyfree::pending())},
+        {"lazyfreed_objects", std::to_string(lazyfree::completed())},
+    };
+}
+
+static InfoFields infoTiered() {
+    Store::TierStats tier = Store::getInstance().tierStats();
+    return {
+        {"tiered_storage_enabled", config::GlobalConfig.tieredStorage ? "1" : "0"},
+        {"tiered_keys", std::to_string(tier.keys)},
+        {"tiered_live_bytes", std::to_string(tier.liveBytes)},
+        {"tiered_disk_bytes", std::to_string(tier.diskBytes)},
+        {"tiered_disk_human", humanBytes(tier.diskBytes)},
+        {"tiered_spilled_values", std::to_string(tier.spills)},
+        {"tiered_faults", std::to_string(tier.faults)},
+        {"tiered_compactions", std::to_string(tier.compactions)},
+    };
+}
+
+static InfoFields infoCompression() {
+    compression::Stats stats = compression::stats();
+    char ratio[32];
+    snprintf(ratio, sizeof(ratio), "%.2f", stats.storedBytes == 0 ? 1.0 : double(stats.rawBytes) / stats.storedBytes);
+    auto perCall = [](uint64_t nanos, uint64_t calls) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.2f", calls == 0 ? 0.0 : nanos / 1000.0 / calls);
+        return std::string(buf);
+    };
+    return {
+        {"compression_enabled", config::GlobalConfig.compression ? "1" : "0"},
+        {"compression_dictionaries", std::to_string(stats.dictionaries)},
+        {"compression_dictionary_bytes", std::to_string(stats.dictionaryBytes)},
+        {"compressed_values", std::to_string(stats.compressed)},
+        {"compression_raw_bytes", std::to_string(stats.rawBytes)},
+        {"compression_stored_bytes", std::to_string(stats.storedBytes)},
+        {"compression_ratio", ratio},
+        {"compression_calls", std::to_string(stats.compressions)},
+        {"compression_usec_per_call", perCall(stats.compressNanos, stats.compressions)},
+        {"decompression_calls", std::to_string(stats.decompressions)},
+        {"decompression_usec_per_call", perCall(stats.decompressNanos, stats.decompressions)},
+    };
+}
+
+static InfoFields infoHotkeys() {
+    std::vector<std::pair<std::string, uint64_t>> hottest = hotkeys::top(HOTKEYS_TOP_SIZE);
+    return {
+        {"hotkeys_sample_rate", std::to_string(config::GlobalConfig.hotkeysSampleRate)},
+        {"hotkeys_sampled", std::to_string(hotkeys::sampled())},
+        {"hotkeys_tracked", std::to_string(hottest.size())},
+        {"hotkeys_top_freq", std::to_string(hottest.empty() ? 0 : hottest[0].second)},
+    };
+}
+
+static InfoFields infoPersistence() {
+    Snapshot::SaveInfo save = Snapshot::lastSave();
+    return {
+        {"rdb_saves", std::to_string(save.saves)},
+        {"rdb_last_save_time", std::to_string(save.lastSave)},
+        {"rdb_last_bgsave_status", save.lastOk ? "ok" : "err"},
+        {"rdb_last_save_duration_ms", std::to_string(save.lastDurationMs)},
+        {"snapshot_period_minutes", std::to_string(config::GlobalConfig.snapshotPeriod)},
+    };
+}
+
+static InfoFields infoStats() {
+    uint64_t calls = 0;
+    uint64_t rejected = 0;
+    for (const auto& [name, cmd] : cmdMap) {
+        stats::CommandStats s = stats::command(cmd.id);
+        calls += s.calls;
+        rejected += s.rejected;
+    }
+
+    return {
+        {"total_connections_received", std::to_string(Connection::acceptedCount())},
+        {"total_commands_processed", std::to_string(calls)},
+        {"total_rejected_commands", std::to_string(rejected)},
+        {"active_defrag_hits", std::to_string(slab::stats().defragHits)},
+    };
+}
+
+static InfoFields infoReplication() {
+    replication::Status status = replication::status();
+    InfoFields fields = {{"role", status.replica ? "slave" : "master"}};
+    if (status.replica) {
+        fields.emplace_back("master_host", status.masterHost);
+        fields.emplace_back("master_port", std::to_string(status.masterPort));
+        fields.emplace_back("master_link_status", status.linkState == "connected" ? "up" : "down");
+    }
+    fields.emplace_back("connected_slaves", std::to_string(status.replicas.size()));
+    for (size_t i = 0; i < status.replicas.size(); i++) {
+        const replication::ReplicaInfo& replica = status.replicas[i];
+        fields.emplace_back("slave" + std::to_string(i), "ip=" + replica.ip + ",port=" + std::to_string(replica.port) +
+                                                             ",offset=" + std::to_string(replica.offset));
+    }
+    fields.emplace_back("master_replid", status.replId);
+    fields.emplace_back("master_repl_offset", std::to_string(status.offset));
+    fields.emplace_back("repl_sync_last_freeze_usec", std::to_string(status.lastSyncFreezeUs));
+    fields.emplace_back("repl_sync_last_bytes", std::to_string(status.lastSyncBytes));
+    fields.emplace_back("repl_sync_buffer_bytes", std::to_string(status.syncBufferBytes));
+    return fields;
+}
+
+// Commands in name order, with the statistics of those called at least once.
+static std::vector<std::pair<std::string, stats::CommandStats>> calledCommands() {
+    std::vector<std::pair<std::string, stats::CommandStats>> called;
+    for (const auto& [name, cmd] : cmdMap) {
+        stats::CommandStats s = stats::command(cmd.id);
+        if (s.calls != 0 || s.rejected != 0) {
+            called.emplace_back(name, std::move(s));
+        }
+    }
+    std::sort(called.begin(), called.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    return called;
+}
+
+static InfoFields infoCommandStats() {
+    InfoFields fields;
+    char buf[256];
+    for (const auto& [name, s] : calledCommands()) {
+        snprintf(buf, sizeof(buf), "calls=%lu,usec=%lu,usec_per_call=%.2f,rejected_calls=%lu,failed_calls=%lu",
+                 s.calls, s.nanos / 1000, s.calls == 0 ? 0.0 : s.nanos / 1000.0 / s.calls, s.rejected, s.failed);
+        fields.emplace_back("cmdstat_" + name, buf);
+    }
+    return fields;
+}
+
+static InfoFields infoLatencyStats() {
+    InfoFields fields;
+    char buf[256];
+    for (const auto& [name, s] : calledCommands()) {
+        if (s.calls == 0) {
+            continue;
+        }
+        snprintf(buf, sizeof(buf), "p50=%.3f,p99=%.3f,p99.9=%.3f",
+                 s.percentile(50) / 1000.0, s.percentile(99) / 1000.0, s.percentile(99.9) / 1000.0);
+        fields.emplace_back("latency_percentiles_usec_" + name, buf);
+    }
+    return fields;
+}
+
+static InfoFields infoKeyspace() {
+    size_t keys = Store::getInstance().size();
+    if (keys == 0) {
+        return {};
+    }
+    return {{"db0", "keys=" + std::to_string(keys)}};
+}
+
+CmdResult cmdInfo(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "info") {
+        throw RedisServerError("Bad input");
+    }
+
+    // commandstats and latencystats cost a pass over every thread's
+    // counters, so only named sections or "all" include them.
+    const std::vector<std::pair<std::string, InfoFields (*)()>> sections = {
+        {"server", infoServer},
+        {"clients", infoClients},
+        {"memory", infoMemory},
+        {"tiered", infoTiered},
+        {"compression", infoCompression},
+        {"hotkeys", infoHotkeys},
+        {"persistence", infoPersistence},
+        {"stats", infoStats},
+        {"replication", infoReplication},
+        {"commandstats", infoCommandStats},
+        {"latencystats", infoLatencyStats},
+        {"keyspace", infoKeyspace},
+    };
+    std::unordered_set<std::string> wanted;
+    bool all = false;
+    bool defaults = req.size() == 1;
+    for (size_t i = 1; i < req.size(); i++) {
+        std::string name = toLower(req[i]);
+        all |= name == "all" || name == "everything";
+        defaults |= name == "default";
+        wanted.insert(name);
+    }
+
+    std::string text;
+    for (const auto& [name, fields] : sections) {
+        bool extra = name == "commandstats" || name == "latencystats";
+        if (!all && !(defaults && !extra) && wanted.find(name) == wanted.end()) {
+            continue;
+        }
+        if (!text.empty()) {
+            text += "\r\n";
+        }
+        text += "# " + std::string(1, toupper(name[0])) + name.substr(1) + "\r\n";
+        for (const auto& [key, value] : fields()) {
+            text += key + ":" + value + "\r\n";
+        }
+    }
+
+    return std::make_unique<resp::Verbatim>(text);
+}
+
+CmdResult cmdSlowlog(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "slowlog") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() < 2) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'slowlog' command");
+    }
+
+    std::string sub = toLower(req[1]);
+    if (sub == "get" && req.size() <= 3) {
+        long count = 10;
+        if (req.size() == 3) {
+            try {
+                count = std::stol(req[2]);
+            } catch (const std::exception& e) {
+                count = -2;
+            }
+            if (count < -1) {
+                return std::make_unique<resp::Error>("ERR count should be greater than or equal to -1");
+            }
+        }
+
+        std::unique_ptr<resp::Array> arr = std::make_unique<resp::Array>();
+        for (const slowlog::Entry& entry : slowlog::get(count == -1 ? SLOWLOG_CAPACITY : count)) {
+            auto item = std::make_unique<resp::Array>();
+            item->addElement(std::make_unique<resp::Integer>(entry.id));
+            item->addElement(std::make_unique<resp::Integer>(entry.time));
+            item->addElement(std::make_unique<resp::Integer>(entry.micros));
+            auto args = std::make_unique<resp::Array>();
+            for (const std::string& arg : entry.args) {
+                args->addElement(std::make_unique<resp::BulkString>(arg));
+            }
+            item->addElement(std::move(args));
+            item->addElement(std::make_unique<resp::BulkString>(entry.client));
+            item->addElement(std::make_unique<resp::BulkString>(""));
+            arr->addElement(std::move(item));
+        }
+        return arr;
+    }
+    if (sub == "len" && req.size() == 2) {
+        return std::make_unique<resp::Integer>(slowlog::len());
+    }
+    if (sub == "reset" && req.size() == 2) {
+        slowlog::reset();
+        return std::make_unique<resp::SimpleString>("OK");
+    }
+
+    return std::make_unique<resp::Error>("ERR unknown subcommand or wrong number of arguments for '" + req[1] + "'");
+}
+
+CmdResult cmdLatency(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "latency") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() < 2) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'latency' command");
+    }
+
+    std::string sub = toLower(req[1]);
+    if (sub == "latest" && req.size() == 2) {
+        std::unique_ptr<resp::Array> arr = std::make_unique<resp::Array>();
+        for (const latency::EventStats& event : latency::latest()) {
+            auto item = std::make_unique<resp::Array>();
+            item->addElement(std::make_unique<resp::BulkString>(event.name));
+            item->addElement(std::make_unique<resp::Integer>(event.latest.time));
+            item->addElement(std::make_unique<resp::Integer>(event.latest.millis));
+            item->addElement(std::make_unique<resp::Integer>(event.maxMillis));
+            arr->addElement(std::move(item));
+        }
+        return arr;
+    }
+    if (sub == "history" && req.size() == 3) {
+        std::unique_ptr<resp::Array> arr = std::make_unique<resp::Array>();
+        for (const latency::Sample& sample : latency::history(req[2])) {
+            auto item = std::make_unique<resp::Array>();
+            item->addElement(std::make_unique<resp::Integer>(sample.time));
+            item->addElement(std::make_unique<resp::Integer>(sample.millis));
+            arr->addElement(std::move(item));
+        }
+        return arr;
+    }
+    if (sub == "reset") {
+        return std::make_unique<resp::Integer>(latency::reset(std::vector<std::string>(req.begin() + 2, req.end())));
+    }
+
+    return std::make_unique<resp::Error>("ERR unknown subcommand or wrong number of arguments for '" + req[1] + "'");
+}
+
+static const char* const INVALID_STREAM_ID = "ERR Invalid stream ID specified as stream command argument";
+
+static uint64_t unixMs() {
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
+}
+
+static bool parseCount(const std::string& arg, long long& value) {
+    try {
+        size_t parsed;
+        value = std::stoll(arg, &parsed);
+        return parsed == arg.size();
+    } catch (const std::exception& e) {
+        return false;
+    }
+}
+
+// A stream ID argument. `-` and `+` are the smallest and the largest ID, and
+// an ID without sequence number takes `missingSeq`.
+static bool parseStreamId(const std::string& arg, uint64_t missingSeq, StreamID& id) {
+    if (arg == "-") {
+        id = StreamID();
+        return true;
+    }
+    if (arg == "+") {
+        id = StreamID::max();
+        return true;
+    }
+    return StreamID::parse(arg, missingSeq, id);
+}
+
+// [id, [field, value, ...]], or [id, nil] for an entry trimmed away.
+static std::unique_ptr<resp::Array> entryReply(StreamID id, const StreamFields* fields) {
+    auto item = std::make_unique<resp::Array>();
+    item->addElement(std::make_unique<resp::BulkString>(id.toString()));
+    if (fields == nullptr) {
+        item->addElement(std::make_unique<resp::NullArray>());
+        return item;
+    }
+
+    auto pairs = std::make_unique<resp::Array>();
+    for (const auto& [name, value] : *fields) {
+        pairs->addElement(std::make_unique<resp::BulkString>(name));
+        pairs->addElement(std::make_unique<resp::BulkString>(value));
+    }
+    item->addElement(std::move(pairs));
+    return item;
+}
+
+static std::unique_ptr<resp::Array> entriesReply(const std::vector<StreamEntry>& entries) {
+    auto arr = std::make_unique<resp::Array>();
+    for (const StreamEntry& entry : entries) {
+        arr->addElement(entryReply(entry.id, &entry.fields));
+    }
+    return arr;
+}
+
+struct StreamTrim {
+    enum class Strategy { None, MaxLen, MinId } strategy = Strategy::None;
+    bool approx = false;
+    size_t maxLen = 0;
+    StreamID minId;
+    size_t limit = 0;
+};
+
+// Parses `MAXLEN|MINID [=|~] threshold [LIMIT count]` from req[i] on and
+// leaves `i` after it. Returns an error reply, or null.
+static CmdResult parseTrim(const std::vector<std::string>& req, size_t& i, StreamTrim& trim) {
+    trim.strategy = toLower(req[i++]) == "maxlen" ? StreamTrim::Strategy::MaxLen : StreamTrim::Strategy::MinId;
+    if (i < req.size() && (req[i] == "=" || req[i] == "~")) {
+        trim.approx = req[i++] == "~";
+    }
+    if (i >= req.size()) {
+        return std::make_unique<resp::Error>("ERR syntax error");
+    }
+
+    if (trim.strategy == StreamTrim::Strategy::MaxLen) {
+        long long maxLen;
+        if (!parseCount(req[i], maxLen)) {
+            return std::make_unique<resp::Error>("ERR value is not an integer or out of range");
+        }
+        if (maxLen < 0) {
+            return std::make_unique<resp::Error>("ERR The MAXLEN argument must be >= 0.");
+        }
+        trim.maxLen = maxLen;
+    }
+    else if (!StreamID::parse(req[i], 0, trim.minId)) {
+        return std::make_unique<resp::Error>(INVALID_STREAM_ID);
+    }
+    i++;
+
+    if (i + 1 < req.size() && toLower(req[i]) == "limit") {
+        long long limit;
+        if (!trim.approx) {
+            return std::make_unique<resp::Error>("ERR syntax error, LIMIT cannot be used without the special ~ option");
+        }
+        if (!parseCount(req[i + 1], limit) || limit < 0) {
+            return std::make_unique<resp::Error>("ERR The LIMIT argument must be >= 0.");
+        }
+        trim.limit = limit;
+        i += 2;
+    }
+
+    return nullptr;
+}
+
+static size_t applyTrim(Stream& stream, const StreamTrim& trim) {
+    switch (trim.strategy) {
+        case StreamTrim::Strategy::MaxLen:
+            return stream.trimMaxLen(trim.maxLen, trim.approx, trim.limit);
+        case StreamTrim::Strategy::MinId:
+            return stream.trimMinId(trim.minId, trim.approx, trim.limit);
+        default:
+            return 0;
+    }
+}
+
+// Whatever a trim removed, replicas remove with the exact MINID trim up to
+// the first entry left, so approximate trims and MAXLEN agree everywhere.
+static std::vector<std::string> trimEffect(const std::string& key, const Stream& stream) {
+    std::vector<StreamEntry> first = stream.range(StreamID(), StreamID::max(), 1);
+    StreamID minId = first.empty() ? stream.lastId().next() : first[0].id;
+    return {"xtrim", key, "MINID", minId.toString()};
+}
+
+// Waits until some stream changed after `seen` or `deadline` passes, false
+// on timeout. Wakes every STREAM_BLOCK_POLL_MS to give up on a client that
+// went away. Transactions and scripts hold shard locks and never wait. The
+// time waited is left out of the command's latency.
+static bool waitForStreams(uint64_t seen, std::chrono::steady_clock::time_point deadline) {
+    if (Store::getInstance().isLockedAny()) {
+        return false;
+    }
+    Connection* conn = Connection::current();
+    if (conn != nullptr) {
+        conn->flushCorked();
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool changed = false;
+    while (true) {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+            break;
+        }
+        if (Store::waitForStreamChange(seen, std::min(deadline, now + std::chrono::milliseconds(STREAM_BLOCK_POLL_MS)))) {
+            changed = true;
+            break;
+        }
+        if (conn != nullptr && conn->peerClosed()) {
+            break;
+        }
+    }
+    blockedNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    return changed;
+}
+
+static std::chrono::steady_clock::time_point blockDeadline(long long blockMs) {
+    if (blockMs == 0) {
+        return std::chrono::steady_clock::time_point::max();
+    }
+    return std::chrono::steady_clock::now() + std::chrono::milliseconds(blockMs);
+}
+
+// The options of XREAD and XREADGROUP up to STREAMS, and the keys and IDs
+// after it. Returns an error reply, or null.
+struct StreamRead {
+    long long count = 0;
+    long long blockMs = -1;
+    bool noAck = false;
+    std::vector<std::string> keys;
+    std::vector<std::string> ids;
+};
+
+static CmdResult parseStreamRead(const std::vector<std::string>& req, size_t i, bool group, StreamRead& read) {
+    for (; i < req.size(); i++) {
+        std::string option = toLower(req[i]);
+        if (option == "streams") {
+            break;
+        }
+        if (option == "count" && i + 1 < req.size()) {
+            if (!parseCount(req[++i], read.count)) {
+                return std::make_unique<resp::Error>("ERR value is not an integer or out of range");
+            }
+            read.count = std::max(read.count, 0LL);
+        }
+        else if (option == "block" && i + 1 < req.size()) {
+            if (!parseCount(req[++i], read.blockMs)) {
+                return std::make_unique<resp::Error>("ERR timeout is not an integer or out of range");
+            }
+            if (read.blockMs < 0) {
+                return std::make_unique<resp::Error>("ERR timeout is negative");
+            }
+        }
+        else if (option == "noack" && group) {
+            read.noAck = true;
+        }
+        else {
+            return std::make_unique<resp::Error>("ERR syntax error");
+        }
+    }
+
+    size_t args = i < req.size() ? req.size() - i - 1 : 0;
+    if (args == 0 || args % 2 != 0) {
+        return std::make_unique<resp::Error>(std::string("ERR Unbalanced '") + (group ? "xreadgroup" : "xread") +
+                                             "' list of streams: for each stream key an ID or '" +
+                                             (group ? ">" : "$") + "' must be specified.");
+    }
+    read.keys.assign(req.begin() + i + 1, req.begin() + i + 1 + args / 2);
+    read.ids.assign(req.begin() + i + 1 + args / 2, req.end());
+    return nullptr;
+}
+
+CmdResult cmdXadd(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "xadd") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() < 5) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'xadd' command");
+    }
+
+    bool noMkStream = false;
+    StreamTrim trim;
+    size_t i = 2;
+    while (i < req.size()) {
+        std::string option = toLower(req[i]);
+        if (option == "nomkstream") {
+            noMkStream = true;
+            i++;
+        }
+        else if (option == "maxlen" || option == "minid") {
+            if (CmdResult err = parseTrim(req, i, trim)) {
+                return err;
+            }
+        }
+        else {
+            break;
+        }
+    }
+    if (i + 3 > req.size() || (req.size() - i - 1) % 2 != 0) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'xadd' command");
+    }
+
+    // `*` picks the whole ID, `<ms>-*` the sequence number only.
+    const std::string& idArg = req[i];
+    bool autoId = idArg == "*";
+    bool autoSeq = !autoId && idArg.size() > 2 && idArg.compare(idArg.size() - 2, 2, "-*") == 0;
+    StreamID given;
+    if (!autoId && !StreamID::parse(autoSeq ? idArg.substr(0, idArg.size() - 2) : idArg, 0, given)) {
+        return std::make_unique<resp::Error>(INVALID_STREAM_ID);
+    }
+    if (!autoId && !autoSeq && given == StreamID()) {
+        return std::make_unique<resp::Error>("ERR The ID specified in XADD must be greater than 0-0");
+    }
+
+    StreamFields fields;
+    for (size_t f = i + 1; f < req.size(); f += 2) {
+        fields.emplace_back(req[f], req[f + 1]);
+    }
+
+    bool missing = false;
+    bool added = false;
+    StreamID id;
+    std::vector<std::string> trimmed;
+    Store::getInstance().writeStream(req[1], [&](std::unique_ptr<Stream>& stream) {
+        if (stream == nullptr && noMkStream) {
+            missing = true;
+            return false;
+        }
+
+        std::unique_ptr<Stream> created = stream == nullptr ? std::make_unique<Stream>() : nullptr;
+        Stream& target = stream != nullptr ? *stream : *created;
+        StreamID last = target.lastId();
+        if (autoId) {
+            uint64_t ms = unixMs();
+            id = ms > last.ms ? StreamID{ms, 0} : last.next();
+        }
+        else if (autoSeq) {
+            id = given.ms > last.ms ? StreamID{given.ms, 0} : last;
+            if (given.ms == last.ms && last.seq != UINT64_MAX) {
+                id = last.next();
+            }
+        }
+        else {
+            id = given;
+        }
+        if (id <= last) {
+            return false;
+        }
+
+        target.append(id, fields);
+        added = true;
+        if (applyTrim(target, trim) > 0) {
+            trimmed = trimEffect(req[1], target);
+        }
+        if (created != nullptr) {
+            stream = std::move(created);
+        }
+        return true;
+    });
+
+    if (missing) {
+        return std::make_unique<resp::NullString>();
+    }
+    if (!added) {
+        return std::make_unique<resp::Error>("ERR The ID specified in XADD is equal or smaller than the target stream top item");
+    }
+
+    // Replicas get the ID chosen here rather than the `*` to choose one.
+    std::vector<std::string> effect = {"xadd", req[1], id.toString()};
+    effect.insert(effect.end(), req.begin() + i + 1, req.end());
+    replication::WriteScope scope;
+    scope.propagate(effect);
+    if (!trimmed.empty()) {
+        scope.propagate(trimmed);
+    }
+
+    return std::make_unique<resp::BulkString>(id.toString());
+}
+
+CmdResult cmdXtrim(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "xtrim") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() < 4) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'xtrim' command");
+    }
+
+    std::string strategy = toLower(req[2]);
+    if (strategy != "maxlen" && strategy != "minid") {
+        return std::make_unique<resp::Error>("ERR syntax error");
+    }
+    StreamTrim trim;
+    size_t i = 2;
+    if (CmdResult err = parseTrim(req, i, trim)) {
+        return err;
+    }
+    if (i != req.size()) {
+        return std::make_unique<resp::Error>("ERR syntax error");
+    }
+
+    size_t removed = 0;
+    std::vector<std::string> effect;
+    Store::getInstance().writeStream(req[1], [&](std::unique_ptr<Stream>& stream) {
+        if (stream == nullptr) {
+            return false;
+        }
+        removed = applyTrim(*stream, trim);
+        if (removed > 0) {
+            effect = trimEffect(req[1], *stream);
+        }
+        return removed > 0;
+    });
+
+    if (removed > 0) {
+        replication::WriteScope scope;
+        scope.propagate(effect);
+    }
+    return std::make_unique<resp::Integer>(removed);
+}
+
+CmdResult cmdXlen(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "xlen") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() != 2) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'xlen' command");
+    }
+
+    size_t length = 0;
+    Store::getInstance().readStream(req[1], [&length](const Stream* stream) {
+        length = stream != nullptr ? stream->size() : 0;
+    });
+    return std::make_unique<resp::Integer>(length);
+}
+
+CmdResult cmdXrange(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "xrange") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() != 4 && req.size() != 6) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'xrange' command");
+    }
+
+    // A leading `(` excludes the bound itself.
+    bool startOpen = req[2].size() > 1 && req[2][0] == '(';
+    bool endOpen = req[3].size() > 1 && req[3][0] == '(';
+    StreamID start, end;
+    if (!parseStreamId(startOpen ? req[2].substr(1) : req[2], 0, start) ||
+        !parseStreamId(endOpen ? req[3].substr(1) : req[3], UINT64_MAX, end) ||
+        (startOpen && start == StreamID::max()) || (endOpen && end == StreamID())) {
+        return std::make_unique<resp::Error>(INVALID_STREAM_ID);
+    }
+    if (startOpen) {
+        start = start.next();
+    }
+    if (endOpen) {
+        end = end.prev();
+    }
+
+    long long count = 0;
+    if (req.size() == 6) {
+        if (toLower(req[4]) != "count") {
+            return std::make_unique<resp::Error>("ERR syntax error");
+        }
+        if (!parseCount(req[5], count)) {
+            return std::make_unique<resp::Error>("ERR value is not an integer or out of range");
+        }
+        if (count <= 0) {
+            return std::make_unique<resp::Array>();
+        }
+    }
+
+    std::vector<StreamEntry> entries;
+    Store::getInstance().readStream(req[1], [&](const Stream* stream) {
+        if (stream != nullptr) {
+            entries = stream->range(start, end, count);
+        }
+    });
+    return entriesReply(entries);
+}
+
+CmdResult cmdXread(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "xread") {
+        throw RedisServerError("Bad input");
+    }
+
+    StreamRead read;
+    if (CmdResult err = parseStreamRead(req, 1, false, read)) {
+        return err;
+    }
+
+    // `$` reads only what is added from now on.
+    Store& store = Store::getInstance();
+    std::vector<StreamID> after(read.keys.size());
+    for (size_t k = 0; k < read.keys.size(); k++) {
+        if (read.ids[k] == "$") {
+            store.readStream(read.keys[k], [&](const Stream* stream) {
+                after[k] = stream != nullptr ? stream->lastId() : StreamID();
+            });
+        }
+        else if (!parseStreamId(read.ids[k], 0, after[k])) {
+            return std::make_unique<resp::Error>(INVALID_STREAM_ID);
+        }
+    }
+
+    auto deadline = blockDeadline(read.blockMs);
+    while (true) {
+        uint64_t seen = Store::streamChanges();
+        auto reply = std::make_unique<resp::Map>(true);
+        for (size_t k = 0; k < read.keys.size(); k++) {
+            std::vector<StreamEntry> entries;
+            store.readStream(read.keys[k], [&](const Stream* stream) {
+                if (stream != nullptr && after[k] != StreamID::max()) {
+                    entries = stream->range(after[k].next(), StreamID::max(), read.count);
+                }
+            });
+            if (!entries.empty()) {
+                reply->addEntry(read.keys[k], entriesReply(entries));
+            }
+        }
+
+        if (reply->size() > 0) {
+            return reply;
+        }
+        if (read.blockMs < 0 || !waitForStreams(seen, deadline)) {
+            return std::make_unique<resp::NullArray>();
+        }
+    }
+}
+
+CmdResult cmdXgroup(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "xgroup") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() < 2) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'xgroup' command");
+    }
+
+    std::string sub = toLower(req[1]);
+    bool known = ((sub == "create" && (req.size() == 5 || req.size() == 6)) || (sub == "setid" && req.size() == 5) ||
+                  (sub == "destroy" && req.size() == 4) ||
+                  ((sub == "createconsumer" || sub == "delconsumer") && req.size() == 5));
+    if (!known) {
+        return std::make_unique<resp::Error>("ERR unknown subcommand or wrong number of arguments for '" + req[1] + "'");
+    }
+
+    const std::string& key = req[2];
+    const std::string& groupName = req[3];
+    bool mkStream = false;
+    StreamID given;
+    if (sub == "create" || sub == "setid") {
+        if (req.size() == 6) {
+            if (toLower(req[5]) != "mkstream") {
+                return std::make_unique<resp::Error>("ERR syntax error");
+            }
+            mkStream = true;
+        }
+        if (req[4] != "$" && !StreamID::parse(req[4], 0, given)) {
+            return std::make_unique<resp::Error>(INVALID_STREAM_ID);
+        }
+    }
+
+    CmdResult reply;
+    std::vector<std::string> effect = req;
+    bool changed = false;
+    Store::getInstance().writeStream(key, [&](std::unique_ptr<Stream>& stream) {
+        if (stream == nullptr && !mkStream) {
+            reply = std::make_unique<resp::Error>("ERR The XGROUP subcommand requires the key to exist. Note that for "
+                                                  "CREATE you may want to use the MKSTREAM option to create an empty "
+                                                  "stream automatically.");
+            return false;
+        }
+        if (stream == nullptr) {
+            stream = std::make_unique<Stream>();
+            changed = true;
+        }
+
+        // `$` is the last ID now; replicas get it spelled out.
+        StreamID at = req.size() > 4 && req[4] == "$" ? stream->lastId() : given;
+        if (sub == "create") {
+            if (!stream->createGroup(groupName, at)) {
+                reply = std::make_unique<resp::Error>("BUSYGROUP Consumer Group name already exists");
+                return changed;
+            }
+            effect = {"xgroup", "create", key, groupName, at.toString(), "MKSTREAM"};
+            reply = std::make_unique<resp::SimpleString>("OK");
+            changed = true;
+            return true;
+        }
+        if (sub == "destroy") {
+            changed = stream->destroyGroup(groupName);
+            reply = std::make_unique<resp::Integer>(changed);
+            return changed;
+        }
+
+        Stream::Group* group = stream->group(groupName);
+        if (group == nullptr) {
+            reply = std::make_unique<resp::Error>("NOGROUP No such consumer group '" + groupName + "' for key name '" +
+                                                  key + "'");
+            return false;
+        }
+        if (sub == "setid") {
+            group->lastDelivered = at;
+            effect[4] = at.toString();
+            reply = std::make_unique<resp::SimpleString>("OK");
+            changed = true;
+            return true;
+        }
+        if (sub == "createconsumer") {
+            changed = stream->createConsumer(*group, req[4], unixMs());
+            reply = std::make_unique<resp::Integer>(changed);
+            return changed;
+        }
+
+        long pending = stream->deleteConsumer(*group, req[4]);
+        changed = pending >= 0;
+        reply = std::make_unique<resp::Integer>(std::max(pending, 0L));
+        return changed;
+    });
+
+    if (changed) {
+        replication::WriteScope scope;
+        scope.propagate(effect);
+    }
+    return reply;
+}
+
+CmdResult cmdXreadgroup(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "xreadgroup") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() < 7) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'xreadgroup' command");
+    }
+    if (toLower(req[1]) != "group") {
+        return std::make_unique<resp::Error>("ERR syntax error");
+    }
+
+    const std::string& groupName = req[2];
+    const std::string& consumer = req[3];
+    StreamRead read;
+    if (CmdResult err = parseStreamRead(req, 4, true, read)) {
+        return err;
+    }
+
+    // `>` asks for entries never delivered to the group; an ID for the
+    // consumer's own pending entries after it, which never blocks.
+    Store& store = Store::getInstance();
+    std::vector<std::optional<StreamID>> after(read.keys.size());
+    bool onlyNew = true;
+    for (size_t k = 0; k < read.keys.size(); k++) {
+        if (read.ids[k] != ">") {
+            StreamID id;
+            if (!parseStreamId(read.ids[k], 0, id)) {
+                return std::make_unique<resp::Error>(INVALID_STREAM_ID);
+            }
+            after[k] = id;
+            onlyNew = false;
+        }
+
+        bool found = false;
+        store.readStream(read.keys[k], [&](const Stream* stream) {
+            found = stream != nullptr && stream->groups().count(groupName) > 0;
+        });
+        if (!found) {
+            return std::make_unique<resp::Error>("NOGROUP No such key '" + read.keys[k] + "' or consumer group '" +
+                                                 groupName + "' in XREADGROUP with GROUP option");
+        }
+    }
+
+    auto deadline = blockDeadline(read.blockMs);
+    while (true) {
+        uint64_t seen = Store::streamChanges();
+        auto reply = std::make_unique<resp::Map>(true);
+        std::string missing;
+        {
+            // Deliveries move the group forward, so each attempt is a write
+            // of its own; none is open while the client waits.
+            replication::WriteScope scope;
+            for (size_t k = 0; k < read.keys.size() && missing.empty(); k++) {
+                std::unique_ptr<resp::Array> entries;
+                std::vector<std::string> effect;
+                store.writeStream(read.keys[k], [&](std::unique_ptr<Stream>& stream) {
+                    Stream::Group* group = stream != nullptr ? stream->group(groupName) : nullptr;
+                    if (group == nullptr) {
+                        missing = read.keys[k];
+                        return false;
+                    }
+
+                    if (after[k]) {
+                        entries = std::make_unique<resp::Array>();
+                        for (const auto& [id, fields] : stream->history(*group, consumer, *after[k], read.count, unixMs())) {
+                            entries->addElement(entryReply(id, fields ? &*fields : nullptr));
+                        }
+                        return false;
+                    }
+
+                    // Replicas deliver the same entries with a read of the
+                    // same size, or at least learn about the consumer.
+                    bool newConsumer = group->consumers.count(consumer) == 0;
+                    std::vector<StreamEntry> delivered = stream->deliver(*group, consumer, read.count, read.noAck, unixMs());
+                    if (!delivered.empty()) {
+                        effect = {"xreadgroup", "GROUP", groupName, consumer, "COUNT", std::to_string(delivered.size())};
+                        if (read.noAck) {
+                            effect.push_back("NOACK");
+                        }
+                        effect.push_back("STREAMS");
+                        effect.push_back(read.keys[k]);
+                        effect.push_back(">");
+                        entries = entriesReply(delivered);
+                    }
+                    else if (newConsumer) {
+                        effect = {"xgroup", "createconsumer", read.keys[k], groupName, consumer};
+                    }
+                    return !effect.empty();
+                });
+
+                if (!effect.empty()) {
+                    scope.propagate(effect);
+                }
+                if (entries != nullptr) {
+                    reply->addEntry(read.keys[k], std::move(entries));
+                }
+            }
+        }
+
+        if (!missing.empty()) {
+            return std::make_unique<resp::Error>("NOGROUP No such key '" + missing + "' or consumer group '" +
+                                                 groupName + "' in XREADGROUP with GROUP option");
+        }
+        if (reply->size() > 0 || !onlyNew) {
+            return reply;
+        }
+        if (read.blockMs < 0 || !waitForStreams(seen, deadline)) {
+            return std::make_unique<resp::NullArray>();
+        }
+    }
+}
+
+CmdResult cmdXack(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "xack") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() < 4) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'xack' command");
+    }
+
+    std::vector<StreamID> ids(req.size() - 3);
+    for (size_t i = 3; i < req.size(); i++) {
+        if (!StreamID::parse(req[i], 0, ids[i - 3])) {
+            return std::make_unique<resp::Error>(INVALID_STREAM_ID);
+        }
+    }
+
+    size_t acked = 0;
+    Store::getInstance().writeStream(req[1], [&](std::unique_ptr<Stream>& stream) {
+        Stream::Group* group = stream != nullptr ? stream->group(req[2]) : nullptr;
+        if (group != nullptr) {
+            acked = stream->ack(*group, ids);
+        }
+        return acked > 0;
+    });
+    return std::make_unique<resp::Integer>(acked);
+}
+
+// Largest bit offset a bitmap command may address: values stay below 512 MB.
+#define BITMAP_MAX_BITS (uint64_t(1) << 32)
+
+static bool parseBitOffset(const std::string& arg, uint64_t& offset) {
+    long long value;
+    if (!parseCount(arg, value) || value < 0 || uint64_t(value) >= BITMAP_MAX_BITS) {
+        return false;
+    }
+    offset = value;
+    return true;
+}
+
+CmdResult cmdSetbit(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "setbit") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() != 4) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'setbit' command");
+    }
+
+    uint64_t offset;
+    if (!parseBitOffset(req[2], offset)) {
+        return std::make_unique<resp::Error>("ERR bit offset is not an integer or out of range");
+    }
+    if (req[3] != "0" && req[3] != "1") {
+        return std::make_unique<resp::Error>("ERR bit is not an integer or out of range");
+    }
+
+    return std::make_unique<resp::Integer>(Store::getInstance().setBit(req[1], offset, req[3] == "1"));
+}
+
+CmdResult cmdGetbit(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "getbit") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() != 3) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'getbit' command");
+    }
+
+    uint64_t offset;
+    if (!parseBitOffset(req[2], offset)) {
+        return std::make_unique<resp::Error>("ERR bit offset is not an integer or out of range");
+    }
+
+    int bit = 0;
+    Store::getInstance().view(req[1], [&](std::string_view value) {
+        size_t byte = offset >> 3;
+        bit = byte < value.size() && (uint8_t(value[byte]) & (0x80 >> (offset & 7)));
+    });
+    return std::make_unique<resp::Integer>(bit);
+}
+
+// A `start end [BYTE|BIT]` range of BITCOUNT or BITPOS, from req[i] on.
+struct BitRange {
+    bool given = false;
+    bool endGiven = false;
+    bool bits = false;
+    long long start = 0;
+    long long end = -1;
+};
+
+static CmdResult parseBitRange(const std::vector<std::string>& req, size_t i, bool endOptional, BitRange& range) {
+    if (i >= req.size()) {
+        return nullptr;
+    }
+    if (!parseCount(req[i], range.start)) {
+        return std::make_unique<resp::Error>("ERR value is not an integer or out of range");
+    }
+    range.given = true;
+    if (++i >= req.size()) {
+        return endOptional ? nullptr : std::make_unique<resp::Error>("ERR syntax error");
+    }
+    if (!parseCount(req[i], range.end)) {
+        return std::make_unique<resp::Error>("ERR value is not an integer or out of range");
+    }
+    range.endGiven = true;
+    if (++i < req.size()) {
+        std::string unit = toLower(req[i]);
+        if ((unit != "bit" && unit != "byte") || i + 1 != req.size()) {
+            return std::make_unique<resp::Error>("ERR syntax error");
+        }
+        range.bits = unit == "bit";
+    }
+    return nullptr;
+}
+
+// Resolves `range` against a value of `len` bytes into the bits [first,
+// last]: negative indexes count from the end and the range is clipped to
+// the value. False if it is empty.
+static bool resolveBitRange(const BitRange& range, size_t len, uint64_t& first, uint64_t& last) {
+    long long size = range.bits ? len * 8 : len;
+    long long start = range.start < 0 ? size + range.start : range.start;
+    long long end = range.end < 0 ? size + range.end : range.end;
+    start = std::max(start, 0LL);
+    end = std::min(end, size - 1);
+    if (start > end) {
+        return false;
+    }
+
+    first = range.bits ? start : start * 8;
+    last = range.bits ? end : end * 8 + 7;
+    return true;
+}
+
+CmdResult cmdBitcount(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "bitcount") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() < 2) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'bitcount' command");
+    }
+
+    BitRange range;
+    if (CmdResult error = parseBitRange(req, 2, false, range)) {
+        return error;
+    }
+
+    uint64_t count = 0;
+    Store::getInstance().view(req[1], [&](std::string_view value) {
+        uint64_t first, last;
+        if (!resolveBitRange(range, value.size(), first, last)) {
+            count = 0;
+            return;
+        }
+
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(value.data());
+        size_t firstByte = first >> 3;
+        size_t lastByte = last >> 3;
+        count = bits::popcount(data + firstByte, lastByte - firstByte + 1);
+        // Bits of the edge bytes outside a BIT range.
+        count -= __builtin_popcount(data[firstByte] & ~(0xff >> (first & 7)) & 0xff);
+        count -= __builtin_popcount(data[lastByte] & (0xff >> ((last & 7) + 1)));
+    });
+    return std::make_unique<resp::Integer>(count);
+}
+
+CmdResult cmdBitpos(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "bitpos") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() < 3) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'bitpos' command");
+    }
+    if (req[2] != "0" && req[2] != "1") {
+        return std::make_unique<resp::Error>("ERR The bit argument must be 1 or 0.");
+    }
+
+    bool bit = req[2] == "1";
+    BitRange range;
+    if (CmdResult error = parseBitRange(req, 3, true, range)) {
+        return error;
+    }
+
+    long long pos = bit ? -1 : 0;
+    Store::getInstance().view(req[1], [&](std::string_view value) {
+        uint64_t first, last;
+        pos = -1;
+        if (!resolveBitRange(range, value.size(), first, last)) {
+            return;
+        }
+
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(value.data());
+        auto at = [data](uint64_t i) { return ((data[i >> 3] >> (7 - (i & 7))) & 1) != 0; };
+        uint64_t i = first;
+        for (; i <= last && (i & 7) != 0; i++) {
+            if (at(i) == bit) {
+                pos = i;
+                return;
+            }
+        }
+        // Whole bytes are skipped by the kernel; the first one that holds
+        // the bit is searched by the loop below.
+        size_t wholeEnd = (last + 1) >> 3;
+        if ((i >> 3) < wholeEnd) {
+            i = (i >> 3) + bits::findByteNot(data + (i >> 3), wholeEnd - (i >> 3), bit ? 0x00 : 0xff);
+            i <<= 3;
+        }
+        for (; i <= last; i++) {
+            if (at(i) == bit) {
+                pos = i;
+                return;
+            }
+        }
+
+        // Looking for a clear bit past a string of set ones without an end
+        // finds the first bit after the string, as if it were padded.
+        if (!bit && !range.endGiven) {
+            pos = value.size() * 8;
+        }
+    });
+    return std::make_unique<resp::Integer>(pos);
+}
+
+CmdResult cmdBitop(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "bitop") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() < 4) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'bitop' command");
+    }
+
+    std::string name = toLower(req[1]);
+    bool invert = name == "not";
+    bits::Op op = bits::Op::And;
+    if (name == "or") {
+        op = bits::Op::Or;
+    }
+    else if (name == "xor") {
+        op = bits::Op::Xor;
+    }
+    else if (name != "and" && !invert) {
+        return std::make_unique<resp::Error>("ERR syntax error");
+    }
+    if (invert && req.size() != 4) {
+        return std::make_unique<resp::Error>("ERR BITOP NOT must be called with a single source key.");
+    }
+
+    // Sources are folded into the result one at a time, straight from their
+    // records, with the shorter side zero-padded.
+    std::string result;
+    auto fold = [&](size_t i) {
+        bool found = Store::getInstance().view(req[i], [&](std::string_view value) {
+            const uint8_t* src = reinterpret_cast<const uint8_t*>(value.data());
+            if (i == 3) {
+                result.assign(value);
+                return;
+            }
+
+            size_t common = std::min(result.size(), value.size());
+            bits::combine(op, reinterpret_cast<uint8_t*>(result.data()), src, common);
+            if (op == bits::Op::And) {
+                std::fill(result.begin() + common, result.end(), '\0');
+                result.resize(value.size(), '\0');
+            }
+            else if (value.size() > common) {
+                result.append(value.substr(common));
+            }
+        });
+        if (!found && op == bits::Op::And) {
+            std::fill(result.begin(), result.end(), '\0');
+        }
+    };
+
+    std::vector<std::string> keys(req.begin() + 2, req.end());
+    Store& store = Store::getInstance();
+    store.runLocked(keys, false, [&]() {
+        for (size_t i = 3; i < req.size(); i++) {
+            fold(i);
+        }
+        if (invert) {
+            bits::invert(reinterpret_cast<uint8_t*>(result.data()), result.size());
+        }
+
+        if (result.empty()) {
+            store.erase(req[2]);
+        }
+        else {
+            store.set(req[2], result);
+        }
+    });
+    return std::make_unique<resp::Integer>(result.size());
+}
+
+// One GET, SET or INCRBY of BITFIELD, with the OVERFLOW mode in force.
+struct BitfieldOp {
+    enum class Kind { Get, Set, Incrby } kind;
+    enum class Overflow { Wrap, Sat, Fail } overflow;
+    bool isSigned;
+    int width;
+    uint64_t offset;
+    int64_t value;
+};
+
+// `i1`..`i64` or `u1`..`u63`.
+static bool parseBitfieldType(const std::string& arg, bool& isSigned, int& width) {
+    if (arg.size() < 2 || (arg[0] != 'i' && arg[0] != 'u')) {
+        return false;
+    }
+    long long bits;
+    if (!parseCount(arg.substr(1), bits)) {
+        return false;
+    }
+    isSigned = arg[0] == 'i';
+    width = bits;
+    return bits >= 1 && bits <= (isSigned ? 64 : 63);
+}
+
+// A bit offset, or `#n` for the n-th field of the type's width.
+static bool parseBitfieldOffset(const std::string& arg, int width, uint64_t& offset) {
+    bool scaled = !arg.empty() && arg[0] == '#';
+    long long value;
+    if (!parseCount(scaled ? arg.substr(1) : arg, value) || value < 0) {
+        return false;
+    }
+    if (scaled && uint64_t(value) > BITMAP_MAX_BITS / width) {
+        return false;
+    }
+    offset = scaled ? value * width : value;
+    return offset + width <= BITMAP_MAX_BITS;
+}
+
+static CmdResult parseBitfield(const std::vector<std::string>& req, bool readOnly, std::vector<BitfieldOp>& ops) {
+    BitfieldOp::Overflow overflow = BitfieldOp::Overflow::Wrap;
+    for (size_t i = 2; i < req.size();) {
+        std::string name = toLower(req[i]);
+        if (name == "overflow") {
+            if (i + 1 >= req.size()) {
+                return std::make_unique<resp::Error>("ERR syntax error");
+            }
+            std::string mode = toLower(req[i + 1]);
+            if (mode == "wrap") {
+                overflow = BitfieldOp::Overflow::Wrap;
+            }
+            else if (mode == "sat") {
+                overflow = BitfieldOp::Overflow::Sat;
+            }
+            else if (mode == "fail") {
+                overflow = BitfieldOp::Overflow::Fail;
+            }
+            else {
+                return std::make_unique<resp::Error>("ERR Invalid OVERFLOW type specified");
+            }
+            i += 2;
+            continue;
+        }
+
+        BitfieldOp op{BitfieldOp::Kind::Get, overflow, false, 0, 0, 0};
+        if (name == "set") {
+            op.kind = BitfieldOp::Kind::Set;
+        }
+        else if (name == "incrby") {
+            op.kind = BitfieldOp::Kind::Incrby;
+        }
+        else if (name != "get") {
+            return std::make_unique<resp::Error>("ERR syntax error");
+        }
+        size_t args = op.kind == BitfieldOp::Kind::Get ? 2 : 3;
+        if (i + args >= req.size()) {
+            return std::make_unique<resp::Error>("ERR syntax error");
+        }
+        if (readOnly && op.kind != BitfieldOp::Kind::Get) {
+            return std::make_unique<resp::Error>("ERR BITFIELD_RO only supports the GET subcommand");
+        }
+        if (!parseBitfieldType(req[i + 1], op.isSigned, op.width)) {
+            return std::make_unique<resp::Error>("ERR Invalid bitfield type. Use something like i16 u8. "
+                                                 "Note that u64 is not supported but i64 is.");
+        }
+        if (!parseBitfieldOffset(req[i + 2], op.width, op.offset)) {
+            return std::make_unique<resp::Error>("ERR bit offset is not an integer or out of range");
+        }
+        long long value;
+        if (args == 3) {
+            if (!parseCount(req[i + 3], value)) {
+                return std::make_unique<resp::Error>("ERR value is not an integer or out of range");
+            }
+            op.value = value;
+        }
+        ops.push_back(op);
+        i += args + 1;
+    }
+    return nullptr;
+}
+
+// Reads the field of `op` from a value zero-padded past its end.
+static int64_t readBitfield(std::string_view value, const BitfieldOp& op) {
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(value.data());
+    uint64_t raw;
+    if ((op.offset + op.width + 7) / 8 <= value.size()) {
+        raw = bits::getField(data, op.offset, op.width);
+    }
+    else {
+        uint8_t padded[9] = {};
+        size_t firstByte = op.offset >> 3;
+        for (size_t b = firstByte; b < value.size() && b < firstByte + sizeof(padded); b++) {
+            padded[b - firstByte] = data[b];
+        }
+        raw = bits::getField(padded, op.offset & 7, op.width);
+    }
+
+    if (op.isSigned && op.width < 64 && (raw >> (op.width - 1)) & 1) {
+        raw |= ~uint64_t(0) << op.width;
+    }
+    return static_cast<int64_t>(raw);
+}
+
+// Applies the OVERFLOW mode to `wanted`; false if FAIL refuses it.
+static bool fitBitfield(const BitfieldOp& op, __int128 wanted, int64_t& stored) {
+    __int128 min = op.isSigned ? -(__int128(1) << (op.width - 1)) : 0;
+    __int128 max = op.isSigned ? (__int128(1) << (op.width - 1)) - 1 : (__int128(1) << op.width) - 1;
+    if (wanted < min || wanted > max) {
+        if (op.overflow == BitfieldOp::Overflow::Fail) {
+            return false;
+        }
+        if (op.overflow == BitfieldOp::Overflow::Sat) {
+            wanted = wanted < min ? min : max;
+        }
+        else {
+            // Two's complement wrap-around: keep the low bits, sign-extend.
+            uint64_t low = static_cast<uint64_t>(wanted);
+            if (op.width < 64) {
+                low &= (uint64_t(1) << op.width) - 1;
+                if (op.isSigned && (low >> (op.width - 1)) & 1) {
+                    low |= ~uint64_t(0) << op.width;
+                }
+            }
+            wanted = op.isSigned ? __int128(static_cast<int64_t>(low)) : __int128(low);
+        }
+    }
+    stored = static_cast<int64_t>(wanted);
+    return true;
+}
+
+static CmdResult bitfield(const std::vector<std::string>& req, bool readOnly) {
+    std::vector<BitfieldOp> ops;
+    if (CmdResult error = parseBitfield(req, readOnly, ops)) {
+        return error;
+    }
+
+    uint64_t writeEnd = 0;
+    for (const BitfieldOp& op : ops) {
+        if (op.kind != BitfieldOp::Kind::Get) {
+            writeEnd = std::max(writeEnd, (op.offset + op.width + 7) / 8);
+        }
+    }
+
+    std::unique_ptr<resp::Array> arr;
+    auto run = [&](std::string& value) {
+        arr = std::make_unique<resp::Array>();
+        bool changed = false;
+        if (value.size() < writeEnd) {
+            value.resize(writeEnd, '\0');
+            changed = true;
+        }
+        for (const BitfieldOp& op : ops) {
+            int64_t old = readBitfield(value, op);
+            if (op.kind == BitfieldOp::Kind::Get) {
+                arr->addElement(std::make_unique<resp::Integer>(old));
+                continue;
+            }
+
+            __int128 wanted = op.kind == BitfieldOp::Kind::Set ? __int128(op.value) : __int128(old) + op.value;
+            int64_t stored;
+            if (!fitBitfield(op, wanted, stored)) {
+                arr->addElement(std::make_unique<resp::NullString>());
+                continue;
+            }
+            bits::setField(reinterpret_cast<uint8_t*>(value.data()), op.offset, op.width, static_cast<uint64_t>(stored));
+            arr->addElement(std::make_unique<resp::Integer>(op.kind == BitfieldOp::Kind::Set ? old : stored));
+            changed = true;
+        }
+        return changed;
+    };
+
+    if (writeEnd > 0) {
+        Store::getInstance().update(req[1], run);
+    }
+    else {
+        // Reads only: the fields are decoded from the record itself.
+        std::string empty;
+        bool found = Store::getInstance().view(req[1], [&](std::string_view value) {
+            arr = std::make_unique<resp::Array>();
+            for (const BitfieldOp& op : ops) {
+                arr->addElement(std::make_unique<resp::Integer>(readBitfield(value, op)));
+            }
+        });
+        if (!found) {
+            run(empty);
+        }
+    }
+    return arr;
+}
+
+CmdResult cmdBitfield(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "bitfield") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() < 2) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'bitfield' command");
+    }
+    return bitfield(req, false);
+}
+
+CmdResult cmdBitfieldRo(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "bitfield_ro") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() < 2) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'bitfield_ro' command");
+    }
+    return bitfield(req, true);
+}
+
+#define HLL_WRONG_TYPE "WRONGTYPE Key is not a valid HyperLogLog string value."
+#define HLL_CORRUPT "INVALIDOBJ Corrupted HLL object detected"
+
+CmdResult cmdPfadd(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "pfadd") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() < 2) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'pfadd' command");
+    }
+
+    std::vector<std::string> elements(req.begin() + 2, req.end());
+    const char* error = nullptr;
+    bool updated = false;
+    Store::getInstance().update(req[1], [&](std::string& value) {
+        if (value.empty()) {
+            value = hll::create();
+            updated = true;
+        }
+        else if (!hll::isHll(value)) {
+            error = HLL_WRONG_TYPE;
+            return false;
+        }
+
+        try {
+            updated |= hll::add(value, elements, config::GlobalConfig.hllSparseMaxBytes);
+        } catch (const std::invalid_argument& e) {
+            error = HLL_CORRUPT;
+            return false;
+        }
+        return updated;
+    });
+
+    if (error != nullptr) {
+        return std::make_unique<resp::Error>(error);
+    }
+    return std::make_unique<resp::Integer>(updated ? 1 : 0);
+}
+
+// Merges the sketches at `keys` into `registers`; returns an error string,
+// or null. Missing keys count as empty sketches.
+static const char* mergeSketches(const std::vector<std::string>& keys, uint8_t* registers) {
+    const char* error = nullptr;
+    for (const std::string& key : keys) {
+        Store::getInstance().view(key, [&](std::string_view value) {
+            if (!hll::isHll(value)) {
+                error = HLL_WRONG_TYPE;
+                return;
+            }
+            try {
+                hll::merge(value, registers);
+            } catch (const std::invalid_argument& e) {
+                error = HLL_CORRUPT;
+            }
+        });
+        if (error != nullptr) {
+            return error;
+        }
+    }
+    return nullptr;
+}
+
+CmdResult cmdPfcount(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "pfcount") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() < 2) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'pfcount' command");
+    }
+
+    Store& store = Store::getInstance();
+    const char* error = nullptr;
+    if (req.size() > 2) {
+        // The union of several sketches is estimated on the fly, uncached.
+        std::vector<std::string> keys(req.begin() + 1, req.end());
+        uint8_t registers[HLL_REGISTERS] = {};
+        store.runLocked(keys, false, [&]() {
+            error = mergeSketches(keys, registers);
+        });
+        if (error != nullptr) {
+            return std::make_unique<resp::Error>(error);
+        }
+        return std::make_unique<resp::Integer>(hll::estimate(registers));
+    }
+
+    // A fresh cached cardinality is read without locking; a stale one is
+    // recomputed and stored back under the write lock.
+    std::optional<uint64_t> card;
+    store.view(req[1], [&](std::string_view value) {
+        if (!hll::isHll(value)) {
+            error = HLL_WRONG_TYPE;
+            return;
+        }
+        card = hll::cached(value);
+    });
+    if (error == nullptr && !card) {
+        store.update(req[1], [&](std::string& value) {
+            if (value.empty() || !hll::isHll(value)) {
+                error = value.empty() ? nullptr : HLL_WRONG_TYPE;
+                return false;
+            }
+            try {
+                card = hll::count(value);
+            } catch (const std::invalid_argument& e) {
+                error = HLL_CORRUPT;
+                return false;
+            }
+            return true;
+        });
+    }
+
+    if (error != nullptr) {
+        return std::make_unique<resp::Error>(error);
+    }
+    return std::make_unique<resp::Integer>(card.value_or(0));
+}
+
+CmdResult cmdPfmerge(const std::vector<std::string>& req) {
+    if (req.size() == 0 || req[0] != "pfmerge") {
+        throw RedisServerError("Bad input");
+    }
+    if (req.size() < 2) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for 'pfmerge' command");
+    }
+
+    // The destination's own registers are part of the union.
+    std::vector<std::string> keys(req.begin() + 1, req.end());
+    uint8_t registers[HLL_REGISTERS] = {};
+    const char* error = nullptr;
+    Store& store = Store::getInstance();
+    store.runLocked(keys, false, [&]() {
+        error = mergeSketches(keys, registers);
+        if (error != nullptr) {
+            return;
+        }
+
+        store.update(req[1], [&](std::string& value) {
+            value = hll::fromRegisters(registers, config::GlobalConfig.hllSparseMaxBytes);
+            return true;
+        });
+    });
+
+    if (error != nullptr) {
+        return std::make_unique<resp::Error>(error);
+    }
+    return std::make_unique<resp::SimpleString>("OK");
 }
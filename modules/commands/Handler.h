@@ -5,17 +5,66 @@
 #include "core/Common.h"
 #include "protocol/Response.h"
 
+#define KEYS_BATCH_SIZE 1024
+// How often a client blocked on streams checks that it is still connected.
+#define STREAM_BLOCK_POLL_MS 100
+// List elements MEMORY USAGE sizes the list from, unless told otherwise.
+#define MEMORY_USAGE_SAMPLES 5
+// Keys HOTKEYS returns unless told otherwise.
+#define HOTKEYS_DEFAULT_COUNT 10
+
 using CmdResult = std::unique_ptr<resp::Response>;
 using CmdFunc = std::function<CmdResult(const std::vector<std::string>&)>;
 
+// Command flags. Write commands are rejected on replicas and fed to the
+// replication stream on a primary. Only CMD_PUBSUB commands are accepted
+// from a connection in subscribed mode. Between MULTI and EXEC every
+// command except the CMD_TRANSACTION ones is queued instead of executed.
+// CMD_NOSCRIPT commands cannot be called from scripts. CMD_EFFECTS write
+// commands propagate the writes they perform instead of themselves.
+// CMD_KEYNUM commands take their key count from the argument before the
+// first key, as EVAL does. CMD_STREAMS commands take as keys the first half
+// of the arguments after STREAMS, looked for from the first key position on.
+// CMD_BLOCKING commands may wait for other clients or servers; blocking
+// writes open their own write scopes, around each write, instead of one for
+// the call.
+// CMD_NOTOUCH commands inspect keys without counting as accesses to them
+// for hot-key detection.
+#define CMD_WRITE (1 << 0)
+#define CMD_PUBSUB (1 << 1)
+#define CMD_TRANSACTION (1 << 2)
+#define CMD_NOSCRIPT (1 << 3)
+#define CMD_EFFECTS (1 << 4)
+#define CMD_KEYNUM (1 << 5)
+#define CMD_STREAMS (1 << 6)
+#define CMD_BLOCKING (1 << 7)
+#define CMD_NOTOUCH (1 << 8)
+
+// Key positions in the request, as in Redis' command table: the first and
+// last key argument (negative counts from the end) and the step between
+// keys. Keyless commands leave them at 0. Cluster mode routes on these.
+struct Command {
+    CmdFunc func;
+    int flags;
+    int firstKey = 0;
+    int lastKey = 0;
+    int keyStep = 0;
+    // Position in the command table, which indexes its statistics.
+    int id = -1;
+};
+
 #define CMD(NAME) CmdResult cmd##NAME(const std::vector<std::string>& req);
 
 CMD(Ping)
 CMD(Echo)
 CMD(Set)
 CMD(Get)
+CMD(Mget)
+CMD(Mset)
+CMD(Msetnx)
 CMD(Exists)
 CMD(Del)
+CMD(Unlink)
 CMD(Incr)
 CMD(Decr)
 CMD(Lpush)
@@ -23,7 +72,68 @@ CMD(Rpush)
 CMD(Lrange)
 CMD(Save)
 CMD(Config)
+CMD(Memory)
+CMD(Flushall)
+CMD(Flushdb)
+CMD(Scan)
+CMD(Keys)
+CMD(Replicaof)
+CMD(Replconf)
+CMD(Role)
+CMD(Cluster)
+CMD(Asking)
+CMD(Dump)
+CMD(Restore)
+CMD(Migrate)
+CMD(Subscribe)
+CMD(Unsubscribe)
+CMD(Psubscribe)
+CMD(Punsubscribe)
+CMD(Publish)
+CMD(Pubsub)
+CMD(Multi)
+CMD(Exec)
+CMD(Discard)
+CMD(Watch)
+CMD(Unwatch)
+CMD(Eval)
+CMD(Evalsha)
+CMD(EvalRo)
+CMD(EvalshaRo)
+CMD(Script)
+CMD(Hello)
+CMD(Client)
+CMD(Info)
+CMD(Slowlog)
+CMD(Latency)
+CMD(Xadd)
+CMD(Xrange)
+CMD(Xlen)
+CMD(Xread)
+CMD(Xgroup)
+CMD(Xreadgroup)
+CMD(Xack)
+CMD(Xtrim)
+CMD(Setbit)
+CMD(Getbit)
+CMD(Bitcount)
+CMD(Bitpos)
+CMD(Bitop)
+CMD(Bitfield)
+CMD(BitfieldRo)
+CMD(Pfadd)
+CMD(Pfcount)
+CMD(Pfmerge)
+CMD(Object)
+CMD(Hotkeys)
 
 CmdFunc getHandler(const std::string& cmdName);
+const Command* lookupCommand(const std::string& cmdName);
+std::vector<std::string> commandKeys(const Command& cmd, const std::vector<std::string>& req);
+// Counts the keys of the call toward hot-key detection when it is sampled.
+void sampleKeys(const Command& cmd, const std::vector<std::string>& req);
+// Time the calling thread spent blocked on streams since the last call, in
+// nanoseconds. Blocking is not work, so command latency leaves it out.
+uint64_t takeBlockedNanos();
 
 #endif // HANDLER_H
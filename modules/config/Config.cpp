@@ -29,6 +29,116 @@ bool config::load() {
                     config::GlobalConfig.port = json["port"];
                 }
 
+                if (json.find("active_defrag") != json.end()) {
+                    config::GlobalConfig.activeDefrag = json["active_defrag"];
+                }
+                if (json.find("active_defrag_threshold") != json.end()) {
+                    config::GlobalConfig.activeDefragThreshold = json["active_defrag_threshold"];
+                }
+                if (json.find("active_defrag_cycle_us") != json.end()) {
+                    config::GlobalConfig.activeDefragCycleUs = json["active_defrag_cycle_us"];
+                }
+                if (json.find("lazyfree_threshold") != json.end()) {
+                    config::GlobalConfig.lazyfreeThreshold = json["lazyfree_threshold"];
+                }
+                if (json.find("lazyfree_threshold_bytes") != json.end()) {
+                    config::GlobalConfig.lazyfreeThresholdBytes = json["lazyfree_threshold_bytes"];
+                }
+                if (json.find("repl_backlog_size") != json.end()) {
+                    config::GlobalConfig.replBacklogSize = json["repl_backlog_size"];
+                }
+                if (json.find("repl_backlog_ttl") != json.end()) {
+                    config::GlobalConfig.replBacklogTtl = json["repl_backlog_ttl"];
+                }
+                if (json.find("repl_diskless_sync") != json.end()) {
+                    config::GlobalConfig.replDisklessSync = json["repl_diskless_sync"];
+                }
+                if (json.find("repl_diskless_sync_delay") != json.end()) {
+                    config::GlobalConfig.replDisklessSyncDelay = json["repl_diskless_sync_delay"];
+                }
+                if (json.find("repl_diskless_sync_max_bytes") != json.end()) {
+                    config::GlobalConfig.replDisklessSyncMaxBytes = json["repl_diskless_sync_max_bytes"];
+                }
+                if (json.find("repl_diskless_load") != json.end()) {
+                    config::GlobalConfig.replDisklessLoad = json["repl_diskless_load"];
+                }
+                if (json.find("cluster_enabled") != json.end()) {
+                    config::GlobalConfig.clusterEnabled = json["cluster_enabled"];
+                }
+                if (json.find("cluster_announce_ip") != json.end()) {
+                    config::GlobalConfig.clusterAnnounceIp = json["cluster_announce_ip"];
+                }
+                if (json.find("client_output_buffer_limit") != json.end()) {
+                    // {"normal": [hard, soft, seconds], "replica": [...], "pubsub": [...]}
+                    auto& limits = json["client_output_buffer_limit"];
+                    std::pair<const char*, OutputBufferLimit*> classes[] = {
+                        {"normal", &config::GlobalConfig.normalOutputLimit},
+                        {"replica", &config::GlobalConfig.replicaOutputLimit},
+                        {"pubsub", &config::GlobalConfig.pubsubOutputLimit}};
+                    for (auto& [name, limit] : classes) {
+                        if (limits.find(name) != limits.end()) {
+                            *limit = {limits[name][0], limits[name][1], limits[name][2]};
+                        }
+                    }
+                }
+                if (json.find("client_query_buffer_limit") != json.end()) {
+                    config::GlobalConfig.clientQueryBufferLimit = json["client_query_buffer_limit"];
+                }
+                if (json.find("lua_time_limit") != json.end()) {
+                    config::GlobalConfig.luaTimeLimit = json["lua_time_limit"];
+                }
+                if (json.find("slowlog_log_slower_than") != json.end()) {
+                    config::GlobalConfig.slowlogLogSlowerThan = json["slowlog_log_slower_than"];
+                }
+                if (json.find("slowlog_max_len") != json.end()) {
+                    config::GlobalConfig.slowlogMaxLen = json["slowlog_max_len"];
+                }
+                if (json.find("latency_monitor_threshold") != json.end()) {
+                    config::GlobalConfig.latencyMonitorThreshold = json["latency_monitor_threshold"];
+                }
+                if (json.find("io_engine") != json.end()) {
+                    config::GlobalConfig.ioEngine = json["io_engine"];
+                }
+                if (json.find("hll_sparse_max_bytes") != json.end()) {
+                    config::GlobalConfig.hllSparseMaxBytes = json["hll_sparse_max_bytes"];
+                }
+                if (json.find("tiered_storage") != json.end()) {
+                    config::GlobalConfig.tieredStorage = json["tiered_storage"];
+                }
+                if (json.find("tiered_dir") != json.end()) {
+                    config::GlobalConfig.tieredDir = json["tiered_dir"];
+                }
+                // The spill files are opened lazily by the maintenance
+                // thread, so a missing directory is created, or reported,
+                // here rather than failing silently later.
+                if (config::GlobalConfig.tieredStorage) {
+                    std::error_code ec;
+                    fs::create_directories(config::GlobalConfig.tieredDir, ec);
+                    if (ec) {
+                        std::cout << "Unable to create tiered_dir " << config::GlobalConfig.tieredDir << ": "
+                                  << ec.message() << std::endl;
+                        return false;
+                    }
+                }
+                if (json.find("tiered_idle_seconds") != json.end()) {
+                    config::GlobalConfig.tieredIdleSeconds = json["tiered_idle_seconds"];
+                }
+                if (json.find("tiered_compact_percent") != json.end()) {
+                    config::GlobalConfig.tieredCompactPercent = json["tiered_compact_percent"];
+                }
+                if (json.find("compression") != json.end()) {
+                    config::GlobalConfig.compression = json["compression"];
+                }
+                if (json.find("compression_min_bytes") != json.end()) {
+                    config::GlobalConfig.compressionMinBytes = json["compression_min_bytes"];
+                }
+                if (json.find("compression_dict_bytes") != json.end()) {
+                    config::GlobalConfig.compressionDictBytes = json["compression_dict_bytes"];
+                }
+                if (json.find("hotkeys_sample_rate") != json.end()) {
+                    config::GlobalConfig.hotkeysSampleRate = json["hotkeys_sample_rate"];
+                }
+
                 return true;
             } 
             else {
@@ -39,3 +149,46 @@ bool config::load() {
 
     return false;
 }
+
+std::vector<std::pair<std::string, std::string>> config::parameters() {
+    const Settings& c = GlobalConfig;
+    auto flag = [](bool on) { return std::string(on ? "yes" : "no"); };
+    auto limit = [](const OutputBufferLimit& l) {
+        return std::to_string(l.hard) + " " + std::to_string(l.soft) + " " + std::to_string(l.softSeconds);
+    };
+
+    return {
+        {"port", std::to_string(c.port)},
+        {"snapshot_period", std::to_string(c.snapshotPeriod)},
+        {"active_defrag", flag(c.activeDefrag)},
+        {"active_defrag_threshold", std::to_string(c.activeDefragThreshold)},
+        {"active_defrag_cycle_us", std::to_string(c.activeDefragCycleUs)},
+        {"lazyfree_threshold", std::to_string(c.lazyfreeThreshold)},
+        {"lazyfree_threshold_bytes", std::to_string(c.lazyfreeThresholdBytes)},
+        {"repl_backlog_size", std::to_string(c.replBacklogSize)},
+        {"repl_backlog_ttl", std::to_string(c.replBacklogTtl)},
+        {"repl_diskless_sync", flag(c.replDisklessSync)},
+        {"repl_diskless_sync_delay", std::to_string(c.replDisklessSyncDelay)},
+        {"repl_diskless_sync_max_bytes", std::to_string(c.replDisklessSyncMaxBytes)},
+        {"repl_diskless_load", flag(c.replDisklessLoad)},
+        {"cluster_enabled", flag(c.clusterEnabled)},
+        {"cluster_announce_ip", c.clusterAnnounceIp},
+        {"client_output_buffer_limit",
+         "normal " + limit(c.normalOutputLimit) + " replica " + limit(c.replicaOutputLimit) + " pubsub " + limit(c.pubsubOutputLimit)},
+        {"client_query_buffer_limit", std::to_string(c.clientQueryBufferLimit)},
+        {"lua_time_limit", std::to_string(c.luaTimeLimit)},
+        {"slowlog_log_slower_than", std::to_string(c.slowlogLogSlowerThan)},
+        {"slowlog_max_len", std::to_string(c.slowlogMaxLen)},
+        {"latency_monitor_threshold", std::to_string(c.latencyMonitorThreshold)},
+        {"io_engine", c.ioEngine},
+        {"hll_sparse_max_bytes", std::to_string(c.hllSparseMaxBytes)},
+        {"tiered_storage", flag(c.tieredStorage)},
+        {"tiered_dir", c.tieredDir},
+        {"tiered_idle_seconds", std::to_string(c.tieredIdleSeconds)},
+        {"tiered_compact_percent", std::to_string(c.tieredCompactPercent)},
+        {"compression", flag(c.compression)},
+        {"compression_min_bytes", std::to_string(c.compressionMinBytes)},
+        {"compression_dict_bytes", std::to_string(c.compressionDictBytes)},
+        {"hotkeys_sample_rate", std::to_string(c.hotkeysSampleRate)},
+    };
+}
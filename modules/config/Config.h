@@ -6,14 +6,59 @@
 #define CONFIG_FILE "config.json"
 
 namespace config {
+    // Pending output, in bytes, at which a client is disconnected: at once
+    // above `hard`, or after `softSeconds` above `soft`. 0 disables a limit.
+    struct OutputBufferLimit {
+        long hard;
+        long soft;
+        int softSeconds;
+    };
+
     struct Settings {
         int port;
         std::string statefile;
         int snapshotPeriod;
+
+        // Optional settings; defaults apply when absent from config.json.
+        bool activeDefrag = false;
+        int activeDefragThreshold = 10;     // percent of allocator overhead
+        int activeDefragCycleUs = 1000;     // time slice per 100ms cycle
+        int lazyfreeThreshold = 64;         // elements before a free is deferred
+        int lazyfreeThresholdBytes = 1048576;
+        int replBacklogSize = 1048576;      // bytes of write stream kept for partial resync
+        int replBacklogTtl = 3600;          // seconds without replicas before the backlog is freed, 0 for never
+        bool replDisklessSync = false;
+        int replDisklessSyncDelay = 5;      // seconds to wait for more replicas
+        long replDisklessSyncMaxBytes = 1073741824; // dataset size above which full syncs use a file, 0 for no limit
+        bool replDisklessLoad = false;
+        bool clusterEnabled = false;
+        std::string clusterAnnounceIp = "127.0.0.1";
+        OutputBufferLimit normalOutputLimit{0, 0, 0};
+        OutputBufferLimit replicaOutputLimit{268435456, 67108864, 60};
+        OutputBufferLimit pubsubOutputLimit{33554432, 8388608, 60};
+        long clientQueryBufferLimit = 1073741824;   // largest request accepted, in bytes
+        int luaTimeLimit = 5000;            // ms before a script that has not written is aborted
+        long slowlogLogSlowerThan = 10000;  // us; negative disables the slow log
+        int slowlogMaxLen = 128;
+        int latencyMonitorThreshold = 10;   // ms; 0 disables the latency monitor
+        std::string ioEngine = "epoll";     // "epoll" or "io_uring" for sockets and snapshot writes
+        int hllSparseMaxBytes = 3000;       // register bytes before a HyperLogLog turns dense
+        bool tieredStorage = false;         // spill idle string values to local disk
+        std::string tieredDir = ".";        // directory of the spill files
+        int tieredIdleSeconds = 3600;       // idle time before a value is spilled
+        int tieredCompactPercent = 50;      // dead share of a spill file that triggers compaction
+        bool compression = false;           // store large string values LZ4-compressed
+        int compressionMinBytes = 256;      // smallest value compressed
+        int compressionDictBytes = 32768;   // size of the trained dictionary, 0 for none
+        int hotkeysSampleRate = 16;         // commands per one counted for hot keys, 0 to stop counting
     };
 
     extern Settings GlobalConfig;
     bool load();
+
+    // Every setting under its config.json name, with its current value as
+    // text, for CONFIG GET.
+    std::vector<std::pair<std::string, std::string>> parameters();
 }
 
 #endif // CONFIG_H
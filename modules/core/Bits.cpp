@@ -0,0 +1,314 @@
+#include "Bits.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BITS_X86 1
+#endif
+
+namespace bits {
+
+namespace {
+
+uint64_t load64(const uint8_t* p) {
+    uint64_t word;
+    std::memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+void store64(uint8_t* p, uint64_t word) {
+    std::memcpy(p, &word, sizeof(word));
+}
+
+uint64_t popcountWord(uint64_t x) {
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (x * 0x0101010101010101ULL) >> 56;
+}
+
+template <Op op>
+uint64_t apply(uint64_t a, uint64_t b) {
+    return op == Op::And ? a & b : op == Op::Or ? a | b : a ^ b;
+}
+
+// Portable kernels, 64 bits at a time.
+
+uint64_t popcountScalar(const uint8_t* data, size_t len) {
+    uint64_t count = 0;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        count += popcountWord(load64(data + i));
+    }
+    for (; i < len; i++) {
+        count += popcountWord(data[i]);
+    }
+    return count;
+}
+
+template <Op op>
+void combineScalar(uint8_t* dst, const uint8_t* src, size_t len) {
+    size_t i = 0;
+    if constexpr (op == Op::Max) {
+        for (; i < len; i++) {
+            dst[i] = dst[i] > src[i] ? dst[i] : src[i];
+        }
+        return;
+    }
+    for (; i + 8 <= len; i += 8) {
+        store64(dst + i, apply<op>(load64(dst + i), load64(src + i)));
+    }
+    for (; i < len; i++) {
+        dst[i] = apply<op>(dst[i], src[i]);
+    }
+}
+
+void combineScalar(Op op, uint8_t* dst, const uint8_t* src, size_t len) {
+    switch (op) {
+        case Op::And: return combineScalar<Op::And>(dst, src, len);
+        case Op::Or: return combineScalar<Op::Or>(dst, src, len);
+        case Op::Xor: return combineScalar<Op::Xor>(dst, src, len);
+        case Op::Max: return combineScalar<Op::Max>(dst, src, len);
+    }
+}
+
+void invertScalar(uint8_t* data, size_t len) {
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        store64(data + i, ~load64(data + i));
+    }
+    for (; i < len; i++) {
+        data[i] = ~data[i];
+    }
+}
+
+size_t findByteNotScalar(const uint8_t* data, size_t len, uint8_t skip) {
+    uint64_t pattern = skip * 0x0101010101010101ULL;
+    size_t i = 0;
+    while (i + 8 <= len && load64(data + i) == pattern) {
+        i += 8;
+    }
+    while (i < len && data[i] == skip) {
+        i++;
+    }
+    return i;
+}
+
+void unpack6Scalar(const uint8_t* packed, uint8_t* out, size_t count) {
+    for (size_t n = 0; n < count; n += 4, packed += 3) {
+        uint32_t word = packed[0] | (packed[1] << 8) | (packed[2] << 16);
+        uint32_t fields = (word & 0x3f) | ((word << 2) & 0x3f00) | ((word << 4) & 0x3f0000) | ((word << 6) & 0x3f000000);
+        std::memcpy(out + n, &fields, sizeof(fields));
+    }
+}
+
+#ifdef BITS_X86
+
+__attribute__((target("popcnt")))
+uint64_t popcountPopcnt(const uint8_t* data, size_t len) {
+    // Independent sums keep several POPCNTs in flight.
+    uint64_t c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        c0 += __builtin_popcountll(load64(data + i));
+        c1 += __builtin_popcountll(load64(data + i + 8));
+        c2 += __builtin_popcountll(load64(data + i + 16));
+        c3 += __builtin_popcountll(load64(data + i + 24));
+    }
+    for (; i + 8 <= len; i += 8) {
+        c0 += __builtin_popcountll(load64(data + i));
+    }
+    for (; i < len; i++) {
+        c0 += __builtin_popcount(data[i]);
+    }
+    return c0 + c1 + c2 + c3;
+}
+
+// Counts each nibble through a 16-entry table held in a register (one
+// VPSHUFB per half byte), sums the byte counts and folds them into 64-bit
+// lanes with VPSADBW before they can overflow.
+__attribute__((target("avx2,popcnt")))
+uint64_t popcountAvx2(const uint8_t* data, size_t len) {
+    const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                           0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i total = zero;
+    size_t i = 0;
+    while (i + 32 <= len) {
+        // A byte counts up to 8 per vector: 31 vectors stay below 256.
+        __m256i bytes = zero;
+        for (int n = 0; n < 31 && i + 32 <= len; n++, i += 32) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            __m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(v, nibble));
+            __m256i hi = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+            bytes = _mm256_add_epi8(bytes, _mm256_add_epi8(lo, hi));
+        }
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(bytes, zero));
+    }
+
+    uint64_t count = _mm256_extract_epi64(total, 0) + _mm256_extract_epi64(total, 1) +
+                     _mm256_extract_epi64(total, 2) + _mm256_extract_epi64(total, 3);
+    for (; i + 8 <= len; i += 8) {
+        count += __builtin_popcountll(load64(data + i));
+    }
+    for (; i < len; i++) {
+        count += __builtin_popcount(data[i]);
+    }
+    return count;
+}
+
+template <Op op>
+__attribute__((target("avx2")))
+void combineAvx2(uint8_t* dst, const uint8_t* src, size_t len) {
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i r = op == Op::And ? _mm256_and_si256(a, b)
+                  : op == Op::Or  ? _mm256_or_si256(a, b)
+                  : op == Op::Xor ? _mm256_xor_si256(a, b)
+                                  : _mm256_max_epu8(a, b);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), r);
+    }
+    combineScalar<op>(dst + i, src + i, len - i);
+}
+
+void combineAvx2(Op op, uint8_t* dst, const uint8_t* src, size_t len) {
+    switch (op) {
+        case Op::And: return combineAvx2<Op::And>(dst, src, len);
+        case Op::Or: return combineAvx2<Op::Or>(dst, src, len);
+        case Op::Xor: return combineAvx2<Op::Xor>(dst, src, len);
+        case Op::Max: return combineAvx2<Op::Max>(dst, src, len);
+    }
+}
+
+__attribute__((target("avx2")))
+void invertAvx2(uint8_t* data, size_t len) {
+    const __m256i ones = _mm256_set1_epi8(-1);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(data + i), _mm256_xor_si256(v, ones));
+    }
+    invertScalar(data + i, len - i);
+}
+
+__attribute__((target("avx2")))
+size_t findByteNotAvx2(const uint8_t* data, size_t len, uint8_t skip) {
+    const __m256i pattern = _mm256_set1_epi8(static_cast<char>(skip));
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        uint32_t differ = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, pattern)));
+        if (differ != 0) {
+            return i + __builtin_ctz(differ);
+        }
+    }
+    return i + findByteNotScalar(data + i, len - i, skip);
+}
+
+// 32 fields per step: each 128-bit half gathers 12 packed bytes into four
+// 32-bit words of three bytes (VPSHUFB), and each word is then spread into
+// four bytes with shifts and masks.
+__attribute__((target("avx2")))
+void unpack6Avx2(const uint8_t* packed, uint8_t* out, size_t count) {
+    const __m256i gather = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                            0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m256i mask0 = _mm256_set1_epi32(0x3f);
+    const __m256i mask1 = _mm256_set1_epi32(0x3f00);
+    const __m256i mask2 = _mm256_set1_epi32(0x3f0000);
+    const __m256i mask3 = _mm256_set1_epi32(0x3f000000);
+    size_t n = 0;
+    // The high half loads 16 bytes from offset 12, so the last step is
+    // left to the scalar loop to stay inside the input.
+    for (; n + 32 < count; n += 32, packed += 24) {
+        __m256i bytes = _mm256_loadu2_m128i(reinterpret_cast<const __m128i*>(packed + 12),
+                                            reinterpret_cast<const __m128i*>(packed));
+        __m256i words = _mm256_shuffle_epi8(bytes, gather);
+        __m256i fields = _mm256_or_si256(
+            _mm256_or_si256(_mm256_and_si256(words, mask0), _mm256_and_si256(_mm256_slli_epi32(words, 2), mask1)),
+            _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi32(words, 4), mask2), _mm256_and_si256(_mm256_slli_epi32(words, 6), mask3)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + n), fields);
+    }
+    unpack6Scalar(packed, out + n, count - n);
+}
+
+#endif // BITS_X86
+
+struct Kernels {
+    const char* name;
+    uint64_t (*popcount)(const uint8_t*, size_t);
+    void (*combine)(Op, uint8_t*, const uint8_t*, size_t);
+    void (*invert)(uint8_t*, size_t);
+    size_t (*findByteNot)(const uint8_t*, size_t, uint8_t);
+    void (*unpack6)(const uint8_t*, uint8_t*, size_t);
+};
+
+Kernels pick() {
+#ifdef BITS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        return {"avx2", popcountAvx2, combineAvx2, invertAvx2, findByteNotAvx2, unpack6Avx2};
+    }
+    if (__builtin_cpu_supports("popcnt")) {
+        return {"popcnt", popcountPopcnt, combineScalar, invertScalar, findByteNotScalar, unpack6Scalar};
+    }
+#endif
+    return {"scalar", popcountScalar, combineScalar, invertScalar, findByteNotScalar, unpack6Scalar};
+}
+
+const Kernels& active() {
+    static const Kernels chosen = pick();
+    return chosen;
+}
+
+} // namespace
+
+uint64_t popcount(const uint8_t* data, size_t len) {
+    return active().popcount(data, len);
+}
+
+void combine(Op op, uint8_t* dst, const uint8_t* src, size_t len) {
+    active().combine(op, dst, src, len);
+}
+
+void invert(uint8_t* data, size_t len) {
+    active().invert(data, len);
+}
+
+size_t findByteNot(const uint8_t* data, size_t len, uint8_t skip) {
+    return active().findByteNot(data, len, skip);
+}
+
+void unpack6(const uint8_t* packed, uint8_t* out, size_t count) {
+    active().unpack6(packed, out, count);
+}
+
+uint64_t getField(const uint8_t* data, uint64_t offset, int width) {
+    uint64_t value = 0;
+    for (int i = 0; i < width; i++) {
+        uint64_t bit = offset + i;
+        value = (value << 1) | ((data[bit >> 3] >> (7 - (bit & 7))) & 1);
+    }
+    return value;
+}
+
+void setField(uint8_t* data, uint64_t offset, int width, uint64_t value) {
+    for (int i = 0; i < width; i++) {
+        uint64_t bit = offset + i;
+        uint8_t mask = 0x80 >> (bit & 7);
+        if ((value >> (width - 1 - i)) & 1) {
+            data[bit >> 3] |= mask;
+        }
+        else {
+            data[bit >> 3] &= ~mask;
+        }
+    }
+}
+
+const char* kernels() {
+    return active().name;
+}
+
+} // namespace bits
@@ -0,0 +1,45 @@
+#ifndef BITS_H
+#define BITS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Kernels for the bitmap commands, which treat a string value as a bit
+// array, and for HyperLogLog register merges. Bits are numbered as in
+// Redis: bit 0 is the most significant bit of the first byte.
+//
+// The bulk kernels are picked once, on first use, for the CPU the server
+// runs on: AVX2 where available, POPCNT otherwise, and portable 64-bit code
+// as the fallback. They make one pass over memory, so counting or combining
+// large bitmaps runs at memory bandwidth on AVX2 hardware.
+namespace bits {
+
+// Max is byte-wise: it merges HyperLogLog registers kept one per byte.
+enum class Op { And, Or, Xor, Max };
+
+// Set bits in data[0, len).
+uint64_t popcount(const uint8_t* data, size_t len);
+
+// dst[i] = dst[i] op src[i] for i < len.
+void combine(Op op, uint8_t* dst, const uint8_t* src, size_t len);
+void invert(uint8_t* data, size_t len);
+
+// Index of the first byte of data[0, len) other than `skip`, len if none.
+// BITPOS looks past 0x00 bytes for a set bit and past 0xff for a clear one.
+size_t findByteNot(const uint8_t* data, size_t len, uint8_t skip);
+
+// Unpacks `count` 6-bit fields, a multiple of 4, packed least significant
+// bit first (HyperLogLog dense registers), into one byte each.
+void unpack6(const uint8_t* packed, uint8_t* out, size_t count);
+
+// The `width`-bit unsigned field at bit `offset` (width 1 to 64), and its
+// replacement. Both stay within the bytes the field covers.
+uint64_t getField(const uint8_t* data, uint64_t offset, int width);
+void setField(uint8_t* data, uint64_t offset, int width, uint64_t value);
+
+// Kernel set in use: "avx2", "popcnt" or "scalar".
+const char* kernels();
+
+} // namespace bits
+
+#endif // BITS_H
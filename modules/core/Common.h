@@ -27,6 +27,9 @@ int recvExactly(int fd, char* buf, size_t nBytes);
 
 int writeExactly(int fd, const char* buf, size_t nBytes);
 
+// Opens a blocking TCP connection with keepalive enabled; -1 on failure.
+int connectTcp(const std::string& host, int port);
+
 std::string toLower(const std::string& str);
 
 class IncorrectProtocol : public std::runtime_error {
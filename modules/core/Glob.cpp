@@ -0,0 +1,169 @@
+#include "Glob.h"
+
+namespace {
+
+bool isSpecial(char c) {
+    return c == '*' || c == '?' || c == '[' || c == '\\';
+}
+
+// Matches a `[...]` class starting just after the `[` at pattern[p]. On
+// return `p` points at the closing `]` (or the end of a malformed class).
+bool matchClass(std::string_view pattern, size_t& p, char c) {
+    bool negate = false;
+    if (p < pattern.size() && pattern[p] == '^') {
+        negate = true;
+        p++;
+    }
+
+    bool found = false;
+    while (p < pattern.size() && pattern[p] != ']') {
+        if (pattern[p] == '\\' && p + 1 < pattern.size()) {
+            p++;
+            found |= pattern[p] == c;
+        }
+        else if (p + 2 < pattern.size() && pattern[p + 1] == '-' && pattern[p + 2] != ']') {
+            char lo = pattern[p];
+            char hi = pattern[p + 2];
+            if (lo > hi) {
+                std::swap(lo, hi);
+            }
+            found |= c >= lo && c <= hi;
+            p += 2;
+        }
+        else {
+            found |= pattern[p] == c;
+        }
+        p++;
+    }
+
+    return found != negate;
+}
+
+}
+
+GlobPattern::GlobPattern(std::string pattern) : pattern(std::move(pattern)), kind(Kind::General) {
+    const std::string& p = this->pattern;
+    size_t stars = 0;
+    size_t starPos = 0;
+    bool otherSpecial = false;
+    for (size_t i = 0; i < p.size(); i++) {
+        if (p[i] == '*') {
+            stars++;
+            starPos = i;
+        }
+        else if (isSpecial(p[i])) {
+            otherSpecial = true;
+        }
+    }
+
+    if (otherSpecial) {
+        // A literal with escapes is still a literal.
+        std::string unescaped;
+        for (size_t i = 0; i < p.size(); i++) {
+            if (p[i] == '\\' && i + 1 < p.size()) {
+                unescaped += p[++i];
+            }
+            else if (isSpecial(p[i])) {
+                return;
+            }
+            else {
+                unescaped += p[i];
+            }
+        }
+        fixed = std::move(unescaped);
+        kind = Kind::Literal;
+    }
+    else if (stars == 0) {
+        fixed = p;
+        kind = Kind::Literal;
+    }
+    else if (p.find_first_not_of('*') == std::string::npos) {
+        kind = Kind::All;
+    }
+    else if (stars == 1 && starPos == p.size() - 1) {
+        fixed = p.substr(0, starPos);
+        kind = Kind::Prefix;
+    }
+    else if (stars == 1 && starPos == 0) {
+        fixed = p.substr(1);
+        kind = Kind::Suffix;
+    }
+}
+
+bool GlobPattern::matches(std::string_view str) const {
+    switch (kind) {
+        case Kind::All:
+            return true;
+        case Kind::Literal:
+            return str == fixed;
+        case Kind::Prefix:
+            return str.size() >= fixed.size() && str.compare(0, fixed.size(), fixed) == 0;
+        case Kind::Suffix:
+            return str.size() >= fixed.size() && str.compare(str.size() - fixed.size(), fixed.size(), fixed) == 0;
+        default:
+            return matchGeneral(pattern, str);
+    }
+}
+
+// Classic wildcard matching with a single backtrack point. Every token other
+// than `*` consumes exactly one character, so when a later `*` is reached
+// the earlier ones never need to be revisited.
+bool GlobPattern::matchGeneral(std::string_view pattern, std::string_view str) {
+    size_t p = 0;
+    size_t s = 0;
+    size_t starP = std::string_view::npos;
+    size_t starS = 0;
+
+    while (s < str.size()) {
+        if (p < pattern.size()) {
+            char pc = pattern[p];
+            if (pc == '*') {
+                while (p < pattern.size() && pattern[p] == '*') {
+                    p++;
+                }
+                if (p == pattern.size()) {
+                    return true;
+                }
+                starP = p;
+                starS = s;
+                continue;
+            }
+
+            bool ok;
+            size_t next = p + 1;
+            if (pc == '?') {
+                ok = true;
+            }
+            else if (pc == '[') {
+                size_t q = p + 1;
+                ok = matchClass(pattern, q, str[s]);
+                next = q < pattern.size() ? q + 1 : q;
+            }
+            else if (pc == '\\' && p + 1 < pattern.size()) {
+                ok = pattern[p + 1] == str[s];
+                next = p + 2;
+            }
+            else {
+                ok = pc == str[s];
+            }
+
+            if (ok) {
+                p = next;
+                s++;
+                continue;
+            }
+        }
+
+        if (starP == std::string_view::npos) {
+            return false;
+        }
+        p = starP;
+        s = ++starS;
+    }
+
+    while (p < pattern.size() && pattern[p] == '*') {
+        p++;
+    }
+
+    return p == pattern.size();
+}
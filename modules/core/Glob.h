@@ -0,0 +1,35 @@
+#ifndef GLOB_H
+#define GLOB_H
+
+#include <string>
+#include <string_view>
+
+// Redis-style glob patterns: `*`, `?`, `[abc]`, `[^a-z]` and `\` escapes.
+//
+// A pattern is classified once when it is built. Patterns that are a plain
+// literal, a literal prefix or suffix around a single `*`, or `*` alone are
+// matched with one comparison; everything else goes through a backtracking
+// matcher that remembers only the last `*`, so it runs in O(n * m) at worst
+// instead of exponential time.
+class GlobPattern {
+public:
+    explicit GlobPattern(std::string pattern);
+
+    bool matches(std::string_view str) const;
+
+    // True when the pattern has no wildcards, i.e. matches exactly one key.
+    bool isLiteral() const { return kind == Kind::Literal; }
+    // The unescaped key a literal pattern stands for.
+    const std::string& literal() const { return fixed; }
+
+private:
+    enum class Kind { All, Literal, Prefix, Suffix, General };
+
+    static bool matchGeneral(std::string_view pattern, std::string_view str);
+
+    std::string pattern;
+    std::string fixed;
+    Kind kind;
+};
+
+#endif // GLOB_H
@@ -0,0 +1,364 @@
+#include "Lz4.h"
+#include <algorithm>
+#include <cstring>
+
+#define LZ4_MIN_MATCH 4
+// The format wants the last match to start at least LZ4_MF_LIMIT bytes from
+// the end and the last LZ4_LAST_LITERALS bytes to be literals.
+#define LZ4_MF_LIMIT 12
+#define LZ4_LAST_LITERALS 5
+#define LZ4_HASH_BITS 12
+#define LZ4_DICT_HASH_BITS 16
+// Training scores segments of LZ4_SEGMENT bytes by their substrings of
+// LZ4_DMER bytes, counted in tables of 2^LZ4_TRAIN_BITS entries.
+#define LZ4_DMER 8
+#define LZ4_SEGMENT 256
+#define LZ4_TRAIN_BITS 20
+
+namespace lz4 {
+
+namespace {
+
+uint32_t read32(const char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t read64(const char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint32_t hash4(uint32_t sequence, int bits) {
+    return (sequence * 2654435761u) >> (32 - bits);
+}
+
+uint32_t hash8(uint64_t sequence) {
+    return (sequence * 0x9E3779B97F4A7C15ull) >> (64 - LZ4_TRAIN_BITS);
+}
+
+// How many bytes from `p` on, up to `limit`, equal those from `match` on.
+size_t count(const char* p, const char* match, const char* limit) {
+    const char* start = p;
+    while (p + 8 <= limit) {
+        uint64_t diff = read64(p) ^ read64(match);
+        if (diff != 0) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            return p - start + (__builtin_ctzll(diff) >> 3);
+#else
+            return p - start + (__builtin_clzll(diff) >> 3);
+#endif
+        }
+        p += 8;
+        match += 8;
+    }
+    while (p < limit && *p == *match) {
+        p++;
+        match++;
+    }
+    return p - start;
+}
+
+char* writeLength(char* op, size_t length) {
+    while (length >= 255) {
+        *op++ = static_cast<char>(255);
+        length -= 255;
+    }
+    *op++ = static_cast<char>(length);
+    return op;
+}
+
+// A sequence of literals followed by a match, or only literals for the last
+// one (`length` 0).
+char* writeSequence(char* op, const char* literals, size_t literalCount, size_t offset, size_t length) {
+    char* token = op++;
+    *token = static_cast<char>(std::min<size_t>(literalCount, 15) << 4);
+    if (literalCount >= 15) {
+        op = writeLength(op, literalCount - 15);
+    }
+    std::memcpy(op, literals, literalCount);
+    op += literalCount;
+    if (length == 0) {
+        return op;
+    }
+
+    *op++ = static_cast<char>(offset & 0xff);
+    *op++ = static_cast<char>(offset >> 8);
+    length -= LZ4_MIN_MATCH;
+    *token |= static_cast<char>(std::min<size_t>(length, 15));
+    if (length >= 15) {
+        op = writeLength(op, length - 15);
+    }
+    return op;
+}
+
+bool readLength(const uint8_t*& ip, const uint8_t* end, size_t& length) {
+    uint8_t byte;
+    do {
+        if (ip == end) {
+            return false;
+        }
+        byte = *ip++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+}
+
+Dictionary::Dictionary(std::string bytes) : data(std::move(bytes)), index(size_t(1) << LZ4_DICT_HASH_BITS, 0) {
+    if (data.size() > LZ4_MAX_DICT) {
+        data.erase(0, data.size() - LZ4_MAX_DICT);
+    }
+    for (size_t i = 0; i + 4 <= data.size(); i++) {
+        index[hash4(read32(&data[i]), LZ4_DICT_HASH_BITS)] = i + 1;
+    }
+}
+
+size_t compressBound(size_t len) {
+    return len + len / 255 + 16;
+}
+
+size_t compress(const char* src, size_t len, char* dst, const Dictionary* dict) {
+    char* op = dst;
+    const char* anchor = src;
+    const char* end = src + len;
+
+    if (len > LZ4_MF_LIMIT) {
+        const char* matchLimit = end - LZ4_LAST_LITERALS;
+        const char* mfLimit = end - LZ4_MF_LIMIT;
+        const char* dictEnd = dict ? dict->data.data() + dict->data.size() : nullptr;
+        uint32_t table[1 << LZ4_HASH_BITS] = {};
+        const char* ip = src;
+        unsigned misses = 0;
+
+        while (ip <= mfLimit) {
+            uint32_t sequence = read32(ip);
+            uint32_t h = hash4(sequence, LZ4_HASH_BITS);
+            uint32_t candidate = table[h];
+            table[h] = ip - src + 1;
+
+            size_t offset = 0;
+            size_t length = 0;
+            if (candidate != 0 && ip - (src + candidate - 1) <= LZ4_WINDOW && read32(src + candidate - 1) == sequence) {
+                const char* match = src + candidate - 1;
+                while (ip > anchor && match > src && ip[-1] == match[-1]) {
+                    ip--;
+                    match--;
+                }
+                offset = ip - match;
+                length = LZ4_MIN_MATCH + count(ip + LZ4_MIN_MATCH, match + LZ4_MIN_MATCH, matchLimit);
+            } else if (dict) {
+                // The dictionary sits right before the input, so a match
+                // that runs off its end carries on at the input's start.
+                uint32_t position = dict->index[hash4(sequence, LZ4_DICT_HASH_BITS)];
+                if (position != 0) {
+                    const char* match = dict->data.data() + position - 1;
+                    size_t inDict = dictEnd - match;
+                    if ((ip - src) + inDict <= LZ4_WINDOW && read32(match) == sequence) {
+                        offset = (ip - src) + inDict;
+                        length = count(ip, match, std::min(matchLimit, ip + inDict));
+                        if (length == inDict) {
+                            length += count(ip + length, src, matchLimit);
+                        }
+                    }
+                }
+            }
+
+            if (length == 0) {
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+
+            misses = 0;
+            op = writeSequence(op, anchor, ip - anchor, offset, length);
+            ip += length;
+            anchor = ip;
+            if (ip <= mfLimit) {
+                table[hash4(read32(ip - 2), LZ4_HASH_BITS)] = ip - 2 - src + 1;
+            }
+        }
+    }
+
+    return writeSequence(op, anchor, end - anchor, 0, 0) - dst;
+}
+
+bool decompress(const char* src, size_t len, char* dst, size_t dstLen, const Dictionary* dict) {
+    const uint8_t* ip = reinterpret_cast<const uint8_t*>(src);
+    const uint8_t* end = ip + len;
+    char* op = dst;
+    char* outEnd = dst + dstLen;
+
+    while (ip < end) {
+        unsigned token = *ip++;
+        size_t literals = token >> 4;
+        if (literals == 15 && !readLength(ip, end, literals)) {
+            return false;
+        }
+        if (literals > static_cast<size_t>(end - ip) || literals > static_cast<size_t>(outEnd - op)) {
+            return false;
+        }
+        // Short runs, the common case, copy as one fixed-size block when
+        // there is room for it on both sides.
+        if (literals <= 16 && end - ip >= 16 && outEnd - op >= 16) {
+            std::memcpy(op, ip, 16);
+        }
+        else {
+            std::memcpy(op, ip, literals);
+        }
+        op += literals;
+        ip += literals;
+        if (ip == end) {
+            return op == outEnd;
+        }
+
+        if (end - ip < 2) {
+            return false;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        size_t length = token & 15;
+        if (length == 15 && !readLength(ip, end, length)) {
+            return false;
+        }
+        length += LZ4_MIN_MATCH;
+        if (offset == 0 || length > static_cast<size_t>(outEnd - op)) {
+            return false;
+        }
+
+        size_t produced = op - dst;
+        if (offset > produced) {
+            size_t back = offset - produced;
+            if (!dict || back > dict->bytes().size()) {
+                return false;
+            }
+            const char* from = dict->bytes().data() + dict->bytes().size() - back;
+            size_t n = std::min(back, length);
+            if (back >= n + 15 && static_cast<size_t>(outEnd - op) >= n + 15) {
+                for (size_t i = 0; i < n; i += 16) {
+                    std::memcpy(op + i, from + i, 16);
+                }
+            }
+            else {
+                std::memcpy(op, from, n);
+            }
+            op += n;
+            length -= n;
+        }
+
+        // An offset shorter than the match repeats the bytes being written;
+        // from 16 on, whole blocks can be copied regardless.
+        const char* match = op - offset;
+        if (offset >= 16 && static_cast<size_t>(outEnd - op) >= length + 15) {
+            for (size_t i = 0; i < length; i += 16) {
+                std::memcpy(op + i, match + i, 16);
+            }
+        }
+        else if (offset >= length) {
+            std::memcpy(op, match, length);
+        } else {
+            for (size_t i = 0; i < length; i++) {
+                op[i] = match[i];
+            }
+        }
+        op += length;
+    }
+
+    return false;
+}
+
+std::string train(const std::vector<std::string>& samples, size_t capacity) {
+    const uint32_t none = UINT32_MAX;
+    const size_t span = LZ4_SEGMENT - LZ4_DMER + 1;
+    capacity = std::min<size_t>(capacity, LZ4_MAX_DICT);
+
+    // The samples back to back, the hash of the d-mer at each position
+    // (none where it would run past its sample), and how many samples hold
+    // each d-mer.
+    std::string text;
+    for (const auto& sample : samples) {
+        text += sample;
+    }
+    std::vector<uint32_t> dmers(text.size(), none);
+    std::vector<uint32_t> frequency(size_t(1) << LZ4_TRAIN_BITS, 0);
+    {
+        std::vector<uint32_t> lastSample(size_t(1) << LZ4_TRAIN_BITS, none);
+        size_t pos = 0;
+        for (uint32_t s = 0; s < samples.size(); s++) {
+            for (size_t i = 0; i + LZ4_DMER <= samples[s].size(); i++) {
+                uint32_t h = hash8(read64(&text[pos + i]));
+                dmers[pos + i] = h;
+                if (lastSample[h] != s) {
+                    lastSample[h] = s;
+                    frequency[h]++;
+                }
+            }
+            pos += samples[s].size();
+        }
+    }
+
+    size_t segments = capacity / LZ4_SEGMENT;
+    if (segments == 0 || text.size() < LZ4_SEGMENT) {
+        return {};
+    }
+
+    // One segment per epoch, a stretch of the text: the window whose
+    // distinct d-mers are the most frequent. Picked d-mers then count for
+    // nothing, so later epochs pick what the dictionary lacks.
+    size_t epoch = std::max<size_t>(text.size() / segments, LZ4_SEGMENT);
+    std::vector<uint16_t> inWindow(size_t(1) << LZ4_TRAIN_BITS, 0);
+    std::vector<std::pair<uint64_t, size_t>> chosen;
+    uint64_t score = 0;
+    auto add = [&](size_t p) {
+        if (dmers[p] != none && inWindow[dmers[p]]++ == 0) {
+            score += frequency[dmers[p]];
+        }
+    };
+    auto remove = [&](size_t p) {
+        if (dmers[p] != none && --inWindow[dmers[p]] == 0) {
+            score -= frequency[dmers[p]];
+        }
+    };
+
+    for (size_t begin = 0; begin + LZ4_SEGMENT <= text.size() && chosen.size() < segments; begin += epoch) {
+        size_t last = std::min(begin + epoch, text.size()) - LZ4_SEGMENT;
+        score = 0;
+        for (size_t p = begin; p < begin + span; p++) {
+            add(p);
+        }
+        uint64_t bestScore = score;
+        size_t best = begin;
+        for (size_t a = begin + 1; a <= last; a++) {
+            remove(a - 1);
+            add(a - 1 + span);
+            if (score > bestScore) {
+                bestScore = score;
+                best = a;
+            }
+        }
+        for (size_t p = last; p < last + span; p++) {
+            remove(p);
+        }
+
+        if (bestScore == 0) {
+            continue;
+        }
+        chosen.emplace_back(bestScore, best);
+        for (size_t p = best; p < best + span; p++) {
+            if (dmers[p] != none) {
+                frequency[dmers[p]] = 0;
+            }
+        }
+    }
+
+    std::sort(chosen.begin(), chosen.end());
+    std::string dict;
+    for (const auto& segment : chosen) {
+        dict.append(text, segment.second, LZ4_SEGMENT);
+    }
+    return dict;
+}
+
+}
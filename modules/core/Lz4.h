@@ -0,0 +1,59 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Farthest back a match may start, dictionary included.
+#define LZ4_WINDOW 65535
+// Largest dictionary kept; a match cannot reach further back anyway.
+#define LZ4_MAX_DICT 65536
+
+// Block compression in the LZ4 format: sequences of literals and
+// (offset, length) back-references, with no entropy coding, so it runs at
+// hundreds of MB/s and decompresses several times faster. A preset
+// dictionary acts as text that precedes every input, which lets a small
+// value reference the substrings it shares with others of its kind, such as
+// the field names of similar JSON documents. train() builds one from sample
+// values.
+namespace lz4 {
+
+// A preset dictionary with its match index, built once and shared by every
+// call that uses it.
+class Dictionary {
+public:
+    // Keeps the last LZ4_MAX_DICT bytes of `bytes`.
+    explicit Dictionary(std::string bytes);
+
+    const std::string& bytes() const { return data; }
+
+private:
+    friend size_t compress(const char* src, size_t len, char* dst, const Dictionary* dict);
+
+    std::string data;
+    // Position + 1 of the last occurrence of each hashed 4-byte sequence.
+    std::vector<uint32_t> index;
+};
+
+// Room compress() needs for `len` bytes of input.
+size_t compressBound(size_t len);
+
+// Compresses `src` into `dst`, which holds compressBound(len) bytes, and
+// returns the compressed size.
+size_t compress(const char* src, size_t len, char* dst, const Dictionary* dict = nullptr);
+
+// Decompresses exactly `dstLen` bytes, with the dictionary `src` was
+// compressed with. False on malformed input, which never reads or writes
+// out of bounds.
+bool decompress(const char* src, size_t len, char* dst, size_t dstLen, const Dictionary* dict = nullptr);
+
+// A dictionary of at most `capacity` bytes made of the segments of the
+// samples whose 8-byte substrings occur in the most samples (the COVER
+// method of zstd's trainer), most valuable last, nearest to the input.
+std::string train(const std::vector<std::string>& samples, size_t capacity);
+
+}
+
+#endif // LZ4_H
@@ -0,0 +1,93 @@
+#include <cstdint>
+#include "Sha1.h"
+
+namespace {
+
+uint32_t rotl(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+void processBlock(const unsigned char* block, uint32_t state[5]) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t(block[i * 4]) << 24) | (uint32_t(block[i * 4 + 1]) << 16) |
+               (uint32_t(block[i * 4 + 2]) << 8) | uint32_t(block[i * 4 + 3]);
+    }
+    for (int i = 16; i < 80; i++) {
+        w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        }
+        else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        }
+        else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        }
+        else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+
+        uint32_t temp = rotl(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rotl(b, 30);
+        b = a;
+        a = temp;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+}
+
+std::string sha1Hex(std::string_view data) {
+    uint32_t state[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    // Taking `rest` as a remainder keeps it visibly below 64, so the tail
+    // writes below are in bounds.
+    size_t rest = data.size() % 64;
+    size_t full = data.size() - rest;
+    for (size_t i = 0; i < full; i += 64) {
+        processBlock(reinterpret_cast<const unsigned char*>(data.data()) + i, state);
+    }
+
+    // The tail is padded with 0x80, zeros and the message length in bits,
+    // which may spill into a second block.
+    unsigned char tail[128] = {};
+    for (size_t i = 0; i < rest; i++) {
+        tail[i] = data[full + i];
+    }
+    tail[rest] = 0x80;
+    size_t tailSize = rest + 9 <= 64 ? 64 : 128;
+    uint64_t bits = uint64_t(data.size()) * 8;
+    for (int i = 0; i < 8; i++) {
+        tail[tailSize - 1 - i] = static_cast<unsigned char>(bits >> (i * 8));
+    }
+    for (size_t i = 0; i < tailSize; i += 64) {
+        processBlock(tail + i, state);
+    }
+
+    static const char* digits = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(40);
+    for (uint32_t word : state) {
+        for (int shift = 28; shift >= 0; shift -= 4) {
+            hex.push_back(digits[(word >> shift) & 0xF]);
+        }
+    }
+
+    return hex;
+}
@@ -0,0 +1,11 @@
+#ifndef SHA1_H
+#define SHA1_H
+
+#include <string>
+#include <string_view>
+
+// SHA-1 digest of `data` as 40 lowercase hex characters, the form Redis
+// uses to name cached scripts.
+std::string sha1Hex(std::string_view data);
+
+#endif // SHA1_H
@@ -0,0 +1,175 @@
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include "Compression.h"
+#include "core/Lz4.h"
+#include "config/Config.h"
+
+// Dictionary id, then the raw length.
+#define COMPRESSION_HEADER_SIZE 5
+// LZ4 cannot expand its input more than this much.
+#define COMPRESSION_MAX_RATIO 255
+
+namespace compression {
+
+namespace {
+
+// Slot 0 stays empty. Dictionaries are never freed: a value may refer to one
+// for as long as the process runs.
+std::atomic<const lz4::Dictionary*> registry[COMPRESSION_MAX_DICTIONARIES + 1];
+std::atomic<uint8_t> current{0};
+std::mutex registryMutex;
+
+std::atomic<uint64_t> compressions{0};
+std::atomic<uint64_t> compressNanos{0};
+std::atomic<uint64_t> compressed{0};
+std::atomic<uint64_t> rawBytes{0};
+std::atomic<uint64_t> storedBytes{0};
+std::atomic<uint64_t> decompressions{0};
+std::atomic<uint64_t> decompressNanos{0};
+
+uint64_t nanosSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+Encoding encode(std::string_view value, std::string& out) {
+    if (!config::GlobalConfig.compression || value.size() > UINT32_MAX ||
+        value.size() < std::max<size_t>(config::GlobalConfig.compressionMinBytes, COMPRESSION_HEADER_SIZE + 1)) {
+        return Encoding::Raw;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    uint8_t id = current.load(std::memory_order_acquire);
+    const lz4::Dictionary* dict = registry[id].load(std::memory_order_acquire);
+    uint32_t length = value.size();
+    out.resize(COMPRESSION_HEADER_SIZE + lz4::compressBound(value.size()));
+    out[0] = static_cast<char>(id);
+    memcpy(&out[1], &length, sizeof(length));
+    size_t size = COMPRESSION_HEADER_SIZE + lz4::compress(value.data(), value.size(), &out[COMPRESSION_HEADER_SIZE], dict);
+    compressions.fetch_add(1, std::memory_order_relaxed);
+    compressNanos.fetch_add(nanosSince(start), std::memory_order_relaxed);
+    if (size > value.size() - value.size() / COMPRESSION_MIN_SAVING) {
+        return Encoding::Raw;
+    }
+
+    out.resize(size);
+    compressed.fetch_add(1, std::memory_order_relaxed);
+    rawBytes.fetch_add(value.size(), std::memory_order_relaxed);
+    storedBytes.fetch_add(size, std::memory_order_relaxed);
+    return Encoding::Lz4;
+}
+
+std::string decode(Encoding encoding, std::string_view stored) {
+    if (encoding == Encoding::Raw) {
+        return std::string(stored);
+    }
+    if (encoding != Encoding::Lz4 || stored.size() < COMPRESSION_HEADER_SIZE) {
+        throw std::invalid_argument("Corrupt compressed value");
+    }
+
+    uint8_t id = stored[0];
+    uint32_t length;
+    memcpy(&length, stored.data() + 1, sizeof(length));
+    std::string_view block = stored.substr(COMPRESSION_HEADER_SIZE);
+    const lz4::Dictionary* dict = registry[id].load(std::memory_order_acquire);
+    if (id != 0 && dict == nullptr) {
+        throw std::invalid_argument("Compressed value refers to unknown dictionary " + std::to_string(id));
+    }
+    if (length > block.size() * COMPRESSION_MAX_RATIO) {
+        throw std::invalid_argument("Corrupt compressed value");
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::string value(length, '\0');
+    if (!lz4::decompress(block.data(), block.size(), &value[0], length, dict)) {
+        throw std::invalid_argument("Corrupt compressed value");
+    }
+    decompressions.fetch_add(1, std::memory_order_relaxed);
+    decompressNanos.fetch_add(nanosSince(start), std::memory_order_relaxed);
+    return value;
+}
+
+uint8_t dictionaryOf(std::string_view stored) {
+    return stored.empty() ? 0 : static_cast<uint8_t>(stored[0]);
+}
+
+void retag(std::string& stored, uint8_t id) {
+    if (!stored.empty()) {
+        stored[0] = static_cast<char>(id);
+    }
+}
+
+uint8_t currentDictionary() {
+    return current.load(std::memory_order_acquire);
+}
+
+void useDictionary(uint8_t id) {
+    current.store(id, std::memory_order_release);
+}
+
+uint8_t addDictionary(std::string bytes) {
+    auto dict = std::make_unique<lz4::Dictionary>(std::move(bytes));
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (size_t id = 1; id <= COMPRESSION_MAX_DICTIONARIES; id++) {
+        const lz4::Dictionary* existing = registry[id].load(std::memory_order_relaxed);
+        if (existing == nullptr) {
+            registry[id].store(dict.release(), std::memory_order_release);
+            return id;
+        }
+        if (existing->bytes() == dict->bytes()) {
+            return id;
+        }
+    }
+
+    throw std::runtime_error("Too many compression dictionaries");
+}
+
+std::vector<std::pair<uint8_t, std::string>> dictionaries() {
+    std::vector<std::pair<uint8_t, std::string>> all;
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (size_t id = 1; id <= COMPRESSION_MAX_DICTIONARIES; id++) {
+        if (const lz4::Dictionary* dict = registry[id].load(std::memory_order_relaxed)) {
+            all.emplace_back(id, dict->bytes());
+        }
+    }
+    return all;
+}
+
+uint8_t train(const std::vector<std::string>& samples) {
+    std::string bytes = lz4::train(samples, std::max(config::GlobalConfig.compressionDictBytes, 0));
+    if (bytes.empty()) {
+        return 0;
+    }
+
+    uint8_t id = addDictionary(std::move(bytes));
+    useDictionary(id);
+    return id;
+}
+
+Stats stats() {
+    Stats stats;
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        for (size_t id = 1; id <= COMPRESSION_MAX_DICTIONARIES; id++) {
+            stats.dictionaries += registry[id].load(std::memory_order_relaxed) != nullptr;
+        }
+        if (const lz4::Dictionary* dict = registry[current.load(std::memory_order_relaxed)].load(std::memory_order_relaxed)) {
+            stats.dictionaryBytes = dict->bytes().size();
+        }
+    }
+    stats.compressions = compressions.load(std::memory_order_relaxed);
+    stats.compressNanos = compressNanos.load(std::memory_order_relaxed);
+    stats.compressed = compressed.load(std::memory_order_relaxed);
+    stats.rawBytes = rawBytes.load(std::memory_order_relaxed);
+    stats.storedBytes = storedBytes.load(std::memory_order_relaxed);
+    stats.decompressions = decompressions.load(std::memory_order_relaxed);
+    stats.decompressNanos = decompressNanos.load(std::memory_order_relaxed);
+    return stats;
+}
+
+}
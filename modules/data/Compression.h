@@ -0,0 +1,84 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Dictionary ids fit in a byte; 0 means no dictionary.
+#define COMPRESSION_MAX_DICTIONARIES 255
+// Compressed values that save less than 1/COMPRESSION_MIN_SAVING of their
+// size are stored raw instead.
+#define COMPRESSION_MIN_SAVING 8
+
+// Transparent compression of string values (`"compression": true`).
+//
+// Values of at least compression_min_bytes written by SET and the like are
+// stored LZ4-compressed (see lz4) when that pays off; reads decompress them.
+// Values edited in place or read piecewise, which SETBIT, BITCOUNT and the
+// HyperLogLog commands do through Store::update() and Store::view(), are
+// left raw. A stored compressed value is the id of its dictionary and its
+// raw length, then the compressed block.
+//
+// Similar small values compress poorly on their own, so the maintenance
+// thread trains a dictionary from a sample of the keyspace once there is
+// enough data, and values compress against it from then on. Dictionaries are
+// registered for the life of the process and never change, so readers look
+// them up without locks; snapshots carry them along with the compressed
+// values that refer to them.
+namespace compression {
+
+// How a value is stored, kept in Record::encoding.
+enum class Encoding : uint8_t {
+    Raw = 0,
+    Lz4 = 1,
+};
+
+// Fills `out` with `value` compressed and returns Lz4 when compression is on,
+// the value large enough and the result small enough; Raw otherwise, leaving
+// `out` unspecified.
+Encoding encode(std::string_view value, std::string& out);
+
+// The value `stored` in `encoding`. Throws std::invalid_argument on corrupt
+// data or a dictionary that is not registered.
+std::string decode(Encoding encoding, std::string_view stored);
+
+// Dictionary a compressed value refers to, 0 for none.
+uint8_t dictionaryOf(std::string_view stored);
+// Makes a compressed value refer to dictionary `id`, which must hold the
+// same bytes as the one it was compressed with.
+void retag(std::string& stored, uint8_t id);
+
+// Dictionary new values compress against, 0 for none.
+uint8_t currentDictionary();
+void useDictionary(uint8_t id);
+
+// Registers a dictionary and returns its id, that of an identical one if
+// registered already. Throws std::runtime_error once every id is taken.
+uint8_t addDictionary(std::string bytes);
+// Every registered dictionary, by id.
+std::vector<std::pair<uint8_t, std::string>> dictionaries();
+
+// Trains a dictionary of compression_dict_bytes from sample values and makes
+// it current. Returns its id, 0 if the samples were too few to build one.
+uint8_t train(const std::vector<std::string>& samples);
+
+// Totals since start for INFO.
+struct Stats {
+    size_t dictionaries = 0;
+    size_t dictionaryBytes = 0;     // of the current one
+    uint64_t compressions = 0;      // attempts, kept or not
+    uint64_t compressNanos = 0;
+    uint64_t compressed = 0;        // values stored compressed
+    uint64_t rawBytes = 0;          // their size before
+    uint64_t storedBytes = 0;       // and after
+    uint64_t decompressions = 0;
+    uint64_t decompressNanos = 0;
+};
+Stats stats();
+
+}
+
+#endif // COMPRESSION_H
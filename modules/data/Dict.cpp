@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include "Dict.h"
+#include "Epoch.h"
+#include "LazyFree.h"
+#include "Slab.h"
+#include "stats/Latency.h"
+
+std::atomic<uint32_t> Record::ticks{0};
+
+void Record::advanceClock() {
+    static const auto start = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    ticks.store(std::chrono::duration_cast<std::chrono::seconds>(elapsed).count(), std::memory_order_relaxed);
+}
+
+Record* Record::create(std::string_view key, std::string_view val, std::time_t expiryEpoch) {
+    void* mem = slab::alloc(sizeof(Record) + key.size() + val.size());
+    Record* record = static_cast<Record*>(mem);
+    record->expiryEpoch = expiryEpoch;
+    record->keyLen = key.size();
+    record->valLen = val.size();
+    record->accessed = clock();
+    record->cold = false;
+    record->encoding = 0;
+
+    char* bytes = reinterpret_cast<char*>(record + 1);
+    memcpy(bytes, key.data(), key.size());
+    memcpy(bytes + key.size(), val.data(), val.size());
+    return record;
+}
+
+void Record::destroy(Record* record) {
+    slab::release(record, record->allocSize());
+}
+
+static void destroyRecord(void* ptr) {
+    Record* record = static_cast<Record*>(ptr);
+    if (lazyfree::shouldDeferBytes(record->valLen)) {
+        lazyfree::enqueue([record]() { Record::destroy(record); });
+        return;
+    }
+
+    Record::destroy(record);
+}
+
+void* Dict::Node::operator new(size_t size) {
+    return slab::alloc(size);
+}
+
+void Dict::Node::operator delete(void* ptr, size_t size) {
+    slab::release(ptr, size);
+}
+
+Dict::Dict() : table(newTable(DICT_INITIAL_SIZE)), count(0) {}
+
+Dict::~Dict() {
+    freeTableAndRecords(table.load(std::memory_order_relaxed));
+}
+
+uint64_t Dict::hash(std::string_view key) {
+    return std::hash<std::string_view>{}(key);
+}
+
+Dict::Table* Dict::newTable(size_t size) {
+    Table* t = new Table();
+    t->mask = size - 1;
+    t->buckets = new std::atomic<Node*>[size];
+    for (size_t i = 0; i < size; i++) {
+        t->buckets[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    return t;
+}
+
+void Dict::freeTable(void* ptr) {
+    Table* t = static_cast<Table*>(ptr);
+    for (size_t i = 0; i <= t->mask; i++) {
+        Node* node = t->buckets[i].load(std::memory_order_relaxed);
+        while (node != nullptr) {
+            Node* next = node->next.load(std::memory_order_relaxed);
+            delete node;
+            node = next;
+        }
+    }
+
+    delete[] t->buckets;
+    delete t;
+}
+
+void Dict::freeTableAndRecords(void* ptr) {
+    Table* t = static_cast<Table*>(ptr);
+    for (size_t i = 0; i <= t->mask; i++) {
+        Node* node = t->buckets[i].load(std::memory_order_relaxed);
+        while (node != nullptr) {
+            Record::destroy(node->record.load(std::memory_order_relaxed));
+            node = node->next.load(std::memory_order_relaxed);
+        }
+    }
+
+    freeTable(t);
+}
+
+void Dict::freeNode(void* ptr) {
+    delete static_cast<Node*>(ptr);
+}
+
+void Dict::lazyFreeTableAndRecords(void* ptr) {
+    lazyfree::enqueue([ptr]() { freeTableAndRecords(ptr); });
+}
+
+void Dict::freeNodeAndRecord(void* ptr) {
+    Node* node = static_cast<Node*>(ptr);
+    destroyRecord(node->record.load(std::memory_order_relaxed));
+    delete node;
+}
+
+const Record* Dict::find(std::string_view key, uint64_t hash) const {
+    const Table* t = table.load(std::memory_order_acquire);
+    Node* node = t->buckets[hash & t->mask].load(std::memory_order_acquire);
+    while (node != nullptr) {
+        if (node->hash == hash) {
+            const Record* record = node->record.load(std::memory_order_acquire);
+            if (record->key() == key) {
+                return record;
+            }
+        }
+        node = node->next.load(std::memory_order_acquire);
+    }
+
+    return nullptr;
+}
+
+void Dict::prefetchBucket(uint64_t hash) const {
+    const Table* t = table.load(std::memory_order_acquire);
+    __builtin_prefetch(&t->buckets[hash & t->mask]);
+}
+
+void Dict::prefetchChain(uint64_t hash) const {
+    const Table* t = table.load(std::memory_order_acquire);
+    Node* node = t->buckets[hash & t->mask].load(std::memory_order_acquire);
+    if (node != nullptr) {
+        __builtin_prefetch(node);
+    }
+}
+
+bool Dict::insert(Record* record, uint64_t hash) {
+    Table* t = table.load(std::memory_order_relaxed);
+    std::atomic<Node*>& bucket = t->buckets[hash & t->mask];
+    for (Node* node = bucket.load(std::memory_order_relaxed); node != nullptr;
+         node = node->next.load(std::memory_order_relaxed)) {
+        if (node->hash == hash && node->record.load(std::memory_order_relaxed)->key() == record->key()) {
+            Record* old = node->record.exchange(record, std::memory_order_acq_rel);
+            epoch::retire(old, &destroyRecord);
+            return false;
+        }
+    }
+
+    Node* node = new Node();
+    node->next.store(bucket.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    node->hash = hash;
+    node->record.store(record, std::memory_order_relaxed);
+    bucket.store(node, std::memory_order_release);
+
+    if (count.fetch_add(1, std::memory_order_relaxed) + 1 > t->mask + 1) {
+        grow(t);
+    }
+    return true;
+}
+
+bool Dict::erase(std::string_view key, uint64_t hash) {
+    Table* t = table.load(std::memory_order_relaxed);
+    std::atomic<Node*>* link = &t->buckets[hash & t->mask];
+    for (Node* node = link->load(std::memory_order_relaxed); node != nullptr;
+         node = link->load(std::memory_order_relaxed)) {
+        if (node->hash == hash && node->record.load(std::memory_order_relaxed)->key() == key) {
+            // The unlinked node keeps its `next` pointer, so a reader that is
+            // standing on it still reaches the rest of the chain.
+            link->store(node->next.load(std::memory_order_relaxed), std::memory_order_release);
+            count.fetch_sub(1, std::memory_order_relaxed);
+            epoch::retire(node, &Dict::freeNodeAndRecord);
+            return true;
+        }
+        link = &node->next;
+    }
+
+    return false;
+}
+
+void Dict::clear(bool lazy) {
+    Table* old = table.exchange(newTable(DICT_INITIAL_SIZE), std::memory_order_acq_rel);
+    count.store(0, std::memory_order_relaxed);
+    epoch::retire(old, lazy ? &Dict::lazyFreeTableAndRecords : &Dict::freeTableAndRecords);
+}
+
+// Doubles the bucket array. Nodes of the old table are copied rather than
+// relinked so that readers still walking it never see a chain change under
+// them; the records themselves are shared between both tables.
+void Dict::grow(Table* current) {
+    latency::Timer timer("dict-rehash");
+    Table* next = newTable((current->mask + 1) * 2);
+    for (size_t i = 0; i <= current->mask; i++) {
+        for (Node* node = current->buckets[i].load(std::memory_order_relaxed); node != nullptr;
+             node = node->next.load(std::memory_order_relaxed)) {
+            std::atomic<Node*>& bucket = next->buckets[node->hash & next->mask];
+            Node* copy = new Node();
+            copy->next.store(bucket.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            copy->hash = node->hash;
+            copy->record.store(node->record.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            bucket.store(copy, std::memory_order_relaxed);
+        }
+    }
+
+    table.store(next, std::memory_order_release);
+    epoch::retire(current, &Dict::freeTable);
+}
+
+void Dict::forEach(const std::function<void(const Record&)>& fn) const {
+    const Table* t = table.load(std::memory_order_acquire);
+    for (size_t i = 0; i <= t->mask; i++) {
+        for (Node* node = t->buckets[i].load(std::memory_order_acquire); node != nullptr;
+             node = node->next.load(std::memory_order_acquire)) {
+            fn(*node->record.load(std::memory_order_acquire));
+        }
+    }
+}
+
+uint64_t Dict::scan(uint64_t cursor, const std::function<void(const Record&)>& fn) const {
+    const Table* t = table.load(std::memory_order_acquire);
+    for (Node* node = t->buckets[cursor & t->mask].load(std::memory_order_acquire); node != nullptr;
+         node = node->next.load(std::memory_order_acquire)) {
+        fn(*node->record.load(std::memory_order_acquire));
+    }
+
+    // Increment the reversed cursor: setting the bits above the mask makes
+    // the carry ripple from the highest bucket bit downwards.
+    cursor |= ~static_cast<uint64_t>(t->mask);
+    cursor = reverseBits(cursor);
+    cursor++;
+    return reverseBits(cursor);
+}
+
+uint64_t Dict::reverseBits(uint64_t v) {
+    v = ((v >> 1) & 0x5555555555555555ULL) | ((v & 0x5555555555555555ULL) << 1);
+    v = ((v >> 2) & 0x3333333333333333ULL) | ((v & 0x3333333333333333ULL) << 2);
+    v = ((v >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((v & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    return __builtin_bswap64(v);
+}
+
+size_t Dict::defrag(size_t cursor, size_t maxBuckets) {
+    Table* t = table.load(std::memory_order_relaxed);
+    if (cursor > t->mask) {
+        cursor = 0;
+    }
+
+    size_t end = std::min(cursor + maxBuckets, t->mask + 1);
+    for (size_t i = cursor; i < end; i++) {
+        std::atomic<Node*>* link = &t->buckets[i];
+        for (Node* node = link->load(std::memory_order_relaxed); node != nullptr;
+             node = link->load(std::memory_order_relaxed)) {
+            // Relocation is just a republish of an identical copy: readers see
+            // either pointer, and the old one goes through the epoch list.
+            Record* record = node->record.load(std::memory_order_relaxed);
+            if (void* mem = slab::defragAlloc(record, record->allocSize())) {
+                memcpy(mem, record, record->allocSize());
+                node->record.store(static_cast<Record*>(mem), std::memory_order_release);
+                epoch::retire(record, &destroyRecord);
+            }
+
+            if (void* mem = slab::defragAlloc(node, sizeof(Node))) {
+                Node* copy = ::new (mem) Node();
+                copy->next.store(node->next.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                copy->hash = node->hash;
+                copy->record.store(node->record.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                link->store(copy, std::memory_order_release);
+                epoch::retire(node, &Dict::freeNode);
+                node = copy;
+            }
+
+            link = &node->next;
+        }
+    }
+
+    return end > t->mask ? 0 : end;
+}
@@ -0,0 +1,138 @@
+#ifndef DICT_H
+#define DICT_H
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <string_view>
+
+#define DICT_INITIAL_SIZE 16
+
+// A key/value pair laid out in a single allocation. Records are immutable
+// once published: an overwrite installs a new record and retires the old
+// one, so a reader holding a pointer always sees a consistent value. The one
+// exception is SETBIT within the value, which stores a single byte in place
+// (see Store::setBit); a reader sees that byte either before or after.
+//
+// `accessed` is Record::clock() as of the last read or write, refreshed by
+// readers at most once per tick so that hot keys do not write their cache
+// line on every GET. Tiered storage spills the values that sit idle; a
+// spilled value leaves a cold record behind whose val() holds the
+// Tier::Ref of its entry in the shard's spill file. `encoding` is the
+// compression::Encoding of the value, which a spill keeps as it is.
+struct Record {
+    std::time_t expiryEpoch;
+    uint32_t keyLen;
+    uint32_t valLen;
+    uint32_t accessed;
+    bool cold;
+    uint8_t encoding;
+
+    std::string_view key() const { return {bytes(), keyLen}; }
+    std::string_view val() const { return {bytes() + keyLen, valLen}; }
+    uint8_t* valBytes() { return reinterpret_cast<uint8_t*>(this + 1) + keyLen; }
+    size_t allocSize() const { return sizeof(Record) + keyLen + valLen; }
+
+    void markAccessed() const {
+        uint32_t now = clock();
+        if (__atomic_load_n(&accessed, __ATOMIC_RELAXED) != now) {
+            __atomic_store_n(const_cast<uint32_t*>(&accessed), now, __ATOMIC_RELAXED);
+        }
+    }
+
+    // Coarse clock in seconds, advanced by the maintenance thread.
+    static uint32_t clock() { return ticks.load(std::memory_order_relaxed); }
+    static void advanceClock();
+
+    // A new record has just been accessed, is not cold and holds its value
+    // raw.
+    static Record* create(std::string_view key, std::string_view val, std::time_t expiryEpoch);
+    static void destroy(Record* record);
+
+private:
+    const char* bytes() const { return reinterpret_cast<const char*>(this + 1); }
+
+    static std::atomic<uint32_t> ticks;
+};
+
+// Chained hash table whose lookups take no locks. Mutations must be
+// serialized by the caller (Store holds the shard's write mutex); readers
+// must be inside an epoch::Guard for as long as they use a returned Record.
+class Dict {
+public:
+    Dict();
+    ~Dict();
+
+    Dict(const Dict&) = delete;
+    Dict& operator=(const Dict&) = delete;
+
+    static uint64_t hash(std::string_view key);
+
+    const Record* find(std::string_view key, uint64_t hash) const;
+
+    // Two-stage prefetch for batched lookups: first the bucket slots, then
+    // the head node of each chain once the slot is likely cached.
+    void prefetchBucket(uint64_t hash) const;
+    void prefetchChain(uint64_t hash) const;
+
+    // Installs `record` under its key, retiring any record it replaces.
+    // Returns whether the key is new.
+    bool insert(Record* record, uint64_t hash);
+    bool erase(std::string_view key, uint64_t hash);
+
+    // Detaches every entry at once. With `lazy` set, the old table is freed
+    // on the lazy-free thread once its grace period ends.
+    void clear(bool lazy = false);
+
+    size_t size() const { return count.load(std::memory_order_relaxed); }
+    // Memory an entry takes besides its record: its node and bucket slot.
+    static size_t entryOverhead() { return sizeof(Node) + sizeof(std::atomic<Node*>); }
+    void forEach(const std::function<void(const Record&)>& fn) const;
+
+    // Visits the bucket at `cursor` and returns the cursor of the next one,
+    // or 0 once the walk is complete. Cursors advance over the reversed
+    // bucket bits, so a walk started before the table grows still visits
+    // every bucket exactly once in terms of the old table: an entry present
+    // for the whole walk is reported at least once. Runs lock-free; callers
+    // must be inside an epoch::Guard.
+    uint64_t scan(uint64_t cursor, const std::function<void(const Record&)>& fn) const;
+
+    // Position of `hash` in scan order; bucket cursors map to contiguous
+    // ranges of it.
+    static uint64_t reverseBits(uint64_t v);
+
+    // Moves records and nodes in up to `maxBuckets` buckets starting at
+    // `cursor` off sparse slab pages. Returns the cursor to resume from, or
+    // 0 once the whole table has been visited.
+    size_t defrag(size_t cursor, size_t maxBuckets);
+
+private:
+    struct Node {
+        std::atomic<Node*> next;
+        uint64_t hash;
+        std::atomic<Record*> record;
+
+        static void* operator new(size_t size);
+        static void operator delete(void* ptr, size_t size);
+    };
+
+    struct Table {
+        size_t mask;
+        std::atomic<Node*>* buckets;
+    };
+
+    static Table* newTable(size_t size);
+    static void freeTable(void* table);
+    static void freeTableAndRecords(void* table);
+    static void lazyFreeTableAndRecords(void* table);
+    static void freeNode(void* node);
+    static void freeNodeAndRecord(void* node);
+    void grow(Table* current);
+
+    std::atomic<Table*> table;
+    std::atomic<size_t> count;
+};
+
+#endif // DICT_H
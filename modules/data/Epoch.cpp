@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include "Epoch.h"
+
+namespace {
+
+struct Retired {
+    uint64_t epoch;
+    void* ptr;
+    epoch::Deleter deleter;
+};
+
+// One participant per live thread that has ever entered a guard or retired
+// an object. Slots are never freed, only recycled, so the reclaimer can walk
+// the list without synchronizing with threads that come and go. A slot's
+// retired objects stay with it when its thread exits, for reclaim().
+struct Participant {
+    alignas(64) std::atomic<uint64_t> epoch{0};
+    std::atomic<bool> inUse{true};
+    Participant* next = nullptr;
+    // Only the owning thread and reclaim() take this, so retiring does not
+    // contend with writers on other threads.
+    alignas(64) std::mutex retiredMutex;
+    std::vector<Retired> retired;
+};
+
+// Epoch 0 marks a quiescent participant, so counting starts at 1.
+std::atomic<uint64_t> globalEpoch{1};
+std::atomic<Participant*> participants{nullptr};
+
+// Serializes reclaim() and guards what it could not free yet.
+std::mutex reclaimMutex;
+std::vector<Retired> deferred;
+
+Participant* acquireParticipant() {
+    for (Participant* p = participants.load(std::memory_order_acquire); p != nullptr; p = p->next) {
+        bool expected = false;
+        if (!p->inUse.load(std::memory_order_relaxed) &&
+            p->inUse.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+            return p;
+        }
+    }
+
+    Participant* p = new Participant();
+    Participant* head = participants.load(std::memory_order_relaxed);
+    do {
+        p->next = head;
+    } while (!participants.compare_exchange_weak(head, p, std::memory_order_release, std::memory_order_relaxed));
+
+    return p;
+}
+
+struct ThreadState {
+    Participant* participant = nullptr;
+    int depth = 0;
+
+    Participant* self() {
+        if (participant == nullptr) {
+            participant = acquireParticipant();
+        }
+        return participant;
+    }
+
+    ~ThreadState() {
+        if (participant != nullptr) {
+            participant->epoch.store(0, std::memory_order_release);
+            participant->inUse.store(false, std::memory_order_release);
+        }
+    }
+};
+
+thread_local ThreadState threadState;
+
+// Starts a new epoch and returns the oldest one a reader may still be in.
+// Objects retired before it are unreachable, provided their retire()
+// happened before this call: then either a reader's guard is seen here, or
+// the fences make its loads see the unlink that preceded the retire.
+uint64_t advance() {
+    uint64_t current = globalEpoch.fetch_add(1, std::memory_order_acq_rel) + 1;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    uint64_t minActive = current;
+    for (Participant* p = participants.load(std::memory_order_acquire); p != nullptr; p = p->next) {
+        uint64_t e = p->epoch.load(std::memory_order_acquire);
+        if (e != 0 && e < minActive) {
+            minActive = e;
+        }
+    }
+    return minActive;
+}
+
+// Moves the objects of `candidates` that no reader can reach to the end and
+// returns where they start.
+std::vector<Retired>::iterator partitionFreeable(std::vector<Retired>& candidates) {
+    uint64_t minActive = advance();
+    return std::partition(candidates.begin(), candidates.end(), [minActive](const Retired& r) {
+        return r.epoch >= minActive;
+    });
+}
+
+// Runs the deleters of [begin, end).
+void runDeleters(std::vector<Retired>::const_iterator begin, std::vector<Retired>::const_iterator end) {
+    for (auto it = begin; it != end; ++it) {
+        it->deleter(it->ptr);
+    }
+}
+
+}
+
+epoch::Guard::Guard() {
+    ThreadState& state = threadState;
+    if (state.depth++ > 0) {
+        return;
+    }
+
+    Participant* participant = state.self();
+    participant->epoch.store(globalEpoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    // Pairs with the fence in advance(): either the reclaimer sees this
+    // epoch, or every load we make afterwards sees the writer's unlink.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+epoch::Guard::~Guard() {
+    ThreadState& state = threadState;
+    if (--state.depth == 0) {
+        state.participant->epoch.store(0, std::memory_order_release);
+    }
+}
+
+void epoch::retire(void* ptr, Deleter deleter) {
+    Participant* self = threadState.self();
+    std::lock_guard<std::mutex> lock(self->retiredMutex);
+    self->retired.push_back({globalEpoch.load(std::memory_order_acquire), ptr, deleter});
+}
+
+size_t epoch::collect(bool force) {
+    Participant* self = threadState.participant;
+    if (self == nullptr) {
+        return 0;
+    }
+
+    std::vector<Retired> candidates;
+    {
+        std::lock_guard<std::mutex> lock(self->retiredMutex);
+        if (self->retired.empty() || (!force && self->retired.size() < EPOCH_RECLAIM_THRESHOLD)) {
+            return 0;
+        }
+        candidates.swap(self->retired);
+    }
+
+    auto freeable = partitionFreeable(candidates);
+    {
+        std::lock_guard<std::mutex> lock(self->retiredMutex);
+        self->retired.insert(self->retired.end(), candidates.begin(), freeable);
+    }
+    runDeleters(freeable, candidates.end());
+    return candidates.end() - freeable;
+}
+
+size_t epoch::reclaim() {
+    std::vector<Retired> candidates;
+    std::vector<Retired>::iterator freeable;
+    {
+        // Taking every list before advancing the epoch orders each retire
+        // that queued a candidate before the fence in advance().
+        std::lock_guard<std::mutex> lock(reclaimMutex);
+        candidates.swap(deferred);
+        for (Participant* p = participants.load(std::memory_order_acquire); p != nullptr; p = p->next) {
+            std::lock_guard<std::mutex> listLock(p->retiredMutex);
+            candidates.insert(candidates.end(), p->retired.begin(), p->retired.end());
+            p->retired.clear();
+        }
+        if (candidates.empty()) {
+            return 0;
+        }
+
+        freeable = partitionFreeable(candidates);
+        deferred.assign(candidates.begin(), freeable);
+    }
+
+    // Deleters run outside the lock; freeing a large value must not stall
+    // another reclaimer.
+    runDeleters(freeable, candidates.end());
+    return candidates.end() - freeable;
+}
+
+size_t epoch::pending() {
+    size_t count = 0;
+    {
+        std::lock_guard<std::mutex> lock(reclaimMutex);
+        count = deferred.size();
+    }
+    for (Participant* p = participants.load(std::memory_order_acquire); p != nullptr; p = p->next) {
+        std::lock_guard<std::mutex> lock(p->retiredMutex);
+        count += p->retired.size();
+    }
+    return count;
+}
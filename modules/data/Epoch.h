@@ -0,0 +1,52 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Objects a thread retires before collect() frees its share.
+#define EPOCH_RECLAIM_THRESHOLD 128
+
+// Epoch-based memory reclamation for the lock-free read paths in Store.
+//
+// Readers wrap every traversal in an epoch::Guard, which publishes the
+// global epoch they entered at. Writers unlink objects first and then hand
+// them to retire(); an object is only destroyed once every thread that was
+// inside a guard when it was retired has left it.
+//
+// Each thread queues what it retires on a list of its own, so writers on
+// different shards never contend here, and retire() never frees anything:
+// deleters run from collect(), which Store calls once a writer has
+// released its last shard lock, and from the maintenance thread's
+// reclaim(), so no client waits on a lock while garbage is freed.
+namespace epoch {
+
+class Guard {
+public:
+    Guard();
+    ~Guard();
+
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+};
+
+typedef void (*Deleter)(void*);
+
+// Queues `ptr` for destruction by `deleter` after the current grace period.
+void retire(void* ptr, Deleter deleter);
+
+// Destroys what the calling thread retired that no reader can still reach,
+// once EPOCH_RECLAIM_THRESHOLD objects are pending or, with `force`, any.
+// The caller must hold no lock a deleter could stall others on. Returns the
+// number of objects freed.
+size_t collect(bool force = false);
+
+// Same for every thread's objects, those of exited threads included.
+size_t reclaim();
+
+size_t pending();
+
+}
+
+#endif // EPOCH_H
@@ -0,0 +1,446 @@
+#include "HyperLogLog.h"
+#include "core/Bits.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#define HLL_Q (64 - HLL_P)
+#define HLL_DENSE 0
+#define HLL_SPARSE 1
+#define HLL_ALPHA_INF 0.721347520444481703680
+#define HLL_HASH_SEED 0xadc83b19ULL
+
+namespace hll {
+
+namespace {
+
+// A run of `len` registers holding `value`: the sparse encoding, decoded.
+struct Run {
+    uint8_t value;
+    uint32_t len;
+};
+
+// MurmurHash64A, as Redis hashes HyperLogLog elements.
+uint64_t murmurHash64A(const void* key, size_t len, uint64_t seed) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t h = seed ^ (len * m);
+    const uint8_t* data = static_cast<const uint8_t*>(key);
+    const uint8_t* end = data + (len - (len & 7));
+    for (; data != end; data += 8) {
+        uint64_t k;
+        std::memcpy(&k, data, sizeof(k));
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+
+    switch (len & 7) {
+        case 7: h ^= uint64_t(data[6]) << 48; [[fallthrough]];
+        case 6: h ^= uint64_t(data[5]) << 40; [[fallthrough]];
+        case 5: h ^= uint64_t(data[4]) << 32; [[fallthrough]];
+        case 4: h ^= uint64_t(data[3]) << 24; [[fallthrough]];
+        case 3: h ^= uint64_t(data[2]) << 16; [[fallthrough]];
+        case 2: h ^= uint64_t(data[1]) << 8; [[fallthrough]];
+        case 1:
+            h ^= uint64_t(data[0]);
+            h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+// The register an element falls into, and the length of the run of zero
+// bits that follows in its hash, plus one.
+void hashElement(const std::string& element, size_t& index, uint8_t& count) {
+    uint64_t hash = murmurHash64A(element.data(), element.size(), HLL_HASH_SEED);
+    index = hash & (HLL_REGISTERS - 1);
+    hash >>= HLL_P;
+    hash |= uint64_t(1) << HLL_Q;
+    count = __builtin_ctzll(hash) + 1;
+}
+
+uint8_t* registerBytes(std::string& value) {
+    return reinterpret_cast<uint8_t*>(value.data()) + HLL_HEADER_SIZE;
+}
+
+const uint8_t* registerBytes(std::string_view value) {
+    return reinterpret_cast<const uint8_t*>(value.data()) + HLL_HEADER_SIZE;
+}
+
+void invalidateCache(std::string& value) {
+    value[15] = static_cast<char>(uint8_t(value[15]) | 0x80);
+}
+
+// Dense registers are packed least significant bit first: register n holds
+// bits [6n, 6n + 6) of the array.
+uint8_t denseGet(const uint8_t* p, size_t n) {
+    size_t byte = n * HLL_BITS / 8;
+    unsigned shift = n * HLL_BITS & 7;
+    unsigned v = p[byte] >> shift;
+    if (shift > 8 - HLL_BITS) {
+        v |= p[byte + 1] << (8 - shift);
+    }
+    return v & 63;
+}
+
+void denseSet(uint8_t* p, size_t n, uint8_t v) {
+    size_t byte = n * HLL_BITS / 8;
+    unsigned shift = n * HLL_BITS & 7;
+    p[byte] = (p[byte] & ~(63 << shift)) | (v << shift);
+    if (shift > 8 - HLL_BITS) {
+        p[byte + 1] = (p[byte + 1] & ~(63 >> (8 - shift))) | (v >> (8 - shift));
+    }
+}
+
+// Register value counts. Four partial histograms keep consecutive equal
+// registers from waiting on each other's increments.
+void histogramOf(const uint8_t* registers, uint32_t* histogram) {
+    uint32_t partial[4][64] = {};
+    for (size_t n = 0; n < HLL_REGISTERS; n += 4) {
+        partial[0][registers[n] & 63]++;
+        partial[1][registers[n + 1] & 63]++;
+        partial[2][registers[n + 2] & 63]++;
+        partial[3][registers[n + 3] & 63]++;
+    }
+    for (int v = 0; v < 64; v++) {
+        histogram[v] += partial[0][v] + partial[1][v] + partial[2][v] + partial[3][v];
+    }
+}
+
+void packDense(const uint8_t* registers, uint8_t* p) {
+    for (size_t n = 0; n < HLL_REGISTERS; n += 4, p += 3) {
+        p[0] = registers[n] | (registers[n + 1] << 6);
+        p[1] = (registers[n + 1] >> 2) | (registers[n + 2] << 4);
+        p[2] = (registers[n + 2] >> 4) | (registers[n + 3] << 2);
+    }
+}
+
+std::vector<Run> decodeSparse(std::string_view value) {
+    std::vector<Run> runs;
+    size_t total = 0;
+    for (size_t i = HLL_HEADER_SIZE; i < value.size();) {
+        uint8_t op = value[i];
+        Run run{0, 0};
+        if ((op & 0xc0) == 0x00) {
+            run.len = (op & 0x3f) + 1;
+            i++;
+        }
+        else if ((op & 0xc0) == 0x40) {
+            if (i + 1 >= value.size()) {
+                throw std::invalid_argument("truncated HyperLogLog opcode");
+            }
+            run.len = (((op & 0x3f) << 8) | uint8_t(value[i + 1])) + 1;
+            i += 2;
+        }
+        else {
+            run.value = ((op >> 2) & 0x1f) + 1;
+            run.len = (op & 0x3) + 1;
+            i++;
+        }
+
+        total += run.len;
+        if (total > HLL_REGISTERS) {
+            throw std::invalid_argument("HyperLogLog runs past its registers");
+        }
+        if (!runs.empty() && runs.back().value == run.value) {
+            runs.back().len += run.len;
+        }
+        else {
+            runs.push_back(run);
+        }
+    }
+
+    if (total != HLL_REGISTERS) {
+        throw std::invalid_argument("HyperLogLog runs short of its registers");
+    }
+    return runs;
+}
+
+// Appends the opcodes of `len` registers holding `value`.
+void encodeRun(uint8_t value, uint32_t len, std::string& out) {
+    while (len > 0) {
+        uint32_t n;
+        if (value != 0) {
+            n = std::min<uint32_t>(len, 4);
+            out += static_cast<char>(0x80 | ((value - 1) << 2) | (n - 1));
+        }
+        else if (len <= 64) {
+            n = len;
+            out += static_cast<char>(n - 1);
+        }
+        else {
+            n = std::min<uint32_t>(len, HLL_REGISTERS);
+            out += static_cast<char>(0x40 | ((n - 1) >> 8));
+            out += static_cast<char>((n - 1) & 0xff);
+        }
+        len -= n;
+    }
+}
+
+// Appends the opcodes of `runs`; adjacent runs of one value are joined.
+void encodeSparse(const std::vector<Run>& runs, std::string& out) {
+    for (size_t i = 0; i < runs.size();) {
+        uint8_t value = runs[i].value;
+        uint32_t len = 0;
+        for (; i < runs.size() && runs[i].value == value; i++) {
+            len += runs[i].len;
+        }
+        encodeRun(value, len, out);
+    }
+}
+
+// Raises register `index` of a sparse sketch to `count` in place, by
+// splitting the opcode that covers it. Returns whether it was lower; false
+// with `tooLarge` set if it was but `count` needs the dense encoding.
+bool sparseSet(std::string& value, size_t index, uint8_t count, bool& tooLarge) {
+    size_t start = 0;
+    size_t i = HLL_HEADER_SIZE;
+    Run run{0, 0};
+    size_t width = 0;
+    while (true) {
+        if (i >= value.size()) {
+            throw std::invalid_argument("HyperLogLog runs short of its registers");
+        }
+        uint8_t op = value[i];
+        width = (op & 0xc0) == 0x40 ? 2 : 1;
+        if (i + width > value.size()) {
+            throw std::invalid_argument("truncated HyperLogLog opcode");
+        }
+        run.value = op & 0x80 ? ((op >> 2) & 0x1f) + 1 : 0;
+        run.len = op & 0x80 ? (op & 0x3) + 1 : width == 1 ? (op & 0x3f) + 1 : (((op & 0x3f) << 8) | uint8_t(value[i + 1])) + 1;
+        if (start + run.len > index) {
+            break;
+        }
+        start += run.len;
+        i += width;
+    }
+
+    if (run.value >= count) {
+        return false;
+    }
+    if (count > HLL_SPARSE_VAL_MAX) {
+        tooLarge = true;
+        return false;
+    }
+
+    std::string split;
+    encodeRun(run.value, index - start, split);
+    encodeRun(count, 1, split);
+    encodeRun(run.value, start + run.len - index - 1, split);
+    value.replace(i, width, split);
+    return true;
+}
+
+std::string header(uint8_t encoding) {
+    std::string value(HLL_HEADER_SIZE, '\0');
+    std::memcpy(value.data(), "HYLL", 4);
+    value[4] = encoding;
+    return value;
+}
+
+void runsToRegisters(const std::vector<Run>& runs, uint8_t* registers) {
+    size_t n = 0;
+    for (const Run& run : runs) {
+        std::memset(registers + n, run.value, run.len);
+        n += run.len;
+    }
+}
+
+std::string denseFromRegisters(const uint8_t* registers) {
+    std::string value = header(HLL_DENSE);
+    value.resize(HLL_DENSE_SIZE);
+    packDense(registers, registerBytes(value));
+    return value;
+}
+
+// The estimator of Ertl's "New cardinality estimation algorithms for
+// HyperLogLog sketches", from the histogram of register values, as Redis
+// computes it.
+double sigma(double x) {
+    if (x == 1.0) {
+        return INFINITY;
+    }
+    double y = 1.0;
+    double z = x;
+    double previous;
+    do {
+        x *= x;
+        previous = z;
+        z += x * y;
+        y += y;
+    } while (previous != z);
+    return z;
+}
+
+double tau(double x) {
+    if (x == 0.0 || x == 1.0) {
+        return 0.0;
+    }
+    double y = 1.0;
+    double z = 1 - x;
+    double previous;
+    do {
+        x = std::sqrt(x);
+        previous = z;
+        y *= 0.5;
+        z -= std::pow(1 - x, 2) * y;
+    } while (previous != z);
+    return z / 3;
+}
+
+uint64_t estimateHistogram(const uint32_t* histogram) {
+    double m = HLL_REGISTERS;
+    double z = m * tau((m - histogram[HLL_Q + 1]) / m);
+    for (int j = HLL_Q; j >= 1; j--) {
+        z += histogram[j];
+        z *= 0.5;
+    }
+    z += m * sigma(histogram[0] / m);
+    return static_cast<uint64_t>(std::llround(HLL_ALPHA_INF * m * m / z));
+}
+
+} // namespace
+
+std::string create() {
+    std::string value = header(HLL_SPARSE);
+    encodeSparse({{0, HLL_REGISTERS}}, value);
+    return value;
+}
+
+bool isHll(std::string_view value) {
+    if (value.size() < HLL_HEADER_SIZE || value.compare(0, 4, "HYLL") != 0) {
+        return false;
+    }
+    uint8_t encoding = value[4];
+    return encoding == HLL_SPARSE || (encoding == HLL_DENSE && value.size() == HLL_DENSE_SIZE);
+}
+
+bool add(std::string& value, const std::vector<std::string>& elements, size_t sparseMaxBytes) {
+    std::vector<std::pair<size_t, uint8_t>> hashed(elements.size());
+    for (size_t i = 0; i < elements.size(); i++) {
+        hashElement(elements[i], hashed[i].first, hashed[i].second);
+    }
+
+    bool changed = false;
+    size_t next = 0;
+    if (value[4] == HLL_SPARSE) {
+        bool tooLarge = false;
+        for (; next < hashed.size() && !tooLarge; next++) {
+            changed |= sparseSet(value, hashed[next].first, hashed[next].second, tooLarge);
+        }
+        if (!tooLarge && value.size() - HLL_HEADER_SIZE <= sparseMaxBytes) {
+            if (changed) {
+                invalidateCache(value);
+            }
+            return changed;
+        }
+
+        // Too large for the sparse encoding: go dense and add the rest, and
+        // the element that did not fit, there.
+        next -= tooLarge ? 1 : 0;
+        uint8_t registers[HLL_REGISTERS];
+        runsToRegisters(decodeSparse(value), registers);
+        value = denseFromRegisters(registers);
+    }
+
+    uint8_t* p = registerBytes(value);
+    for (; next < hashed.size(); next++) {
+        auto [index, count] = hashed[next];
+        if (denseGet(p, index) < count) {
+            denseSet(p, index, count);
+            changed = true;
+        }
+    }
+    if (changed) {
+        invalidateCache(value);
+    }
+    return changed;
+}
+
+std::optional<uint64_t> cached(std::string_view value) {
+    if (uint8_t(value[15]) & 0x80) {
+        return std::nullopt;
+    }
+    uint64_t card = 0;
+    for (int i = 7; i >= 0; i--) {
+        card = (card << 8) | uint8_t(value[8 + i]);
+    }
+    return card;
+}
+
+uint64_t count(std::string& value) {
+    uint32_t histogram[64] = {};
+    if (value[4] == HLL_SPARSE) {
+        for (const Run& run : decodeSparse(value)) {
+            histogram[run.value] += run.len;
+        }
+    }
+    else {
+        uint8_t registers[HLL_REGISTERS];
+        bits::unpack6(registerBytes(value), registers, HLL_REGISTERS);
+        histogramOf(registers, histogram);
+    }
+
+    uint64_t card = estimateHistogram(histogram);
+    for (int i = 0; i < 8; i++) {
+        value[8 + i] = static_cast<char>(card >> (8 * i));
+    }
+    return card;
+}
+
+void merge(std::string_view value, uint8_t* registers) {
+    if (value[4] == HLL_SPARSE) {
+        size_t n = 0;
+        for (const Run& run : decodeSparse(value)) {
+            for (size_t i = n; run.value != 0 && i < n + run.len; i++) {
+                registers[i] = std::max(registers[i], run.value);
+            }
+            n += run.len;
+        }
+        return;
+    }
+
+    uint8_t unpacked[HLL_REGISTERS];
+    bits::unpack6(registerBytes(value), unpacked, HLL_REGISTERS);
+    bits::combine(bits::Op::Max, registers, unpacked, HLL_REGISTERS);
+}
+
+uint64_t estimate(const uint8_t* registers) {
+    uint32_t histogram[64] = {};
+    histogramOf(registers, histogram);
+    return estimateHistogram(histogram);
+}
+
+std::string fromRegisters(const uint8_t* registers, size_t sparseMaxBytes) {
+    std::vector<Run> runs;
+    bool fits = true;
+    for (size_t n = 0; n < HLL_REGISTERS && fits; n++) {
+        fits = registers[n] <= HLL_SPARSE_VAL_MAX;
+        if (!runs.empty() && runs.back().value == registers[n]) {
+            runs.back().len++;
+        }
+        else {
+            runs.push_back({registers[n], 1});
+        }
+    }
+
+    std::string value;
+    if (fits) {
+        value = header(HLL_SPARSE);
+        encodeSparse(runs, value);
+    }
+    if (!fits || value.size() - HLL_HEADER_SIZE > sparseMaxBytes) {
+        value = denseFromRegisters(registers);
+    }
+    invalidateCache(value);
+    return value;
+}
+
+} // namespace hll
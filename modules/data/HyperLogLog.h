@@ -0,0 +1,61 @@
+#ifndef HYPERLOGLOG_H
+#define HYPERLOGLOG_H
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define HLL_P 14
+#define HLL_REGISTERS (1 << HLL_P)
+#define HLL_BITS 6
+#define HLL_HEADER_SIZE 16
+#define HLL_DENSE_SIZE (HLL_HEADER_SIZE + (HLL_REGISTERS * HLL_BITS + 7) / 8)
+// Largest register value the sparse encoding can hold.
+#define HLL_SPARSE_VAL_MAX 32
+
+// HyperLogLog sketches for PFADD, PFCOUNT and PFMERGE. A sketch is an
+// ordinary string value in Redis' own layout, so it is saved, replicated
+// and dumped like any string and can be moved to and from a real Redis.
+//
+// The value starts with a 16-byte header: "HYLL", the encoding, three
+// unused bytes and the cached cardinality, little endian, whose top bit
+// marks it stale. The 16384 registers follow in one of two encodings:
+// - dense: 6 bits per register, 12 KB in all
+// - sparse: runs of equal registers, as ZERO (one byte for up to 64 zero
+//   registers), XZERO (two bytes for up to 16384) and VAL (one byte for up
+//   to 4 registers of a value up to 32) opcodes
+// A new sketch is sparse, two bytes of registers, and turns dense once a
+// register outgrows the VAL opcode or the runs outgrow the caller's limit
+// (hll_sparse_max_bytes).
+//
+// Functions that decode registers throw std::invalid_argument on malformed
+// register data.
+namespace hll {
+
+// An empty sketch.
+std::string create();
+// Whether `value` has the header and size of a sketch.
+bool isHll(std::string_view value);
+
+// Adds `elements`; returns whether any register changed, which also marks
+// the cached cardinality stale.
+bool add(std::string& value, const std::vector<std::string>& elements, size_t sparseMaxBytes);
+
+// The cached cardinality, unless it is stale.
+std::optional<uint64_t> cached(std::string_view value);
+// Estimates the cardinality and caches it in the value.
+uint64_t count(std::string& value);
+
+// Merges the registers of `value` into `registers`, HLL_REGISTERS of them,
+// one per byte, keeping the larger of each pair.
+void merge(std::string_view value, uint8_t* registers);
+// Cardinality estimate of HLL_REGISTERS one-byte registers.
+uint64_t estimate(const uint8_t* registers);
+// A sketch of `registers`, sparse if that fits in `sparseMaxBytes`.
+std::string fromRegisters(const uint8_t* registers, size_t sparseMaxBytes);
+
+} // namespace hll
+
+#endif // HYPERLOGLOG_H
@@ -0,0 +1,64 @@
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "LazyFree.h"
+#include "config/Config.h"
+
+namespace {
+
+std::mutex queueMutex;
+std::condition_variable queueCond;
+std::deque<std::function<void()>> jobs;
+std::atomic<size_t> pendingJobs{0};
+std::atomic<size_t> completedJobs{0};
+std::once_flag workerStarted;
+
+void worker() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            queueCond.wait(lock, [] { return !jobs.empty(); });
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+
+        job();
+        job = nullptr;
+        pendingJobs.fetch_sub(1, std::memory_order_relaxed);
+        completedJobs.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+}
+
+void lazyfree::enqueue(std::function<void()> job) {
+    std::call_once(workerStarted, [] {
+        std::thread(worker).detach();
+    });
+
+    pendingJobs.fetch_add(1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        jobs.push_back(std::move(job));
+    }
+    queueCond.notify_one();
+}
+
+bool lazyfree::shouldDefer(size_t elements) {
+    return elements > static_cast<size_t>(config::GlobalConfig.lazyfreeThreshold);
+}
+
+bool lazyfree::shouldDeferBytes(size_t bytes) {
+    return bytes > static_cast<size_t>(config::GlobalConfig.lazyfreeThresholdBytes);
+}
+
+size_t lazyfree::pending() {
+    return pendingJobs.load(std::memory_order_relaxed);
+}
+
+size_t lazyfree::completed() {
+    return completedJobs.load(std::memory_order_relaxed);
+}
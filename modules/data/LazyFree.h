@@ -0,0 +1,28 @@
+#ifndef LAZYFREE_H
+#define LAZYFREE_H
+
+#include <cstddef>
+#include <functional>
+
+// Background destruction of large values.
+//
+// Dropping a list with millions of elements, or a whole shard table on
+// FLUSHALL, is linear in the number of allocations. Callers detach such
+// objects from the keyspace under their lock and hand ownership to a job
+// here, which runs on a single lazy-free thread started on first use.
+namespace lazyfree {
+
+// `job` must only destroy objects it owns.
+void enqueue(std::function<void()> job);
+
+// Whether freeing an object made of `elements` allocations, or a single
+// allocation of `bytes`, is expensive enough to be moved off-thread.
+bool shouldDefer(size_t elements);
+bool shouldDeferBytes(size_t bytes);
+
+size_t pending();
+size_t completed();
+
+}
+
+#endif // LAZYFREE_H
@@ -0,0 +1,299 @@
+#include <atomic>
+#include <cstdlib>
+#include <iomanip>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include "Slab.h"
+
+namespace {
+
+const size_t CLASS_SIZES[] = {
+    16, 32, 48, 64, 80, 96, 112, 128,
+    160, 192, 224, 256, 320, 384, 448, 512,
+    640, 768, 896, 1024, 1280, 1536, 1792, 2048,
+    2560, 3072, 3584, 4096
+};
+const size_t CLASS_COUNT = sizeof(CLASS_SIZES) / sizeof(CLASS_SIZES[0]);
+
+// Lives at the start of every page; pages are SLAB_PAGE_SIZE-aligned so an
+// object's page is found by masking its address.
+struct Page {
+    Page* prev;
+    Page* next;
+    void* freeList;
+    char* bump;
+    uint32_t sizeClass;
+    uint32_t used;
+    uint32_t bucket;
+};
+
+const size_t PAGE_HEADER = (sizeof(Page) + 63) & ~size_t(63);
+
+struct SizeClass {
+    std::mutex mutex;
+    size_t objectSize = 0;
+    size_t capacity = 0;
+    // Pages by occupancy: bucket i holds the partial pages between i and
+    // i + 1 SLAB_OCCUPANCY_BUCKETS-ths full, the last one the full pages.
+    Page* buckets[SLAB_OCCUPANCY_BUCKETS + 1] = {};
+    Page* current = nullptr;
+    size_t pages = 0;
+    size_t usedObjects = 0;
+};
+
+struct Allocator {
+    SizeClass classes[CLASS_COUNT];
+    uint8_t classOf[SLAB_MAX_OBJECT / 16 + 1];
+    std::atomic<size_t> requestedBytes{0};
+    std::atomic<size_t> largeBytes{0};
+    std::atomic<size_t> defragHits{0};
+    std::atomic<size_t> defragMisses{0};
+
+    Allocator() {
+        size_t c = 0;
+        for (size_t i = 0; i <= SLAB_MAX_OBJECT / 16; i++) {
+            while (CLASS_SIZES[c] < i * 16) {
+                c++;
+            }
+            classOf[i] = c;
+        }
+        for (size_t i = 0; i < CLASS_COUNT; i++) {
+            classes[i].objectSize = CLASS_SIZES[i];
+            classes[i].capacity = (SLAB_PAGE_SIZE - PAGE_HEADER) / CLASS_SIZES[i];
+        }
+    }
+};
+
+Allocator& allocator() {
+    static Allocator instance;
+    return instance;
+}
+
+Page* pageOf(void* ptr) {
+    return reinterpret_cast<Page*>(reinterpret_cast<uintptr_t>(ptr) & ~uintptr_t(SLAB_PAGE_SIZE - 1));
+}
+
+bool isFull(const SizeClass& cls, const Page* page) {
+    return page->used == cls.capacity;
+}
+
+uint32_t bucketOf(const SizeClass& cls, const Page* page) {
+    if (isFull(cls, page)) {
+        return SLAB_OCCUPANCY_BUCKETS;
+    }
+    return page->used * SLAB_OCCUPANCY_BUCKETS / cls.capacity;
+}
+
+void link(SizeClass& cls, Page* page, uint32_t bucket) {
+    page->bucket = bucket;
+    page->prev = nullptr;
+    page->next = cls.buckets[bucket];
+    if (page->next != nullptr) {
+        page->next->prev = page;
+    }
+    cls.buckets[bucket] = page;
+}
+
+void unlink(SizeClass& cls, Page* page) {
+    if (page->prev != nullptr) {
+        page->prev->next = page->next;
+    }
+    else {
+        cls.buckets[page->bucket] = page->next;
+    }
+    if (page->next != nullptr) {
+        page->next->prev = page->prev;
+    }
+}
+
+// Moves `page` to the bucket of its current occupancy.
+void refile(SizeClass& cls, Page* page) {
+    uint32_t bucket = bucketOf(cls, page);
+    if (bucket != page->bucket) {
+        unlink(cls, page);
+        link(cls, page, bucket);
+    }
+}
+
+Page* newPage(SizeClass& cls, uint32_t sizeClass) {
+    void* mem = std::aligned_alloc(SLAB_PAGE_SIZE, SLAB_PAGE_SIZE);
+    if (mem == nullptr) {
+        throw std::bad_alloc();
+    }
+
+    Page* page = static_cast<Page*>(mem);
+    page->freeList = nullptr;
+    page->bump = static_cast<char*>(mem) + PAGE_HEADER;
+    page->sizeClass = sizeClass;
+    page->used = 0;
+    link(cls, page, 0);
+    cls.pages++;
+    return page;
+}
+
+void freePage(SizeClass& cls, Page* page) {
+    unlink(cls, page);
+    cls.pages--;
+    std::free(page);
+}
+
+// Prefers a page from the fullest bucket that still has room, so
+// allocations pile onto dense pages and sparse ones are left to drain.
+// Looks at no more than two pages per bucket however many the class has.
+Page* fullestPartialPage(SizeClass& cls, const Page* exclude) {
+    for (uint32_t bucket = SLAB_OCCUPANCY_BUCKETS; bucket-- > 0;) {
+        Page* page = cls.buckets[bucket];
+        if (page == exclude && page != nullptr) {
+            page = page->next;
+        }
+        if (page != nullptr) {
+            return page;
+        }
+    }
+
+    return nullptr;
+}
+
+void* takeSlot(SizeClass& cls, Page* page) {
+    void* obj;
+    if (page->freeList != nullptr) {
+        obj = page->freeList;
+        page->freeList = *static_cast<void**>(obj);
+    }
+    else {
+        obj = page->bump;
+        page->bump += cls.objectSize;
+    }
+
+    page->used++;
+    cls.usedObjects++;
+    refile(cls, page);
+    return obj;
+}
+
+}
+
+void* slab::alloc(size_t size) {
+    Allocator& a = allocator();
+    a.requestedBytes.fetch_add(size, std::memory_order_relaxed);
+    if (size > SLAB_MAX_OBJECT) {
+        a.largeBytes.fetch_add(size, std::memory_order_relaxed);
+        return ::operator new(size);
+    }
+
+    uint32_t sizeClass = a.classOf[(size + 15) / 16];
+    SizeClass& cls = a.classes[sizeClass];
+    std::lock_guard<std::mutex> lock(cls.mutex);
+    if (cls.current == nullptr || isFull(cls, cls.current)) {
+        cls.current = fullestPartialPage(cls, nullptr);
+        if (cls.current == nullptr) {
+            cls.current = newPage(cls, sizeClass);
+        }
+    }
+
+    return takeSlot(cls, cls.current);
+}
+
+void slab::release(void* ptr, size_t size) {
+    Allocator& a = allocator();
+    a.requestedBytes.fetch_sub(size, std::memory_order_relaxed);
+    if (size > SLAB_MAX_OBJECT) {
+        a.largeBytes.fetch_sub(size, std::memory_order_relaxed);
+        ::operator delete(ptr);
+        return;
+    }
+
+    Page* page = pageOf(ptr);
+    SizeClass& cls = a.classes[page->sizeClass];
+    std::lock_guard<std::mutex> lock(cls.mutex);
+    *static_cast<void**>(ptr) = page->freeList;
+    page->freeList = ptr;
+    page->used--;
+    cls.usedObjects--;
+    refile(cls, page);
+
+    if (page->used == 0 && page != cls.current) {
+        freePage(cls, page);
+    }
+}
+
+void* slab::defragAlloc(void* ptr, size_t size) {
+    if (size > SLAB_MAX_OBJECT) {
+        return nullptr;
+    }
+
+    Allocator& a = allocator();
+    Page* page = pageOf(ptr);
+    SizeClass& cls = a.classes[page->sizeClass];
+    std::lock_guard<std::mutex> lock(cls.mutex);
+
+    // Only pages emptier than the class average are worth evacuating, and
+    // only into a page that is already fuller than the one being drained.
+    bool sparse = page != cls.current && page->used * cls.pages < cls.usedObjects;
+    Page* target = nullptr;
+    if (sparse) {
+        if (cls.current != nullptr && cls.current != page && !isFull(cls, cls.current)) {
+            target = cls.current;
+        }
+        else {
+            target = fullestPartialPage(cls, page);
+        }
+    }
+
+    if (target == nullptr || target->used <= page->used) {
+        a.defragMisses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    a.defragHits.fetch_add(1, std::memory_order_relaxed);
+    a.requestedBytes.fetch_add(size, std::memory_order_relaxed);
+    return takeSlot(cls, target);
+}
+
+double slab::Stats::fragmentation() const {
+    if (allocatedBytes == 0) {
+        return 1.0;
+    }
+
+    return static_cast<double>(slabBytes + largeBytes) / allocatedBytes;
+}
+
+slab::Stats slab::stats() {
+    Allocator& a = allocator();
+    Stats s{};
+    for (SizeClass& cls : a.classes) {
+        std::lock_guard<std::mutex> lock(cls.mutex);
+        s.classes.push_back({cls.objectSize, cls.pages, cls.usedObjects, cls.pages * cls.capacity});
+        s.slabBytes += cls.pages * SLAB_PAGE_SIZE;
+        s.allocatedBytes += cls.usedObjects * cls.objectSize;
+    }
+
+    s.requestedBytes = a.requestedBytes.load(std::memory_order_relaxed);
+    s.largeBytes = a.largeBytes.load(std::memory_order_relaxed);
+    s.allocatedBytes += s.largeBytes;
+    s.defragHits = a.defragHits.load(std::memory_order_relaxed);
+    s.defragMisses = a.defragMisses.load(std::memory_order_relaxed);
+    return s;
+}
+
+std::string slab::formatStats(const Stats& s) {
+    std::ostringstream out;
+    out << "requested_bytes:" << s.requestedBytes << "\r\n"
+        << "allocated_bytes:" << s.allocatedBytes << "\r\n"
+        << "slab_bytes:" << s.slabBytes << "\r\n"
+        << "large_bytes:" << s.largeBytes << "\r\n"
+        << "fragmentation:" << std::fixed << std::setprecision(2) << s.fragmentation() << "\r\n"
+        << "defrag_hits:" << s.defragHits << "\r\n"
+        << "defrag_misses:" << s.defragMisses << "\r\n";
+
+    for (const ClassStats& c : s.classes) {
+        if (c.pages == 0) {
+            continue;
+        }
+        out << "class_" << c.objectSize << ":pages=" << c.pages
+            << ",used=" << c.usedObjects << ",capacity=" << c.capacity << "\r\n";
+    }
+
+    return out.str();
+}
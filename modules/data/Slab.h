@@ -0,0 +1,60 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define SLAB_PAGE_SIZE 65536
+#define SLAB_MAX_OBJECT 4096
+// Partial pages of a size class are grouped into this many occupancy
+// ranges, so finding a dense page with room does not walk every page.
+#define SLAB_OCCUPANCY_BUCKETS 16
+
+// Size-class slab allocator for Store records and hash nodes.
+//
+// Objects up to SLAB_MAX_OBJECT bytes are carved out of SLAB_PAGE_SIZE
+// pages that each hold a single size class, so churn of similarly sized
+// values reuses the same slots instead of fragmenting the general heap.
+// Larger objects fall through to operator new. Callers always pass the
+// allocation size back on release, which is how large objects are told
+// apart from slab objects.
+namespace slab {
+
+void* alloc(size_t size);
+void release(void* ptr, size_t size);
+
+// Active defragmentation support. If `ptr` sits on a page that is sparser
+// than its size class average, returns a fresh slot on a denser page; the
+// caller copies the object there, republishes it, and releases the old
+// pointer. Returns nullptr when moving would not help.
+void* defragAlloc(void* ptr, size_t size);
+
+struct ClassStats {
+    size_t objectSize;
+    size_t pages;
+    size_t usedObjects;
+    size_t capacity;
+};
+
+struct Stats {
+    size_t requestedBytes;   // sum of sizes handed out
+    size_t allocatedBytes;   // the same, rounded up to size classes
+    size_t slabBytes;        // pages held for small objects
+    size_t largeBytes;       // objects served by operator new
+    size_t defragHits;       // objects relocated by defragAlloc
+    size_t defragMisses;     // defragAlloc calls that found nothing to gain
+    std::vector<ClassStats> classes;
+
+    // Held-to-allocated ratio: how much memory sits in partially empty
+    // pages. Size-class rounding is not counted since defrag cannot fix it.
+    double fragmentation() const;
+};
+
+Stats stats();
+std::string formatStats(const Stats& s);
+
+}
+
+#endif // SLAB_H
@@ -1,9 +1,59 @@
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <thread>
 #include "Store.h"
+#include "LazyFree.h"
+#include "Slab.h"
+#include "config/Config.h"
+#include "tracking/Tracking.h"
+#include "stats/HotKeys.h"
+#include "stats/Latency.h"
 
 Store* Store::instance = nullptr;
 std::mutex Store::instanceMutex;
-Store::DataType Store::data;
-Store::ListType Store::listData;
+
+// Shards the current thread holds through runLocked(), one bit per shard.
+static thread_local uint32_t heldShards = 0;
+// DataWriteLocks the calling thread holds; once the last goes, it frees its
+// share of retired records.
+static thread_local int writeLocks = 0;
+
+// Wakes clients blocked on streams. Writers only take the mutex while
+// someone waits.
+static std::mutex streamWaitMutex;
+static std::condition_variable streamWait;
+static std::atomic<uint64_t> streamChangeCount{0};
+static std::atomic<size_t> streamWaiters{0};
+
+// Tiered storage totals since start.
+static std::atomic<uint64_t> tierSpills{0};
+static std::atomic<uint64_t> tierFaults{0};
+static std::atomic<uint64_t> tierCompactions{0};
+
+static void notifyStreamChange() {
+    streamChangeCount.fetch_add(1);
+    if (streamWaiters.load() != 0) {
+        std::lock_guard<std::mutex> lock(streamWaitMutex);
+        streamWait.notify_all();
+    }
+}
+
+template <typename Map>
+static size_t streamEntries(const Map& streams) {
+    size_t entries = streams.size();
+    for (const auto& [key, stream] : streams) {
+        entries += stream->size();
+    }
+    return entries;
+}
+
+Store::Store() {
+    for (size_t s = 0; s < STORE_SHARD_COUNT; s++) {
+        shards[s].bit = 1u << s;
+    }
+}
 
 Store& Store::getInstance() {
     if (instance == nullptr) {
@@ -23,24 +73,29 @@ void Store::deleteInstance() {
             instance->clear();
             delete instance;
             instance = nullptr;
+            epoch::reclaim();
         }
     }
 }
 
-void Store::clear() {
-    {
-        std::unique_lock<std::shared_mutex> lock(dataMutex);
-        data.clear();
-    }
-    {
-        std::unique_lock<std::shared_mutex> lock(listMutex);
-        listData.clear();
-    }
+// A record holding `stored`, a value in `encoding`.
+static Record* encodedRecord(std::string_view key, std::string_view stored, compression::Encoding encoding,
+                             std::time_t expiryEpoch) {
+    Record* record = Record::create(key, stored, expiryEpoch);
+    record->encoding = static_cast<uint8_t>(encoding);
+    return record;
 }
 
-void Store::set(const std::string& key, const std::string& value, const std::time_t expiryEpoch) {
-    std::unique_lock<std::shared_mutex> lock(dataMutex);
-    data[key] = {value, expiryEpoch};
+// A record for a string value being written, compressed when that is on
+// and pays off. Every write that replaces a string value goes through here,
+// since the recompress walk only revisits records already compressed.
+static Record* stringRecord(std::string_view key, std::string_view value, std::time_t expiryEpoch) {
+    std::string stored;
+    compression::Encoding encoding = compression::encode(value, stored);
+    if (encoding == compression::Encoding::Raw) {
+        return Record::create(key, value, expiryEpoch);
+    }
+    return encodedRecord(key, stored, encoding, expiryEpoch);
 }
 
 static std::time_t nowEpoch() {
@@ -48,89 +103,714 @@ static std::time_t nowEpoch() {
     return std::chrono::system_clock::to_time_t(now);
 }
 
-bool Store::get(const std::string& key, std::string& value) const {
-    bool removeKey = false;
-    {
-        std::shared_lock<std::shared_mutex> lock(dataMutex);
-        auto it = data.find(key);
-        if (it != data.end()) {
-            if (it->second.expiryEpoch > nowEpoch()) {
-                value = it->second.val;
+bool Store::held(const Shard& shard) {
+    return (heldShards & shard.bit) != 0;
+}
+
+Store::DataWriteLock::DataWriteLock(Shard& s) : shard(s), lock(s.dataMutex, std::defer_lock) {
+    if (held(shard)) {
+        return;
+    }
+
+    if (!lock.try_lock()) {
+        latency::Timer timer("store-lock-wait");
+        lock.lock();
+    }
+    shard.dataSeq.store(shard.dataSeq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    writeLocks++;
+}
+
+Store::DataWriteLock::~DataWriteLock() {
+    if (!lock.owns_lock()) {
+        return;
+    }
+
+    shard.dataSeq.store(shard.dataSeq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    lock.unlock();
+    if (--writeLocks == 0 && heldShards == 0) {
+        epoch::collect();
+    }
+}
+
+Store::DataLock::DataLock(const Shard& shard) : lock(shard.dataMutex, std::defer_lock) {
+    if (!held(shard) && !lock.try_lock()) {
+        latency::Timer timer("store-lock-wait");
+        lock.lock();
+    }
+}
+
+Store::ListLock::ListLock(const Shard& shard, bool exclusive)
+    : unique(shard.listMutex, std::defer_lock), shared(shard.listMutex, std::defer_lock) {
+    if (held(shard)) {
+        return;
+    }
+
+    // Uncontended locks are taken without reading the clock.
+    if (exclusive && !unique.try_lock()) {
+        latency::Timer timer("store-lock-wait");
+        unique.lock();
+    }
+    else if (!exclusive && !shared.try_lock()) {
+        latency::Timer timer("store-lock-wait");
+        shared.lock();
+    }
+}
+
+template <typename Fn>
+auto Store::readConsistent(const Shard& shard, Fn fn) const -> decltype(fn()) {
+    uint64_t seq = shard.txSeq.load(std::memory_order_acquire);
+    if ((seq & 1) == 0) {
+        epoch::Guard guard;
+        auto result = fn();
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (shard.txSeq.load(std::memory_order_relaxed) == seq) {
+            return result;
+        }
+    }
+
+    // A transaction is running or ran meanwhile; the data lock waits for it
+    // unless it is our own.
+    DataLock lock(shard);
+    epoch::Guard guard;
+    return fn();
+}
+
+void Store::touch(Shard& shard, const std::string& key) {
+    tracking::invalidate(key);
+    if (shard.watchedCount.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(shard.watchMutex);
+    auto it = shard.watched.find(key);
+    if (it != shard.watched.end()) {
+        it->second.version++;
+    }
+}
+
+void Store::touchAll(Shard& shard) {
+    if (shard.watchedCount.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(shard.watchMutex);
+    for (auto& [key, entry] : shard.watched) {
+        entry.version++;
+    }
+}
+
+// A slot's entries in the slot index begin with these two bytes.
+static std::string slotPrefix(unsigned slot) {
+    return {static_cast<char>(slot >> 8), static_cast<char>(slot & 0xff)};
+}
+
+void Store::fileKey(Shard& shard, std::string_view key, bool add) {
+    if (!slotIndexed.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    unsigned slot = cluster::keyHashSlot(key);
+    std::string entry = slotPrefix(slot);
+    entry.append(key);
+    std::lock_guard<std::mutex> lock(shard.slotMutex);
+    if (add) {
+        if (shard.slotKeys[std::move(entry)]++ == 0) {
+            slotCounts[slot].fetch_add(1, std::memory_order_relaxed);
+        }
+        return;
+    }
+
+    auto it = shard.slotKeys.find(entry);
+    if (it != shard.slotKeys.end() && --it->second == 0) {
+        shard.slotKeys.erase(it);
+        slotCounts[slot].fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+void Store::unfileData(Shard& shard) {
+    if (slotIndexed.load(std::memory_order_relaxed)) {
+        shard.data.forEach([&](const Record& record) { fileKey(shard, record.key(), false); });
+    }
+}
+
+void Store::unfileLists(Shard& shard) {
+    if (!slotIndexed.load(std::memory_order_relaxed)) {
+        return;
+    }
+    for (const auto& [key, list] : shard.listData) {
+        fileKey(shard, key, false);
+    }
+    for (const auto& [key, stream] : shard.streamData) {
+        fileKey(shard, key, false);
+    }
+}
+
+void Store::indexSlots() {
+    // With every shard held, each writer either finishes before the index
+    // is on, and its keys are filed here, or files them itself.
+    runLocked({}, true, [this]() {
+        if (slotIndexed.exchange(true)) {
+            return;
+        }
+        for (Shard& shard : shards) {
+            shard.data.forEach([&](const Record& record) { fileKey(shard, record.key(), true); });
+            for (const auto& [key, list] : shard.listData) {
+                fileKey(shard, key, true);
+            }
+            for (const auto& [key, stream] : shard.streamData) {
+                fileKey(shard, key, true);
+            }
+        }
+    });
+}
+
+size_t Store::countKeysInSlot(unsigned slot) const {
+    return slot < CLUSTER_SLOTS ? slotCounts[slot].load(std::memory_order_relaxed) : 0;
+}
+
+std::vector<std::string> Store::getKeysInSlot(unsigned slot, size_t count) const {
+    std::vector<std::string> keys;
+    std::string prefix = slotPrefix(slot);
+    for (const Shard& shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.slotMutex);
+        for (auto it = shard.slotKeys.lower_bound(prefix);
+             it != shard.slotKeys.end() && keys.size() < count && it->first.compare(0, 2, prefix) == 0; ++it) {
+            keys.push_back(it->first.substr(2));
+        }
+    }
+
+    return keys;
+}
+
+void Store::clear(bool async) {
+    for (Shard& shard : shards) {
+        ListType doomedLists;
+        StreamType doomedStreams;
+        {
+            DataWriteLock lock(shard);
+            unfileData(shard);
+            shard.data.clear(async && lazyfree::shouldDefer(shard.data.size()));
+            shard.expiries = {};
+            shard.expiriesCompacted = 0;
+            touchAll(shard);
+        }
+        {
+            ListLock lock(shard, true);
+            unfileLists(shard);
+            shard.listKeys.clear();
+            doomedLists.swap(shard.listData);
+            shard.streamKeys.clear();
+            doomedStreams.swap(shard.streamData);
+            touchAll(shard);
+        }
+
+        size_t elements = doomedLists.size();
+        for (const auto& [key, list] : doomedLists) {
+            elements += list.size();
+        }
+        if (async && lazyfree::shouldDefer(elements)) {
+            auto* detached = new ListType(std::move(doomedLists));
+            lazyfree::enqueue([detached]() { delete detached; });
+        }
+        if (async && lazyfree::shouldDefer(streamEntries(doomedStreams))) {
+            auto* detached = new StreamType(std::move(doomedStreams));
+            lazyfree::enqueue([detached]() { delete detached; });
+        }
+    }
+
+    tracking::invalidateAll();
+    notifyStreamChange();
+
+    // A synchronous flush releases what it can right away; tables still
+    // pinned by in-flight readers follow at the next reclaim.
+    if (!async && heldShards == 0) {
+        epoch::collect(true);
+    }
+}
+
+uint64_t Store::scan(uint64_t cursor, size_t count, KeyType type,
+                     const std::function<bool(std::string_view)>& match, std::vector<std::string>& keys) const {
+    size_t shardIdx = cursor % STORE_SHARD_COUNT;
+    uint64_t bucketCursor = cursor / STORE_SHARD_COUNT;
+    size_t budget = std::max<size_t>(count, 1) * SCAN_EMPTY_BUCKET_FACTOR;
+    size_t wanted = keys.size() + count;
+    std::time_t now = nowEpoch();
+
+    while (shardIdx < STORE_SHARD_COUNT) {
+        const Shard& shard = shards[shardIdx];
+        uint64_t start = bucketCursor;
+        {
+            epoch::Guard guard;
+            do {
+                bucketCursor = shard.data.scan(bucketCursor, [&](const Record& record) {
+                    if ((type == KeyType::Any || type == KeyType::String) && record.expiryEpoch > now &&
+                        match(record.key())) {
+                        keys.emplace_back(record.key());
+                    }
+                });
+                budget--;
+            } while (bucketCursor != 0 && keys.size() < wanted && budget > 0);
+        }
+
+        // The buckets just walked cover [reverse(start), reverse(cursor)) in
+        // scan order, whatever the table size was at the time.
+        if (type != KeyType::String) {
+            ListLock lock(shard, false);
+            uint64_t end = Dict::reverseBits(bucketCursor);
+            const std::pair<KeyType, const ListKeyIndex*> indexes[] = {{KeyType::List, &shard.listKeys},
+                                                                        {KeyType::Stream, &shard.streamKeys}};
+            for (const auto& [indexType, index] : indexes) {
+                if (type != KeyType::Any && type != indexType) {
+                    continue;
+                }
+                for (auto it = index->lower_bound({Dict::reverseBits(start), std::string_view()});
+                     it != index->end() && (bucketCursor == 0 || it->first < end); ++it) {
+                    if (match(it->second)) {
+                        keys.emplace_back(it->second);
+                    }
+                }
+            }
+        }
+
+        if (bucketCursor == 0) {
+            shardIdx++;
+        }
+        if (keys.size() >= wanted || budget == 0) {
+            break;
+        }
+    }
+
+    if (shardIdx == STORE_SHARD_COUNT) {
+        return 0;
+    }
+
+    return bucketCursor * STORE_SHARD_COUNT + shardIdx;
+}
+
+void Store::forEachData(size_t shard, const std::function<void(const std::string&, const ValueEntry&)>& fn,
+                        bool stored) const {
+    const Shard& s = shards[shard];
+    DataLock lock(s);
+    s.data.forEach([&](const Record& record) {
+        if (stored) {
+            fn(std::string(record.key()), ValueEntry{storedValueOf(s, record), record.expiryEpoch,
+                                                     static_cast<compression::Encoding>(record.encoding)});
+        }
+        else {
+            fn(std::string(record.key()), ValueEntry{valueOf(s, record), record.expiryEpoch});
+        }
+    });
+}
+
+void Store::forEachList(size_t shard, const std::function<void(const std::string&, const std::deque<std::string>&)>& fn) const {
+    ListLock lock(shards[shard], false);
+    for (const auto& [key, list] : shards[shard].listData) {
+        fn(key, list);
+    }
+}
+
+void Store::forEachStream(size_t shard, const std::function<void(const std::string&, const Stream&)>& fn) const {
+    ListLock lock(shards[shard], false);
+    for (const auto& [key, stream] : shards[shard].streamData) {
+        fn(key, *stream);
+    }
+}
+
+void Store::setData(const DataType& d, bool compressRaw) {
+    for (Shard& shard : shards) {
+        DataWriteLock lock(shard);
+        unfileData(shard);
+        shard.data.clear();
+        shard.expiries = {};
+        shard.expiriesCompacted = 0;
+        touchAll(shard);
+    }
+    tracking::invalidateAll();
+
+    for (const auto& [key, entry] : d) {
+        uint64_t hash = Dict::hash(key);
+        Shard& shard = shards[shardIndex(hash)];
+        Record* record = entry.encoding == compression::Encoding::Raw && compressRaw
+                             ? stringRecord(key, entry.val, entry.expiryEpoch)
+                             : encodedRecord(key, entry.val, entry.encoding, entry.expiryEpoch);
+        DataWriteLock lock(shard);
+        if (shard.data.insert(record, hash)) {
+            fileKey(shard, key, true);
+        }
+        if (entry.expiryEpoch != LONG_MAX) {
+            pushExpiry(shard, key, entry.expiryEpoch);
+        }
+        touch(shard, key);
+    }
+}
+
+void Store::setListData(const ListType& ld) {
+    for (Shard& shard : shards) {
+        ListLock lock(shard, true);
+        for (const auto& [key, list] : shard.listData) {
+            fileKey(shard, key, false);
+        }
+        shard.listKeys.clear();
+        shard.listData.clear();
+        touchAll(shard);
+    }
+    tracking::invalidateAll();
+
+    for (const auto& [key, list] : ld) {
+        uint64_t hash = Dict::hash(key);
+        Shard& shard = shards[shardIndex(hash)];
+        ListLock lock(shard, true);
+        auto [it, created] = shard.listData.insert_or_assign(key, list);
+        if (created) {
+            shard.listKeys.emplace(Dict::reverseBits(hash), it->first);
+            fileKey(shard, key, true);
+        }
+        touch(shard, key);
+    }
+}
+
+void Store::setStreamData(StreamType&& sd) {
+    for (Shard& shard : shards) {
+        ListLock lock(shard, true);
+        for (const auto& [key, stream] : shard.streamData) {
+            fileKey(shard, key, false);
+        }
+        shard.streamKeys.clear();
+        shard.streamData.clear();
+        touchAll(shard);
+    }
+    tracking::invalidateAll();
+
+    for (auto& [key, stream] : sd) {
+        uint64_t hash = Dict::hash(key);
+        Shard& shard = shards[shardIndex(hash)];
+        ListLock lock(shard, true);
+        auto [it, created] = shard.streamData.insert_or_assign(key, std::move(stream));
+        if (created) {
+            shard.streamKeys.emplace(Dict::reverseBits(hash), it->first);
+            fileKey(shard, key, true);
+        }
+        touch(shard, key);
+    }
+    notifyStreamChange();
+}
+
+void Store::set(const std::string& key, const std::string& value, const std::time_t expiryEpoch) {
+    uint64_t hash = Dict::hash(key);
+    Shard& shard = shards[shardIndex(hash)];
+    Record* record = stringRecord(key, value, expiryEpoch);
+    DataWriteLock lock(shard);
+    if (shard.data.insert(record, hash)) {
+        fileKey(shard, key, true);
+    }
+    if (expiryEpoch != LONG_MAX) {
+        pushExpiry(shard, key, expiryEpoch);
+    }
+    touch(shard, key);
+}
+
+template <typename Fn>
+bool Store::readValue(const Shard& shard, const std::string& key, uint64_t hash, Fn fn) const {
+    while (true) {
+        std::optional<Tier::Ref> cold;
+        std::time_t expiryEpoch = LONG_MAX;
+        auto encoding = compression::Encoding::Raw;
+        bool found = readConsistent(shard, [&]() {
+            cold.reset();
+            const Record* record = shard.data.find(key, hash);
+            if (record == nullptr || record->expiryEpoch <= nowEpoch()) {
+                return false;
+            }
+            encoding = static_cast<compression::Encoding>(record->encoding);
+            if (record->cold) {
+                cold = refOf(*record);
+                expiryEpoch = record->expiryEpoch;
                 return true;
-            } 
+            }
+
+            record->markAccessed();
+            if (encoding == compression::Encoding::Raw) {
+                fn(record->val(), record->expiryEpoch);
+            }
             else {
-                removeKey = true;
+                fn(std::string_view(compression::decode(encoding, record->val())), record->expiryEpoch);
+            }
+            return true;
+        });
+        if (!found || !cold) {
+            return found;
+        }
+
+        // Outside the guard: the disk read holds up no reclamation either.
+        std::string value;
+        if (fetchCold(shard, key, hash, *cold, value)) {
+            if (encoding != compression::Encoding::Raw) {
+                value = compression::decode(encoding, value);
             }
+            fn(std::string_view(value), expiryEpoch);
+            return true;
         }
     }
+}
+
+bool Store::get(const std::string& key, std::string& value) const {
+    uint64_t hash = Dict::hash(key);
+    return readValue(shards[shardIndex(hash)], key, hash, [&](std::string_view val, std::time_t) {
+        value.assign(val);
+    });
+}
+
+std::optional<ValueEntry> Store::getEntry(const std::string& key) const {
+    uint64_t hash = Dict::hash(key);
+    ValueEntry entry;
+    bool found = readValue(shards[shardIndex(hash)], key, hash, [&](std::string_view val, std::time_t expiryEpoch) {
+        entry = ValueEntry{std::string(val), expiryEpoch};
+    });
+    if (!found) {
+        return std::nullopt;
+    }
+
+    return entry;
+}
+
+bool Store::view(const std::string& key, const std::function<void(std::string_view)>& fn) const {
+    uint64_t hash = Dict::hash(key);
+    return readValue(shards[shardIndex(hash)], key, hash, [&](std::string_view val, std::time_t) { fn(val); });
+}
+
+bool Store::update(const std::string& key, const std::function<bool(std::string&)>& fn) {
+    uint64_t hash = Dict::hash(key);
+    Shard& shard = shards[shardIndex(hash)];
+    DataWriteLock lock(shard);
+    const Record* record = shard.data.find(key, hash);
+    std::string value;
+    std::time_t expiryEpoch = LONG_MAX;
+    if (record != nullptr && record->expiryEpoch > nowEpoch()) {
+        value = valueOf(shard, *record);
+        expiryEpoch = record->expiryEpoch;
+    }
+    if (!fn(value)) {
+        return false;
+    }
 
-    if (removeKey) {
-        std::unique_lock<std::shared_mutex> lock(dataMutex);
-        data.erase(key);
+    if (shard.data.insert(stringRecord(key, value, expiryEpoch), hash)) {
+        fileKey(shard, key, true);
     }
-    
-    return false;
+    touch(shard, key);
+    return true;
 }
 
 bool Store::exists(const std::string& key) const {
-    static std::string temp;
-    bool inData = get(key, temp);
-    bool inListData = false;
-    std::shared_lock<std::shared_mutex> lock(listMutex);
-    auto it = listData.find(key);
-    if (it != listData.end()) {
-        inListData = true;
+    uint64_t hash = Dict::hash(key);
+    const Shard& shard = shards[shardIndex(hash)];
+    bool found = readConsistent(shard, [&]() {
+        const Record* record = shard.data.find(key, hash);
+        return record != nullptr && record->expiryEpoch > nowEpoch();
+    });
+    if (found) {
+        return true;
     }
-    
-    return inData || inListData;
+
+    ListLock lock(shard, false);
+    return shard.listData.count(key) || shard.streamData.count(key);
 }
 
-int Store::erase(const std::string& key) {
-    std::unique_lock<std::shared_mutex> lockData(dataMutex);
-    int inData = data.erase(key);
-    if (inData) {
-        return inData;
+// Heap taken by a string held in a container: the object itself, plus its
+// buffer unless short enough to be stored inline.
+static size_t stringBytes(const std::string& s) {
+    return sizeof(std::string) + (s.capacity() > 15 ? s.capacity() + 1 : 0);
+}
+
+std::optional<Store::KeyInfo> Store::inspect(const std::string& key, size_t samples) const {
+    uint64_t hash = Dict::hash(key);
+    const Shard& shard = shards[shardIndex(hash)];
+    std::optional<KeyInfo> info = readConsistent(shard, [&]() -> std::optional<KeyInfo> {
+        const Record* record = shard.data.find(key, hash);
+        if (record == nullptr || record->expiryEpoch <= nowEpoch()) {
+            return std::nullopt;
+        }
+        KeyInfo found;
+        found.type = KeyType::String;
+        found.encoding = record->encoding == static_cast<uint8_t>(compression::Encoding::Lz4) ? "lz4" : "raw";
+        found.bytes = record->allocSize() + Dict::entryOverhead();
+        found.idle = Record::clock() - __atomic_load_n(&record->accessed, __ATOMIC_RELAXED);
+        return found;
+    });
+    if (info) {
+        return info;
+    }
+
+    // A hash table node holding the key and the container, and its bucket.
+    size_t entry = 3 * sizeof(void*) + stringBytes(key);
+    ListLock lock(shard, false);
+    auto list = shard.listData.find(key);
+    if (list != shard.listData.end()) {
+        const std::deque<std::string>& values = list->second;
+        size_t counted = samples == 0 ? values.size() : std::min(samples, values.size());
+        size_t bytes = 0;
+        for (size_t i = 0; i < counted; i++) {
+            bytes += stringBytes(values[i]);
+        }
+        if (counted != 0) {
+            bytes = bytes * values.size() / counted;
+        }
+        return KeyInfo{KeyType::List, "deque", entry + sizeof(std::deque<std::string>) + bytes, 0};
     }
-    
-    std::unique_lock<std::shared_mutex> lockList(listMutex);
-    int inListData = listData.erase(key);
-    if (inListData) {
-        return inListData;
+
+    auto stream = shard.streamData.find(key);
+    if (stream != shard.streamData.end()) {
+        return KeyInfo{KeyType::Stream, "stream", entry + sizeof(std::unique_ptr<Stream>) + stream->second->memoryUsage(), 0};
     }
-    
-    return 0;
+    return std::nullopt;
 }
 
-int Store::incr(const std::string key, bool reverse) {
-    std::unique_lock<std::shared_mutex> lock(dataMutex);
-    std::string strVal;
-    auto it = data.find(key);
-    if (it != data.end() && it->second.expiryEpoch > nowEpoch()) {
-        int64_t intVal;
-        try {
-            intVal = std::stoll(it->second.val);
-        } catch (const std::exception& e) {
-            throw e;
-        }
-    
-        int delta = reverse ? -1 : 1;
-        strVal = std::to_string(intVal + delta);
-        it->second.val = strVal;
+size_t Store::size() const {
+    size_t keys = 0;
+    for (const Shard& shard : shards) {
+        keys += shard.data.size();
+        ListLock lock(shard, false);
+        keys += shard.listData.size() + shard.streamData.size();
+    }
+
+    return keys;
+}
+
+int Store::erase(const std::string& key, bool async) {
+    uint64_t hash = Dict::hash(key);
+    Shard& shard = shards[shardIndex(hash)];
+    std::deque<std::string> doomed;
+    std::unique_ptr<Stream> doomedStream;
+    {
+        DataWriteLock lockData(shard);
+        const Record* record = shard.data.find(key, hash);
+        if (record != nullptr) {
+            bool live = record->expiryEpoch > nowEpoch();
+            shard.data.erase(key, hash);
+            fileKey(shard, key, false);
+            if (live) {
+                touch(shard, key);
+                return 1;
+            }
+        }
+
+        ListLock lockList(shard, true);
+        auto it = shard.listData.find(key);
+        if (it != shard.listData.end()) {
+            doomed.swap(it->second);
+            shard.listKeys.erase({Dict::reverseBits(hash), it->first});
+            shard.listData.erase(it);
+            fileKey(shard, key, false);
+        }
+        else {
+            auto streamIt = shard.streamData.find(key);
+            if (streamIt == shard.streamData.end()) {
+                return 0;
+            }
+            doomedStream = std::move(streamIt->second);
+            shard.streamKeys.erase({Dict::reverseBits(hash), streamIt->first});
+            shard.streamData.erase(streamIt);
+            fileKey(shard, key, false);
+        }
+        touch(shard, key);
+    }
+
+    if (async && lazyfree::shouldDefer(doomed.size())) {
+        auto* detached = new std::deque<std::string>(std::move(doomed));
+        lazyfree::enqueue([detached]() { delete detached; });
+    }
+    if (doomedStream != nullptr) {
+        // Blocked group readers learn that their stream is gone.
+        notifyStreamChange();
+        if (async && lazyfree::shouldDefer(doomedStream->size())) {
+            lazyfree::enqueue([detached = doomedStream.release()]() { delete detached; });
+        }
+    }
+
+    return 1;
+}
+
+int64_t Store::incr(const std::string key, bool reverse) {
+    uint64_t hash = Dict::hash(key);
+    Shard& shard = shards[shardIndex(hash)];
+    DataWriteLock lock(shard);
+    const Record* record = shard.data.find(key, hash);
+    int delta = reverse ? -1 : 1;
+    if (record != nullptr && record->expiryEpoch > nowEpoch()) {
+        int64_t intVal = std::stoll(valueOf(shard, *record));
+        shard.data.insert(stringRecord(key, std::to_string(intVal + delta), record->expiryEpoch), hash);
+        touch(shard, key);
         return intVal + delta;
     } 
+
+    if (shard.data.insert(stringRecord(key, std::to_string(delta), LONG_MAX), hash)) {
+        fileKey(shard, key, true);
+    }
+    touch(shard, key);
+    return delta;
+}
+
+int Store::setBit(const std::string& key, uint64_t offset, bool bit) {
+    uint64_t hash = Dict::hash(key);
+    Shard& shard = shards[shardIndex(hash)];
+    size_t byte = offset >> 3;
+    uint8_t mask = 0x80 >> (offset & 7);
+    DataWriteLock lock(shard);
+    const Record* record = shard.data.find(key, hash);
+    bool live = record != nullptr && record->expiryEpoch > nowEpoch();
+    if (live && !record->cold && record->encoding == 0 && byte < record->valLen) {
+        // Writers are excluded and lock-free readers see the byte whole, so
+        // a large bitmap is not copied for every bit. The access time moves
+        // too, which keeps the spill walk from storing a stale copy.
+        record->markAccessed();
+        uint8_t* target = const_cast<Record*>(record)->valBytes() + byte;
+        int old = (__atomic_load_n(target, __ATOMIC_RELAXED) & mask) != 0;
+        if (old != bit) {
+            if (bit) {
+                __atomic_fetch_or(target, mask, __ATOMIC_RELEASE);
+            }
+            else {
+                __atomic_fetch_and(target, static_cast<uint8_t>(~mask), __ATOMIC_RELEASE);
+            }
+            touch(shard, key);
+        }
+        return old;
+    }
+
+    std::string value;
+    std::time_t expiryEpoch = LONG_MAX;
+    if (live) {
+        value = valueOf(shard, *record);
+        expiryEpoch = record->expiryEpoch;
+    }
+    // A cold value may already cover the byte.
+    if (value.size() <= byte) {
+        value.resize(byte + 1, '\0');
+    }
+    int old = (value[byte] & mask) != 0;
+    if (bit) {
+        value[byte] |= mask;
+    }
     else {
-        data[key] = {reverse ? "-1" : "1", LONG_MAX};
-        return reverse ? -1 : 1;
+        value[byte] &= ~mask;
+    }
+    if (shard.data.insert(stringRecord(key, value, expiryEpoch), hash)) {
+        fileKey(shard, key, true);
     }
-    
-    return -1;
+    touch(shard, key);
+    return old;
 }
 
 int Store::lpush(const std::string& key, const std::vector<std::string>& vals, bool reverse) {
-    std::unique_lock<std::shared_mutex> lock(listMutex);
+    uint64_t hash = Dict::hash(key);
+    Shard& shard = shards[shardIndex(hash)];
+    ListType& listData = shard.listData;
+    ListLock lock(shard, true);
     auto it = listData.find(key);
     if (it == listData.end()) {
-        listData[key] = {};
+        it = listData.emplace(key, std::deque<std::string>()).first;
+        shard.listKeys.emplace(Dict::reverseBits(hash), it->first);
+        fileKey(shard, key, true);
     }
 
     for (auto val : vals) {
@@ -141,14 +821,16 @@ int Store::lpush(const std::string& key, const std::vector<std::string>& vals, b
             listData[key].push_front(val);
         }
     }
+    touch(shard, key);
 
     return listData[key].size();
 }
 
 std::vector<std::string> Store::lrange(const std::string& key, int start, int end) {
-    std::shared_lock<std::shared_mutex> lock(listMutex);
-    auto it = listData.find(key);
-    if (it == listData.end()) {
+    Shard& shard = shards[shardIndex(Dict::hash(key))];
+    ListLock lock(shard, false);
+    auto it = shard.listData.find(key);
+    if (it == shard.listData.end()) {
         return {};
     }
 
@@ -181,3 +863,791 @@ std::vector<std::string> Store::lrange(const std::string& key, int start, int en
 
     return res;
 }
+
+void Store::readStream(const std::string& key, const std::function<void(const Stream*)>& fn) const {
+    const Shard& shard = shards[shardIndex(Dict::hash(key))];
+    ListLock lock(shard, false);
+    auto it = shard.streamData.find(key);
+    fn(it == shard.streamData.end() ? nullptr : it->second.get());
+}
+
+void Store::writeStream(const std::string& key, const std::function<bool(std::unique_ptr<Stream>&)>& fn) {
+    uint64_t hash = Dict::hash(key);
+    Shard& shard = shards[shardIndex(hash)];
+    bool changed;
+    {
+        ListLock lock(shard, true);
+        auto [it, created] = shard.streamData.try_emplace(key);
+        // Keeps the key index in step with the slot, also when `fn` throws.
+        auto settle = [&, it = it, created = created]() {
+            if (it->second == nullptr) {
+                if (!created) {
+                    shard.streamKeys.erase({Dict::reverseBits(hash), it->first});
+                    fileKey(shard, key, false);
+                }
+                shard.streamData.erase(it);
+            }
+            else if (created) {
+                shard.streamKeys.emplace(Dict::reverseBits(hash), it->first);
+                fileKey(shard, key, true);
+            }
+        };
+
+        try {
+            changed = fn(it->second);
+        }
+        catch (...) {
+            settle();
+            throw;
+        }
+        settle();
+        if (changed) {
+            touch(shard, key);
+        }
+    }
+
+    if (changed) {
+        notifyStreamChange();
+    }
+}
+
+uint64_t Store::streamChanges() {
+    return streamChangeCount.load();
+}
+
+bool Store::waitForStreamChange(uint64_t seen, std::chrono::steady_clock::time_point deadline) {
+    std::unique_lock<std::mutex> lock(streamWaitMutex);
+    streamWaiters.fetch_add(1);
+    bool changed = streamWait.wait_until(lock, deadline, [seen] { return streamChangeCount.load() != seen; });
+    streamWaiters.fetch_sub(1);
+    return changed;
+}
+
+void Store::lookupBatch(const std::vector<std::string>& keys, const std::vector<uint64_t>& hashes,
+                        std::vector<std::optional<std::string>>& values, std::vector<ColdValue>& cold) const {
+    // Prefetch the bucket slots of the whole batch, then the chain heads, so
+    // the cache misses overlap instead of being paid one lookup at a time.
+    for (size_t i = 0; i < keys.size(); i++) {
+        shards[shardIndex(hashes[i])].data.prefetchBucket(hashes[i]);
+    }
+    for (size_t i = 0; i < keys.size(); i++) {
+        shards[shardIndex(hashes[i])].data.prefetchChain(hashes[i]);
+    }
+
+    std::time_t now = nowEpoch();
+    cold.clear();
+    for (size_t i = 0; i < keys.size(); i++) {
+        const Record* record = shards[shardIndex(hashes[i])].data.find(keys[i], hashes[i]);
+        values[i].reset();
+        if (record != nullptr && record->expiryEpoch > now) {
+            auto encoding = static_cast<compression::Encoding>(record->encoding);
+            if (record->cold) {
+                cold.push_back({i, refOf(*record), encoding});
+                continue;
+            }
+            record->markAccessed();
+            values[i] = compression::decode(encoding, record->val());
+        }
+    }
+}
+
+std::vector<std::optional<std::string>> Store::mget(const std::vector<std::string>& keys) const {
+    std::vector<uint64_t> hashes(keys.size());
+    bool involved[STORE_SHARD_COUNT] = {};
+    for (size_t i = 0; i < keys.size(); i++) {
+        hashes[i] = Dict::hash(keys[i]);
+        involved[shardIndex(hashes[i])] = true;
+    }
+
+    std::vector<std::optional<std::string>> values(keys.size());
+    std::vector<ColdValue> cold;
+    auto snapshot = [&]() {
+        epoch::Guard guard;
+        for (int attempt = 0; attempt < MGET_OPTIMISTIC_RETRIES; attempt++) {
+            uint64_t seqs[STORE_SHARD_COUNT] = {};
+            bool stable = true;
+            for (size_t s = 0; s < STORE_SHARD_COUNT && stable; s++) {
+                if (involved[s]) {
+                    seqs[s] = shards[s].dataSeq.load(std::memory_order_acquire);
+                    stable = (seqs[s] & 1) == 0;
+                }
+            }
+            if (!stable) {
+                continue;
+            }
+
+            lookupBatch(keys, hashes, values, cold);
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            for (size_t s = 0; s < STORE_SHARD_COUNT && stable; s++) {
+                if (involved[s]) {
+                    stable = shards[s].dataSeq.load(std::memory_order_relaxed) == seqs[s];
+                }
+            }
+            if (stable) {
+                return;
+            }
+        }
+
+        // Writers kept racing the batch; exclude them for one final pass.
+        std::deque<DataLock> locks;
+        for (size_t s = 0; s < STORE_SHARD_COUNT; s++) {
+            if (involved[s]) {
+                locks.emplace_back(shards[s]);
+            }
+        }
+
+        lookupBatch(keys, hashes, values, cold);
+    };
+
+    // Spill file entries never change, so reading the cold values after the
+    // snapshot still yields the values it saw. Only a compaction that moved
+    // one of them meanwhile makes the batch start over.
+    while (true) {
+        snapshot();
+        bool complete = true;
+        for (const auto& [i, ref, encoding] : cold) {
+            values[i].emplace();
+            if (!fetchCold(shards[shardIndex(hashes[i])], keys[i], hashes[i], ref, *values[i])) {
+                complete = false;
+                break;
+            }
+            if (encoding != compression::Encoding::Raw) {
+                *values[i] = compression::decode(encoding, *values[i]);
+            }
+        }
+        if (complete) {
+            return values;
+        }
+    }
+}
+
+void Store::mset(const std::vector<std::pair<std::string, std::string>>& pairs) {
+    std::vector<uint64_t> hashes(pairs.size());
+    bool involved[STORE_SHARD_COUNT] = {};
+    for (size_t i = 0; i < pairs.size(); i++) {
+        hashes[i] = Dict::hash(pairs[i].first);
+        involved[shardIndex(hashes[i])] = true;
+    }
+    std::vector<Record*> records(pairs.size());
+    for (size_t i = 0; i < pairs.size(); i++) {
+        records[i] = stringRecord(pairs[i].first, pairs[i].second, LONG_MAX);
+    }
+
+    std::deque<DataWriteLock> locks;
+    for (size_t s = 0; s < STORE_SHARD_COUNT; s++) {
+        if (involved[s]) {
+            locks.emplace_back(shards[s]);
+        }
+    }
+
+    for (size_t i = 0; i < pairs.size(); i++) {
+        Shard& shard = shards[shardIndex(hashes[i])];
+        if (shard.data.insert(records[i], hashes[i])) {
+            fileKey(shard, pairs[i].first, true);
+        }
+        touch(shard, pairs[i].first);
+    }
+}
+
+bool Store::msetnx(const std::vector<std::pair<std::string, std::string>>& pairs) {
+    std::vector<uint64_t> hashes(pairs.size());
+    bool involved[STORE_SHARD_COUNT] = {};
+    for (size_t i = 0; i < pairs.size(); i++) {
+        hashes[i] = Dict::hash(pairs[i].first);
+        involved[shardIndex(hashes[i])] = true;
+    }
+
+    std::deque<DataWriteLock> dataLocks;
+    std::deque<ListLock> listLocks;
+    for (size_t s = 0; s < STORE_SHARD_COUNT; s++) {
+        if (involved[s]) {
+            dataLocks.emplace_back(shards[s]);
+        }
+    }
+    for (size_t s = 0; s < STORE_SHARD_COUNT; s++) {
+        if (involved[s]) {
+            listLocks.emplace_back(shards[s], false);
+        }
+    }
+
+    std::time_t now = nowEpoch();
+    for (size_t i = 0; i < pairs.size(); i++) {
+        const Shard& shard = shards[shardIndex(hashes[i])];
+        const Record* record = shard.data.find(pairs[i].first, hashes[i]);
+        if (record != nullptr && record->expiryEpoch > now) {
+            return false;
+        }
+        if (shard.listData.count(pairs[i].first) || shard.streamData.count(pairs[i].first)) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < pairs.size(); i++) {
+        Shard& shard = shards[shardIndex(hashes[i])];
+        if (shard.data.insert(stringRecord(pairs[i].first, pairs[i].second, LONG_MAX), hashes[i])) {
+            fileKey(shard, pairs[i].first, true);
+        }
+        touch(shard, pairs[i].first);
+    }
+
+    return true;
+}
+
+void Store::runLocked(const std::vector<std::string>& keys, bool allShards, const std::function<void()>& fn) {
+    bool involved[STORE_SHARD_COUNT] = {};
+    for (const std::string& key : keys) {
+        involved[shardIndex(Dict::hash(key))] = true;
+    }
+
+    uint32_t mask = 0;
+    std::deque<DataWriteLock> dataLocks;
+    std::deque<ListLock> listLocks;
+    for (size_t s = 0; s < STORE_SHARD_COUNT; s++) {
+        if ((allShards || involved[s]) && !held(shards[s])) {
+            dataLocks.emplace_back(shards[s]);
+            mask |= shards[s].bit;
+        }
+    }
+    for (size_t s = 0; s < STORE_SHARD_COUNT; s++) {
+        if (mask & shards[s].bit) {
+            listLocks.emplace_back(shards[s], true);
+        }
+    }
+
+    // Marks the shards for lock-free readers and as held by this thread,
+    // undone also when `fn` throws.
+    struct Marker {
+        Marker(Shard* shards, uint32_t mask) : shards(shards), mask(mask) { bump(); }
+        ~Marker() { bump(); }
+
+        void bump() {
+            heldShards ^= mask;
+            for (size_t s = 0; s < STORE_SHARD_COUNT; s++) {
+                if (mask & shards[s].bit) {
+                    shards[s].txSeq.store(shards[s].txSeq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                }
+            }
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        Shard* shards;
+        uint32_t mask;
+    } marker(shards, mask);
+
+    fn();
+}
+
+bool Store::isLocked(const std::string& key) const {
+    return held(shards[shardIndex(Dict::hash(key))]);
+}
+
+bool Store::isLockedAll() const {
+    return heldShards == (1u << STORE_SHARD_COUNT) - 1;
+}
+
+bool Store::isLockedAny() const {
+    return heldShards != 0;
+}
+
+uint64_t Store::watch(const std::string& key) {
+    Shard& shard = shards[shardIndex(Dict::hash(key))];
+    // Writers check watchedCount under their shard lock, so registering
+    // under both locks guarantees every later write sees the key.
+    DataLock lockData(shard);
+    ListLock lockList(shard, false);
+    std::lock_guard<std::mutex> lock(shard.watchMutex);
+    WatchedKey& entry = shard.watched[key];
+    entry.watchers++;
+    shard.watchedCount.fetch_add(1, std::memory_order_relaxed);
+    return entry.version;
+}
+
+void Store::unwatch(const std::string& key) {
+    Shard& shard = shards[shardIndex(Dict::hash(key))];
+    std::lock_guard<std::mutex> lock(shard.watchMutex);
+    auto it = shard.watched.find(key);
+    if (it == shard.watched.end()) {
+        return;
+    }
+
+    shard.watchedCount.fetch_sub(1, std::memory_order_relaxed);
+    if (--it->second.watchers == 0) {
+        shard.watched.erase(it);
+    }
+}
+
+uint64_t Store::keyVersion(const std::string& key) const {
+    const Shard& shard = shards[shardIndex(Dict::hash(key))];
+    std::lock_guard<std::mutex> lock(shard.watchMutex);
+    auto it = shard.watched.find(key);
+    return it == shard.watched.end() ? 0 : it->second.version;
+}
+
+size_t Store::expireCycle(size_t budget) {
+    std::time_t now = nowEpoch();
+    size_t reclaimed = 0;
+    for (Shard& shard : shards) {
+        reclaimed += expireShard(shard, budget, now);
+        compactExpiries(shard);
+    }
+
+    return reclaimed;
+}
+
+size_t Store::expireShard(Shard& shard, size_t budget, std::time_t now) {
+    {
+        DataLock lock(shard);
+        if (shard.expiries.empty() || shard.expiries.front().first > now) {
+            return 0;
+        }
+    }
+
+    // Heap entries go stale when a key is overwritten or deleted, so each
+    // one is checked against the live entry before anything is erased.
+    size_t reclaimed = 0;
+    DataWriteLock lock(shard);
+    for (size_t n = 0; n < budget && !shard.expiries.empty(); n++) {
+        const auto& [expiryEpoch, key] = shard.expiries.front();
+        if (expiryEpoch > now) {
+            break;
+        }
+
+        uint64_t hash = Dict::hash(key);
+        const Record* record = shard.data.find(key, hash);
+        if (record != nullptr && record->expiryEpoch <= now) {
+            shard.data.erase(key, hash);
+            fileKey(shard, key, false);
+            touch(shard, key);
+            reclaimed++;
+        }
+        std::pop_heap(shard.expiries.begin(), shard.expiries.end(), std::greater<ExpiryItem>());
+        shard.expiries.pop_back();
+    }
+
+    return reclaimed;
+}
+
+void Store::pushExpiry(Shard& shard, const std::string& key, std::time_t expiryEpoch) {
+    shard.expiries.emplace_back(expiryEpoch, key);
+    std::push_heap(shard.expiries.begin(), shard.expiries.end(), std::greater<ExpiryItem>());
+}
+
+void Store::compactExpiries(Shard& shard) {
+    ExpiryHeap entries;
+    {
+        DataLock lock(shard);
+        size_t threshold = std::max<size_t>(EXPIRY_COMPACT_MIN, EXPIRY_COMPACT_FACTOR * shard.expiriesCompacted);
+        if (shard.expiries.size() < threshold) {
+            return;
+        }
+        entries.swap(shard.expiries);
+    }
+
+    // Entries are checked against the live records lock-free, while writers
+    // push to the emptied heap. One judged stale cannot become current
+    // again other than by a write with the same expiry, which pushes its
+    // own entry, so dropping it is safe whatever happens meanwhile.
+    size_t kept = 0;
+    for (size_t i = 0; i < entries.size();) {
+        epoch::Guard guard;
+        for (size_t end = std::min(entries.size(), i + EXPIRE_CYCLE_BUDGET); i < end; i++) {
+            const Record* record = shard.data.find(entries[i].second, Dict::hash(entries[i].second));
+            if (record != nullptr && record->expiryEpoch == entries[i].first) {
+                std::swap(entries[kept++], entries[i]);
+            }
+        }
+    }
+    entries.resize(kept);
+    // Sorted, the entries form a heap and a key rewritten with the same
+    // expiry shows up as adjacent duplicates.
+    std::sort(entries.begin(), entries.end());
+    entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+
+    DataLock lock(shard);
+    for (ExpiryItem& item : shard.expiries) {
+        entries.push_back(std::move(item));
+        std::push_heap(entries.begin(), entries.end(), std::greater<ExpiryItem>());
+    }
+    shard.expiries.swap(entries);
+    shard.expiriesCompacted = shard.expiries.size();
+}
+
+void Store::defragCycle(long budgetUs) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(budgetUs);
+    size_t shardsVisited = 0;
+    while (std::chrono::steady_clock::now() < deadline && shardsVisited < STORE_SHARD_COUNT) {
+        Shard& shard = shards[defragShard];
+        {
+            // Relocated records are byte-identical copies, so MGET's seqlock
+            // does not need to be bumped; excluding writers is enough.
+            DataLock lock(shard);
+            defragCursor = shard.data.defrag(defragCursor, DEFRAG_BUCKETS_PER_STEP);
+        }
+
+        if (defragCursor == 0) {
+            defragShard = (defragShard + 1) % STORE_SHARD_COUNT;
+            shardsVisited++;
+        }
+    }
+}
+
+Tier::Ref Store::refOf(const Record& record) {
+    Tier::Ref ref;
+    memcpy(&ref, record.val().data(), sizeof(ref));
+    return ref;
+}
+
+Record* Store::coldRecord(std::string_view key, const Tier::Ref& ref, std::time_t expiryEpoch, uint32_t accessed,
+                          uint8_t encoding) {
+    Record* record = Record::create(key, std::string_view(reinterpret_cast<const char*>(&ref), sizeof(ref)), expiryEpoch);
+    record->accessed = accessed;
+    record->cold = true;
+    record->encoding = encoding;
+    return record;
+}
+
+std::string Store::valueOf(const Shard& shard, const Record& record) const {
+    return compression::decode(static_cast<compression::Encoding>(record.encoding), storedValueOf(shard, record));
+}
+
+std::string Store::storedValueOf(const Shard& shard, const Record& record) const {
+    if (!record.cold) {
+        return std::string(record.val());
+    }
+
+    // Under the data lock the record cannot move to another generation, so
+    // the one it points at is still open.
+    std::string value;
+    shard.tier.read(refOf(record), record.key(), value);
+    return value;
+}
+
+bool Store::fetchCold(const Shard& shard, const std::string& key, uint64_t hash, const Tier::Ref& ref,
+                      std::string& value) const {
+    if (!shard.tier.read(ref, key, value)) {
+        return false;
+    }
+    tierFaults.fetch_add(1, std::memory_order_relaxed);
+
+    // Bringing the value back changes no key, so, as for defrag, excluding
+    // writers is enough. It does change the shard, which a const reader
+    // otherwise never does.
+    DataLock lock(shard);
+    const Record* record = shard.data.find(key, hash);
+    if (record != nullptr && record->cold && refOf(*record) == ref) {
+        Record* hot = Record::create(key, value, record->expiryEpoch);
+        hot->encoding = record->encoding;
+        const_cast<Dict&>(shard.data).insert(hot, hash);
+    }
+    return true;
+}
+
+void Store::spillStep(Shard& shard) {
+    struct Spill {
+        std::string key;
+        const Record* record;
+        uint32_t accessed;
+        Tier::Ref ref;
+    };
+
+    uint32_t now = Record::clock();
+    uint32_t idle = std::max(config::GlobalConfig.tieredIdleSeconds, 1);
+    std::time_t nowE = nowEpoch();
+    std::vector<Spill> spills;
+    {
+        // The guard keeps the copied records from being freed, so a record
+        // still in place below is known to be the very one copied.
+        epoch::Guard guard;
+        for (size_t n = 0; n < TIER_SCAN_BUCKETS; n++) {
+            shard.tierCursor = shard.data.scan(shard.tierCursor, [&](const Record& record) {
+                if (record.cold) {
+                    shard.tierWalkBytes += refOf(record).length;
+                    shard.tierWalkKeys++;
+                    return;
+                }
+
+                uint32_t accessed = __atomic_load_n(&record.accessed, __ATOMIC_RELAXED);
+                if (record.valLen >= TIER_MIN_VALUE_BYTES && now - accessed >= idle && record.expiryEpoch > nowE) {
+                    spills.push_back({std::string(record.key()), &record, accessed,
+                                      shard.tier.append(record.key(), record.val())});
+                }
+            });
+            if (shard.tierCursor == 0) {
+                break;
+            }
+        }
+
+        if (!spills.empty()) {
+            shard.tier.flush();
+            DataLock lock(shard);
+            for (const Spill& spill : spills) {
+                // Any read or write since the copy, SETBIT in place included,
+                // moved the access time on.
+                uint64_t hash = Dict::hash(spill.key);
+                const Record* record = shard.data.find(spill.key, hash);
+                if (record == spill.record && __atomic_load_n(&record->accessed, __ATOMIC_RELAXED) == spill.accessed) {
+                    shard.data.insert(coldRecord(spill.key, spill.ref, record->expiryEpoch, spill.accessed, record->encoding), hash);
+                    shard.tierWalkBytes += spill.ref.length;
+                    shard.tierWalkKeys++;
+                    tierSpills.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+
+    if (shard.tierCursor != 0) {
+        return;
+    }
+
+    // A full walk: what it passed is what is live in the file.
+    uint64_t size = shard.tier.size();
+    uint64_t live = std::min(shard.tierWalkBytes, size);
+    shard.tierLiveBytes.store(live, std::memory_order_relaxed);
+    shard.tierKeys.store(shard.tierWalkKeys, std::memory_order_relaxed);
+    shard.tierWalkBytes = 0;
+    shard.tierWalkKeys = 0;
+    if (size >= TIER_COMPACT_MIN_BYTES &&
+        (size - live) * 100 >= size * static_cast<uint64_t>(config::GlobalConfig.tieredCompactPercent)) {
+        shard.tierCompacting = shard.tier.rotate();
+        shard.tierCompactCursor = 0;
+    }
+}
+
+void Store::compactStep(Shard& shard) {
+    std::vector<std::pair<std::string, Tier::Ref>> moves;
+    {
+        epoch::Guard guard;
+        for (size_t n = 0; n < TIER_SCAN_BUCKETS; n++) {
+            shard.tierCompactCursor = shard.data.scan(shard.tierCompactCursor, [&](const Record& record) {
+                if (record.cold && refOf(record).generation == shard.tierCompacting) {
+                    moves.emplace_back(record.key(), refOf(record));
+                }
+            });
+            if (shard.tierCompactCursor == 0) {
+                break;
+            }
+        }
+    }
+
+    // Copy without any lock, then repoint the records that did not change
+    // meanwhile; the copies of those that did are dead on arrival.
+    if (!moves.empty()) {
+        std::vector<Tier::Ref> moved;
+        std::string value;
+        for (const auto& [key, ref] : moves) {
+            shard.tier.read(ref, key, value);
+            moved.push_back(shard.tier.append(key, value));
+        }
+        shard.tier.flush();
+
+        DataLock lock(shard);
+        for (size_t i = 0; i < moves.size(); i++) {
+            const auto& [key, ref] = moves[i];
+            uint64_t hash = Dict::hash(key);
+            const Record* record = shard.data.find(key, hash);
+            if (record != nullptr && record->cold && refOf(*record) == ref) {
+                shard.data.insert(coldRecord(key, moved[i], record->expiryEpoch, record->accessed, record->encoding), hash);
+            }
+        }
+    }
+
+    // Every cold record present for the whole walk has been visited, and no
+    // new one points at the old generation, so nothing reaches it anymore.
+    // Readers that pinned it before keep it open until they are done.
+    if (shard.tierCompactCursor == 0) {
+        shard.tier.drop(shard.tierCompacting);
+        shard.tierCompacting = 0;
+        shard.tierCursor = 0;
+        shard.tierWalkBytes = 0;
+        shard.tierWalkKeys = 0;
+        tierCompactions.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void Store::tierCycle() {
+    for (size_t s = 0; s < STORE_SHARD_COUNT; s++) {
+        Shard& shard = shards[s];
+        if (!shard.tier.isOpen()) {
+            shard.tier.open(config::GlobalConfig.tieredDir, s);
+        }
+
+        if (shard.tierCompacting != 0) {
+            compactStep(shard);
+        }
+        else {
+            spillStep(shard);
+        }
+    }
+}
+
+Store::TierStats Store::tierStats() const {
+    TierStats stats;
+    for (const Shard& shard : shards) {
+        stats.keys += shard.tierKeys.load(std::memory_order_relaxed);
+        stats.liveBytes += shard.tierLiveBytes.load(std::memory_order_relaxed);
+        stats.diskBytes += shard.tier.diskBytes();
+    }
+    stats.spills = tierSpills.load(std::memory_order_relaxed);
+    stats.faults = tierFaults.load(std::memory_order_relaxed);
+    stats.compactions = tierCompactions.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void Store::compressionCycle() {
+    if (compression::currentDictionary() == 0) {
+        uint32_t now = Record::clock();
+        if (config::GlobalConfig.compressionDictBytes <= 0 || now < nextTraining) {
+            return;
+        }
+        nextTraining = now + COMPRESSION_TRAIN_RETRY_SECONDS;
+
+        // Keys hash uniformly, so the first values of each shard's walk are
+        // as good a sample as any; each shard contributes its share.
+        std::vector<std::string> samples;
+        size_t bytes = 0;
+        size_t minBytes = std::max(config::GlobalConfig.compressionMinBytes, 1);
+        for (size_t s = 0; s < STORE_SHARD_COUNT; s++) {
+            size_t quota = (s + 1) * (COMPRESSION_TRAIN_BYTES / STORE_SHARD_COUNT);
+            uint64_t cursor = 0;
+            epoch::Guard guard;
+            do {
+                cursor = shards[s].data.scan(cursor, [&](const Record& record) {
+                    if (bytes >= quota || (!record.cold && record.encoding == 0 && record.valLen < minBytes)) {
+                        return;
+                    }
+                    // With tiering on, idle values, which may be most of
+                    // them, are read back from the spill file.
+                    std::string stored;
+                    if (record.cold && !shards[s].tier.read(refOf(record), record.key(), stored)) {
+                        return;
+                    }
+                    std::string value = compression::decode(static_cast<compression::Encoding>(record.encoding),
+                                                            record.cold ? std::string_view(stored) : record.val());
+                    if (value.size() >= minBytes) {
+                        bytes += value.size();
+                        samples.push_back(std::move(value));
+                    }
+                });
+            } while (cursor != 0 && bytes < quota);
+        }
+        if (samples.size() < COMPRESSION_TRAIN_MIN_SAMPLES) {
+            return;
+        }
+
+        uint8_t id = compression::train(samples);
+        if (id != 0) {
+            std::cout << "Trained compression dictionary " << static_cast<int>(id) << " from " << samples.size()
+                      << " values" << std::endl;
+            recompressShard = 0;
+            recompressCursor = 0;
+        }
+        return;
+    }
+
+    if (recompressShard < STORE_SHARD_COUNT) {
+        recompressStep();
+    }
+}
+
+void Store::recompressStep() {
+    struct Recompressed {
+        std::string key;
+        const Record* record;
+        std::string stored;
+    };
+
+    Shard& shard = shards[recompressShard];
+    uint8_t dictionary = compression::currentDictionary();
+    std::vector<Recompressed> updates;
+    {
+        // As for spills, the guard makes a record still in place below the
+        // very one recompressed. Compressed records never change in place.
+        epoch::Guard guard;
+        for (size_t n = 0; n < COMPRESSION_SCAN_BUCKETS; n++) {
+            recompressCursor = shard.data.scan(recompressCursor, [&](const Record& record) {
+                auto encoding = static_cast<compression::Encoding>(record.encoding);
+                if (record.cold || encoding == compression::Encoding::Raw ||
+                    compression::dictionaryOf(record.val()) == dictionary) {
+                    return;
+                }
+
+                std::string stored;
+                if (compression::encode(compression::decode(encoding, record.val()), stored) != compression::Encoding::Raw &&
+                    stored.size() < record.valLen) {
+                    updates.push_back({std::string(record.key()), &record, std::move(stored)});
+                }
+            });
+            if (recompressCursor == 0) {
+                break;
+            }
+        }
+
+        if (!updates.empty()) {
+            // The value reads the same either way, so, as for defrag,
+            // excluding writers is enough.
+            DataLock lock(shard);
+            for (const Recompressed& update : updates) {
+                uint64_t hash = Dict::hash(update.key);
+                const Record* record = shard.data.find(update.key, hash);
+                if (record == update.record) {
+                    Record* smaller = encodedRecord(update.key, update.stored, compression::Encoding::Lz4, record->expiryEpoch);
+                    smaller->accessed = record->accessed;
+                    shard.data.insert(smaller, hash);
+                }
+            }
+        }
+    }
+
+    if (recompressCursor == 0) {
+        recompressShard++;
+    }
+}
+
+void Store::periodicMaintenance() {
+    bool tierFailed = false;
+    bool compressionFailed = false;
+    while (true) {
+        Record::advanceClock();
+        {
+            latency::Timer timer("expire-cycle");
+            expireCycle(EXPIRE_CYCLE_BUDGET);
+        }
+
+        // Values already spilled stay readable if the tier fails; only
+        // spilling and compaction stop.
+        if (config::GlobalConfig.tieredStorage && !tierFailed) {
+            latency::Timer timer("tier-cycle");
+            try {
+                tierCycle();
+            }
+            catch (const std::exception& e) {
+                std::cout << "Tiered storage stopped: " << e.what() << std::endl;
+                tierFailed = true;
+            }
+        }
+
+        if (config::GlobalConfig.compression && !compressionFailed) {
+            latency::Timer timer("compression-cycle");
+            try {
+                compressionCycle();
+            }
+            catch (const std::exception& e) {
+                std::cout << "Compression dictionary training stopped: " << e.what() << std::endl;
+                compressionFailed = true;
+            }
+        }
+
+        if (config::GlobalConfig.activeDefrag) {
+            double threshold = 1.0 + config::GlobalConfig.activeDefragThreshold / 100.0;
+            if (slab::stats().fragmentation() > threshold) {
+                latency::Timer timer("defrag-cycle");
+                defragCycle(config::GlobalConfig.activeDefragCycleUs);
+            }
+        }
+
+        hotkeys::decay();
+        epoch::reclaim();
+        std::this_thread::sleep_for(std::chrono::milliseconds(EXPIRE_CYCLE_PERIOD_MS));
+    }
+}
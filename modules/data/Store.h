@@ -1,22 +1,190 @@
 #ifndef STORE_H
 #define STORE_H
 
+#include "cluster/HashSlot.h"
 #include "core/Common.h"
+#include "Compression.h"
+#include "Dict.h"
+#include "Epoch.h"
+#include "Stream.h"
+#include "Tier.h"
 #include <shared_mutex>
 #include <mutex>
 #include <deque>
+#include <chrono>
+#include <map>
 #include <climits>
+#include <memory>
+#include <optional>
+#include <vector>
+#include <set>
+#include <unordered_map>
 
 #define STATEFILE "state.json"
+#define STORE_SHARD_COUNT 16
+#define EXPIRE_CYCLE_BUDGET 256
+#define EXPIRE_CYCLE_PERIOD_MS 100
+// The expire cycle drops stale expiry heap entries once the heap has grown
+// to EXPIRY_COMPACT_FACTOR times its size after the last such pass, and to
+// at least EXPIRY_COMPACT_MIN entries.
+#define EXPIRY_COMPACT_MIN 1024
+#define EXPIRY_COMPACT_FACTOR 2
+#define MGET_OPTIMISTIC_RETRIES 4
+#define DEFRAG_BUCKETS_PER_STEP 64
+#define SCAN_EMPTY_BUCKET_FACTOR 10
+// Dictionary training waits for this many values of compression_min_bytes
+// or more, samples up to COMPRESSION_TRAIN_BYTES of them, and retries this
+// often while there are too few.
+#define COMPRESSION_TRAIN_MIN_SAMPLES 100
+#define COMPRESSION_TRAIN_BYTES (4 << 20)
+#define COMPRESSION_TRAIN_RETRY_SECONDS 10
+// Dict buckets the recompression walk covers per maintenance cycle.
+#define COMPRESSION_SCAN_BUCKETS 2048
+
+enum class KeyType { Any, String, List, Stream };
 
 struct ValueEntry {
     std::string val;
     std::time_t expiryEpoch;
+    // Raw unless the entry comes from forEachData() asked for stored values.
+    compression::Encoding encoding = compression::Encoding::Raw;
 };
 
 class Store {
     typedef std::unordered_map<std::string, ValueEntry> DataType;
     typedef std::unordered_map<std::string, std::deque<std::string>> ListType;
+    typedef std::unordered_map<std::string, std::unique_ptr<Stream>> StreamType;
+
+    // The keyspace is split into shards by key hash so that unrelated keys
+    // do not contend on the same lock. Lock order is always data before
+    // list, and shards in ascending index order when more than one is held.
+    //
+    // String reads take no lock at all: `data` is a Dict whose lookups run
+    // under an epoch::Guard, and `dataMutex` only serializes writers. Each
+    // writer bumps `dataSeq` on entry and exit (a seqlock), which lets MGET
+    // validate that a lock-free batch did not overlap an MSET.
+    //
+    // Reads never mutate a shard, bringing a spilled value back aside:
+    // expired entries are skipped by readers and left for expireCycle(),
+    // which reclaims them from the expiry heap. Every write with a TTL pushes
+    // a heap entry, which goes stale when the key is overwritten or deleted;
+    // the expire cycle skips those and, when they pile up, filters them out
+    // without holding the shard lock (see compactExpiries()).
+    //
+    // A transaction (runLocked) holds the data and list locks of every shard
+    // it touches. The lock guards below skip shards the calling thread
+    // already holds that way, so commands run inside a transaction take the
+    // same code paths as outside one. Lock-free readers of a shard also check
+    // `txSeq`, odd while a transaction runs on it, and redo their read under
+    // the lock if one overlapped, so they never see a transaction halfway.
+    //
+    // Keys under WATCH carry a version in `watched`, bumped by every write to
+    // them while the writer holds the shard's lock. Unwatched keys cost
+    // writers one check of `watchedCount`.
+    //
+    // Streams live beside the lists, under the same lock.
+    //
+    // In cluster mode every key is also filed under its hash slot in
+    // `slotKeys`, which has a mutex of its own since strings and lists are
+    // written under different locks. Entries are the key prefixed with its
+    // slot in two big-endian bytes, so a slot's keys are one range, and
+    // count the shard's containers holding the key: a string and a list may
+    // share a name. `slotCounts` totals the distinct keys of each slot over
+    // all shards.
+    //
+    // With compression on, string writers compress large values before
+    // taking the lock and readers decompress them after finding the record;
+    // see compression. Once the maintenance thread trains a dictionary, it
+    // walks the shards recompressing the values stored without it.
+    //
+    // With tiered storage, the maintenance thread walks each shard's Dict
+    // and moves string values idle for tiered_idle_seconds to the shard's
+    // spill file, leaving cold records (see Tier). Readers that meet a cold
+    // record read the value from the file holding no lock and no epoch
+    // guard, so the disk read delays nobody else, then bring it back into
+    // memory unless the key changed meanwhile. Writers holding the shard
+    // lock read cold values under it.
+    //
+    // List and stream keys are also indexed by their position in Dict scan
+    // order, so SCAN can return the ones that fall into the bucket range it
+    // just walked. The views point at the keys owned by `listData` and
+    // `streamData`.
+    typedef std::set<std::pair<uint64_t, std::string_view>> ListKeyIndex;
+    // A min-heap on expiry, kept with std::push_heap/pop_heap and
+    // std::greater so that compaction can get at its entries.
+    typedef std::pair<std::time_t, std::string> ExpiryItem;
+    typedef std::vector<ExpiryItem> ExpiryHeap;
+    typedef std::map<std::string, uint8_t> SlotKeyIndex;
+
+    struct WatchedKey {
+        uint64_t version = 0;
+        size_t watchers = 0;
+    };
+
+    struct alignas(64) Shard {
+        uint32_t bit = 0;
+        Dict data;
+        ListType listData;
+        ListKeyIndex listKeys;
+        StreamType streamData;
+        ListKeyIndex streamKeys;
+        SlotKeyIndex slotKeys;
+        mutable std::mutex slotMutex;
+        ExpiryHeap expiries;
+        size_t expiriesCompacted = 0;
+        std::atomic<uint64_t> dataSeq{0};
+        std::atomic<uint64_t> txSeq{0};
+        mutable std::mutex dataMutex;
+        mutable std::shared_mutex listMutex;
+        std::unordered_map<std::string, WatchedKey> watched;
+        std::atomic<size_t> watchedCount{0};
+        mutable std::mutex watchMutex;
+
+        // Tiered storage; all but the atomics belong to the maintenance
+        // thread. The spill walk totals the cold entries it passes, which
+        // tells how much of the file is still live once it wraps.
+        Tier tier;
+        uint64_t tierCursor = 0;
+        uint64_t tierWalkBytes = 0;
+        size_t tierWalkKeys = 0;
+        // Generation being compacted away, 0 if none, and the compaction's
+        // own walk.
+        uint32_t tierCompacting = 0;
+        uint64_t tierCompactCursor = 0;
+        std::atomic<uint64_t> tierLiveBytes{0};
+        std::atomic<size_t> tierKeys{0};
+    };
+
+    class DataWriteLock {
+    public:
+        explicit DataWriteLock(Shard& shard);
+        ~DataWriteLock();
+
+        DataWriteLock(const DataWriteLock&) = delete;
+        DataWriteLock& operator=(const DataWriteLock&) = delete;
+
+    private:
+        Shard& shard;
+        std::unique_lock<std::mutex> lock;
+    };
+
+    // Excludes writers without bumping the seqlock.
+    class DataLock {
+    public:
+        explicit DataLock(const Shard& shard);
+
+    private:
+        std::unique_lock<std::mutex> lock;
+    };
+
+    class ListLock {
+    public:
+        ListLock(const Shard& shard, bool exclusive);
+
+    private:
+        std::unique_lock<std::shared_mutex> unique;
+        std::shared_lock<std::shared_mutex> shared;
+    };
 
 public:
     static Store& getInstance();
@@ -24,37 +192,244 @@ public:
 
     void set(const std::string& key, const std::string& value, const std::time_t expiryEpoch = LONG_MAX);
     bool get(const std::string& key, std::string& value) const;
+    // Value and expiry of a live string key, for DUMP and MIGRATE.
+    std::optional<ValueEntry> getEntry(const std::string& key) const;
+    // Runs `fn` on the value of a live string key where it lies, without
+    // copying it; false if there is none. `fn` may run twice when the read
+    // overlaps a transaction.
+    bool view(const std::string& key, const std::function<void(std::string_view)>& fn) const;
+    // Read-modify-write of a string key under the shard's write lock: `fn`
+    // edits a copy of the value, empty for a missing key, and returns
+    // whether to store it. The key keeps its expiry. Records are immutable,
+    // so every change publishes a new one and costs a copy of the value.
+    bool update(const std::string& key, const std::function<bool(std::string&)>& fn);
     bool exists(const std::string& key) const;
-    int erase(const std::string& key);
-    int incr(const std::string key, bool reverse = false);
+
+    // What OBJECT and MEMORY USAGE tell of a key. A spilled value counts
+    // only what stays in memory of it.
+    struct KeyInfo {
+        KeyType type = KeyType::Any;
+        const char* encoding = "";
+        size_t bytes = 0;       // key, value and bookkeeping
+        uint32_t idle = 0;      // seconds since the last access, strings only
+    };
+    // Null for a missing key. The size of a list is extrapolated from its
+    // first `samples` elements, or counted in full with 0. Does not count
+    // as an access.
+    std::optional<KeyInfo> inspect(const std::string& key, size_t samples) const;
+    // Keys of either type, including expired ones not yet reclaimed.
+    size_t size() const;
+    // Values are always detached under the shard lock and destroyed once
+    // the calling thread holds no shard lock, by it or by the maintenance
+    // thread. With `async`, large ones go to the lazy-free thread.
+    int erase(const std::string& key, bool async = false);
+    int64_t incr(const std::string key, bool reverse = false);
+    // Sets bit `offset` of a string key, growing it with zero bytes as
+    // needed, and returns the bit's previous value. A bit inside the value
+    // is written in place with one atomic byte store instead of copying
+    // the value into a new record.
+    int setBit(const std::string& key, uint64_t offset, bool bit);
     int lpush(const std::string& key, const std::vector<std::string>& vals, bool reverse = false);
     std::vector<std::string> lrange(const std::string& key, int start, int end);
-    void clear();
+    void clear(bool async = false);
+
+    // Runs `fn` on the stream at `key`, null if there is none, under the
+    // shard's list lock held shared.
+    void readStream(const std::string& key, const std::function<void(const Stream*)>& fn) const;
+    // Runs `fn` on the slot of the stream at `key`, empty if there is none,
+    // under the shard's list lock. `fn` may fill the slot to create the
+    // stream or reset it to delete the key, and returns whether it changed
+    // anything; changes wake the clients blocked on streams.
+    void writeStream(const std::string& key, const std::function<bool(std::unique_ptr<Stream>&)>& fn);
+    // Counts stream changes. A blocked XREAD samples it, checks its streams
+    // and waits for it to move past the sample, or for `deadline`; false on
+    // timeout. The caller must not hold any shard.
+    static uint64_t streamChanges();
+    static bool waitForStreamChange(uint64_t seen, std::chrono::steady_clock::time_point deadline);
+
+    // Erases up to `budget` expired keys per shard and returns how many were
+    // reclaimed.
+    size_t expireCycle(size_t budget);
+
+    // Relocates live entries off sparse slab pages for at most `budgetUs`
+    // microseconds, resuming where the previous call stopped. Each step holds
+    // one shard's write lock for DEFRAG_BUCKETS_PER_STEP buckets only.
+    void defragCycle(long budgetUs);
+
+    // Background housekeeping loop: expiry, epoch reclamation, hot-key
+    // count decay, tiered storage and compression dictionary training when
+    // enabled and, when enabled and fragmentation crosses the threshold,
+    // active defrag.
+    void periodicMaintenance();
+
+    // Tiered storage totals for INFO. Cold keys and live bytes are as of the
+    // last complete walk of each shard.
+    struct TierStats {
+        size_t keys = 0;
+        uint64_t liveBytes = 0;
+        uint64_t diskBytes = 0;
+        uint64_t spills = 0;
+        uint64_t faults = 0;
+        uint64_t compactions = 0;
+    };
+    TierStats tierStats() const;
+
+    // Multi-key operations take every involved shard lock exactly once and
+    // hold them together, so each call is atomic with respect to the others.
+    // MGET first tries a lock-free pass validated against the shard seqlocks.
+    std::vector<std::optional<std::string>> mget(const std::vector<std::string>& keys) const;
+    void mset(const std::vector<std::pair<std::string, std::string>>& pairs);
+    bool msetnx(const std::vector<std::pair<std::string, std::string>>& pairs);
+
+    // Runs `fn` holding the data and list locks of the shards owning `keys`,
+    // or of every shard with `allShards`, taken in ascending shard order.
+    // Store calls made by `fn` on those shards run under these locks.
+    // Shards the calling thread already holds are skipped, so runLocked()
+    // nests, as for a script run inside a transaction.
+    void runLocked(const std::vector<std::string>& keys, bool allShards, const std::function<void()>& fn);
+    // Whether the calling thread holds the shard of `key`, or every shard,
+    // through runLocked().
+    bool isLocked(const std::string& key) const;
+    bool isLockedAll() const;
+    // Whether the calling thread holds any shard that way.
+    bool isLockedAny() const;
+
+    // Per-key version counters for WATCH. A key is versioned while at least
+    // one watch() on it is not matched by an unwatch().
+    uint64_t watch(const std::string& key);
+    void unwatch(const std::string& key);
+    uint64_t keyVersion(const std::string& key) const;
+
+    // Cursor-based iteration. Appends keys of `type` accepted by `match` from
+    // roughly `count` buckets (up to SCAN_EMPTY_BUCKET_FACTOR times more if
+    // they are empty) and returns the cursor to continue from, 0 when done.
+    // Strings are walked lock-free; the list lock of a shard is held once per
+    // call, for the range just walked.
+    uint64_t scan(uint64_t cursor, size_t count, KeyType type,
+                  const std::function<bool(std::string_view)>& match, std::vector<std::string>& keys) const;
+
+    // Files every key under its cluster hash slot from now on, starting
+    // with the keys already stored. Cluster mode turns it on at startup.
+    void indexSlots();
+    // Keys in `slot`, including expired ones not yet reclaimed, from the
+    // slot index; none before indexSlots().
+    size_t countKeysInSlot(unsigned slot) const;
+    std::vector<std::string> getKeysInSlot(unsigned slot, size_t count) const;
 
     Store(const Store&) = delete;
     Store& operator=(const Store&) = delete;
 
-    // Expose data for persistence layer
-    const DataType& getData() const { return data; }
-    const ListType& getListData() const { return listData; }
-    void setData(const DataType& d) { data = d; }
-    void setListData(const ListType& ld) { listData = ld; }
-
-    std::shared_mutex& getDataMutex() { return dataMutex; }
-    std::shared_mutex& getListMutex() { return listMutex; }
+    // Expose data for persistence layer. Snapshots are taken one shard at a
+    // time so a save never holds more than a single shard's locks.
+    static size_t shardCount() { return STORE_SHARD_COUNT; }
+    // With `stored`, compressed values come as stored, with their encoding.
+    void forEachData(size_t shard, const std::function<void(const std::string&, const ValueEntry&)>& fn,
+                     bool stored = false) const;
+    void forEachList(size_t shard, const std::function<void(const std::string&, const std::deque<std::string>&)>& fn) const;
+    void forEachStream(size_t shard, const std::function<void(const std::string&, const Stream&)>& fn) const;
+    // With `compressRaw`, raw values are compressed as if written anew;
+    // otherwise every value keeps the encoding it comes with.
+    void setData(const DataType& d, bool compressRaw = true);
+    void setListData(const ListType& ld);
+    void setStreamData(StreamType&& sd);
 
 private:
-    static DataType data;
-    static ListType listData;
-
-    Store() {}
+    Store();
     ~Store() {}
 
+    static size_t shardIndex(uint64_t hash) { return (hash >> 32) % STORE_SHARD_COUNT; }
+
+    // Whether the calling thread holds `shard` through runLocked().
+    static bool held(const Shard& shard);
+
+    // Runs the lock-free read `fn` so that it does not observe a transaction
+    // halfway, falling back to a read under the shard's data lock.
+    template <typename Fn>
+    auto readConsistent(const Shard& shard, Fn fn) const -> decltype(fn());
+
+    // One shard's share of expireCycle().
+    size_t expireShard(Shard& shard, size_t budget, std::time_t now);
+    // Queues the expiry of `key` for expireCycle(). Caller holds the shard's
+    // write lock.
+    static void pushExpiry(Shard& shard, const std::string& key, std::time_t expiryEpoch);
+    // Drops the entries of `shard`'s expiry heap that no longer match their
+    // key, if enough have piled up. Only the expire cycle calls it.
+    void compactExpiries(Shard& shard);
+
+    // Bumps the version of `key` if watched and sends client-side caching
+    // invalidations for it. Caller holds a write lock of the shard.
+    static void touch(Shard& shard, const std::string& key);
+    static void touchAll(Shard& shard);
+
+    // Files `key` under its slot as one more of the shard's containers
+    // gains it, or takes it out as one loses it, if the slot index is on.
+    // Caller holds the lock of the container. The unfile helpers take out
+    // every string, or every list and stream, of a shard about to be
+    // cleared.
+    void fileKey(Shard& shard, std::string_view key, bool add);
+    void unfileData(Shard& shard);
+    void unfileLists(Shard& shard);
+
+    // A cold value found by lookupBatch(): the key's index, where its entry
+    // lies and how it is encoded.
+    struct ColdValue {
+        size_t index;
+        Tier::Ref ref;
+        compression::Encoding encoding;
+    };
+
+    // Leaves the values of cold keys unset and lists them in `cold`.
+    void lookupBatch(const std::vector<std::string>& keys, const std::vector<uint64_t>& hashes,
+                     std::vector<std::optional<std::string>>& values, std::vector<ColdValue>& cold) const;
+
+    // Runs `fn(value, expiryEpoch)` on the live string `key`, reading it
+    // back from the tier first if it is cold; false if there is none. `fn`
+    // may run more than once.
+    template <typename Fn>
+    bool readValue(const Shard& shard, const std::string& key, uint64_t hash, Fn fn) const;
+    // Reads the cold value of `key` at `ref`, as stored, and brings it back
+    // into memory if the key still points there. Takes no lock for the read
+    // itself. False if `ref` has been compacted away.
+    bool fetchCold(const Shard& shard, const std::string& key, uint64_t hash, const Tier::Ref& ref,
+                   std::string& value) const;
+    // Value of `record`, hot or cold, decompressed or as stored. Caller
+    // holds the shard's data lock.
+    std::string valueOf(const Shard& shard, const Record& record) const;
+    std::string storedValueOf(const Shard& shard, const Record& record) const;
+    static Tier::Ref refOf(const Record& record);
+    static Record* coldRecord(std::string_view key, const Tier::Ref& ref, std::time_t expiryEpoch, uint32_t accessed,
+                              uint8_t encoding);
+
+    // One tiered storage step per shard: a slice of the spill walk, or of
+    // the compaction in progress.
+    void tierCycle();
+    void spillStep(Shard& shard);
+    void compactStep(Shard& shard);
+
+    // Trains the compression dictionary from a sample of the keyspace once
+    // there is enough to learn from, then recompresses a slice of the values
+    // stored before it.
+    void compressionCycle();
+    void recompressStep();
+
     static Store* instance;
     static std::mutex instanceMutex;
 
-    mutable std::shared_mutex dataMutex;
-    mutable std::shared_mutex listMutex;
+    Shard shards[STORE_SHARD_COUNT];
+
+    std::atomic<bool> slotIndexed{false};
+    std::atomic<uint32_t> slotCounts[CLUSTER_SLOTS] = {};
+
+    // Resume point of the active defrag pass; only touched by defragCycle().
+    size_t defragShard = 0;
+    size_t defragCursor = 0;
+
+    // Compression dictionary training and the recompression walk that
+    // follows it, STORE_SHARD_COUNT when idle; only touched by
+    // compressionCycle().
+    uint32_t nextTraining = 0;
+    size_t recompressShard = STORE_SHARD_COUNT;
+    uint64_t recompressCursor = 0;
 };
 
 #endif // STORE_H
@@ -0,0 +1,661 @@
+#include <stdexcept>
+#include "Stream.h"
+
+namespace {
+
+// Entry layout within a block:
+//   flags, varint ms - master.ms, varint seq (minus master.seq when the ms
+//   are equal), then either the values alone (ENTRY_SAME_FIELDS, the field
+//   names being the block's master fields) or a varint field count and the
+//   field-value pairs. Strings are a varint length and the bytes.
+const uint8_t ENTRY_DELETED = 1;
+const uint8_t ENTRY_SAME_FIELDS = 2;
+
+void putVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+uint64_t getVarint(const std::string& in, size_t& pos) {
+    uint64_t value = 0;
+    for (int shift = 0;; shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(in[pos++]);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+}
+
+void putString(std::string& out, const std::string& str) {
+    putVarint(out, str.size());
+    out += str;
+}
+
+std::string getString(const std::string& in, size_t& pos) {
+    size_t len = getVarint(in, pos);
+    std::string str = in.substr(pos, len);
+    pos += len;
+    return str;
+}
+
+void skipString(const std::string& in, size_t& pos) {
+    pos += getVarint(in, pos);
+}
+
+bool parseU64(const std::string& text, uint64_t& out) {
+    if (text.empty() || text.size() > 20) {
+        return false;
+    }
+    uint64_t value = 0;
+    for (char c : text) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        uint64_t digit = c - '0';
+        if (value > (UINT64_MAX - digit) / 10) {
+            return false;
+        }
+        value = value * 10 + digit;
+    }
+
+    out = value;
+    return true;
+}
+
+StreamID idFromText(const std::string& text) {
+    StreamID id;
+    if (!StreamID::parse(text, 0, id)) {
+        throw std::invalid_argument("bad stream ID");
+    }
+    return id;
+}
+
+int bitAt(StreamID id, int bit) {
+    return bit < 64 ? (id.ms >> (63 - bit)) & 1 : (id.seq >> (127 - bit)) & 1;
+}
+
+// First bit, from the top, at which two different IDs differ.
+int firstDifference(StreamID a, StreamID b) {
+    if (a.ms != b.ms) {
+        return __builtin_clzll(a.ms ^ b.ms);
+    }
+    return 64 + __builtin_clzll(a.seq ^ b.seq);
+}
+
+}
+
+StreamID StreamID::next() const {
+    if (seq != UINT64_MAX) {
+        return {ms, seq + 1};
+    }
+    if (ms != UINT64_MAX) {
+        return {ms + 1, 0};
+    }
+    return *this;
+}
+
+StreamID StreamID::prev() const {
+    if (seq != 0) {
+        return {ms, seq - 1};
+    }
+    if (ms != 0) {
+        return {ms - 1, UINT64_MAX};
+    }
+    return *this;
+}
+
+std::string StreamID::toString() const {
+    return std::to_string(ms) + "-" + std::to_string(seq);
+}
+
+bool StreamID::parse(const std::string& text, uint64_t missingSeq, StreamID& out) {
+    size_t dash = text.find('-');
+    if (dash == std::string::npos) {
+        out.seq = missingSeq;
+        return parseU64(text, out.ms);
+    }
+
+    return parseU64(text.substr(0, dash), out.ms) && parseU64(text.substr(dash + 1), out.seq);
+}
+
+Stream::BlockTree::~BlockTree() {
+    freeNodes(root);
+    for (Block* block = head; block != nullptr;) {
+        Block* next = block->next;
+        delete block;
+        block = next;
+    }
+}
+
+void Stream::BlockTree::freeNodes(uintptr_t p) {
+    if (p == 0 || isBlock(p)) {
+        return;
+    }
+    freeNodes(asInner(p)->child[0]);
+    freeNodes(asInner(p)->child[1]);
+    delete asInner(p);
+}
+
+// The block whose key matches `id` in every bit tested on the way down.
+Stream::Block* Stream::BlockTree::closest(StreamID id) const {
+    uintptr_t p = root;
+    while (!isBlock(p)) {
+        Inner* node = asInner(p);
+        p = node->child[bitAt(id, node->bit)];
+    }
+    return asBlock(p);
+}
+
+// The smallest (side 0) or largest (side 1) block under `p`.
+Stream::Block* Stream::BlockTree::edge(uintptr_t p, int side) {
+    while (!isBlock(p)) {
+        p = asInner(p)->child[side];
+    }
+    return asBlock(p);
+}
+
+void Stream::BlockTree::insert(Block* block) {
+    count++;
+    if (root == 0) {
+        root = tag(block);
+        head = tail = block;
+        return;
+    }
+
+    StreamID key = block->master;
+    int diff = firstDifference(key, closest(key)->master);
+    int side = bitAt(key, diff);
+
+    // The new node goes above the first one that tests a later bit: every
+    // key below that point agrees with `key` up to `diff`.
+    uintptr_t* slot = &root;
+    while (!isBlock(*slot) && asInner(*slot)->bit < diff) {
+        Inner* node = asInner(*slot);
+        slot = &node->child[bitAt(key, node->bit)];
+    }
+
+    uintptr_t subtree = *slot;
+    Inner* node = new Inner();
+    node->bit = diff;
+    node->child[side] = tag(block);
+    node->child[1 - side] = subtree;
+    *slot = reinterpret_cast<uintptr_t>(node);
+
+    // Above the whole subtree, or below it.
+    if (side == 1) {
+        Block* before = edge(subtree, 1);
+        block->prev = before;
+        block->next = before->next;
+        before->next = block;
+        (block->next != nullptr ? block->next->prev : tail) = block;
+    }
+    else {
+        Block* after = edge(subtree, 0);
+        block->next = after;
+        block->prev = after->prev;
+        after->prev = block;
+        (block->prev != nullptr ? block->prev->next : head) = block;
+    }
+}
+
+void Stream::BlockTree::erase(Block* block) {
+    uintptr_t* slot = &root;
+    uintptr_t* parent = nullptr;
+    while (!isBlock(*slot)) {
+        parent = slot;
+        Inner* node = asInner(*slot);
+        slot = &node->child[bitAt(block->master, node->bit)];
+    }
+
+    if (parent == nullptr) {
+        root = 0;
+    }
+    else {
+        Inner* node = asInner(*parent);
+        *parent = node->child[slot == &node->child[0] ? 1 : 0];
+        delete node;
+    }
+
+    (block->prev != nullptr ? block->prev->next : head) = block->next;
+    (block->next != nullptr ? block->next->prev : tail) = block->prev;
+    block->prev = block->next = nullptr;
+    count--;
+}
+
+Stream::Block* Stream::BlockTree::floor(StreamID id) const {
+    if (root == 0) {
+        return nullptr;
+    }
+    Block* near = closest(id);
+    if (near->master == id) {
+        return near;
+    }
+
+    // Find the subtree `id` would be inserted next to; it lies entirely
+    // above or below `id`.
+    int diff = firstDifference(id, near->master);
+    uintptr_t p = root;
+    while (!isBlock(p) && asInner(p)->bit < diff) {
+        Inner* node = asInner(p);
+        p = node->child[bitAt(id, node->bit)];
+    }
+
+    return bitAt(id, diff) ? edge(p, 1) : edge(p, 0)->prev;
+}
+
+Stream::Stream() {}
+
+Stream::~Stream() {}
+
+template <typename Fn>
+void Stream::forEachEntry(const Block& block, Fn fn) {
+    size_t pos = 0;
+    for (uint32_t i = 0; i < block.entries; i++) {
+        size_t start = pos;
+        uint8_t flags = static_cast<uint8_t>(block.data[pos++]);
+        StreamID id;
+        uint64_t msDelta = getVarint(block.data, pos);
+        id.ms = block.master.ms + msDelta;
+        id.seq = getVarint(block.data, pos) + (msDelta == 0 ? block.master.seq : 0);
+
+        size_t strings = flags & ENTRY_SAME_FIELDS ? block.masterFields.size() : getVarint(block.data, pos) * 2;
+        for (size_t s = 0; s < strings; s++) {
+            skipString(block.data, pos);
+        }
+
+        if (!fn(start, id, (flags & ENTRY_DELETED) != 0)) {
+            return;
+        }
+    }
+}
+
+StreamFields Stream::decodeFields(const Block& block, size_t offset) {
+    size_t pos = offset;
+    uint8_t flags = static_cast<uint8_t>(block.data[pos++]);
+    getVarint(block.data, pos);
+    getVarint(block.data, pos);
+
+    StreamFields fields;
+    if (flags & ENTRY_SAME_FIELDS) {
+        for (const std::string& name : block.masterFields) {
+            fields.emplace_back(name, getString(block.data, pos));
+        }
+        return fields;
+    }
+
+    size_t count = getVarint(block.data, pos);
+    for (size_t i = 0; i < count; i++) {
+        std::string name = getString(block.data, pos);
+        fields.emplace_back(std::move(name), getString(block.data, pos));
+    }
+    return fields;
+}
+
+void Stream::append(StreamID id, const StreamFields& fields) {
+    Block* block = tree.lastBlock();
+    size_t payload = 0;
+    for (const auto& [name, value] : fields) {
+        payload += name.size() + value.size();
+    }
+    if (block == nullptr || block->entries >= STREAM_BLOCK_MAX_ENTRIES ||
+        block->data.size() + payload > STREAM_BLOCK_MAX_BYTES) {
+        block = new Block();
+        block->master = id;
+        for (const auto& field : fields) {
+            block->masterFields.push_back(field.first);
+        }
+        tree.insert(block);
+    }
+
+    bool same = fields.size() == block->masterFields.size();
+    for (size_t i = 0; same && i < fields.size(); i++) {
+        same = fields[i].first == block->masterFields[i];
+    }
+
+    std::string& out = block->data;
+    out.push_back(static_cast<char>(same ? ENTRY_SAME_FIELDS : 0));
+    uint64_t msDelta = id.ms - block->master.ms;
+    putVarint(out, msDelta);
+    putVarint(out, msDelta == 0 ? id.seq - block->master.seq : id.seq);
+    if (!same) {
+        putVarint(out, fields.size());
+    }
+    for (const auto& [name, value] : fields) {
+        if (!same) {
+            putString(out, name);
+        }
+        putString(out, value);
+    }
+
+    block->newest = id;
+    block->entries++;
+    block->live++;
+    length++;
+    last = id;
+}
+
+std::vector<StreamEntry> Stream::range(StreamID start, StreamID end, size_t count) const {
+    std::vector<StreamEntry> out;
+    if (end < start) {
+        return out;
+    }
+
+    Block* block = tree.floor(start);
+    if (block == nullptr) {
+        block = tree.first();
+    }
+    for (; block != nullptr && block->master <= end; block = block->next) {
+        if (block->newest < start) {
+            continue;
+        }
+        bool more = true;
+        forEachEntry(*block, [&](size_t offset, StreamID id, bool deleted) {
+            if (id > end) {
+                more = false;
+                return false;
+            }
+            if (!deleted && id >= start) {
+                out.push_back({id, decodeFields(*block, offset)});
+                if (count != 0 && out.size() >= count) {
+                    more = false;
+                    return false;
+                }
+            }
+            return true;
+        });
+        if (!more) {
+            break;
+        }
+    }
+
+    return out;
+}
+
+std::optional<StreamFields> Stream::find(StreamID id) const {
+    Block* block = tree.floor(id);
+    if (block == nullptr || block->newest < id) {
+        return std::nullopt;
+    }
+
+    std::optional<StreamFields> fields;
+    forEachEntry(*block, [&](size_t offset, StreamID entryId, bool deleted) {
+        if (entryId == id && !deleted) {
+            fields = decodeFields(*block, offset);
+        }
+        return entryId < id;
+    });
+    return fields;
+}
+
+void Stream::deleteAt(Block* block, size_t offset) {
+    block->data[offset] = static_cast<char>(block->data[offset] | ENTRY_DELETED);
+    block->live--;
+    length--;
+}
+
+void Stream::dropFirstBlock() {
+    Block* block = tree.first();
+    length -= block->live;
+    tree.erase(block);
+    delete block;
+}
+
+size_t Stream::trimMaxLen(size_t maxLen, bool approx, size_t limit) {
+    size_t removed = 0;
+    while (length > maxLen && tree.first() != nullptr) {
+        Block* block = tree.first();
+        if (length - block->live >= maxLen) {
+            if (limit != 0 && removed + block->live > limit) {
+                break;
+            }
+            removed += block->live;
+            dropFirstBlock();
+            continue;
+        }
+        if (approx) {
+            break;
+        }
+
+        forEachEntry(*block, [&](size_t offset, StreamID, bool deleted) {
+            if (!deleted) {
+                deleteAt(block, offset);
+                removed++;
+            }
+            return length > maxLen;
+        });
+        if (block->live == 0) {
+            dropFirstBlock();
+        }
+    }
+
+    return removed;
+}
+
+size_t Stream::trimMinId(StreamID minId, bool approx, size_t limit) {
+    size_t removed = 0;
+    while (tree.first() != nullptr) {
+        Block* block = tree.first();
+        if (block->newest < minId) {
+            if (limit != 0 && removed + block->live > limit) {
+                break;
+            }
+            removed += block->live;
+            dropFirstBlock();
+            continue;
+        }
+        if (approx) {
+            break;
+        }
+
+        forEachEntry(*block, [&](size_t offset, StreamID id, bool deleted) {
+            if (id >= minId) {
+                return false;
+            }
+            if (!deleted) {
+                deleteAt(block, offset);
+                removed++;
+            }
+            return true;
+        });
+        if (block->live == 0) {
+            dropFirstBlock();
+        }
+        break;
+    }
+
+    return removed;
+}
+
+Stream::Group* Stream::group(const std::string& name) {
+    auto it = groupMap.find(name);
+    return it == groupMap.end() ? nullptr : &it->second;
+}
+
+bool Stream::createGroup(const std::string& name, StreamID lastDelivered) {
+    if (groupMap.count(name)) {
+        return false;
+    }
+    groupMap[name].lastDelivered = lastDelivered;
+    return true;
+}
+
+bool Stream::destroyGroup(const std::string& name) {
+    return groupMap.erase(name) > 0;
+}
+
+bool Stream::createConsumer(Group& group, const std::string& name, uint64_t nowMs) {
+    return group.consumers.emplace(name, Consumer{nowMs, 0}).second;
+}
+
+long Stream::deleteConsumer(Group& group, const std::string& name) {
+    auto it = group.consumers.find(name);
+    if (it == group.consumers.end()) {
+        return -1;
+    }
+
+    long pending = it->second.pending;
+    for (auto entry = group.pel.begin(); entry != group.pel.end();) {
+        entry = entry->second.consumer == name ? group.pel.erase(entry) : std::next(entry);
+    }
+    group.consumers.erase(it);
+    return pending;
+}
+
+std::vector<StreamEntry> Stream::deliver(Group& group, const std::string& consumer, size_t count, bool noAck,
+                                         uint64_t nowMs) {
+    Consumer& owner = group.consumers[consumer];
+    owner.seenMs = nowMs;
+    if (group.lastDelivered == StreamID::max()) {
+        return {};
+    }
+
+    std::vector<StreamEntry> entries = range(group.lastDelivered.next(), StreamID::max(), count);
+    for (const StreamEntry& entry : entries) {
+        group.lastDelivered = entry.id;
+        if (noAck) {
+            continue;
+        }
+
+        // After SETID moved the group back, an entry may be delivered
+        // again, to a new owner.
+        auto [it, created] = group.pel.try_emplace(entry.id);
+        if (!created) {
+            group.consumers[it->second.consumer].pending--;
+        }
+        it->second.consumer = consumer;
+        it->second.deliveredMs = nowMs;
+        it->second.deliveries++;
+        owner.pending++;
+    }
+
+    return entries;
+}
+
+std::vector<std::pair<StreamID, std::optional<StreamFields>>> Stream::history(Group& group, const std::string& consumer,
+                                                                              StreamID after, size_t count, uint64_t nowMs) {
+    group.consumers[consumer].seenMs = nowMs;
+    std::vector<std::pair<StreamID, std::optional<StreamFields>>> out;
+    if (after == StreamID::max()) {
+        return out;
+    }
+    for (auto it = group.pel.lower_bound(after.next()); it != group.pel.end(); ++it) {
+        if (count != 0 && out.size() >= count) {
+            break;
+        }
+        if (it->second.consumer == consumer) {
+            out.emplace_back(it->first, find(it->first));
+        }
+    }
+    return out;
+}
+
+size_t Stream::ack(Group& group, const std::vector<StreamID>& ids) {
+    size_t acked = 0;
+    for (StreamID id : ids) {
+        auto it = group.pel.find(id);
+        if (it == group.pel.end()) {
+            continue;
+        }
+        auto owner = group.consumers.find(it->second.consumer);
+        if (owner != group.consumers.end()) {
+            owner->second.pending--;
+        }
+        group.pel.erase(it);
+        acked++;
+    }
+    return acked;
+}
+
+size_t Stream::memoryUsage() const {
+    size_t bytes = sizeof(Stream);
+    for (Block* block = tree.first(); block != nullptr; block = block->next) {
+        // A block, the inner node above it and the buffers they own.
+        bytes += sizeof(Block) + 2 * sizeof(uintptr_t) + sizeof(int) + block->data.capacity();
+        for (const std::string& name : block->masterFields) {
+            bytes += sizeof(std::string) + name.capacity();
+        }
+    }
+    return bytes;
+}
+
+void Stream::toRecord(std::vector<std::string>& out) const {
+    out.push_back(last.toString());
+    out.push_back(std::to_string(length));
+    for (Block* block = tree.first(); block != nullptr; block = block->next) {
+        forEachEntry(*block, [&](size_t offset, StreamID id, bool deleted) {
+            if (!deleted) {
+                StreamFields fields = decodeFields(*block, offset);
+                out.push_back(id.toString());
+                out.push_back(std::to_string(fields.size()));
+                for (auto& [name, value] : fields) {
+                    out.push_back(std::move(name));
+                    out.push_back(std::move(value));
+                }
+            }
+            return true;
+        });
+    }
+
+    out.push_back(std::to_string(groupMap.size()));
+    for (const auto& [name, group] : groupMap) {
+        out.push_back(name);
+        out.push_back(group.lastDelivered.toString());
+        out.push_back(std::to_string(group.consumers.size()));
+        for (const auto& [consumer, state] : group.consumers) {
+            out.push_back(consumer);
+            out.push_back(std::to_string(state.seenMs));
+        }
+        out.push_back(std::to_string(group.pel.size()));
+        for (const auto& [id, pending] : group.pel) {
+            out.push_back(id.toString());
+            out.push_back(pending.consumer);
+            out.push_back(std::to_string(pending.deliveredMs));
+            out.push_back(std::to_string(pending.deliveries));
+        }
+    }
+}
+
+std::unique_ptr<Stream> Stream::fromRecord(const std::vector<std::string>& in, size_t& pos) {
+    std::unique_ptr<Stream> stream = std::make_unique<Stream>();
+    StreamID lastId = idFromText(in.at(pos++));
+    size_t entries = std::stoull(in.at(pos++));
+    for (size_t i = 0; i < entries; i++) {
+        StreamID id = idFromText(in.at(pos++));
+        size_t fieldCount = std::stoull(in.at(pos++));
+        StreamFields fields;
+        for (size_t f = 0; f < fieldCount; f++) {
+            std::string name = in.at(pos++);
+            fields.emplace_back(std::move(name), in.at(pos++));
+        }
+        if (id <= stream->last && stream->length > 0) {
+            throw std::invalid_argument("stream IDs out of order");
+        }
+        stream->append(id, fields);
+    }
+    stream->last = lastId;
+
+    size_t groups = std::stoull(in.at(pos++));
+    for (size_t g = 0; g < groups; g++) {
+        Group& group = stream->groupMap[in.at(pos++)];
+        group.lastDelivered = idFromText(in.at(pos++));
+        size_t consumers = std::stoull(in.at(pos++));
+        for (size_t c = 0; c < consumers; c++) {
+            Consumer& consumer = group.consumers[in.at(pos++)];
+            consumer.seenMs = std::stoull(in.at(pos++));
+        }
+        size_t pending = std::stoull(in.at(pos++));
+        for (size_t p = 0; p < pending; p++) {
+            Pending& entry = group.pel[idFromText(in.at(pos++))];
+            entry.consumer = in.at(pos++);
+            entry.deliveredMs = std::stoull(in.at(pos++));
+            entry.deliveries = std::stoull(in.at(pos++));
+            group.consumers[entry.consumer].pending++;
+        }
+    }
+
+    return stream;
+}
@@ -0,0 +1,201 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Entries per block, and bytes a block grows to before a new one starts.
+#define STREAM_BLOCK_MAX_ENTRIES 100
+#define STREAM_BLOCK_MAX_BYTES 4096
+
+struct StreamID {
+    uint64_t ms = 0;
+    uint64_t seq = 0;
+
+    bool operator==(const StreamID& o) const { return ms == o.ms && seq == o.seq; }
+    bool operator!=(const StreamID& o) const { return !(*this == o); }
+    bool operator<(const StreamID& o) const { return ms < o.ms || (ms == o.ms && seq < o.seq); }
+    bool operator<=(const StreamID& o) const { return !(o < *this); }
+    bool operator>(const StreamID& o) const { return o < *this; }
+    bool operator>=(const StreamID& o) const { return !(*this < o); }
+
+    // The smallest ID above this one; the largest ID is its own successor.
+    StreamID next() const;
+    // The largest ID below this one; 0-0 is its own predecessor.
+    StreamID prev() const;
+    static StreamID max() { return {UINT64_MAX, UINT64_MAX}; }
+
+    std::string toString() const;
+    // `ms-seq`, or `ms` alone with `missingSeq` as its sequence. False if
+    // the text is not an ID.
+    static bool parse(const std::string& text, uint64_t missingSeq, StreamID& out);
+};
+
+typedef std::vector<std::pair<std::string, std::string>> StreamFields;
+
+struct StreamEntry {
+    StreamID id;
+    StreamFields fields;
+};
+
+// The value of a stream key: an append-only log of field-value entries
+// ordered by ID, and its consumer groups.
+//
+// Entries are packed into blocks of up to STREAM_BLOCK_MAX_ENTRIES entries
+// or STREAM_BLOCK_MAX_BYTES bytes. Within a block, each entry stores its ID
+// as varint deltas from the block's first ID, and entries with the same
+// field names as the first one store their values only, so a small entry
+// costs a few bytes over its payload. Blocks are indexed by their first ID
+// in a radix tree (see BlockTree) and linked in ID order: appending touches
+// only the last block, and a range read seeks to its first block in at most
+// 128 bit tests and then walks forward.
+//
+// Trimming drops whole blocks from the front and, for exact trims, marks
+// the remaining entries of the first block deleted in place.
+class Stream {
+public:
+    struct Pending {
+        std::string consumer;
+        uint64_t deliveredMs = 0;
+        uint64_t deliveries = 0;
+    };
+
+    struct Consumer {
+        uint64_t seenMs = 0;
+        size_t pending = 0;
+    };
+
+    // A consumer group: what it has been handed so far, and the entries
+    // delivered but not acknowledged (its pending entries list).
+    struct Group {
+        StreamID lastDelivered;
+        std::map<StreamID, Pending> pel;
+        std::map<std::string, Consumer> consumers;
+    };
+
+    Stream();
+    ~Stream();
+
+    Stream(const Stream&) = delete;
+    Stream& operator=(const Stream&) = delete;
+
+    size_t size() const { return length; }
+    // The largest ID ever added, kept when its entry is trimmed away.
+    StreamID lastId() const { return last; }
+    void setLastId(StreamID id) { last = id; }
+
+    // Appends an entry; `id` must be above lastId().
+    void append(StreamID id, const StreamFields& fields);
+
+    // Entries with IDs in [start, end], at most `count` of them (0 for
+    // all), in ID order.
+    std::vector<StreamEntry> range(StreamID start, StreamID end, size_t count) const;
+    std::optional<StreamFields> find(StreamID id) const;
+
+    // Remove the oldest entries until at most `maxLen` remain, or none below
+    // `minId` does. Approximate trims only drop whole blocks, and at most
+    // `limit` entries (0 for no limit). Return the entries removed.
+    size_t trimMaxLen(size_t maxLen, bool approx, size_t limit);
+    size_t trimMinId(StreamID minId, bool approx, size_t limit);
+
+    const std::map<std::string, Group>& groups() const { return groupMap; }
+    Group* group(const std::string& name);
+    // False if the group exists already.
+    bool createGroup(const std::string& name, StreamID lastDelivered);
+    bool destroyGroup(const std::string& name);
+    // False if the consumer exists already.
+    bool createConsumer(Group& group, const std::string& name, uint64_t nowMs);
+    // Deletes the consumer with its pending entries; returns how many it
+    // had, or -1 if there is no such consumer.
+    long deleteConsumer(Group& group, const std::string& name);
+
+    // XREADGROUP with `>`: hands `consumer` up to `count` entries the group
+    // has not seen yet, adding them to its pending list unless `noAck`.
+    std::vector<StreamEntry> deliver(Group& group, const std::string& consumer, size_t count, bool noAck, uint64_t nowMs);
+    // XREADGROUP with an ID: the consumer's pending entries above `after`.
+    // Entries trimmed since their delivery come without fields.
+    std::vector<std::pair<StreamID, std::optional<StreamFields>>> history(Group& group, const std::string& consumer,
+                                                                          StreamID after, size_t count, uint64_t nowMs);
+    // Removes `ids` from the group's pending list; returns how many were.
+    size_t ack(Group& group, const std::vector<StreamID>& ids);
+
+    // Bytes held by the blocks and the index.
+    size_t memoryUsage() const;
+
+    // Flat text form for snapshots and replication, and back. fromRecord()
+    // reads from `pos` on and throws std::exception on malformed input.
+    void toRecord(std::vector<std::string>& out) const;
+    static std::unique_ptr<Stream> fromRecord(const std::vector<std::string>& in, size_t& pos);
+
+private:
+    struct Block {
+        StreamID master;    // first ID, the block's key in the tree
+        StreamID newest;    // last ID, deleted or not
+        std::string data;
+        std::vector<std::string> masterFields;
+        uint32_t entries = 0;
+        uint32_t live = 0;
+        Block* prev = nullptr;
+        Block* next = nullptr;
+    };
+
+    // A crit-bit tree: a radix tree over the 128 bits of the block keys
+    // that keeps an inner node only where two keys first differ, so its
+    // depth is bounded by the key width and each lookup costs one bit test
+    // per level. Leaves are the blocks, which are also linked in key order.
+    class BlockTree {
+    public:
+        ~BlockTree();
+
+        void insert(Block* block);
+        // Unlinks `block` without freeing it.
+        void erase(Block* block);
+        // The last block whose key is at most `id`, null if none.
+        Block* floor(StreamID id) const;
+
+        Block* first() const { return head; }
+        Block* lastBlock() const { return tail; }
+        size_t size() const { return count; }
+
+    private:
+        struct Inner {
+            int bit;
+            uintptr_t child[2];
+        };
+
+        // Children are tagged pointers; the low bit marks a block.
+        static bool isBlock(uintptr_t p) { return p & 1; }
+        static Block* asBlock(uintptr_t p) { return reinterpret_cast<Block*>(p & ~uintptr_t(1)); }
+        static Inner* asInner(uintptr_t p) { return reinterpret_cast<Inner*>(p); }
+        static uintptr_t tag(Block* block) { return reinterpret_cast<uintptr_t>(block) | 1; }
+
+        Block* closest(StreamID id) const;
+        static Block* edge(uintptr_t p, int side);
+        static void freeNodes(uintptr_t p);
+
+        uintptr_t root = 0;
+        Block* head = nullptr;
+        Block* tail = nullptr;
+        size_t count = 0;
+    };
+
+    // Calls fn(offset, id, deleted) for each entry of `block` until it
+    // returns false. `offset` is where the entry starts.
+    template <typename Fn>
+    static void forEachEntry(const Block& block, Fn fn);
+    static StreamFields decodeFields(const Block& block, size_t offset);
+    // Marks the entry at `offset` of the first block deleted.
+    void deleteAt(Block* block, size_t offset);
+    void dropFirstBlock();
+
+    BlockTree tree;
+    size_t length = 0;
+    StreamID last;
+    std::map<std::string, Group> groupMap;
+};
+
+#endif // STREAM_H
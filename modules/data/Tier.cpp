@@ -0,0 +1,135 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <stdexcept>
+#include <unistd.h>
+#include "Tier.h"
+#include "core/Common.h"
+
+#define TIER_HEADER_SIZE 8
+
+Tier::File::~File() {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+void Tier::open(const std::string& dir, size_t shard) {
+    path = dir + "/tier-" + std::to_string(shard);
+    current = create();
+}
+
+std::shared_ptr<Tier::File> Tier::create() {
+    std::string name = path + "." + std::to_string(currentGeneration + 1);
+    auto file = std::make_shared<File>();
+    file->fd = ::open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (file->fd < 0) {
+        throw SysCallFailure("open " + name + ": " + strerror(errno));
+    }
+    unlink(name.c_str());
+
+    currentGeneration++;
+    end = 0;
+    std::lock_guard<std::mutex> lock(filesMutex);
+    files[currentGeneration] = file;
+    return file;
+}
+
+Tier::Ref Tier::append(std::string_view key, std::string_view value) {
+    uint32_t lengths[2] = {static_cast<uint32_t>(key.size()), static_cast<uint32_t>(value.size())};
+    Ref ref{end + pending.size(), static_cast<uint32_t>(TIER_HEADER_SIZE + key.size() + value.size()), currentGeneration};
+    pending.append(reinterpret_cast<const char*>(lengths), TIER_HEADER_SIZE);
+    pending.append(key);
+    pending.append(value);
+    if (pending.size() >= TIER_WRITE_BUFFER) {
+        flush();
+    }
+    return ref;
+}
+
+void Tier::flush() {
+    size_t written = 0;
+    while (written < pending.size()) {
+        ssize_t n = pwrite(current->fd, pending.data() + written, pending.size() - written, end + written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            throw SysCallFailure(std::string("tier write: ") + strerror(errno));
+        }
+        written += n;
+    }
+
+    end += written;
+    current->size = end;
+    totalBytes.fetch_add(written, std::memory_order_relaxed);
+    pending.clear();
+}
+
+bool Tier::read(const Ref& ref, std::string_view key, std::string& value) const {
+    std::shared_ptr<File> file;
+    {
+        std::lock_guard<std::mutex> lock(filesMutex);
+        auto it = files.find(ref.generation);
+        if (it == files.end()) {
+            return false;
+        }
+        file = it->second;
+    }
+
+    // The header and key land in `head` and the value straight in `value`.
+    std::string head(TIER_HEADER_SIZE + key.size(), '\0');
+    if (ref.length < head.size()) {
+        throw std::runtime_error("Tier entry does not match its key");
+    }
+    value.resize(ref.length - head.size());
+    struct iovec iov[2] = {{&head[0], head.size()}, {&value[0], value.size()}};
+    struct iovec* next = iov;
+    int count = value.empty() ? 1 : 2;
+    uint64_t offset = ref.offset;
+    while (count > 0) {
+        ssize_t n = preadv(file->fd, next, count, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            throw SysCallFailure(std::string("tier read: ") + (n == 0 ? "short file" : strerror(errno)));
+        }
+        offset += n;
+        size_t done = n;
+        while (count > 0 && done >= next->iov_len) {
+            done -= next->iov_len;
+            next++;
+            count--;
+        }
+        if (count > 0) {
+            next->iov_base = static_cast<char*>(next->iov_base) + done;
+            next->iov_len -= done;
+        }
+    }
+
+    uint32_t lengths[2];
+    memcpy(lengths, head.data(), TIER_HEADER_SIZE);
+    if (lengths[0] != key.size() || lengths[1] != value.size() || head.compare(TIER_HEADER_SIZE, key.size(), key) != 0) {
+        throw std::runtime_error("Tier entry does not match its key");
+    }
+
+    return true;
+}
+
+uint32_t Tier::rotate() {
+    flush();
+    uint32_t previous = currentGeneration;
+    current = create();
+    return previous;
+}
+
+void Tier::drop(uint32_t generation) {
+    std::lock_guard<std::mutex> lock(filesMutex);
+    auto it = files.find(generation);
+    if (it != files.end()) {
+        totalBytes.fetch_sub(it->second->size, std::memory_order_relaxed);
+        files.erase(it);
+    }
+}
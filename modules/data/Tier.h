@@ -0,0 +1,108 @@
+#ifndef TIER_H
+#define TIER_H
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+// Values shorter than this stay in memory: a spilled key still keeps its
+// record, key and a Ref in RAM, so small values would save next to nothing.
+#define TIER_MIN_VALUE_BYTES 64
+// Dict buckets a shard's spill walk, or its compaction, covers per
+// maintenance cycle.
+#define TIER_SCAN_BUCKETS 4096
+// Queued entries are written out once they reach this many bytes.
+#define TIER_WRITE_BUFFER 1048576
+// A shard's spill file is never compacted while smaller than this.
+#define TIER_COMPACT_MIN_BYTES (1 << 20)
+
+// The spill file of one Store shard, for tiered storage
+// (`"tiered_storage": true`).
+//
+// Values are only ever appended, each entry being its key and value behind
+// an 8-byte header of their lengths, and never rewritten in place. Keys stay
+// in memory: the shard's Dict keeps a cold record for each spilled key,
+// holding the Ref of its entry where the value used to be, which makes the
+// Dict itself the index of the file. Dead entries are left behind until
+// compaction copies the live ones into a new generation of the file and the
+// old one is dropped.
+//
+// Only the maintenance thread appends, rotates and drops. Any thread may
+// read, without locks beyond a brief one to pin the generation it needs: a
+// dropped generation stays open until its last reader is done with it. The
+// files are unlinked as soon as they are created; the snapshot, not the
+// tier, is what survives a restart.
+class Tier {
+public:
+    // Where a spilled entry lies. Stored in place of the value of a cold
+    // record.
+    struct Ref {
+        uint64_t offset;
+        uint32_t length;        // header, key and value
+        uint32_t generation;
+
+        bool operator==(const Ref& other) const {
+            return offset == other.offset && generation == other.generation;
+        }
+    };
+
+    Tier() = default;
+
+    Tier(const Tier&) = delete;
+    Tier& operator=(const Tier&) = delete;
+
+    // Creates the first generation of the file for shard `shard` in `dir`.
+    // Throws SysCallFailure.
+    void open(const std::string& dir, size_t shard);
+    bool isOpen() const { return current != nullptr; }
+
+    // Queues an entry for the next flush(), or writes the queue out once it
+    // reaches TIER_WRITE_BUFFER, and returns where the entry will lie.
+    Ref append(std::string_view key, std::string_view value);
+    // Writes the queued entries out. Refs must not be published before it
+    // returns. Throws SysCallFailure.
+    void flush();
+
+    // Reads the value of the entry at `ref`, checking that it belongs to
+    // `key`. False if its generation has been dropped, in which case the
+    // key has moved and the caller looks it up again. Throws SysCallFailure
+    // on I/O errors and std::runtime_error on an entry that does not match.
+    bool read(const Ref& ref, std::string_view key, std::string& value) const;
+
+    uint32_t generation() const { return currentGeneration; }
+    // Bytes written to the current generation.
+    uint64_t size() const { return end; }
+    // Bytes on disk over every generation still open.
+    uint64_t diskBytes() const { return totalBytes.load(std::memory_order_relaxed); }
+
+    // Starts a new generation for appends and returns the previous one,
+    // which stays readable until drop().
+    uint32_t rotate();
+    void drop(uint32_t generation);
+
+private:
+    struct File {
+        ~File();
+
+        int fd = -1;
+        uint64_t size = 0;
+    };
+
+    std::shared_ptr<File> create();
+
+    std::string path;
+    std::shared_ptr<File> current;
+    uint32_t currentGeneration = 0;
+    uint64_t end = 0;
+    std::string pending;
+
+    std::map<uint32_t, std::shared_ptr<File>> files;
+    mutable std::mutex filesMutex;
+    std::atomic<uint64_t> totalBytes{0};
+};
+
+#endif // TIER_H
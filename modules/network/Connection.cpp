@@ -0,0 +1,381 @@
+#include <arpa/inet.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <iostream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "Connection.h"
+#include "config/Config.h"
+
+namespace {
+
+std::once_flag pollerOnce;
+int epollFd = -1;
+// Connections with parked output, by socket. Holding a reference here keeps
+// a connection alive while the poller works on it.
+std::mutex pollerMutex;
+std::unordered_map<int, std::shared_ptr<Connection>> parked;
+
+std::atomic<uint64_t> nextClientId{1};
+std::atomic<size_t> openConnections{0};
+thread_local Connection* currentConnection = nullptr;
+
+const config::OutputBufferLimit& limitsFor(ClientClass cls) {
+    switch (cls) {
+        case ClientClass::Replica:
+            return config::GlobalConfig.replicaOutputLimit;
+        case ClientClass::Pubsub:
+            return config::GlobalConfig.pubsubOutputLimit;
+        default:
+            return config::GlobalConfig.normalOutputLimit;
+    }
+}
+
+const char* className(ClientClass cls) {
+    switch (cls) {
+        case ClientClass::Replica:
+            return "replica";
+        case ClientClass::Pubsub:
+            return "pubsub";
+        default:
+            return "normal";
+    }
+}
+
+}
+
+void outputPollerLoop() {
+    struct epoll_event events[CONNECTION_WRITE_BATCH];
+    auto lastCheck = std::chrono::steady_clock::now();
+    while (true) {
+        int n = epoll_wait(epollFd, events, CONNECTION_WRITE_BATCH, OUTPUT_POLL_PERIOD_MS);
+        std::vector<std::shared_ptr<Connection>> ready;
+        {
+            std::lock_guard<std::mutex> lock(pollerMutex);
+            for (int i = 0; i < n; i++) {
+                auto it = parked.find(events[i].data.fd);
+                if (it != parked.end()) {
+                    ready.push_back(it->second);
+                }
+            }
+        }
+
+        for (const std::shared_ptr<Connection>& conn : ready) {
+            conn->onWritable();
+        }
+
+        // Soft limits are about time, so clients that stopped reading must
+        // be looked at even when nothing happens on their sockets.
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastCheck >= std::chrono::milliseconds(OUTPUT_POLL_PERIOD_MS)) {
+            lastCheck = now;
+            std::vector<std::shared_ptr<Connection>> all;
+            {
+                std::lock_guard<std::mutex> lock(pollerMutex);
+                for (const auto& entry : parked) {
+                    all.push_back(entry.second);
+                }
+            }
+            for (const std::shared_ptr<Connection>& conn : all) {
+                conn->checkLimits(now);
+            }
+        }
+    }
+}
+
+bool OutputLimit::exceeded(size_t pending, std::chrono::steady_clock::time_point now) {
+    const config::OutputBufferLimit& limits = limitsFor(cls);
+    if (limits.hard != 0 && pending > static_cast<size_t>(limits.hard)) {
+        return true;
+    }
+    if (limits.soft == 0 || pending <= static_cast<size_t>(limits.soft)) {
+        overSoft = false;
+        return false;
+    }
+
+    if (!overSoft) {
+        overSoft = true;
+        softSince = now;
+        return false;
+    }
+
+    return now - softSince > std::chrono::seconds(limits.softSeconds);
+}
+
+Connection::Connection(int fd) : sock(fd), clientId(nextClientId.fetch_add(1)), limit(ClientClass::Normal) {
+    openConnections.fetch_add(1);
+}
+
+Connection* Connection::current() {
+    return currentConnection;
+}
+
+void Connection::setCurrent(Connection* conn) {
+    currentConnection = conn;
+}
+
+Connection::~Connection() {
+    close();
+    openConnections.fetch_sub(1);
+}
+
+std::string Connection::peerAddress() const {
+    struct sockaddr_in addr;
+    socklen_t addrLen = sizeof(addr);
+    char ip[INET_ADDRSTRLEN] = "?";
+    if (getpeername(sock, (struct sockaddr*)&addr, &addrLen) != 0) {
+        return ip;
+    }
+
+    inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+    return std::string(ip) + ":" + std::to_string(ntohs(addr.sin_port));
+}
+
+bool Connection::peerClosed() const {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (closed) {
+            return true;
+        }
+    }
+
+    struct pollfd pfd = {sock, POLLRDHUP, 0};
+    return poll(&pfd, 1, 0) > 0 && (pfd.revents & (POLLRDHUP | POLLHUP | POLLERR)) != 0;
+}
+
+size_t Connection::openCount() {
+    return openConnections.load();
+}
+
+uint64_t Connection::acceptedCount() {
+    return nextClientId.load() - 1;
+}
+
+bool Connection::send(std::shared_ptr<const std::string> buf) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (closed) {
+        return false;
+    }
+
+    bool idle = queue.empty();
+    queuedBytes += buf->size();
+    queue.push_back(std::move(buf));
+    // With output already parked the poller is waiting for the socket;
+    // writing now would only hit EAGAIN again. Corked replies wait for
+    // their thread to send them.
+    if (idle && !(corked && currentConnection == this)) {
+        flush();
+    }
+
+    if (!closed && limit.exceeded(queuedBytes, std::chrono::steady_clock::now())) {
+        drop("output buffer limit reached");
+    }
+
+    return !closed;
+}
+
+bool Connection::waitForDrain(size_t bytes) {
+    std::unique_lock<std::mutex> lock(mutex);
+    drained.wait(lock, [this, bytes] { return closed || queuedBytes <= bytes; });
+    return !closed;
+}
+
+void Connection::setClass(ClientClass cls) {
+    std::lock_guard<std::mutex> lock(mutex);
+    limit.setClass(cls);
+}
+
+void Connection::setCorked(bool on) {
+    std::lock_guard<std::mutex> lock(mutex);
+    corked = on;
+}
+
+void Connection::flushCorked() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (corked && !closed) {
+        flush();
+    }
+}
+
+struct msghdr* Connection::beginSend() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (closed || sending || queue.empty()) {
+        return nullptr;
+    }
+
+    size_t count = std::min<size_t>(queue.size(), CONNECTION_WRITE_BATCH);
+    sendBufs.assign(queue.begin(), queue.begin() + count);
+    for (size_t i = 0; i < count; i++) {
+        size_t skip = i == 0 ? headOffset : 0;
+        sendIov[i].iov_base = const_cast<char*>(queue[i]->data()) + skip;
+        sendIov[i].iov_len = queue[i]->size() - skip;
+    }
+    sendMsg = {};
+    sendMsg.msg_iov = sendIov;
+    sendMsg.msg_iovlen = count;
+    sending = true;
+    return &sendMsg;
+}
+
+void Connection::endSend(int result) {
+    std::lock_guard<std::mutex> lock(mutex);
+    sending = false;
+    sendBufs.clear();
+    if (closed) {
+        return;
+    }
+
+    if (result < 0) {
+        if (result != -EINTR && result != -EAGAIN) {
+            drop(nullptr);
+        }
+        return;
+    }
+
+    consume(result);
+    drained.notify_all();
+    if (queue.empty()) {
+        unpark();
+    }
+}
+
+size_t Connection::pendingBytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return queuedBytes;
+}
+
+void Connection::close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (closed) {
+        return;
+    }
+
+    closed = true;
+    queue.clear();
+    queuedBytes = 0;
+    unpark();
+    drained.notify_all();
+}
+
+void Connection::flush() {
+    // The in-flight send continues from the head of the queue when it
+    // completes.
+    if (sending) {
+        return;
+    }
+
+    while (!queue.empty()) {
+        struct iovec iov[CONNECTION_WRITE_BATCH];
+        size_t count = std::min<size_t>(queue.size(), CONNECTION_WRITE_BATCH);
+        for (size_t i = 0; i < count; i++) {
+            size_t skip = i == 0 ? headOffset : 0;
+            iov[i].iov_base = const_cast<char*>(queue[i]->data()) + skip;
+            iov[i].iov_len = queue[i]->size() - skip;
+        }
+
+        struct msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        ssize_t written = sendmsg(sock, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            drop(nullptr);
+            return;
+        }
+
+        consume(written);
+    }
+
+    drained.notify_all();
+    if (queue.empty()) {
+        unpark();
+        return;
+    }
+
+    std::call_once(pollerOnce, [] {
+        epollFd = epoll_create1(0);
+        if (epollFd < 0) {
+            die("epoll_create1");
+        }
+        std::thread(outputPollerLoop).detach();
+    });
+
+    // One-shot, so the poller sees each writable socket once per arming.
+    struct epoll_event ev = {};
+    ev.events = EPOLLOUT | EPOLLONESHOT;
+    ev.data.fd = sock;
+    std::lock_guard<std::mutex> lock(pollerMutex);
+    if (!polled) {
+        parked[sock] = shared_from_this();
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, sock, &ev);
+        polled = true;
+    }
+    else {
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, sock, &ev);
+    }
+}
+
+// Caller holds mutex. Removes `written` bytes from the head of the queue.
+void Connection::consume(size_t written) {
+    queuedBytes -= written;
+    while (written > 0) {
+        size_t left = queue.front()->size() - headOffset;
+        if (written < left) {
+            headOffset += written;
+            break;
+        }
+        written -= left;
+        headOffset = 0;
+        queue.pop_front();
+    }
+}
+
+// Caller holds mutex.
+void Connection::unpark() {
+    if (!polled) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(pollerMutex);
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, sock, nullptr);
+    parked.erase(sock);
+    polled = false;
+}
+
+// Caller holds mutex.
+void Connection::drop(const char* reason) {
+    if (reason != nullptr) {
+        std::cout << "Closing " << className(limit.getClass()) << " client on fd " << sock << ": " << reason
+                  << " (" << queuedBytes << " bytes pending)" << std::endl;
+    }
+
+    closed = true;
+    queue.clear();
+    queuedBytes = 0;
+    unpark();
+    // The connection thread sees EOF and cleans up.
+    shutdown(sock, SHUT_RDWR);
+    drained.notify_all();
+}
+
+void Connection::onWritable() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!closed) {
+        flush();
+    }
+}
+
+void Connection::checkLimits(std::chrono::steady_clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!closed && limit.exceeded(queuedBytes, now)) {
+        drop("output buffer limit reached");
+    }
+}
@@ -0,0 +1,151 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define CONNECTION_WRITE_BATCH 64
+#define OUTPUT_POLL_PERIOD_MS 1000
+// A client stops being read from while this much output is pending.
+#define CLIENT_OUTPUT_PAUSE_BYTES 1048576
+
+// Output limits differ by what the client does: pub/sub subscribers and
+// replicas legitimately fall behind in bursts, normal clients by default
+// never get disconnected.
+enum class ClientClass { Normal, Replica, Pubsub };
+
+// Tracks the pending output of one client against the limits of its class.
+class OutputLimit {
+public:
+    explicit OutputLimit(ClientClass cls) : cls(cls) {}
+
+    void setClass(ClientClass c) { cls = c; }
+    ClientClass getClass() const { return cls; }
+
+    // True once `pending` is above the hard limit, or has stayed above the
+    // soft limit for longer than allowed.
+    bool exceeded(size_t pending, std::chrono::steady_clock::time_point now);
+
+private:
+    ClientClass cls;
+    bool overSoft = false;
+    std::chrono::steady_clock::time_point softSince;
+};
+
+// The output side of a client connection.
+//
+// Replies are written with non-blocking sends. Whatever the socket does not
+// take right away is parked in a queue of shared buffers and flushed by the
+// output poller, a single thread waiting for EPOLLOUT on every connection
+// with parked output. Buffers are shared rather than copied, so one pub/sub
+// message queued on many connections exists once.
+//
+// A connection that exceeds its output limits is dropped: its queue is
+// freed and the socket shut down, which the connection's thread sees as EOF.
+//
+// Under the io_uring engine the connection's own thread also sends through
+// its ring: it corks its replies, and takes the queue for one asynchronous
+// send at a time with beginSend(). While that send is in flight, no other
+// thread writes to the socket; their output queues up behind it.
+class Connection : public std::enable_shared_from_this<Connection> {
+public:
+    explicit Connection(int fd);
+    ~Connection();
+
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    int fd() const { return sock; }
+    uint64_t id() const { return clientId; }
+    // ip:port of the peer.
+    std::string peerAddress() const;
+    // Whether the peer has hung up or the connection was dropped, checked
+    // without blocking. Lets a blocked command give up on a gone client.
+    bool peerClosed() const;
+
+    // RESP version negotiated with HELLO, 2 until then. Only the
+    // connection's own thread changes it.
+    int protocol() const { return proto.load(std::memory_order_relaxed); }
+    void setProtocol(int version) { proto.store(version, std::memory_order_relaxed); }
+
+    // The connection served by the calling client thread, null on other
+    // threads.
+    static Connection* current();
+    static void setCurrent(Connection* conn);
+
+    // Connections open now, and accepted since startup.
+    static size_t openCount();
+    static uint64_t acceptedCount();
+
+    // Returns false if the connection has been dropped, either earlier or
+    // because this reply crossed its limits.
+    bool send(std::shared_ptr<const std::string> buf);
+    bool send(std::string data) { return send(std::make_shared<const std::string>(std::move(data))); }
+
+    // Blocks while more than `bytes` are pending. Returns false if the
+    // connection was dropped meanwhile.
+    bool waitForDrain(size_t bytes);
+
+    void setClass(ClientClass cls);
+    size_t pendingBytes() const;
+
+    // While corked, replies of the connection's own thread are only
+    // queued, for it to send with beginSend().
+    void setCorked(bool on);
+    // Sends what the owning thread has corked now, before it blocks in a
+    // command. A no-op when not corked.
+    void flushCorked();
+
+    // Describes the head of the queue for an asynchronous send and marks it
+    // in flight; null if the queue is empty, a send is already in flight or
+    // the connection was dropped. The message stays valid until endSend().
+    struct msghdr* beginSend();
+    // Completes the send started by beginSend(): `result` is the bytes
+    // written or -errno.
+    void endSend(int result);
+
+    // Stops all output. Must be called before the socket is closed.
+    void close();
+
+private:
+    friend void outputPollerLoop();
+
+    // Caller holds mutex.
+    void flush();
+    void consume(size_t written);
+    void unpark();
+    void drop(const char* reason);
+
+    // Called by the output poller.
+    void onWritable();
+    void checkLimits(std::chrono::steady_clock::time_point now);
+
+    int sock;
+    uint64_t clientId;
+    std::atomic<int> proto{2};
+    mutable std::mutex mutex;
+    std::condition_variable drained;
+    std::deque<std::shared_ptr<const std::string>> queue;
+    size_t queuedBytes = 0;
+    size_t headOffset = 0;
+    OutputLimit limit;
+    bool polled = false;
+    bool closed = false;
+    bool corked = false;
+    // The asynchronous send in flight, and the buffers it reads from, kept
+    // alive even if the queue is cleared meanwhile.
+    bool sending = false;
+    struct iovec sendIov[CONNECTION_WRITE_BATCH];
+    struct msghdr sendMsg;
+    std::vector<std::shared_ptr<const std::string>> sendBufs;
+};
+
+#endif // CONNECTION_H
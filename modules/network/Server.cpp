@@ -1,52 +1,172 @@
+#include <algorithm>
+#include <netinet/tcp.h>
 #include <thread>
 #include <vector>
 #include "Server.h"
+#include "Connection.h"
+#include "Uring.h"
 #include "commands/Handler.h"
 #include "core/Common.h"
 #include "protocol/RESPParser.h"
 #include "protocol/Response.h"
 #include "config/Config.h"
+#include "replication/Replication.h"
+#include "cluster/Cluster.h"
+#include "pubsub/PubSub.h"
+#include "transaction/Transaction.h"
+#include "tracking/Tracking.h"
+#include "stats/Stats.h"
+#include "stats/SlowLog.h"
+#include "stats/Latency.h"
 
-void processRequest(const std::vector<std::string>& req, int clientFd) {
+// Runs the command, counting the call and its latency for INFO, and
+// reporting it to the slow log and latency monitor if it ran long. Its keys
+// count toward hot-key detection, those of a script being the ones it
+// declares. Time spent blocked waiting for streams is not counted.
+static std::unique_ptr<resp::Response> execute(const Command& cmd, const std::vector<std::string>& req) {
+    sampleKeys(cmd, req);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::unique_ptr<resp::Response> output = cmd.func(req);
+    uint64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    nanos -= std::min(nanos, takeBlockedNanos());
+    stats::record(cmd.id, nanos, output != nullptr && output->prefix() == "-");
+    slowlog::record(req, nanos / 1000);
+    latency::record("command", nanos / 1000000);
+    return output;
+}
+
+void processRequest(const std::vector<std::string>& req, Connection& conn) {
     if (req.size() == 0) {
         return;
     }
 
     if (req[0] == "COMMAND") {
-        const char* response = "*1\r\n$4\r\nPING\r\n";
-        writeExactly(clientFd, response, strlen(response));
+        conn.send("*1\r\n$4\r\nPING\r\n");
     }
     else {
-        CmdFunc handler = getHandler(req[0]);
-        std::unique_ptr<resp::Response> output = handler(req);
+        const Command* cmd = lookupCommand(req[0]);
+        bool asking = cluster::takeAsking();
+        std::string redirect;
+        if (cmd != nullptr && cluster::enabled()) {
+            std::vector<std::string> keys = commandKeys(*cmd, req);
+            if (!keys.empty()) {
+                redirect = cluster::route(keys, asking);
+            }
+        }
+
+        std::unique_ptr<resp::Response> output;
+        if (cmd == nullptr) {
+            output = std::make_unique<resp::Error>("ERR unknown command '" + req[0] + "'");
+        }
+        else if (!redirect.empty()) {
+            stats::reject(cmd->id);
+            output = std::make_unique<resp::Error>(redirect);
+        }
+        else if (!(cmd->flags & CMD_PUBSUB) && pubsub::subscribed() && conn.protocol() == 2) {
+            stats::reject(cmd->id);
+            output = std::make_unique<resp::Error>("ERR Can't execute '" + req[0] +
+                                                   "': only (P)SUBSCRIBE / (P)UNSUBSCRIBE / PING are allowed in this context");
+        }
+        else if ((cmd->flags & CMD_WRITE) && replication::isReplica()) {
+            stats::reject(cmd->id);
+            output = std::make_unique<resp::Error>("READONLY You can't write against a read only replica.");
+        }
+        else if (transaction::active() && !(cmd->flags & CMD_TRANSACTION)) {
+            transaction::queue(req);
+            output = std::make_unique<resp::SimpleString>("QUEUED");
+        }
+        else if (!(cmd->flags & CMD_WRITE)) {
+            tracking::remember(commandKeys(*cmd, req));
+            output = execute(*cmd, req);
+        }
+        else if (cmd->flags & CMD_BLOCKING) {
+            output = execute(*cmd, req);
+        }
+        else {
+            replication::WriteScope scope;
+            output = execute(*cmd, req);
+            if (output != nullptr && output->prefix() != "-" && !(cmd->flags & CMD_EFFECTS)) {
+                scope.propagate(req);
+            }
+        }
+
         if (output == nullptr) {
             throw RedisServerError("Command failed to return a valid Response!");
         }
 
-        std::string response = output->serialize();
-        writeExactly(clientFd, response.c_str(), response.size());
+        // A command refused while queueing dooms the whole transaction.
+        if (transaction::active() && output->prefix() == "-") {
+            transaction::fail();
+        }
+
+        conn.send(output->serialize(conn.protocol()));
     }
 }
 
 void handleClient(int clientFd) {
+    std::shared_ptr<Connection> conn = std::make_shared<Connection>(clientFd);
     RESPParser parser(clientFd);
+    parser.setQueryLimit(config::GlobalConfig.clientQueryBufferLimit);
+    Connection::setCurrent(conn.get());
+    pubsub::attach(*conn);
+
+    // Under io_uring the parser reads through the thread's ring, which also
+    // sends the replies. A client whose ring cannot be set up is served
+    // the plain way.
+    std::unique_ptr<uring::ClientIo> io;
+    if (uring::enabled()) {
+        try {
+            io = std::make_unique<uring::ClientIo>(*conn);
+            parser.setSource([&io] { return io->read(); });
+        }
+        catch (const SysCallFailure& e) {
+            std::cout << "Serving client on fd " << clientFd << " without io_uring: " << e.what() << std::endl;
+        }
+    }
+    auto drain = [&conn, &io](size_t bytes) {
+        return io ? io->waitForDrain(bytes) : conn->waitForDrain(bytes);
+    };
+
     while (true) {
         try {
+            // Backpressure: a client that does not read its replies is not
+            // served more until they drain, or its output limits drop it.
+            if (!drain(CLIENT_OUTPUT_PAUSE_BYTES)) {
+                break;
+            }
+
             std::vector<std::string> req = parser.readNewRequest();
             if (req.size() == 0) {
                 throw RedisServerError("Read empty request!");
             }
 
             req[0] = toLower(req[0]);
-            processRequest(req, clientFd);
+            // A replica's PSYNC turns this connection into its stream.
+            if (req[0] == "psync") {
+                bool drained = drain(0);
+                // The replica's acknowledgements are read by the stream.
+                io.reset();
+                if (drained) {
+                    replication::serveReplica(clientFd, req);
+                }
+                break;
+            }
+
+            processRequest(req, *conn);
         }
         catch (const std::exception& e) {
             break;
         }
+    }
 
-        if (close(clientFd)) {
-            die("client");
-        }
+    transaction::discard();
+    pubsub::detach();
+    tracking::disable();
+    Connection::setCurrent(nullptr);
+    io.reset();
+    conn->close();
+    if (close(clientFd)) {
+        die("client");
     }
 }
 
@@ -79,6 +199,18 @@ int setupServer() {
 
 void handleClients(int serverFd) {
     std::vector<std::thread> clientThreads;
+    auto startClient = [&clientThreads](int clientFd) {
+        // Replies are written one per command; with Nagle on, the second
+        // of a pipelined batch waits for the client's delayed ACK.
+        int noDelay = 1;
+        setsockopt(clientFd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+        clientThreads.emplace_back(handleClient, clientFd);
+    };
+
+    if (uring::enabled()) {
+        uring::acceptLoop(serverFd, startClient);
+    }
     while (true) {
         struct sockaddr_in clientAddr;
         socklen_t clientAddrLen = sizeof(clientAddr);
@@ -86,8 +218,7 @@ void handleClients(int serverFd) {
         if ((clientFd = accept(serverFd, (struct sockaddr*)&clientAddr, &clientAddrLen)) < 0) {
             die("accept");
         }
-
-        clientThreads.emplace_back(handleClient, clientFd);
+        startClient(clientFd);
     }
 
     for (auto& thread : clientThreads) {
@@ -4,7 +4,9 @@
 #include <vector>
 #include <string>
 
-void processRequest(const std::vector<std::string>& req, int clientFd);
+class Connection;
+
+void processRequest(const std::vector<std::string>& req, Connection& conn);
 void handleClient(int clientFd);
 int setupServer();
 void handleClients(int serverFd);
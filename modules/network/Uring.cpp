@@ -0,0 +1,441 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <cstddef>
+#include <iostream>
+#include <vector>
+#include "Uring.h"
+#include "Connection.h"
+#include "config/Config.h"
+#include "core/Common.h"
+
+// Ring entries per round of snapshot writes, the fsync included.
+#define URING_WRITE_ENTRIES 32
+
+namespace {
+
+enum Tag : uint64_t { TAG_RECV = 1, TAG_SEND, TAG_CANCEL };
+
+const size_t PAGE_SIZE_BYTES = 4096;
+
+// Registers a ring of URING_RECV_BUFFERS provided buffers as group 0;
+// returns its page, or null if the kernel does not support them (< 5.19).
+void* registerBufRing(int ringFd) {
+    void* page = mmap(nullptr, PAGE_SIZE_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (page == MAP_FAILED) {
+        return nullptr;
+    }
+
+    struct io_uring_buf_reg reg = {};
+    reg.ring_addr = reinterpret_cast<uint64_t>(page);
+    reg.ring_entries = URING_RECV_BUFFERS;
+    reg.bgid = 0;
+    if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        munmap(page, PAGE_SIZE_BYTES);
+        return nullptr;
+    }
+
+    return page;
+}
+
+// Empty if the kernel has everything the engine uses, else what is missing.
+std::string probe() {
+    try {
+        uring::Ring ring(URING_CLIENT_ENTRIES);
+        std::vector<char> mem(sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op));
+        struct io_uring_probe* ops = reinterpret_cast<struct io_uring_probe*>(mem.data());
+        if (syscall(__NR_io_uring_register, ring.fd(), IORING_REGISTER_PROBE, ops, 256) < 0) {
+            return "no opcode probe";
+        }
+
+        for (int op : {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_WRITE, IORING_OP_FSYNC,
+                       IORING_OP_ASYNC_CANCEL}) {
+            if (op > ops->last_op || !(ops->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                return "opcode " + std::to_string(op) + " unsupported";
+            }
+        }
+
+        void* bufRing = registerBufRing(ring.fd());
+        if (bufRing == nullptr) {
+            return "no provided buffer rings";
+        }
+        munmap(bufRing, PAGE_SIZE_BYTES);
+    }
+    catch (const SysCallFailure& e) {
+        return e.what();
+    }
+
+    return "";
+}
+
+}
+
+bool uring::enabled() {
+    static const bool on = [] {
+        const std::string& engine = config::GlobalConfig.ioEngine;
+        if (engine != "io_uring") {
+            if (engine != "epoll") {
+                std::cout << "Unknown io_engine '" << engine << "', using epoll" << std::endl;
+            }
+            return false;
+        }
+
+        std::string missing = probe();
+        if (!missing.empty()) {
+            std::cout << "io_uring unavailable (" << missing << "), using epoll" << std::endl;
+            return false;
+        }
+
+        std::cout << "Using the io_uring I/O engine" << std::endl;
+        return true;
+    }();
+
+    return on;
+}
+
+uring::Ring::Ring(unsigned entries) {
+    struct io_uring_params params = {};
+    // Only the thread that made a ring ever submits to it.
+    params.flags = IORING_SETUP_SINGLE_ISSUER;
+    ringFd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ringFd < 0 && errno == EINVAL) {
+        params = {};
+        ringFd = syscall(__NR_io_uring_setup, entries, &params);
+    }
+    if (ringFd < 0) {
+        throw SysCallFailure("io_uring_setup failed!");
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        ::close(ringFd);
+        throw SysCallFailure("io_uring too old!");
+    }
+
+    sqRingSize = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                          params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqeMem = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (sqRing == MAP_FAILED || sqeMem == MAP_FAILED) {
+        if (sqRing != MAP_FAILED) {
+            munmap(sqRing, sqRingSize);
+        }
+        if (sqeMem != MAP_FAILED) {
+            munmap(sqeMem, sqesSize);
+        }
+        ::close(ringFd);
+        throw SysCallFailure("io_uring mmap failed!");
+    }
+
+    char* base = static_cast<char*>(sqRing);
+    sqes = static_cast<struct io_uring_sqe*>(sqeMem);
+    sqHead = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+    sqMask = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+    sqEntries = params.sq_entries;
+    sqArray = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+    cqHead = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct io_uring_cqe*>(base + params.cq_off.cqes);
+    localTail = *sqTail;
+}
+
+uring::Ring::~Ring() {
+    munmap(sqes, sqesSize);
+    munmap(sqRing, sqRingSize);
+    ::close(ringFd);
+}
+
+struct io_uring_sqe* uring::Ring::next() {
+    if (localTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+        return nullptr;
+    }
+
+    unsigned index = localTail & sqMask;
+    sqArray[index] = index;
+    localTail++;
+    struct io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int uring::Ring::enter(unsigned wait) {
+    __atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+    while (true) {
+        // Whatever the kernel has not consumed yet, so a retry after EINTR
+        // does not submit anything twice.
+        unsigned pending = localTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+        int n = syscall(__NR_io_uring_enter, ringFd, pending, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        if (n >= 0) {
+            return n;
+        }
+        if (errno != EINTR) {
+            return -errno;
+        }
+    }
+}
+
+bool uring::Ring::pop(struct io_uring_cqe& out) {
+    unsigned head = *cqHead;
+    if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    out = cqes[head & cqMask];
+    __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+uring::ClientIo::ClientIo(Connection& conn)
+    : conn(conn), ring(URING_CLIENT_ENTRIES), buffers(new char[URING_RECV_BUFFERS * URING_RECV_BUFFER_SIZE]) {
+    bufRing = registerBufRing(ring.fd());
+    if (bufRing == nullptr) {
+        throw SysCallFailure("io_uring buffer ring registration failed!");
+    }
+    for (unsigned short bid = 0; bid < URING_RECV_BUFFERS; bid++) {
+        recycle(bid);
+    }
+
+    conn.setCorked(true);
+    armRecv();
+}
+
+uring::ClientIo::~ClientIo() {
+    for (Tag tag : {TAG_RECV, TAG_SEND}) {
+        if (tag == TAG_RECV ? receiving : sending) {
+            struct io_uring_sqe* sqe = ring.next();
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = tag;
+            sqe->user_data = TAG_CANCEL;
+        }
+    }
+    // Both write into memory about to be freed.
+    while (receiving || sending) {
+        if (!wait()) {
+            break;
+        }
+    }
+
+    conn.setCorked(false);
+    munmap(bufRing, PAGE_SIZE_BYTES);
+}
+
+std::string uring::ClientIo::read() {
+    while (true) {
+        if (!received.empty()) {
+            std::pair<unsigned short, unsigned> chunk = received.front();
+            received.pop_front();
+            std::string data(buffers.get() + chunk.first * URING_RECV_BUFFER_SIZE, chunk.second);
+            recycle(chunk.first);
+            return data;
+        }
+        if (eof) {
+            return "";
+        }
+
+        if (!receiving) {
+            armRecv();
+        }
+        startSend();
+        if (!wait()) {
+            eof = true;
+        }
+    }
+}
+
+bool uring::ClientIo::waitForDrain(size_t bytes) {
+    // A dropped connection has nothing pending; its thread then reads EOF.
+    while (conn.pendingBytes() > bytes) {
+        startSend();
+        if (!wait()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void uring::ClientIo::armRecv() {
+    struct io_uring_sqe* sqe = ring.next();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn.fd();
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->ioprio = multishot ? IORING_RECV_MULTISHOT : 0;
+    sqe->user_data = TAG_RECV;
+    receiving = true;
+}
+
+void uring::ClientIo::startSend() {
+    if (sending) {
+        return;
+    }
+    struct msghdr* msg = conn.beginSend();
+    if (msg == nullptr) {
+        return;
+    }
+
+    struct io_uring_sqe* sqe = ring.next();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn.fd();
+    sqe->addr = reinterpret_cast<uint64_t>(msg);
+    sqe->len = 1;
+    // Stream sockets retry short sends rather than complete them.
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->user_data = TAG_SEND;
+    sending = true;
+}
+
+bool uring::ClientIo::wait() {
+    if (ring.enter(1) < 0) {
+        return false;
+    }
+
+    struct io_uring_cqe cqe;
+    while (ring.pop(cqe)) {
+        if (cqe.user_data == TAG_SEND) {
+            sending = false;
+            conn.endSend(cqe.res);
+        }
+        else if (cqe.user_data == TAG_RECV) {
+            if (!(cqe.flags & IORING_CQE_F_MORE)) {
+                receiving = false;
+            }
+            unsigned short bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+            if (cqe.res > 0) {
+                received.emplace_back(bid, cqe.res);
+                continue;
+            }
+            if (cqe.flags & IORING_CQE_F_BUFFER) {
+                recycle(bid);
+            }
+
+            if (cqe.res == -EINVAL && multishot) {
+                // Multishot receives need 6.0; take one chunk per receive.
+                multishot = false;
+            }
+            // Out of buffers: rearmed once some are read.
+            else if (cqe.res != -ENOBUFS) {
+                eof = true;
+            }
+        }
+    }
+
+    return true;
+}
+
+void uring::ClientIo::recycle(unsigned short bid) {
+    struct io_uring_buf* bufs = static_cast<struct io_uring_buf*>(bufRing);
+    struct io_uring_buf& buf = bufs[bufTail & (URING_RECV_BUFFERS - 1)];
+    buf.addr = reinterpret_cast<uint64_t>(buffers.get() + bid * URING_RECV_BUFFER_SIZE);
+    buf.len = URING_RECV_BUFFER_SIZE;
+    buf.bid = bid;
+    bufTail++;
+    // The tail overlays the reserved field of the first buffer.
+    unsigned short* tail = reinterpret_cast<unsigned short*>(static_cast<char*>(bufRing) + offsetof(struct io_uring_buf, resv));
+    __atomic_store_n(tail, bufTail, __ATOMIC_RELEASE);
+}
+
+void uring::acceptLoop(int serverFd, const std::function<void(int)>& onClient) {
+    Ring ring(URING_ACCEPT_ENTRIES);
+    bool multishot = true;
+    bool armed = false;
+    while (true) {
+        if (!armed) {
+            struct io_uring_sqe* sqe = ring.next();
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = serverFd;
+            sqe->ioprio = multishot ? IORING_ACCEPT_MULTISHOT : 0;
+            armed = true;
+        }
+
+        int n = ring.enter(1);
+        if (n < 0) {
+            errno = -n;
+            die("io_uring_enter");
+        }
+
+        struct io_uring_cqe cqe;
+        while (ring.pop(cqe)) {
+            if (!(cqe.flags & IORING_CQE_F_MORE)) {
+                armed = false;
+            }
+            if (cqe.res >= 0) {
+                onClient(cqe.res);
+            }
+            else if (cqe.res == -EINVAL && multishot) {
+                // Multishot accepts need 5.19.
+                multishot = false;
+            }
+            else {
+                errno = -cqe.res;
+                die("accept");
+            }
+        }
+    }
+}
+
+bool uring::writeFile(const std::string& path, const std::string& data) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool ok = true;
+    try {
+        Ring ring(URING_WRITE_ENTRIES);
+        size_t offset = 0;
+        bool synced = false;
+        while (ok && !synced) {
+            // A chain of writes, then on the last round the fsync, all in
+            // one submission. Each entry carries the result it should
+            // complete with.
+            unsigned count = 0;
+            struct io_uring_sqe* last = nullptr;
+            while (offset < data.size() && count < URING_WRITE_ENTRIES - 1) {
+                size_t len = std::min<size_t>(URING_WRITE_CHUNK, data.size() - offset);
+                struct io_uring_sqe* sqe = ring.next();
+                sqe->opcode = IORING_OP_WRITE;
+                sqe->fd = fd;
+                sqe->addr = reinterpret_cast<uint64_t>(data.data() + offset);
+                sqe->len = len;
+                sqe->off = offset;
+                sqe->flags = IOSQE_IO_LINK;
+                sqe->user_data = len;
+                last = sqe;
+                offset += len;
+                count++;
+            }
+            if (offset == data.size()) {
+                struct io_uring_sqe* sqe = ring.next();
+                sqe->opcode = IORING_OP_FSYNC;
+                sqe->fd = fd;
+                sqe->user_data = 0;
+                count++;
+                synced = true;
+            }
+            else {
+                last->flags = 0;
+            }
+
+            if (ring.enter(count) < 0) {
+                ok = false;
+                break;
+            }
+            struct io_uring_cqe cqe;
+            while (ring.pop(cqe)) {
+                if (cqe.res != static_cast<int64_t>(cqe.user_data)) {
+                    ok = false;
+                }
+            }
+        }
+    }
+    catch (const SysCallFailure& e) {
+        ok = false;
+    }
+
+    if (::close(fd) != 0) {
+        ok = false;
+    }
+    return ok;
+}
@@ -0,0 +1,134 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+
+// Submission queue depth of a client thread's ring: one multishot receive,
+// one send and their cancellations.
+#define URING_CLIENT_ENTRIES 8
+// Receive buffers the kernel picks from, per client. A power of two.
+#define URING_RECV_BUFFERS 8
+#define URING_RECV_BUFFER_SIZE 8192
+#define URING_ACCEPT_ENTRIES 16
+// Snapshot files are written in linked chunks of this size.
+#define URING_WRITE_CHUNK 1048576
+
+class Connection;
+
+// The io_uring I/O engine, selected with `"io_engine": "io_uring"`.
+//
+// The server keeps its thread per client; what changes is how that thread
+// talks to its socket. Each one owns a small ring with a multishot receive
+// armed on the socket, landing in a ring of provided buffers, so requests
+// arriving while a command runs are already waiting when the thread wants
+// them. Replies are corked while more requests are buffered and go out as
+// one send, submitted in the same io_uring_enter that waits for the next
+// request: a request/reply round trip costs one system call instead of a
+// read and a sendmsg, and a pipelined batch one per batch.
+//
+// Accepts use a multishot accept, and snapshots are written as linked
+// writes followed by an fsync in a single submission. Kernels without the
+// opcodes used, or without io_uring at all, fall back to epoll.
+namespace uring {
+
+// True when io_uring is configured and the kernel supports it. Decided,
+// and logged, on first call.
+bool enabled();
+
+// A ring driven through the raw system calls.
+class Ring {
+public:
+    // Throws SysCallFailure if the kernel refuses the ring.
+    explicit Ring(unsigned entries);
+    ~Ring();
+
+    Ring(const Ring&) = delete;
+    Ring& operator=(const Ring&) = delete;
+
+    int fd() const { return ringFd; }
+
+    // A cleared entry to fill in, queued for the next enter(); null when
+    // the submission queue is full.
+    struct io_uring_sqe* next();
+    // Submits the queued entries and waits for at least `wait`
+    // completions. Returns the entries submitted, or -errno.
+    int enter(unsigned wait);
+    // Pops the oldest completion into `out`; false when there is none.
+    bool pop(struct io_uring_cqe& out);
+
+private:
+    int ringFd = -1;
+    void* sqRing = nullptr;
+    size_t sqRingSize = 0;
+    struct io_uring_sqe* sqes = nullptr;
+    size_t sqesSize = 0;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe* cqes;
+    // Entries handed out by next() and not yet published to the kernel.
+    unsigned localTail;
+};
+
+// The socket I/O of one client thread. Replaces the blocking read of the
+// parser and the waits for output to drain; the connection's replies stay
+// corked until the thread needs more input.
+class ClientIo {
+public:
+    explicit ClientIo(Connection& conn);
+    // Cancels the receive and any send in flight and waits for both.
+    ~ClientIo();
+
+    ClientIo(const ClientIo&) = delete;
+    ClientIo& operator=(const ClientIo&) = delete;
+
+    // The next chunk of input, after sending whatever output is queued.
+    // Empty at EOF or on error.
+    std::string read();
+
+    // Connection::waitForDrain for a thread whose sends complete on its
+    // own ring.
+    bool waitForDrain(size_t bytes);
+
+private:
+    void armRecv();
+    void startSend();
+    // Submits, waits for a completion and handles all that are posted.
+    // False if the ring cannot be entered.
+    bool wait();
+    void recycle(unsigned short bid);
+
+    Connection& conn;
+    Ring ring;
+    // Page holding the buffer ring shared with the kernel.
+    void* bufRing = nullptr;
+    std::unique_ptr<char[]> buffers;
+    unsigned short bufTail = 0;
+    // Received chunks not read yet, by buffer id and length. Their buffers
+    // go back to the kernel only when read, which bounds what a client can
+    // have buffered to URING_RECV_BUFFERS chunks.
+    std::deque<std::pair<unsigned short, unsigned>> received;
+    bool multishot = true;
+    bool receiving = false;
+    bool sending = false;
+    bool eof = false;
+};
+
+// Accepts connections on `serverFd` forever, handing each to `onClient`.
+void acceptLoop(int serverFd, const std::function<void(int)>& onClient);
+
+// Replaces the file at `path` with `data` and fsyncs it.
+bool writeFile(const std::string& path, const std::string& data);
+
+}
+
+#endif // URING_H
@@ -1,34 +1,196 @@
+#include <fcntl.h>
+#include <cstring>
 #include <fstream>
 #include <filesystem>
+#include <map>
 #include <thread>
 #include <nlohmann/json.hpp>
 #include "Snapshot.h"
 #include "data/Store.h"
+#include "network/Uring.h"
+#include "protocol/RESPParser.h"
+#include "protocol/Response.h"
+#include "stats/Latency.h"
 
 #define STATEFILE "state.json"
 
+namespace {
+
+std::mutex saveInfoMutex;
+Snapshot::SaveInfo saveInfo;
+
+const char base64Digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Strict UTF-8, as the JSON writer checks it: no overlong forms, no
+// surrogates, nothing above U+10FFFF.
+bool validUtf8(const std::string& s) {
+    size_t i = 0;
+    while (i < s.size()) {
+        unsigned char c = s[i];
+        if (c < 0x80) {
+            i++;
+            continue;
+        }
+
+        size_t extra = c >= 0xc2 && c <= 0xdf ? 1 : c >= 0xe0 && c <= 0xef ? 2 : c >= 0xf0 && c <= 0xf4 ? 3 : 0;
+        if (extra == 0 || i + extra >= s.size()) {
+            return false;
+        }
+        unsigned char second = s[i + 1];
+        unsigned char low = c == 0xe0 ? 0xa0 : c == 0xf0 ? 0x90 : 0x80;
+        unsigned char high = c == 0xed ? 0x9f : c == 0xf4 ? 0x8f : 0xbf;
+        if (second < low || second > high) {
+            return false;
+        }
+        for (size_t k = 2; k <= extra; k++) {
+            if ((static_cast<unsigned char>(s[i + k]) >> 6) != 0x2) {
+                return false;
+            }
+        }
+        i += extra + 1;
+    }
+    return true;
+}
+
+std::string toBase64(const std::string& in) {
+    std::string out;
+    out.reserve((in.size() + 2) / 3 * 4);
+    for (size_t i = 0; i < in.size(); i += 3) {
+        uint32_t n = static_cast<unsigned char>(in[i]) << 16;
+        if (i + 1 < in.size()) {
+            n |= static_cast<unsigned char>(in[i + 1]) << 8;
+        }
+        if (i + 2 < in.size()) {
+            n |= static_cast<unsigned char>(in[i + 2]);
+        }
+        out += base64Digits[(n >> 18) & 63];
+        out += base64Digits[(n >> 12) & 63];
+        out += i + 1 < in.size() ? base64Digits[(n >> 6) & 63] : '=';
+        out += i + 2 < in.size() ? base64Digits[n & 63] : '=';
+    }
+    return out;
+}
+
+std::string fromBase64(const std::string& in) {
+    std::string out;
+    out.reserve(in.size() / 4 * 3);
+    uint32_t n = 0;
+    int bits = 0;
+    for (char c : in) {
+        if (c == '=') {
+            break;
+        }
+        const char* digit = std::strchr(base64Digits, c);
+        if (c == '\0' || digit == nullptr) {
+            throw RedisServerError("Bad base64 value in snapshot");
+        }
+        n = (n << 6) | (digit - base64Digits);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out += static_cast<char>((n >> bits) & 0xff);
+        }
+    }
+    return out;
+}
+
+}
+
+// JSON strings hold UTF-8 only: other values, such as bitmaps, are saved
+// base64-encoded under "val_base64" instead of "val". So are compressed
+// ones, kept compressed and marked with their "encoding".
 void to_json(nlohmann::json& j, const ValueEntry& v) {
-    j = nlohmann::json{{"val", v.val}, {"expiry_epoch", v.expiryEpoch}};
+    if (v.encoding == compression::Encoding::Lz4) {
+        j = nlohmann::json{{"val_base64", toBase64(v.val)}, {"encoding", "lz4"}, {"expiry_epoch", v.expiryEpoch}};
+    }
+    else if (validUtf8(v.val)) {
+        j = nlohmann::json{{"val", v.val}, {"expiry_epoch", v.expiryEpoch}};
+    }
+    else {
+        j = nlohmann::json{{"val_base64", toBase64(v.val)}, {"expiry_epoch", v.expiryEpoch}};
+    }
 }
 
 void from_json(const nlohmann::json& j, ValueEntry& v) {
-    j.at("val").get_to(v.val);
+    auto encoded = j.find("val_base64");
+    if (encoded != j.end()) {
+        v.val = fromBase64(encoded->get<std::string>());
+    }
+    else {
+        j.at("val").get_to(v.val);
+    }
     j.at("expiry_epoch").get_to(v.expiryEpoch);
+
+    auto encoding = j.find("encoding");
+    if (encoding != j.end()) {
+        if (encoding->get<std::string>() != "lz4") {
+            throw RedisServerError("Unknown value encoding in snapshot");
+        }
+        v.encoding = compression::Encoding::Lz4;
+    }
 }
 
 bool Snapshot::save() {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool ok = save(STATEFILE);
+    long millis = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    latency::record("snapshot-save", millis);
+
+    std::lock_guard<std::mutex> lock(saveInfoMutex);
+    saveInfo.saves++;
+    saveInfo.lastOk = ok;
+    saveInfo.lastDurationMs = millis;
+    if (ok) {
+        saveInfo.lastSave = std::time(nullptr);
+    }
+    return ok;
+}
+
+Snapshot::SaveInfo Snapshot::lastSave() {
+    std::lock_guard<std::mutex> lock(saveInfoMutex);
+    return saveInfo;
+}
+
+bool Snapshot::save(const std::string& file, const std::function<void()>& copied) {
     try {
         nlohmann::json json;
+        json["data"] = nlohmann::json::object();
+        json["list_data"] = nlohmann::json::object();
+        json["stream_data"] = nlohmann::json::object();
         Store& store = Store::getInstance();
-        {
-            std::shared_lock<std::shared_mutex> lockData(store.getDataMutex());
-            std::shared_lock<std::shared_mutex> lockList(store.getListMutex());
-            json["data"] = store.getData();
-            json["list_data"] = store.getListData();
+        for (size_t shard = 0; shard < Store::shardCount(); shard++) {
+            store.forEachData(shard, [&json](const std::string& key, const ValueEntry& entry) {
+                json["data"][key] = entry;
+            }, true);
+
+            store.forEachList(shard, [&json](const std::string& key, const std::deque<std::string>& list) {
+                json["list_data"][key] = list;
+            });
+
+            store.forEachStream(shard, [&json](const std::string& key, const Stream& stream) {
+                std::vector<std::string> record;
+                stream.toRecord(record);
+                json["stream_data"][key] = record;
+            });
+        }
+
+        // After the values: the registry only grows, so every dictionary
+        // they refer to is there. Raw values saved with compression on were
+        // left raw on purpose.
+        json["compression"] = config::GlobalConfig.compression;
+        json["dictionaries"] = nlohmann::json::object();
+        for (const auto& [id, bytes] : compression::dictionaries()) {
+            json["dictionaries"][std::to_string(id)] = toBase64(bytes);
+        }
+        if (copied) {
+            copied();
         }
     
         std::filesystem::path currentPath = std::filesystem::current_path();
-        std::filesystem::path state = currentPath / STATEFILE;
+        std::filesystem::path state = currentPath / file;
+        if (uring::enabled()) {
+            return uring::writeFile(state.string(), json.dump(4) + "\n");
+        }
         std::ofstream outputFile(state);
         outputFile << json.dump(4) << std::endl;
     } catch (const std::exception& e) {
@@ -39,17 +201,45 @@ bool Snapshot::save() {
 }
 
 bool Snapshot::load() {
+    return load(STATEFILE);
+}
+
+bool Snapshot::load(const std::string& file) {
     try {
         Store& store = Store::getInstance();
-        std::unique_lock<std::shared_mutex> lockData(store.getDataMutex());
-        std::unique_lock<std::shared_mutex> lockList(store.getListMutex());
         std::filesystem::path currentPath = std::filesystem::current_path();
-        std::filesystem::path state = currentPath / STATEFILE;
+        std::filesystem::path state = currentPath / file;
         std::ifstream inputFile(state);
         nlohmann::json json = nlohmann::json::parse(inputFile);
+
+        // Dictionaries get ids of this process, which compressed values are
+        // retagged with. The last one saved becomes current if none is.
+        std::map<uint8_t, uint8_t> dictionaryIds;
+        auto itDictionaries = json.find("dictionaries");
+        if (itDictionaries != json.end()) {
+            for (const auto& [id, bytes] : itDictionaries->items()) {
+                dictionaryIds[std::stoi(id)] = compression::addDictionary(fromBase64(bytes.get<std::string>()));
+            }
+        }
+        if (!dictionaryIds.empty() && compression::currentDictionary() == 0) {
+            compression::useDictionary(dictionaryIds.rbegin()->second);
+        }
+
         auto itData = json.find("data");
         if (itData != json.end()) {
-            store.setData(itData.value());
+            auto data = itData->get<std::unordered_map<std::string, ValueEntry>>();
+            for (auto& [key, entry] : data) {
+                uint8_t id = entry.encoding == compression::Encoding::Raw ? 0 : compression::dictionaryOf(entry.val);
+                if (id == 0) {
+                    continue;
+                }
+                auto mapped = dictionaryIds.find(id);
+                if (mapped == dictionaryIds.end()) {
+                    throw RedisServerError("Snapshot value refers to a missing dictionary");
+                }
+                compression::retag(entry.val, mapped->second);
+            }
+            store.setData(data, !json.value("compression", false));
         } 
         else {
             throw RedisServerError("Could not find data map");
@@ -62,6 +252,18 @@ bool Snapshot::load() {
         else {
             throw RedisServerError("Could not find list_data map");
         }
+
+        // Optional: state files from before streams have none.
+        std::unordered_map<std::string, std::unique_ptr<Stream>> streams;
+        auto itStreamData = json.find("stream_data");
+        if (itStreamData != json.end()) {
+            for (const auto& [key, value] : itStreamData->items()) {
+                std::vector<std::string> record = value.get<std::vector<std::string>>();
+                size_t pos = 0;
+                streams[key] = Stream::fromRecord(record, pos);
+            }
+        }
+        store.setStreamData(std::move(streams));
     } catch (const std::exception& e) {
         return false;
     }
@@ -69,6 +271,79 @@ bool Snapshot::load() {
     return true;
 }
 
+void Snapshot::encodeKeyspace(std::string& out) {
+    for (size_t shard = 0; shard < Store::shardCount(); shard++) {
+        encodeShard(shard, out);
+    }
+
+    out += resp::encodeCommand({"eof"});
+}
+
+void Snapshot::encodeShard(size_t shard, std::string& out) {
+    Store& store = Store::getInstance();
+    store.forEachData(shard, [&out](const std::string& key, const ValueEntry& entry) {
+        out += resp::encodeCommand({"string", key, entry.val, std::to_string(entry.expiryEpoch)});
+    });
+
+    store.forEachList(shard, [&out](const std::string& key, const std::deque<std::string>& list) {
+        std::vector<std::string> record = {"list", key};
+        record.insert(record.end(), list.begin(), list.end());
+        out += resp::encodeCommand(record);
+    });
+
+    store.forEachStream(shard, [&out](const std::string& key, const Stream& stream) {
+        std::vector<std::string> record = {"stream", key};
+        stream.toRecord(record);
+        out += resp::encodeCommand(record);
+    });
+}
+
+bool Snapshot::applyRecord(const std::vector<std::string>& record) {
+    if (record.size() == 4 && record[0] == "string") {
+        Store::getInstance().set(record[1], record[2], std::stol(record[3]));
+        return true;
+    }
+    if (record.size() >= 3 && record[0] == "list") {
+        std::vector<std::string> elements(record.begin() + 2, record.end());
+        Store::getInstance().lpush(record[1], elements, true);
+        return true;
+    }
+    if (record.size() >= 2 && record[0] == "stream") {
+        size_t pos = 2;
+        std::unique_ptr<Stream> stream = Stream::fromRecord(record, pos);
+        Store::getInstance().writeStream(record[1], [&stream](std::unique_ptr<Stream>& slot) {
+            slot = std::move(stream);
+            return true;
+        });
+        return true;
+    }
+    if (record.size() == 1 && record[0] == "eof") {
+        return false;
+    }
+
+    throw IncorrectProtocol("Bad snapshot record");
+}
+
+bool Snapshot::loadRecords(const std::string& file) {
+    int fd = open((std::filesystem::current_path() / file).c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool ok = true;
+    try {
+        RESPParser parser(fd);
+        Store::getInstance().clear(true);
+        while (applyRecord(parser.readNewRequest())) {
+        }
+    } catch (const std::exception& e) {
+        ok = false;
+    }
+
+    close(fd);
+    return ok;
+}
+
 void Snapshot::periodicSave() {
     while (true) {
         save();
@@ -4,8 +4,36 @@
 #include "config/Config.h"
 
 namespace Snapshot {
+    struct SaveInfo {
+        uint64_t saves = 0;         // attempts since startup
+        std::time_t lastSave = 0;   // time of the last successful save
+        bool lastOk = true;
+        long lastDurationMs = 0;
+    };
+
     bool save();
     bool load();
+    // Outcome of save() to the state file, for INFO persistence.
+    SaveInfo lastSave();
+
+    // The same, against an arbitrary file in the working directory; used to
+    // ship and receive full replication syncs. `copied`, if set, runs once
+    // the keyspace has been copied and before it is serialized and written,
+    // so a caller freezing writes for a consistent image can let them go.
+    bool save(const std::string& file, const std::function<void()>& copied = nullptr);
+    bool load(const std::string& file);
+
+    // Compact RESP encoding of the keyspace used by diskless replication:
+    // one record per key, `string <key> <value> <expiry>`,
+    // `list <key> <elements...>` or `stream <key> <Stream::toRecord()...>`,
+    // terminated by an `eof` record.
+    void encodeKeyspace(std::string& out);
+    // The records of one Store shard, without the `eof` record.
+    void encodeShard(size_t shard, std::string& out);
+    // Applies one record to the Store; returns false at the `eof` record.
+    bool applyRecord(const std::vector<std::string>& record);
+    // Replaces the keyspace with a file of such records.
+    bool loadRecords(const std::string& file);
     void periodicSave();
 }
 
@@ -1,24 +1,21 @@
 #include "RESPParser.h"
 
 std::string RESPParser::readFromFd(int nBytes) {
-    char buf[nBytes];
-    ssize_t bytesRead = recv(readFd, buf, nBytes, 0);
-    if (bytesRead <= 0) {
-        throw SysCallFailure("recv failed!");
+    if (source) {
+        std::string chunk = source();
+        if (chunk.empty()) {
+            throw SysCallFailure("read failed!");
+        }
+        return chunk;
     }
-    return std::string(buf, bytesRead);
-}
-
-bool RESPParser::cacheHasValidItem(std::string& item) {
-    for (int i = 0; i < readCache.length(); i++) {
-        item += readCache[i];
 
-        if (item.length() >= 2 && item[item.length() - 2] == '\r' && item[item.length() - 1] == '\n') {
-            readCache = readCache.substr(i + 1);
-            return true;
-        }
+    std::vector<char> buf(nBytes);
+    // read() rather than recv() so a parser can also replay a file.
+    ssize_t bytesRead = read(readFd, buf.data(), nBytes);
+    if (bytesRead <= 0) {
+        throw SysCallFailure("read failed!");
     }
-    return false;
+    return std::string(buf.data(), bytesRead);
 }
 
 void RESPParser::updateCache() {
@@ -28,14 +25,53 @@ void RESPParser::updateCache() {
 std::string RESPParser::readNextItem() {
     std::string item = "";
 
-    while (!cacheHasValidItem(item)) {
-        if (item.length() > ITEM_LEN_MAX) {
-            throw IncorrectProtocol("item length too big!");
+    while (true) {
+        // The CRLF may straddle two reads.
+        size_t from = item.empty() ? 0 : item.length() - 1;
+        item += readCache;
+        size_t end = item.find("\r\n", from);
+        if (end != std::string::npos) {
+            readCache = item.substr(end + 2);
+            item.resize(end + 2);
+            consumed += item.length();
+            requestBytes += item.length();
+            return item;
+        }
+
+        readCache.clear();
+        if (queryLimit != 0 && requestBytes + item.length() > queryLimit) {
+            throw IncorrectProtocol("query buffer limit exceeded");
         }
         updateCache();
     }
+}
+
+std::string RESPParser::readExactly(size_t nBytes) {
+    std::string out;
+    readPayload(nBytes, [&out](const char* data, size_t len) {
+        out.append(data, len);
+    });
 
-    return item;
+    return out;
+}
+
+std::string RESPParser::readLine() {
+    std::string item = readNextItem();
+    return item.substr(0, item.length() - 2);
+}
+
+void RESPParser::readPayload(size_t nBytes, const std::function<void(const char*, size_t)>& sink) {
+    while (nBytes > 0) {
+        if (readCache.empty()) {
+            updateCache();
+        }
+
+        size_t take = std::min(nBytes, readCache.size());
+        sink(readCache.data(), take);
+        readCache.erase(0, take);
+        consumed += take;
+        nBytes -= take;
+    }
 }
 
 bool RESPParser::validateArraySize(const std::string& sizeItem) {
@@ -53,7 +89,7 @@ bool RESPParser::validateArraySize(const std::string& sizeItem) {
         return false;
     }
 
-    for (int i = 0; i < len - 2; ++i) {
+    for (int i = 1; i < len - 2; ++i) {
         if (sizeItem[i] < '0' || sizeItem[i] > '9') {
             return false;
         }
@@ -77,7 +113,10 @@ bool RESPParser::validateBstrSize(const std::string& sizeItem) {
         return false;
     }
 
-    for (int i = 0; i < len - 2; ++i) {
+    for (int i = 1; i < len - 2; ++i) {
+        if (i == 1 && sizeItem[i] == '-') {
+            continue;
+        }
         if (sizeItem[i] < '0' || sizeItem[i] > '9') {
             return false;
         }
@@ -97,6 +136,7 @@ bool RESPParser::validateCrlf(const std::string& bstr) {
 }
 
 std::vector<std::string> RESPParser::readNewRequest() {
+    requestBytes = 0;
     std::string arrSizeItem = readNextItem();
 
     if (!validateArraySize(arrSizeItem)) {
@@ -105,19 +145,22 @@ std::vector<std::string> RESPParser::readNewRequest() {
 
     int size = std::stoi(arrSizeItem.substr(1, arrSizeItem.length() - 3));
 
-    std::vector<std::string> req(size);
+    // The element count is not trusted for allocation; elements are only
+    // kept once they have actually arrived within the query limit.
+    std::vector<std::string> req;
+    req.reserve(std::min(size, READ_CACHE_MAX));
 
     for (int i = 0; i < size; ++i) {
         std::string bstrSizeItem = readNextItem();
 
-        if (!validateArraySize(bstrSizeItem)) {
+        if (!validateBstrSize(bstrSizeItem)) {
             throw IncorrectProtocol("Bad bulk string size");
         }
 
         int bstrSize = std::stoi(bstrSizeItem.substr(1, bstrSizeItem.length() - 3));
 
         if (bstrSize == -1) {
-            req[i] = NULL_BULK_STRING;
+            req.push_back(NULL_BULK_STRING);
             continue;
         }
 
@@ -125,19 +168,23 @@ std::vector<std::string> RESPParser::readNewRequest() {
             throw IncorrectProtocol("Bulk string size is less than -1");
         }
 
-        std::string bstrItem = readNextItem();
-
-        if (!validateCrlf(bstrItem)) {
-            throw IncorrectProtocol("Bulk string not terminated by CRLF");
+        // Read by length so values may contain CRLF.
+        if (bstrSize > ITEM_LEN_MAX) {
+            throw IncorrectProtocol("item length too big!");
         }
+        if (queryLimit != 0 && requestBytes + bstrSize + 2 > queryLimit) {
+            throw IncorrectProtocol("query buffer limit exceeded");
+        }
+        requestBytes += bstrSize + 2;
 
-        std::string bstr = bstrItem.substr(0, bstrItem.length() - 2);
+        std::string bstrItem = readExactly(bstrSize + 2);
 
-        if (bstr.length() != bstrSize) {
-            throw IncorrectProtocol("Bulk string size doesn't match");
+        if (!validateCrlf(bstrItem)) {
+            throw IncorrectProtocol("Bulk string not terminated by CRLF");
         }
 
-        req[i] = bstr;
+        bstrItem.resize(bstrSize);
+        req.push_back(std::move(bstrItem));
     }
 
     return req;
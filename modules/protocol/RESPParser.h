@@ -11,17 +11,22 @@ class RESPParser {
 
 private:
     int readFd = -1;
+    std::function<std::string()> source;
     std::string readCache = "";
+    uint64_t consumed = 0;
+    // Bytes of the request being read, checked against queryLimit.
+    size_t requestBytes = 0;
+    size_t queryLimit = 0;
 
 protected:
     bool validateArraySize(const std::string& sizeItem);
     bool validateBstrSize(const std::string& sizeItem);
     bool validateCrlf(const std::string& bstr);
-    bool cacheHasValidItem(std::string& item);
     void updateCache();
 
     std::string readFromFd(int nBytes);
     std::string readNextItem();
+    std::string readExactly(size_t nBytes);
 
 public:
     RESPParser(int fd) {
@@ -30,6 +35,25 @@ public:
     }
 
     std::vector<std::string> readNewRequest();
+
+    // Takes input from `fn` instead of the fd, a chunk per call; an empty
+    // chunk is EOF. Used by the io_uring engine.
+    void setSource(std::function<std::string()> fn) { source = std::move(fn); }
+
+    // Largest request readNewRequest() accepts, in bytes; 0 for no limit.
+    // A request that would exceed it fails with IncorrectProtocol before
+    // its payload is buffered.
+    void setQueryLimit(size_t bytes) { queryLimit = bytes; }
+
+    // Raw access for the replication handshake: a CRLF-terminated line
+    // without its terminator, and a payload of known length delivered to
+    // `sink` in chunks as it arrives.
+    std::string readLine();
+    void readPayload(size_t nBytes, const std::function<void(const char*, size_t)>& sink);
+
+    // Total bytes consumed from the socket so far; a replica uses it to
+    // track its offset in the primary's stream.
+    uint64_t bytesConsumed() const { return consumed; }
 };
 
 #endif // RESPPARSER_H
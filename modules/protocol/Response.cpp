@@ -1,3 +1,46 @@
 #include "Response.h"
 
 std::string resp::Response::CRLF = "\r\n";
+
+std::string resp::encodeCommand(const std::vector<std::string>& args) {
+    std::string out = "*" + std::to_string(args.size()) + Response::CRLF;
+    for (const std::string& arg : args) {
+        out += "$" + std::to_string(arg.size()) + Response::CRLF + arg + Response::CRLF;
+    }
+
+    return out;
+}
+
+bool resp::decodeCommand(const std::string& in, std::vector<std::string>& args) {
+    size_t pos = 0;
+    auto readNumber = [&in, &pos](char prefix, size_t& n) {
+        size_t end = in.find(Response::CRLF, pos);
+        if (end == std::string::npos || end == pos + 1 || in[pos] != prefix) {
+            return false;
+        }
+        try {
+            n = std::stoul(in.substr(pos + 1, end - pos - 1));
+        } catch (const std::exception& e) {
+            return false;
+        }
+        pos = end + 2;
+        return true;
+    };
+
+    size_t count;
+    if (!readNumber('*', count)) {
+        return false;
+    }
+
+    args.clear();
+    for (size_t i = 0; i < count; i++) {
+        size_t len;
+        if (!readNumber('$', len) || len > in.size() - pos || in.compare(pos + len, 2, Response::CRLF) != 0) {
+            return false;
+        }
+        args.emplace_back(in, pos, len);
+        pos += len + 2;
+    }
+
+    return pos == in.size();
+}
@@ -1,16 +1,41 @@
 #ifndef RESPONSE_H
 #define RESPONSE_H
 
+#include <cmath>
+#include <cstdio>
 #include "core/Common.h"
 
 namespace resp {
 
+// A reply is built once and encoded for the protocol the connection speaks,
+// 2 or 3 (HELLO). RESP3-only types fall back to their RESP2 counterparts,
+// so handlers can always return the most precise type.
 class Response {
 public:
     virtual ~Response() {};
     virtual std::string prefix() = 0;
-    virtual std::string serialize() = 0;
+    virtual void serializeTo(std::string& out, int protocol) = 0;
+
+    std::string serialize(int protocol = 2) {
+        std::string out;
+        serializeTo(out, protocol);
+        return out;
+    }
+
     static std::string CRLF;
+
+protected:
+    static void header(std::string& out, char type, size_t n) {
+        out += type;
+        out += std::to_string(n);
+        out += CRLF;
+    }
+
+    static void bulk(std::string& out, const std::string& str) {
+        header(out, '$', str.size());
+        out += str;
+        out += CRLF;
+    }
 };
 
 class SimpleString : public Response {
@@ -19,8 +44,8 @@ public:
 
     std::string prefix() override { return "+"; }
 
-    std::string serialize() override {
-        return prefix() + str + CRLF;
+    void serializeTo(std::string& out, int) override {
+        out += prefix() + str + CRLF;
     }
 
 private:
@@ -33,8 +58,8 @@ public:
 
     std::string prefix() override { return "-"; }
 
-    std::string serialize() override {
-        return prefix() + str + CRLF;
+    void serializeTo(std::string& out, int) override {
+        out += prefix() + str + CRLF;
     }
 
 private:
@@ -43,16 +68,16 @@ private:
 
 class Integer : public Response {
 public:
-    Integer(int input) : val(input) {}
+    Integer(int64_t input) : val(input) {}
 
     std::string prefix() override { return ":"; }
 
-    std::string serialize() override {
-        return prefix() + std::to_string(val) + CRLF;
+    void serializeTo(std::string& out, int) override {
+        out += prefix() + std::to_string(val) + CRLF;
     }
 
 private:
-    int val;
+    int64_t val;
 };
 
 class BulkString : public Response {
@@ -61,22 +86,37 @@ public:
 
     std::string prefix() override { return "$"; }
 
-    std::string serialize() override {
-        return prefix() + std::to_string(str.size()) + CRLF + str + CRLF;
+    void serializeTo(std::string& out, int) override {
+        bulk(out, str);
     }
 
 private:
     std::string str;
 };
 
+// A missing value. RESP3 has a single null for every type.
 class NullString : public Response {
 public:
     NullString() : str("-1") {}
 
     std::string prefix() override { return "$"; }
 
-    std::string serialize() override {
-        return prefix() + str + CRLF;
+    void serializeTo(std::string& out, int protocol) override {
+        out += protocol == 3 ? "_" + CRLF : prefix() + str + CRLF;
+    }
+
+private:
+    std::string str;
+};
+
+class NullArray : public Response {
+public:
+    NullArray() : str("-1") {}
+
+    std::string prefix() override { return "*"; }
+
+    void serializeTo(std::string& out, int protocol) override {
+        out += protocol == 3 ? "_" + CRLF : prefix() + str + CRLF;
     }
 
 private:
@@ -89,25 +129,242 @@ public:
 
     std::string prefix() override { return "*"; }
 
-    std::string serialize() override {
-        std::string res = prefix() + std::to_string(array.size()) + CRLF;
+    void serializeTo(std::string& out, int protocol) override {
+        header(out, '*', array.size());
         for (const auto& it : array) {
-            res += it->serialize();
+            it->serializeTo(out, protocol);
         }
-        return res;
     }
 
     void addElement(std::unique_ptr<Response> robj) {
         array.emplace_back(std::move(robj));
     }
 
+    size_t size() const { return array.size(); }
+
     Array(const Array&) = delete;
     Array& operator=(const Array&) = delete;
 
-private:
+protected:
     std::vector<std::unique_ptr<Response>> array;
 };
 
+// RESP3 null. A null bulk string in RESP2.
+class Null : public Response {
+public:
+    Null() {}
+
+    std::string prefix() override { return "_"; }
+
+    void serializeTo(std::string& out, int protocol) override {
+        out += protocol == 3 ? prefix() + CRLF : "$-1" + CRLF;
+    }
+};
+
+// RESP3 map: key/value pairs in order. A flat array of 2n elements in RESP2,
+// or with `nested`, an array of n [key, value] pairs, as XREAD replies.
+class Map : public Response {
+public:
+    explicit Map(bool nested = false) : nested(nested) {}
+
+    std::string prefix() override { return "%"; }
+
+    void serializeTo(std::string& out, int protocol) override {
+        if (protocol == 3) {
+            header(out, '%', entries.size());
+        }
+        else {
+            header(out, '*', nested ? entries.size() : entries.size() * 2);
+        }
+        for (const auto& [key, value] : entries) {
+            if (protocol != 3 && nested) {
+                header(out, '*', 2);
+            }
+            key->serializeTo(out, protocol);
+            value->serializeTo(out, protocol);
+        }
+    }
+
+    void addEntry(std::unique_ptr<Response> key, std::unique_ptr<Response> value) {
+        entries.emplace_back(std::move(key), std::move(value));
+    }
+
+    // The common case: a field name and its value.
+    void addEntry(const std::string& key, std::unique_ptr<Response> value) {
+        addEntry(std::make_unique<BulkString>(key), std::move(value));
+    }
+
+    Map(const Map&) = delete;
+    Map& operator=(const Map&) = delete;
+
+    size_t size() const { return entries.size(); }
+
+private:
+    bool nested;
+    std::vector<std::pair<std::unique_ptr<Response>, std::unique_ptr<Response>>> entries;
+};
+
+// RESP3 set: an unordered collection of distinct elements. A plain array
+// in RESP2.
+class Set : public Array {
+public:
+    Set() {}
+
+    std::string prefix() override { return "~"; }
+
+    void serializeTo(std::string& out, int protocol) override {
+        header(out, protocol == 3 ? '~' : '*', array.size());
+        for (const auto& it : array) {
+            it->serializeTo(out, protocol);
+        }
+    }
+};
+
+// RESP3 push: out-of-band data the server sends on its own, such as
+// invalidation and pub/sub messages. A plain array in RESP2, which is how
+// pub/sub messages have always looked there.
+class Push : public Array {
+public:
+    Push() {}
+
+    std::string prefix() override { return ">"; }
+
+    void serializeTo(std::string& out, int protocol) override {
+        header(out, protocol == 3 ? '>' : '*', array.size());
+        for (const auto& it : array) {
+            it->serializeTo(out, protocol);
+        }
+    }
+};
+
+// RESP3 double. A bulk string in RESP2, with the same text.
+class Double : public Response {
+public:
+    Double(double input) : val(input) {}
+
+    std::string prefix() override { return ","; }
+
+    void serializeTo(std::string& out, int protocol) override {
+        std::string text;
+        if (std::isnan(val)) {
+            text = "nan";
+        }
+        else if (std::isinf(val)) {
+            text = val > 0 ? "inf" : "-inf";
+        }
+        else {
+            char buf[32];
+            int n = std::snprintf(buf, sizeof(buf), "%.17g", val);
+            text.assign(buf, n);
+        }
+
+        if (protocol == 3) {
+            out += prefix() + text + CRLF;
+        }
+        else {
+            bulk(out, text);
+        }
+    }
+
+private:
+    double val;
+};
+
+// RESP3 boolean. The integers 1 and 0 in RESP2.
+class Boolean : public Response {
+public:
+    Boolean(bool input) : val(input) {}
+
+    std::string prefix() override { return "#"; }
+
+    void serializeTo(std::string& out, int protocol) override {
+        if (protocol == 3) {
+            out += prefix() + (val ? "t" : "f") + CRLF;
+        }
+        else {
+            out += std::string(":") + (val ? "1" : "0") + CRLF;
+        }
+    }
+
+private:
+    bool val;
+};
+
+// RESP3 verbatim string: text tagged with a three letter format, "txt" or
+// "mkd", for clients to display as is. A bulk string in RESP2.
+class Verbatim : public Response {
+public:
+    Verbatim(const std::string& input, const std::string& fmt = "txt") : str(input), format(fmt) {}
+
+    std::string prefix() override { return "="; }
+
+    void serializeTo(std::string& out, int protocol) override {
+        if (protocol != 3) {
+            bulk(out, str);
+            return;
+        }
+        header(out, '=', format.size() + 1 + str.size());
+        out += format;
+        out += ':';
+        out += str;
+        out += CRLF;
+    }
+
+private:
+    std::string str;
+    std::string format;
+};
+
+// RESP3 big number, given as its decimal digits. A bulk string in RESP2.
+class BigNumber : public Response {
+public:
+    BigNumber(const std::string& digits) : str(digits) {}
+
+    std::string prefix() override { return "("; }
+
+    void serializeTo(std::string& out, int protocol) override {
+        if (protocol == 3) {
+            out += prefix() + str + CRLF;
+        }
+        else {
+            bulk(out, str);
+        }
+    }
+
+private:
+    std::string str;
+};
+
+// Several replies to one command, sent back to back. SUBSCRIBE answers
+// once per channel.
+class Replies : public Response {
+public:
+    Replies() {}
+
+    std::string prefix() override { return replies.empty() ? "" : replies.front()->prefix(); }
+
+    void serializeTo(std::string& out, int protocol) override {
+        for (const auto& it : replies) {
+            it->serializeTo(out, protocol);
+        }
+    }
+
+    void addReply(std::unique_ptr<Response> robj) {
+        replies.emplace_back(std::move(robj));
+    }
+
+    Replies(const Replies&) = delete;
+    Replies& operator=(const Replies&) = delete;
+
+private:
+    std::vector<std::unique_ptr<Response>> replies;
+};
+
+// Encodes a request the way a client sends it: an array of bulk strings.
+std::string encodeCommand(const std::vector<std::string>& args);
+// Inverse of encodeCommand; false if `in` is not exactly one such array.
+bool decodeCommand(const std::string& in, std::vector<std::string>& args);
+
 }
 
 #endif // RESPONSE_H
@@ -0,0 +1,261 @@
+#include <memory>
+#include <shared_mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include "PubSub.h"
+#include "network/Connection.h"
+#include "core/Glob.h"
+#include "protocol/Response.h"
+
+namespace {
+
+struct PatternEntry {
+    explicit PatternEntry(const std::string& pattern) : glob(pattern) {}
+
+    GlobPattern glob;
+    std::unordered_set<Connection*> subscribers;
+};
+
+// Patterns hang off the node reached by their literal prefix, so matching a
+// channel walks the trie along the channel name and tests only the
+// patterns found on that path.
+struct TrieNode {
+    std::unordered_map<char, std::unique_ptr<TrieNode>> children;
+    std::unordered_map<std::string, PatternEntry> patterns;
+};
+
+std::string literalPrefix(const std::string& pattern) {
+    return pattern.substr(0, pattern.find_first_of("*?[\\"));
+}
+
+std::shared_mutex registryMutex;
+std::unordered_map<std::string, std::unordered_set<Connection*>> channelTable;
+TrieNode patternRoot;
+size_t patternCount = 0;
+
+// The current connection and what it is subscribed to. Only its own thread
+// touches the sets, but the registry changes under registryMutex with them.
+thread_local Connection* current = nullptr;
+thread_local std::unordered_set<std::string> myChannels;
+thread_local std::unordered_set<std::string> myPatterns;
+
+size_t subscriptionCount() {
+    return myChannels.size() + myPatterns.size();
+}
+
+// Subscribers are held to the pub/sub output limits while subscribed.
+void updateClass() {
+    current->setClass(subscriptionCount() == 0 ? ClientClass::Normal : ClientClass::Pubsub);
+}
+
+// Caller holds registryMutex exclusively.
+void addPattern(const std::string& pattern, Connection* sub) {
+    TrieNode* node = &patternRoot;
+    for (char c : literalPrefix(pattern)) {
+        std::unique_ptr<TrieNode>& child = node->children[c];
+        if (child == nullptr) {
+            child = std::make_unique<TrieNode>();
+        }
+        node = child.get();
+    }
+
+    auto it = node->patterns.try_emplace(pattern, pattern).first;
+    patternCount += it->second.subscribers.empty();
+    it->second.subscribers.insert(sub);
+}
+
+// Caller holds registryMutex exclusively. Returns whether `node` is left
+// empty, so the parent can prune it.
+bool removePattern(TrieNode* node, const std::string& pattern, size_t depth, Connection* sub) {
+    if (depth == literalPrefix(pattern).size()) {
+        auto it = node->patterns.find(pattern);
+        if (it != node->patterns.end()) {
+            it->second.subscribers.erase(sub);
+            if (it->second.subscribers.empty()) {
+                node->patterns.erase(it);
+                patternCount--;
+            }
+        }
+    }
+    else {
+        auto child = node->children.find(pattern[depth]);
+        if (child != node->children.end() && removePattern(child->second.get(), pattern, depth + 1, sub)) {
+            node->children.erase(child);
+        }
+    }
+
+    return node->patterns.empty() && node->children.empty();
+}
+
+// A message encoded on first use for each protocol its subscribers speak:
+// a plain array for RESP2, a push for RESP3.
+class Message {
+public:
+    Message(std::initializer_list<std::string> parts) : parts(parts) {}
+
+    std::shared_ptr<const std::string> get(int protocol) {
+        std::shared_ptr<const std::string>& buf = protocol == 3 ? resp3 : resp2;
+        if (buf == nullptr) {
+            resp::Push push;
+            for (const std::string& part : parts) {
+                push.addElement(std::make_unique<resp::BulkString>(part));
+            }
+            buf = std::make_shared<const std::string>(push.serialize(protocol));
+        }
+
+        return buf;
+    }
+
+private:
+    std::vector<std::string> parts;
+    std::shared_ptr<const std::string> resp2;
+    std::shared_ptr<const std::string> resp3;
+};
+
+}
+
+void pubsub::attach(Connection& conn) {
+    current = &conn;
+}
+
+void pubsub::detach() {
+    if (current == nullptr) {
+        return;
+    }
+
+    {
+        std::unique_lock<std::shared_mutex> lock(registryMutex);
+        for (const std::string& channel : myChannels) {
+            auto it = channelTable.find(channel);
+            it->second.erase(current);
+            if (it->second.empty()) {
+                channelTable.erase(it);
+            }
+        }
+        for (const std::string& pattern : myPatterns) {
+            removePattern(&patternRoot, pattern, 0, current);
+        }
+    }
+
+    myChannels.clear();
+    myPatterns.clear();
+    current = nullptr;
+}
+
+bool pubsub::subscribed() {
+    return subscriptionCount() != 0;
+}
+
+size_t pubsub::subscribe(const std::string& channel) {
+    std::unique_lock<std::shared_mutex> lock(registryMutex);
+    if (myChannels.insert(channel).second) {
+        channelTable[channel].insert(current);
+    }
+
+    updateClass();
+    return subscriptionCount();
+}
+
+size_t pubsub::unsubscribe(const std::string& channel) {
+    std::unique_lock<std::shared_mutex> lock(registryMutex);
+    if (myChannels.erase(channel) != 0) {
+        auto it = channelTable.find(channel);
+        it->second.erase(current);
+        if (it->second.empty()) {
+            channelTable.erase(it);
+        }
+    }
+
+    updateClass();
+    return subscriptionCount();
+}
+
+size_t pubsub::psubscribe(const std::string& pattern) {
+    std::unique_lock<std::shared_mutex> lock(registryMutex);
+    if (myPatterns.insert(pattern).second) {
+        addPattern(pattern, current);
+    }
+
+    updateClass();
+    return subscriptionCount();
+}
+
+size_t pubsub::punsubscribe(const std::string& pattern) {
+    std::unique_lock<std::shared_mutex> lock(registryMutex);
+    if (myPatterns.erase(pattern) != 0) {
+        removePattern(&patternRoot, pattern, 0, current);
+    }
+
+    updateClass();
+    return subscriptionCount();
+}
+
+std::vector<std::string> pubsub::channels() {
+    return std::vector<std::string>(myChannels.begin(), myChannels.end());
+}
+
+std::vector<std::string> pubsub::patterns() {
+    return std::vector<std::string>(myPatterns.begin(), myPatterns.end());
+}
+
+size_t pubsub::publish(const std::string& channel, const std::string& message) {
+    size_t receivers = 0;
+    std::shared_lock<std::shared_mutex> lock(registryMutex);
+    auto it = channelTable.find(channel);
+    if (it != channelTable.end()) {
+        Message msg{"message", channel, message};
+        for (Connection* sub : it->second) {
+            receivers += sub->send(msg.get(sub->protocol()));
+        }
+    }
+
+    const TrieNode* node = &patternRoot;
+    for (size_t depth = 0; node != nullptr; depth++) {
+        for (const auto& [pattern, entry] : node->patterns) {
+            if (!entry.glob.matches(channel)) {
+                continue;
+            }
+            Message msg{"pmessage", pattern, channel, message};
+            for (Connection* sub : entry.subscribers) {
+                receivers += sub->send(msg.get(sub->protocol()));
+            }
+        }
+
+        if (depth == channel.size()) {
+            break;
+        }
+        auto child = node->children.find(channel[depth]);
+        node = child == node->children.end() ? nullptr : child->second.get();
+    }
+
+    return receivers;
+}
+
+std::vector<std::string> pubsub::activeChannels(const std::string& pattern) {
+    GlobPattern glob(pattern);
+    std::vector<std::string> result;
+    std::shared_lock<std::shared_mutex> lock(registryMutex);
+    for (const auto& [channel, subscribers] : channelTable) {
+        if (glob.matches(channel)) {
+            result.push_back(channel);
+        }
+    }
+
+    return result;
+}
+
+std::vector<std::pair<std::string, size_t>> pubsub::numSubscribers(const std::vector<std::string>& channels) {
+    std::vector<std::pair<std::string, size_t>> result;
+    std::shared_lock<std::shared_mutex> lock(registryMutex);
+    for (const std::string& channel : channels) {
+        auto it = channelTable.find(channel);
+        result.emplace_back(channel, it == channelTable.end() ? 0 : it->second.size());
+    }
+
+    return result;
+}
+
+size_t pubsub::numPatterns() {
+    std::shared_lock<std::shared_mutex> lock(registryMutex);
+    return patternCount;
+}
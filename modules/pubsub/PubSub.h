@@ -0,0 +1,58 @@
+#ifndef PUBSUB_H
+#define PUBSUB_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+class Connection;
+
+// Publish/subscribe messaging.
+//
+// Channel subscriptions are a hash table from channel to subscribers.
+// Pattern subscriptions are compiled once into GlobPatterns and indexed in
+// a trie by their literal prefix (the part before the first wildcard), so a
+// publish only tests the patterns whose prefix the channel starts with.
+//
+// Each published message is serialized once per channel and once per
+// matching pattern, for each protocol in use among the subscribers, and the
+// resulting buffer is shared by every subscriber connection it is queued
+// on. RESP3 subscribers get messages as pushes, which they can tell apart
+// from replies, so they may run other commands while subscribed. Subscribers are held to the pubsub class of
+// client output limits, so a subscriber that stops reading is disconnected
+// instead of slowing publishers down or growing without bound.
+//
+// Subscription state belongs to the connection, which is tracked per
+// client thread between attach() and detach().
+namespace pubsub {
+
+void attach(Connection& conn);
+// Drops every subscription of the current connection.
+void detach();
+
+// Whether the current connection has any subscription left; if so, a RESP2
+// connection may only run subscription commands and PING.
+bool subscribed();
+
+// Subscribe or unsubscribe the current connection. Each returns the number
+// of channels and patterns it is subscribed to afterwards.
+size_t subscribe(const std::string& channel);
+size_t unsubscribe(const std::string& channel);
+size_t psubscribe(const std::string& pattern);
+size_t punsubscribe(const std::string& pattern);
+
+// Current connection's subscriptions, for UNSUBSCRIBE without arguments.
+std::vector<std::string> channels();
+std::vector<std::string> patterns();
+
+// Returns the number of subscribers the message was queued for.
+size_t publish(const std::string& channel, const std::string& message);
+
+// PUBSUB introspection.
+std::vector<std::string> activeChannels(const std::string& pattern);
+std::vector<std::pair<std::string, size_t>> numSubscribers(const std::vector<std::string>& channels);
+size_t numPatterns();
+
+}
+
+#endif // PUBSUB_H
@@ -0,0 +1,47 @@
+#include <algorithm>
+#include <cstring>
+#include "Backlog.h"
+
+Backlog::Backlog(size_t capacity, uint64_t base) : buf(std::max<size_t>(capacity, 1)), begin(base), end(base) {}
+
+void Backlog::append(const char* data, size_t len) {
+    size_t capacity = buf.size();
+    // Only the last `capacity` bytes can survive anyway.
+    if (len > capacity) {
+        end += len - capacity;
+        data += len - capacity;
+        len = capacity;
+    }
+
+    while (len > 0) {
+        size_t pos = end % capacity;
+        size_t take = std::min(len, capacity - pos);
+        memcpy(buf.data() + pos, data, take);
+        data += take;
+        len -= take;
+        end += take;
+    }
+
+    if (end - begin > capacity) {
+        begin = end - capacity;
+    }
+}
+
+bool Backlog::read(uint64_t offset, size_t maxBytes, std::string& out) const {
+    if (offset < begin || offset > end) {
+        return false;
+    }
+
+    size_t capacity = buf.size();
+    size_t len = std::min<uint64_t>(maxBytes, end - offset);
+    out.clear();
+    while (len > 0) {
+        size_t pos = offset % capacity;
+        size_t take = std::min(len, capacity - pos);
+        out.append(buf.data() + pos, take);
+        offset += take;
+        len -= take;
+    }
+
+    return true;
+}
@@ -0,0 +1,35 @@
+#ifndef BACKLOG_H
+#define BACKLOG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Fixed-size circular buffer over the tail of the replication stream.
+//
+// Offsets are absolute positions in the stream. The backlog holds the bytes
+// in [startOffset(), endOffset()); once it wraps, the oldest bytes are
+// overwritten and replicas that still need them must do a full resync.
+// Not thread-safe; the replication module serializes access.
+class Backlog {
+public:
+    // `base` is the stream offset of the first byte that will be appended.
+    Backlog(size_t capacity, uint64_t base);
+
+    void append(const char* data, size_t len);
+
+    uint64_t startOffset() const { return begin; }
+    uint64_t endOffset() const { return end; }
+
+    // Copies up to `maxBytes` starting at `offset` into `out`. Returns false
+    // if `offset` is no longer (or not yet) covered by the backlog.
+    bool read(uint64_t offset, size_t maxBytes, std::string& out) const;
+
+private:
+    std::vector<char> buf;
+    uint64_t begin;
+    uint64_t end;
+};
+
+#endif // BACKLOG_H
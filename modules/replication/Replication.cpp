@@ -0,0 +1,897 @@
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <optional>
+#include <random>
+#include <thread>
+#include <poll.h>
+#include "Replication.h"
+#include "Backlog.h"
+#include "commands/Handler.h"
+#include "transaction/Transaction.h"
+#include "config/Config.h"
+#include "data/Slab.h"
+#include "data/Store.h"
+#include "network/Connection.h"
+#include "persistence/Snapshot.h"
+#include "protocol/RESPParser.h"
+#include "stats/Latency.h"
+
+namespace {
+
+struct ReplicaLink {
+    std::string ip;
+    int port;
+    std::atomic<uint64_t> offset;
+};
+
+std::string randomId() {
+    static const char hex[] = "0123456789abcdef";
+    std::random_device rd;
+    std::mt19937_64 gen((static_cast<uint64_t>(rd()) << 32) | rd());
+    std::string id(40, '0');
+    for (char& c : id) {
+        c = hex[gen() & 15];
+    }
+
+    return id;
+}
+
+// Everything below is guarded by stateMutex unless it is atomic.
+std::mutex stateMutex;
+std::condition_variable streamCond;
+
+// Primary state. The offset only advances while a backlog exists.
+std::string replId = randomId();
+uint64_t masterOffset = 0;
+std::unique_ptr<Backlog> backlog;
+std::list<std::shared_ptr<ReplicaLink>> links;
+
+// Replica state. `generation` changes on every REPLICAOF so that a link
+// thread started for an earlier primary knows to stop.
+bool replicaRole = false;
+std::atomic<bool> replicaFlag{false};
+std::string masterHost;
+int masterPort = 0;
+uint64_t generation = 0;
+std::string linkState;
+int masterFd = -1;
+std::string masterReplId = "?";
+uint64_t replOffset = 0;
+
+// Write ordering; see WriteScope.
+std::mutex orderMutex;
+std::atomic<bool> orderingEnabled{false};
+std::atomic<int> unorderedWriters{0};
+
+// When the last replica left, and whether a thread is waiting to release
+// the backlog; see releaseWhenIdle().
+std::chrono::steady_clock::time_point lastReplicaLeft;
+bool releaseScheduled = false;
+
+// Full syncs go through one snapshot file, so they run one at a time.
+std::mutex syncMutex;
+
+// Reported through status().
+std::atomic<uint64_t> lastSyncFreezeUs{0};
+std::atomic<uint64_t> lastSyncBytes{0};
+std::atomic<uint64_t> syncBufferBytes{0};
+
+uint64_t microsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Diskless syncs are shared: replicas asking within the delay window of the
+// first one join its job and receive the same payload.
+struct SyncJob {
+    std::vector<int> fds;
+    std::vector<std::shared_ptr<ReplicaLink>> links;
+    std::vector<bool> ok;
+    uint64_t start = 0;
+    bool done = false;
+};
+
+std::mutex jobMutex;
+std::condition_variable jobCond;
+std::shared_ptr<SyncJob> pendingJob;
+
+thread_local int announcedPort = 0;
+thread_local replication::WriteScope* activeScope = nullptr;
+
+// Relative expiries would drift by the replication lag, so they are
+// rewritten into absolute ones before entering the stream. MIGRATE reaches
+// replicas as the DEL it amounts to locally; an empty result means there is
+// nothing to propagate.
+std::vector<std::string> rewriteForStream(const std::vector<std::string>& req) {
+    std::vector<std::string> out = req;
+    if (out[0] == "migrate") {
+        std::vector<std::string> del = {"del"};
+        if (!req[3].empty()) {
+            del.push_back(req[3]);
+        }
+        for (size_t i = 6; i < req.size(); i++) {
+            std::string option = toLower(req[i]);
+            if (option == "copy") {
+                return {};
+            }
+            if (option == "keys") {
+                del.insert(del.end(), req.begin() + i + 1, req.end());
+                break;
+            }
+        }
+        return del.size() > 1 ? del : std::vector<std::string>();
+    }
+    if (out[0] == "restore") {
+        bool absTtl = false;
+        for (size_t i = 4; i < out.size(); i++) {
+            absTtl |= toLower(out[i]) == "absttl";
+        }
+        if (!absTtl && out[2] != "0") {
+            auto now = std::chrono::system_clock::now().time_since_epoch();
+            out[2] = std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(now).count() + std::stoll(out[2]));
+            out.push_back("ABSTTL");
+        }
+        return out;
+    }
+    if (out[0] != "set") {
+        return out;
+    }
+
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    for (size_t i = 3; i + 1 < out.size(); i++) {
+        std::string option = toLower(out[i]);
+        if (option == "ex") {
+            out[i] = "exat";
+            out[i + 1] = std::to_string(std::chrono::duration_cast<std::chrono::seconds>(now).count() + std::stoll(out[i + 1]));
+        }
+        else if (option == "px") {
+            out[i] = "pxat";
+            out[i + 1] = std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(now).count() + std::stoll(out[i + 1]));
+        }
+        i++;
+    }
+
+    return out;
+}
+
+// Switches writers to ordered mode and creates the backlog. Must be called
+// with orderMutex held; returns once no unordered writer is in flight.
+void enableStream() {
+    if (!orderingEnabled.load()) {
+        orderingEnabled.store(true);
+        while (unorderedWriters.load() != 0) {
+            std::this_thread::yield();
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(stateMutex);
+    if (backlog == nullptr) {
+        backlog = std::make_unique<Backlog>(config::GlobalConfig.replBacklogSize, masterOffset);
+    }
+}
+
+// Once no replica has been attached for repl_backlog_ttl seconds, drops the
+// backlog and lets writers run in parallel again. The replication id
+// changes with it: writes from then on are in no stream, so the next
+// replica needs a full sync.
+void releaseWhenIdle() {
+    std::unique_lock<std::mutex> lock(stateMutex);
+    while (links.empty() && !replicaRole && backlog != nullptr) {
+        auto deadline = lastReplicaLeft + std::chrono::seconds(config::GlobalConfig.replBacklogTtl);
+        if (std::chrono::steady_clock::now() >= deadline) {
+            break;
+        }
+        lock.unlock();
+        std::this_thread::sleep_until(deadline);
+        lock.lock();
+    }
+    releaseScheduled = false;
+    lock.unlock();
+
+    // Syncs hold orderMutex from enableStream() until their link is listed.
+    std::lock_guard<std::mutex> order(orderMutex);
+    lock.lock();
+    if (!links.empty() || replicaRole || backlog == nullptr ||
+        std::chrono::steady_clock::now() < lastReplicaLeft + std::chrono::seconds(config::GlobalConfig.replBacklogTtl)) {
+        return;
+    }
+    orderingEnabled.store(false);
+    backlog.reset();
+    replId = randomId();
+    std::cout << "Released the replication backlog: no replica for " << config::GlobalConfig.replBacklogTtl
+              << " seconds" << std::endl;
+}
+
+bool peerClosed(int fd) {
+    char c;
+    return recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 0;
+}
+
+// Streams the backlog to a replica from `offset` until it disconnects, falls
+// out of the backlog, or this server stops being a primary.
+void feed(int fd, ReplicaLink& link, uint64_t offset) {
+    std::string chunk;
+    // What the replica has yet to receive is its output buffer.
+    OutputLimit limit(ClientClass::Replica);
+    while (true) {
+        uint64_t lag;
+        {
+            std::unique_lock<std::mutex> lock(stateMutex);
+            bool ready = streamCond.wait_for(lock, std::chrono::seconds(1), [&offset] {
+                return replicaRole || backlog == nullptr || masterOffset > offset;
+            });
+            if (!ready) {
+                lock.unlock();
+                if (peerClosed(fd)) {
+                    return;
+                }
+                continue;
+            }
+
+            if (replicaRole || backlog == nullptr || !backlog->read(offset, REPL_STREAM_CHUNK, chunk)) {
+                return;
+            }
+            lag = masterOffset - offset;
+        }
+
+        if (limit.exceeded(lag, std::chrono::steady_clock::now())) {
+            std::cout << "Dropping replica " << link.ip << ":" << link.port << ": output buffer limit reached ("
+                      << lag << " bytes behind)" << std::endl;
+            return;
+        }
+
+        if (writeExactly(fd, chunk.data(), chunk.size()) < 0) {
+            return;
+        }
+        offset += chunk.size();
+        link.offset.store(offset);
+    }
+}
+
+// Freezes writes just long enough to copy the keyspace at a known offset,
+// then writes the snapshot out and ships it as a bulk payload.
+bool fullSync(int fd, const std::shared_ptr<ReplicaLink>& link, uint64_t& start) {
+    std::lock_guard<std::mutex> sync(syncMutex);
+    std::string id;
+    std::unique_lock<std::mutex> order(orderMutex);
+    std::optional<latency::Timer> freeze;
+    freeze.emplace("repl-sync-freeze");
+    auto frozen = std::chrono::steady_clock::now();
+    enableStream();
+    bool saved = Snapshot::save(REPL_SYNC_FILE, [&]() {
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            start = masterOffset;
+            id = replId;
+            link->offset.store(start);
+            links.push_back(link);
+        }
+        freeze.reset();
+        order.unlock();
+        lastSyncFreezeUs.store(microsSince(frozen));
+    });
+    if (!saved) {
+        return false;
+    }
+
+    std::ifstream in(REPL_SYNC_FILE, std::ios::binary);
+    size_t size = std::filesystem::file_size(REPL_SYNC_FILE);
+    lastSyncBytes.store(size);
+    std::string header = "+FULLRESYNC " + id + " " + std::to_string(start) + "\r\n$" + std::to_string(size) + "\r\n";
+    if (writeExactly(fd, header.c_str(), header.size()) < 0) {
+        return false;
+    }
+
+    std::vector<char> buf(REPL_STREAM_CHUNK);
+    while (size > 0) {
+        in.read(buf.data(), std::min<size_t>(size, buf.size()));
+        if (in.gcount() <= 0 || writeExactly(fd, buf.data(), in.gcount()) < 0) {
+            return false;
+        }
+        size -= in.gcount();
+    }
+
+    return true;
+}
+
+// The payload of a diskless sync on its way to the replicas of a job. It
+// grows a chunk at a time and is sent to every replica independently with
+// non-blocking sends, so a slow replica holds up neither the others nor the
+// encoding. Chunks every replica has been sent are freed.
+class Transfer {
+public:
+    explicit Transfer(SyncJob& job)
+        : job(job), sent(job.fds.size(), 0), lastProgress(job.fds.size(), std::chrono::steady_clock::now()) {
+        job.ok.assign(job.fds.size(), true);
+    }
+
+    ~Transfer() { syncBufferBytes.fetch_sub(total - base); }
+
+    Transfer(const Transfer&) = delete;
+    Transfer& operator=(const Transfer&) = delete;
+
+    void add(std::string chunk) {
+        total += chunk.size();
+        syncBufferBytes.fetch_add(chunk.size());
+        chunks.push_back(std::move(chunk));
+    }
+
+    // Sends whatever the sockets take right now.
+    void pump() {
+        auto now = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < job.fds.size(); i++) {
+            while (job.ok[i] && sent[i] < total) {
+                auto [data, len] = pending(sent[i]);
+                ssize_t n = send(job.fds[i], data, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+                if (n > 0) {
+                    sent[i] += n;
+                    lastProgress[i] = now;
+                }
+                else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    break;
+                }
+                else if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                else {
+                    job.ok[i] = false;
+                }
+            }
+        }
+        trim();
+    }
+
+    // Sends the rest, waiting for sockets to drain. Replicas that take
+    // nothing for REPL_DISKLESS_SEND_TIMEOUT_MS are dropped.
+    void finish() {
+        while (true) {
+            pump();
+            std::vector<pollfd> fds;
+            for (size_t i = 0; i < job.fds.size(); i++) {
+                if (job.ok[i] && sent[i] < total) {
+                    fds.push_back({job.fds[i], POLLOUT, 0});
+                }
+            }
+            if (fds.empty()) {
+                return;
+            }
+            poll(fds.data(), fds.size(), 1000);
+
+            auto now = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < job.fds.size(); i++) {
+                if (job.ok[i] && sent[i] < total &&
+                    now - lastProgress[i] > std::chrono::milliseconds(REPL_DISKLESS_SEND_TIMEOUT_MS)) {
+                    std::cout << "Dropping replica " << job.links[i]->ip << ":" << job.links[i]->port
+                              << ": diskless sync stalled" << std::endl;
+                    job.ok[i] = false;
+                }
+            }
+        }
+    }
+
+private:
+    // The unsent bytes of the chunk holding stream position `pos`.
+    std::pair<const char*, size_t> pending(uint64_t pos) const {
+        uint64_t chunkStart = base;
+        for (const std::string& chunk : chunks) {
+            if (pos < chunkStart + chunk.size()) {
+                size_t offset = pos - chunkStart;
+                return {chunk.data() + offset, std::min<size_t>(chunk.size() - offset, REPL_STREAM_CHUNK)};
+            }
+            chunkStart += chunk.size();
+        }
+        return {nullptr, 0};
+    }
+
+    void trim() {
+        uint64_t low = total;
+        for (size_t i = 0; i < job.fds.size(); i++) {
+            if (job.ok[i]) {
+                low = std::min(low, sent[i]);
+            }
+        }
+        while (!chunks.empty() && base + chunks.front().size() <= low) {
+            base += chunks.front().size();
+            syncBufferBytes.fetch_sub(chunks.front().size());
+            chunks.pop_front();
+        }
+    }
+
+    SyncJob& job;
+    std::deque<std::string> chunks;
+    uint64_t base = 0;      // stream position of chunks.front()
+    uint64_t total = 0;
+    std::vector<uint64_t> sent;
+    std::vector<std::chrono::steady_clock::time_point> lastProgress;
+};
+
+// Encodes the keyspace one shard at a time while writes are frozen, sending
+// each shard's records as far as the sockets take them without waiting, then
+// sends the rest with no lock held. Writes therefore wait for the encoding
+// only, never for the network, but whatever the slowest replica has not
+// taken stays in memory; repl_diskless_sync_max_bytes bounds both.
+void runDisklessJob(SyncJob& job) {
+    Transfer transfer(job);
+    size_t bytes = 0;
+    {
+        std::lock_guard<std::mutex> order(orderMutex);
+        latency::Timer timer("repl-sync-freeze");
+        auto frozen = std::chrono::steady_clock::now();
+        enableStream();
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            job.start = masterOffset;
+            transfer.add("+FULLRESYNC " + replId + " " + std::to_string(job.start) + "\r\n" + REPL_STREAM_MARKER + "\r\n");
+            for (const auto& link : job.links) {
+                link->offset.store(job.start);
+                links.push_back(link);
+            }
+        }
+
+        for (size_t shard = 0; shard < Store::shardCount(); shard++) {
+            std::string chunk;
+            Snapshot::encodeShard(shard, chunk);
+            bytes += chunk.size();
+            transfer.add(std::move(chunk));
+            transfer.pump();
+        }
+        lastSyncFreezeUs.store(microsSince(frozen));
+    }
+    lastSyncBytes.store(bytes);
+
+    std::cout << "Streaming " << bytes << " bytes to " << job.fds.size() << " replica(s)" << std::endl;
+    transfer.add(resp::encodeCommand({"eof"}));
+    transfer.finish();
+}
+
+// The first replica to ask opens a job and, after the delay window, drives
+// the transfer for everyone who joined; the others wait for it.
+bool disklessSync(int fd, const std::shared_ptr<ReplicaLink>& link, uint64_t& start) {
+    std::shared_ptr<SyncJob> job;
+    {
+        std::unique_lock<std::mutex> lock(jobMutex);
+        bool driver = pendingJob == nullptr;
+        if (driver) {
+            pendingJob = std::make_shared<SyncJob>();
+        }
+
+        job = pendingJob;
+        size_t slot = job->fds.size();
+        job->fds.push_back(fd);
+        job->links.push_back(link);
+        if (!driver) {
+            jobCond.wait(lock, [&job] { return job->done; });
+            start = job->start;
+            return job->ok[slot];
+        }
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(config::GlobalConfig.replDisklessSyncDelay));
+    {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        pendingJob.reset();
+    }
+
+    runDisklessJob(*job);
+    {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        job->done = true;
+    }
+    jobCond.notify_all();
+
+    start = job->start;
+    return job->ok[0];
+}
+
+// Diskless syncs hold the encoded keyspace in memory until the slowest
+// replica has it, and freeze writes while it is encoded. Past
+// repl_diskless_sync_max_bytes of data a full sync goes through the file
+// instead, which freezes writes only for the copy and frees it once written.
+bool useDiskless() {
+    long limit = config::GlobalConfig.replDisklessSyncMaxBytes;
+    return config::GlobalConfig.replDisklessSync && (limit <= 0 || slab::stats().requestedBytes <= static_cast<size_t>(limit));
+}
+
+void sendCommand(int fd, const std::vector<std::string>& req) {
+    std::string out = resp::encodeCommand(req);
+    if (writeExactly(fd, out.c_str(), out.size()) < 0) {
+        throw SysCallFailure("send to primary failed!");
+    }
+}
+
+std::string expectReply(RESPParser& parser) {
+    std::string reply = parser.readLine();
+    if (reply.empty() || reply[0] == '-') {
+        throw RedisServerError("primary refused: " + reply);
+    }
+
+    return reply;
+}
+
+// Reads a streamed sync payload. With repl_diskless_load the records are
+// applied as they arrive; otherwise they are staged in REPL_LOAD_FILE first,
+// so the current keyspace survives a link that drops mid-transfer.
+void loadStream(RESPParser& parser) {
+    if (config::GlobalConfig.replDisklessLoad) {
+        Store::getInstance().clear(true);
+        while (Snapshot::applyRecord(parser.readNewRequest())) {
+        }
+        return;
+    }
+
+    {
+        std::ofstream out(REPL_LOAD_FILE, std::ios::binary | std::ios::trunc);
+        while (true) {
+            std::vector<std::string> record = parser.readNewRequest();
+            out << resp::encodeCommand(record);
+            if (record.size() == 1 && record[0] == "eof") {
+                break;
+            }
+        }
+    }
+
+    if (!Snapshot::loadRecords(REPL_LOAD_FILE)) {
+        throw RedisServerError("could not load sync payload");
+    }
+}
+
+// Handshake, initial sync and stream application for one connection to the
+// primary. Returns when the link breaks or REPLICAOF changed the target.
+void syncWithMaster(int fd, uint64_t gen) {
+    try {
+        RESPParser parser(fd);
+        sendCommand(fd, {"PING"});
+        expectReply(parser);
+        sendCommand(fd, {"REPLCONF", "listening-port", std::to_string(config::GlobalConfig.port)});
+        expectReply(parser);
+
+        std::string id;
+        uint64_t offset;
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            id = masterReplId;
+            offset = replOffset;
+        }
+        sendCommand(fd, {"PSYNC", id, id == "?" ? "-1" : std::to_string(offset)});
+
+        std::string reply = expectReply(parser);
+        std::istringstream fields(reply.substr(1));
+        std::string kind;
+        fields >> kind >> id;
+        if (kind == "FULLRESYNC") {
+            fields >> offset;
+            std::cout << "Full resync from primary " << id << " at offset " << offset << std::endl;
+            {
+                std::lock_guard<std::mutex> lock(stateMutex);
+                linkState = "sync";
+            }
+
+            std::string header = parser.readLine();
+            if (header == REPL_STREAM_MARKER) {
+                loadStream(parser);
+            }
+            else if (!header.empty() && header[0] == '$') {
+                {
+                    std::ofstream out(REPL_LOAD_FILE, std::ios::binary | std::ios::trunc);
+                    parser.readPayload(std::stoull(header.substr(1)), [&out](const char* data, size_t len) {
+                        out.write(data, len);
+                    });
+                }
+                if (!Snapshot::load(REPL_LOAD_FILE)) {
+                    throw RedisServerError("could not load sync payload");
+                }
+            }
+            else {
+                throw IncorrectProtocol("bad sync payload header");
+            }
+        }
+        else if (kind == "CONTINUE") {
+            std::cout << "Partial resync from primary at offset " << offset << std::endl;
+        }
+        else {
+            throw IncorrectProtocol("unexpected PSYNC reply: " + reply);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            if (generation != gen) {
+                return;
+            }
+            masterReplId = id;
+            replOffset = offset;
+            linkState = "connected";
+        }
+
+        // A MULTI ... EXEC block is buffered and applied as a whole. The
+        // offset only moves past it once applied, so a resync resumes at
+        // its start rather than in the middle.
+        uint64_t mark = parser.bytesConsumed();
+        bool inBlock = false;
+        std::vector<std::vector<std::string>> block;
+        while (true) {
+            std::vector<std::string> req = parser.readNewRequest();
+            req[0] = toLower(req[0]);
+            if (req[0] == "multi") {
+                inBlock = true;
+                block.clear();
+                continue;
+            }
+            if (inBlock && req[0] != "exec") {
+                block.push_back(std::move(req));
+                continue;
+            }
+
+            if (inBlock) {
+                transaction::apply(block);
+                inBlock = false;
+                block.clear();
+            }
+            else {
+                const Command* cmd = lookupCommand(req[0]);
+                if (cmd != nullptr) {
+                    try {
+                        cmd->func(req);
+                    }
+                    catch (const std::exception& e) {
+                    }
+                }
+            }
+
+            uint64_t consumed = parser.bytesConsumed();
+            std::lock_guard<std::mutex> lock(stateMutex);
+            if (generation != gen) {
+                return;
+            }
+            replOffset += consumed - mark;
+            mark = consumed;
+        }
+    }
+    catch (const std::exception& e) {
+    }
+}
+
+void replicaLoop(uint64_t gen) {
+    while (true) {
+        std::string host;
+        int port;
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            if (generation != gen) {
+                return;
+            }
+            host = masterHost;
+            port = masterPort;
+            linkState = "connecting";
+        }
+
+        int fd = connectTcp(host, port);
+        if (fd >= 0) {
+            {
+                std::lock_guard<std::mutex> lock(stateMutex);
+                if (generation != gen) {
+                    close(fd);
+                    return;
+                }
+                masterFd = fd;
+            }
+
+            syncWithMaster(fd, gen);
+
+            {
+                std::lock_guard<std::mutex> lock(stateMutex);
+                if (masterFd == fd) {
+                    masterFd = -1;
+                }
+            }
+            close(fd);
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(REPL_RECONNECT_PERIOD_MS));
+    }
+}
+
+}
+
+replication::WriteScope::WriteScope() : outer(activeScope), ordered(false) {
+    activeScope = this;
+    if (outer != nullptr) {
+        return;
+    }
+
+    unorderedWriters.fetch_add(1);
+    if (orderingEnabled.load()) {
+        unorderedWriters.fetch_sub(1);
+        orderMutex.lock();
+        ordered = true;
+    }
+}
+
+replication::WriteScope::~WriteScope() {
+    activeScope = outer;
+    if (outer != nullptr) {
+        return;
+    }
+    if (!ordered) {
+        unorderedWriters.fetch_sub(1);
+        return;
+    }
+
+    if (!payloads.empty()) {
+        bool wrap = payloads.size() > 1;
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (backlog != nullptr) {
+            auto append = [](const std::string& payload) {
+                backlog->append(payload.data(), payload.size());
+                masterOffset += payload.size();
+            };
+            if (wrap) {
+                append(resp::encodeCommand({"multi"}));
+            }
+            for (const std::string& payload : payloads) {
+                append(payload);
+            }
+            if (wrap) {
+                append(resp::encodeCommand({"exec"}));
+            }
+            streamCond.notify_all();
+        }
+    }
+    orderMutex.unlock();
+}
+
+void replication::WriteScope::propagate(const std::vector<std::string>& req) {
+    if (outer != nullptr) {
+        outer->propagate(req);
+        return;
+    }
+    if (!ordered) {
+        return;
+    }
+
+    std::vector<std::string> rewritten = rewriteForStream(req);
+    if (!rewritten.empty()) {
+        payloads.push_back(resp::encodeCommand(rewritten));
+    }
+}
+
+bool replication::isReplica() {
+    return replicaFlag.load();
+}
+
+void replication::setAnnouncedPort(int port) {
+    announcedPort = port;
+}
+
+void replication::serveReplica(int fd, const std::vector<std::string>& req) {
+    if (isReplica()) {
+        const char* err = "-ERR replicas do not accept replicas\r\n";
+        writeExactly(fd, err, strlen(err));
+        return;
+    }
+
+    std::string id = req.size() > 1 ? req[1] : "?";
+    uint64_t offset = 0;
+    bool hasOffset = false;
+    if (req.size() > 2 && !req[2].empty() && req[2][0] != '-') {
+        try {
+            offset = std::stoull(req[2]);
+            hasOffset = true;
+        }
+        catch (const std::exception& e) {
+        }
+    }
+
+    auto link = std::make_shared<ReplicaLink>();
+    struct sockaddr_in addr;
+    socklen_t addrLen = sizeof(addr);
+    char ip[INET_ADDRSTRLEN] = "?";
+    if (getpeername(fd, (struct sockaddr*)&addr, &addrLen) == 0) {
+        inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+    }
+    link->ip = ip;
+    link->port = announcedPort;
+
+    bool partial = false;
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (hasOffset && backlog != nullptr && id == replId &&
+            offset >= backlog->startOffset() && offset <= masterOffset) {
+            partial = true;
+            link->offset.store(offset);
+            links.push_back(link);
+        }
+    }
+
+    std::cout << "Replica " << link->ip << ":" << link->port << " asks for sync: "
+              << (partial ? "partial resync accepted" : "full resync") << std::endl;
+
+    bool ok;
+    if (partial) {
+        std::string reply = "+CONTINUE " + id + "\r\n";
+        ok = writeExactly(fd, reply.c_str(), reply.size()) == 0;
+    }
+    else {
+        ok = useDiskless() ? disklessSync(fd, link, offset) : fullSync(fd, link, offset);
+    }
+
+    if (ok) {
+        feed(fd, *link, offset);
+    }
+
+    std::lock_guard<std::mutex> lock(stateMutex);
+    links.remove(link);
+    if (links.empty() && config::GlobalConfig.replBacklogTtl > 0) {
+        lastReplicaLeft = std::chrono::steady_clock::now();
+        if (!releaseScheduled) {
+            releaseScheduled = true;
+            std::thread(releaseWhenIdle).detach();
+        }
+    }
+}
+
+void replication::replicaOf(const std::string& host, int port) {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    if (replicaRole && masterHost == host && masterPort == port) {
+        return;
+    }
+
+    replicaRole = true;
+    replicaFlag.store(true);
+    masterHost = host;
+    masterPort = port;
+    uint64_t gen = ++generation;
+    if (masterFd >= 0) {
+        shutdown(masterFd, SHUT_RDWR);
+    }
+
+    // Replicas attached to us are dropped; their feeders see replicaRole.
+    // Writes need no ordering until one attaches again.
+    backlog.reset();
+    orderingEnabled.store(false);
+    linkState = "connect";
+    streamCond.notify_all();
+    std::thread(replicaLoop, gen).detach();
+}
+
+void replication::promote() {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    if (!replicaRole) {
+        return;
+    }
+
+    replicaRole = false;
+    replicaFlag.store(false);
+    generation++;
+    if (masterFd >= 0) {
+        shutdown(masterFd, SHUT_RDWR);
+    }
+
+    // A new history starts at the offset applied so far.
+    replId = randomId();
+    masterOffset = replOffset;
+    masterHost.clear();
+    masterPort = 0;
+    linkState.clear();
+}
+
+replication::Status replication::status() {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    Status s;
+    s.replica = replicaRole;
+    s.replId = replicaRole ? masterReplId : replId;
+    s.offset = replicaRole ? replOffset : masterOffset;
+    s.masterHost = masterHost;
+    s.masterPort = masterPort;
+    s.linkState = linkState;
+    for (const auto& link : links) {
+        s.replicas.push_back({link->ip, link->port, link->offset.load()});
+    }
+    s.lastSyncFreezeUs = lastSyncFreezeUs.load();
+    s.lastSyncBytes = lastSyncBytes.load();
+    s.syncBufferBytes = syncBufferBytes.load();
+
+    return s;
+}
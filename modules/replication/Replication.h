@@ -0,0 +1,99 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define REPL_SYNC_FILE "replsync.json"
+#define REPL_LOAD_FILE "replload.json"
+#define REPL_STREAM_CHUNK 65536
+// A diskless sync drops a replica whose socket takes nothing for this long.
+#define REPL_DISKLESS_SEND_TIMEOUT_MS 60000
+#define REPL_RECONNECT_PERIOD_MS 1000
+#define REPL_STREAM_MARKER "$RESP"
+
+// Asynchronous primary-replica replication.
+//
+// A primary appends every successful write command, RESP-encoded, to a
+// circular backlog and streams it to each attached replica from a feeder
+// running on that replica's connection thread. A replica connects with
+// PSYNC <replid> <offset>: if the primary still holds that offset in its
+// backlog it answers +CONTINUE and resumes the stream, otherwise it answers
+// +FULLRESYNC, ships a snapshot taken at a known offset, and streams from
+// there. Replicas are read-only and do not chain.
+//
+// The snapshot is either the JSON state file, sent as a `$<length>` bulk,
+// or with repl_diskless_sync a stream of Snapshot records that follows a
+// REPL_STREAM_MARKER line and ends with an `eof` record.
+namespace replication {
+
+// Scopes the execution of one write command on a primary.
+//
+// Until the first replica attaches there is no stream and writers run
+// concurrently, only registering themselves. After that, write commands are
+// serialized so that the stream carries them in the order they were
+// applied, which is also what makes a snapshot's offset exact.
+//
+// Scopes nest: one opened while another is active on the thread takes no
+// lock and hands what it propagates to the outermost scope. That one
+// appends everything when it closes, wrapped in MULTI/EXEC if there is more
+// than one command, so a transaction or script reaches replicas as a unit.
+class WriteScope {
+public:
+    WriteScope();
+    ~WriteScope();
+
+    WriteScope(const WriteScope&) = delete;
+    WriteScope& operator=(const WriteScope&) = delete;
+
+    // Queues the executed command for the replication stream.
+    void propagate(const std::vector<std::string>& req);
+
+private:
+    WriteScope* outer;
+    bool ordered;
+    std::vector<std::string> payloads;
+};
+
+bool isReplica();
+
+// Primary side. Takes over a client connection that sent PSYNC and feeds it
+// the stream until either side goes away.
+void serveReplica(int fd, const std::vector<std::string>& req);
+
+// Records the port a replica announced with REPLCONF listening-port on the
+// current connection.
+void setAnnouncedPort(int port);
+
+// REPLICAOF host port, and REPLICAOF NO ONE.
+void replicaOf(const std::string& host, int port);
+void promote();
+
+struct ReplicaInfo {
+    std::string ip;
+    int port;
+    uint64_t offset;
+};
+
+struct Status {
+    bool replica;
+    std::string replId;
+    uint64_t offset;
+    std::string masterHost;
+    int masterPort;
+    std::string linkState;
+    std::vector<ReplicaInfo> replicas;
+    // The last full sync served: how long writes were frozen for it and
+    // the size of its payload. Then the bytes diskless syncs still hold
+    // for replicas that have not received them yet.
+    uint64_t lastSyncFreezeUs;
+    uint64_t lastSyncBytes;
+    uint64_t syncBufferBytes;
+};
+
+Status status();
+
+}
+
+#endif // REPLICATION_H
@@ -0,0 +1,2035 @@
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include "Lua.h"
+
+namespace lua {
+
+Error::Error(Value value)
+    : std::runtime_error(std::holds_alternative<std::string>(value) ? std::get<std::string>(value) : "error object"),
+      value(std::move(value)) {}
+
+std::string typeName(const Value& v) {
+    switch (v.index()) {
+        case 0:
+            return "nil";
+        case 1:
+            return "boolean";
+        case 2:
+            return "number";
+        case 3:
+            return "string";
+        case 4:
+            return "table";
+        case 5:
+            return "function";
+        default:
+            return "userdata";
+    }
+}
+
+static std::string formatNumber(double d) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.14g", d);
+    return buf;
+}
+
+std::string toString(const Value& v) {
+    char buf[64];
+    switch (v.index()) {
+        case 0:
+            return "nil";
+        case 1:
+            return std::get<bool>(v) ? "true" : "false";
+        case 2:
+            return formatNumber(std::get<double>(v));
+        case 3:
+            return std::get<std::string>(v);
+        case 4:
+            snprintf(buf, sizeof(buf), "table: %p", static_cast<void*>(std::get<TablePtr>(v).get()));
+            return buf;
+        case 5:
+            snprintf(buf, sizeof(buf), "function: %p", static_cast<void*>(std::get<FunctionPtr>(v).get()));
+            return buf;
+        default:
+            snprintf(buf, sizeof(buf), "userdata: %p", std::get<Userdata>(v).ptr);
+            return buf;
+    }
+}
+
+static bool parseNumber(const std::string& s, double& out) {
+    const char* begin = s.c_str();
+    char* end;
+    while (isspace(static_cast<unsigned char>(*begin))) {
+        begin++;
+    }
+    if (begin[0] == '0' && (begin[1] == 'x' || begin[1] == 'X')) {
+        out = static_cast<double>(strtoull(begin, &end, 16));
+        if (end == begin + 2) {
+            return false;
+        }
+    }
+    else {
+        out = strtod(begin, &end);
+        if (end == begin) {
+            return false;
+        }
+    }
+
+    while (isspace(static_cast<unsigned char>(*end))) {
+        end++;
+    }
+    return end == s.c_str() + s.size();
+}
+
+bool toNumber(const Value& v, double& out) {
+    if (std::holds_alternative<double>(v)) {
+        out = std::get<double>(v);
+        return true;
+    }
+    if (std::holds_alternative<std::string>(v)) {
+        return parseNumber(std::get<std::string>(v), out);
+    }
+    return false;
+}
+
+bool truthy(const Value& v) {
+    return !(std::holds_alternative<std::monostate>(v) || (std::holds_alternative<bool>(v) && !std::get<bool>(v)));
+}
+
+void raise(State& state, const std::string& msg) {
+    throw Error(Value("user_script:" + std::to_string(state.line) + ": " + msg));
+}
+
+void tick(State& state) {
+    if (++state.steps % LUA_HOOK_PERIOD == 0 && state.hook) {
+        state.hook();
+    }
+}
+
+Values call(State& state, const Value& fn, Values& args) {
+    if (std::holds_alternative<FunctionPtr>(fn)) {
+        return std::get<FunctionPtr>(fn)->call(state, args);
+    }
+
+    Value handler = metamethod(fn, "__call");
+    if (!std::holds_alternative<FunctionPtr>(handler)) {
+        raise(state, "attempt to call a " + typeName(fn) + " value");
+    }
+    args.insert(args.begin(), fn);
+    return std::get<FunctionPtr>(handler)->call(state, args);
+}
+
+Value metamethod(const Value& v, const std::string& event) {
+    if (!std::holds_alternative<TablePtr>(v)) {
+        return Value();
+    }
+    const TablePtr& mt = std::get<TablePtr>(v)->metatable;
+    return mt == nullptr ? Value() : mt->get(event);
+}
+
+// The first result of calling a metamethod.
+static Value callMeta(State& state, const Value& handler, Values args) {
+    Values results = call(state, handler, args);
+    return results.empty() ? Value() : std::move(results[0]);
+}
+
+// The handler of a binary event as the reference implementation picks it:
+// the first operand's, else the second's.
+static Value binaryMeta(const Value& a, const Value& b, const std::string& event) {
+    Value handler = metamethod(a, event);
+    return std::holds_alternative<std::monostate>(handler) ? metamethod(b, event) : handler;
+}
+
+// The handler of a comparison, which both operands must share.
+static Value comparisonMeta(const Value& a, const Value& b, const std::string& event) {
+    Value handler = metamethod(a, event);
+    if (std::holds_alternative<std::monostate>(handler) || !(handler == metamethod(b, event))) {
+        return Value();
+    }
+    return handler;
+}
+
+[[noreturn]] static void compareError(State& state, const Value& a, const Value& b) {
+    std::string ta = typeName(a), tb = typeName(b);
+    raise(state, ta == tb ? "attempt to compare two " + ta + " values" : "attempt to compare " + ta + " with " + tb);
+}
+
+bool less(State& state, const Value& a, const Value& b) {
+    if (std::holds_alternative<double>(a) && std::holds_alternative<double>(b)) {
+        return std::get<double>(a) < std::get<double>(b);
+    }
+    if (std::holds_alternative<std::string>(a) && std::holds_alternative<std::string>(b)) {
+        return std::get<std::string>(a) < std::get<std::string>(b);
+    }
+    if (a.index() == b.index()) {
+        Value handler = comparisonMeta(a, b, "__lt");
+        if (!std::holds_alternative<std::monostate>(handler)) {
+            return truthy(callMeta(state, handler, {a, b}));
+        }
+    }
+    compareError(state, a, b);
+}
+
+// Whether the thread is within LUA_STACK_RESERVE bytes of the end of its
+// stack. Script calls recurse on the native stack, so this rather than the
+// call count is what bounds recursion on threads with small stacks.
+static bool stackExhausted() {
+    static thread_local uintptr_t limit = []() -> uintptr_t {
+        pthread_attr_t attr;
+        if (pthread_getattr_np(pthread_self(), &attr) != 0) {
+            return 0;
+        }
+        void* base;
+        size_t size;
+        int err = pthread_attr_getstack(&attr, &base, &size);
+        pthread_attr_destroy(&attr);
+        return err == 0 ? reinterpret_cast<uintptr_t>(base) + LUA_STACK_RESERVE : 0;
+    }();
+    return reinterpret_cast<uintptr_t>(__builtin_frame_address(0)) < limit;
+}
+
+// Tables.
+
+static bool arrayIndex(double d, size_t& index) {
+    if (d >= 1 && d == std::floor(d) && d <= 9007199254740992.0) {
+        index = static_cast<size_t>(d);
+        return true;
+    }
+    return false;
+}
+
+Value Table::get(const Value& key) const {
+    if (std::holds_alternative<double>(key)) {
+        double d = std::get<double>(key);
+        size_t index;
+        if (arrayIndex(d, index) && index <= array.size()) {
+            return array[index - 1];
+        }
+        auto it = numbers.find(d);
+        return it == numbers.end() ? Value() : it->second;
+    }
+    if (std::holds_alternative<std::string>(key)) {
+        return get(std::get<std::string>(key));
+    }
+    return Value();
+}
+
+Value Table::get(const std::string& key) const {
+    auto it = fields.find(key);
+    return it == fields.end() ? Value() : it->second;
+}
+
+bool Table::set(const Value& key, Value value) {
+    if (std::holds_alternative<std::string>(key)) {
+        set(std::get<std::string>(key), std::move(value));
+        return true;
+    }
+    if (!std::holds_alternative<double>(key) || std::isnan(std::get<double>(key))) {
+        return false;
+    }
+
+    double d = std::get<double>(key);
+    size_t index;
+    bool isNil = std::holds_alternative<std::monostate>(value);
+    if (arrayIndex(d, index) && index <= array.size()) {
+        array[index - 1] = std::move(value);
+        while (!array.empty() && std::holds_alternative<std::monostate>(array.back())) {
+            array.pop_back();
+        }
+    }
+    else if (arrayIndex(d, index) && index == array.size() + 1 && !isNil) {
+        numbers.erase(d);
+        array.push_back(std::move(value));
+        migrate();
+    }
+    else if (isNil) {
+        auto it = numbers.find(d);
+        if (it != numbers.end()) {
+            it->second = Value();
+        }
+    }
+    else {
+        numbers[d] = std::move(value);
+    }
+
+    return true;
+}
+
+void Table::set(const std::string& key, Value value) {
+    if (std::holds_alternative<std::monostate>(value)) {
+        auto it = fields.find(key);
+        if (it != fields.end()) {
+            it->second = Value();
+        }
+        return;
+    }
+
+    fields[key] = std::move(value);
+}
+
+void Table::setList(Values values) {
+    size_t n = values.size();
+    for (auto it = numbers.begin(); it != numbers.end();) {
+        size_t index;
+        if (arrayIndex(it->first, index) && index <= n) {
+            it = numbers.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+
+    if (array.size() < n) {
+        array.resize(n);
+    }
+    for (size_t i = 0; i < n; i++) {
+        array[i] = std::move(values[i]);
+    }
+    migrate();
+    while (!array.empty() && std::holds_alternative<std::monostate>(array.back())) {
+        array.pop_back();
+    }
+}
+
+// Moves keys that now continue the array part out of `numbers`.
+void Table::migrate() {
+    while (!numbers.empty()) {
+        auto it = numbers.find(static_cast<double>(array.size() + 1));
+        if (it == numbers.end() || std::holds_alternative<std::monostate>(it->second)) {
+            return;
+        }
+        array.push_back(std::move(it->second));
+        numbers.erase(it);
+    }
+}
+
+bool Table::next(const Value& key, Value& nextKey, Value& nextValue) const {
+    size_t arrayFrom = 0;
+    auto numberFrom = numbers.begin();
+    auto fieldFrom = fields.begin();
+    int phase = 0;
+    if (std::holds_alternative<double>(key)) {
+        double d = std::get<double>(key);
+        size_t index;
+        auto it = numbers.find(d);
+        if (arrayIndex(d, index) && index <= array.size()) {
+            arrayFrom = index;
+        }
+        else if (it != numbers.end()) {
+            numberFrom = std::next(it);
+            phase = 1;
+        }
+        else if (arrayIndex(d, index)) {
+            // Trimmed off the end of the array part during the traversal.
+            phase = 1;
+        }
+        else {
+            throw Error(Value("invalid key to 'next'"));
+        }
+    }
+    else if (std::holds_alternative<std::string>(key)) {
+        auto it = fields.find(std::get<std::string>(key));
+        if (it == fields.end()) {
+            throw Error(Value("invalid key to 'next'"));
+        }
+        fieldFrom = std::next(it);
+        phase = 2;
+    }
+    else if (!std::holds_alternative<std::monostate>(key)) {
+        throw Error(Value("invalid key to 'next'"));
+    }
+
+    if (phase == 0) {
+        for (size_t i = arrayFrom; i < array.size(); i++) {
+            if (!std::holds_alternative<std::monostate>(array[i])) {
+                nextKey = static_cast<double>(i + 1);
+                nextValue = array[i];
+                return true;
+            }
+        }
+    }
+    if (phase <= 1) {
+        for (auto it = numberFrom; it != numbers.end(); ++it) {
+            if (!std::holds_alternative<std::monostate>(it->second)) {
+                nextKey = it->first;
+                nextValue = it->second;
+                return true;
+            }
+        }
+    }
+    for (auto it = fieldFrom; it != fields.end(); ++it) {
+        if (!std::holds_alternative<std::monostate>(it->second)) {
+            nextKey = it->first;
+            nextValue = it->second;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+namespace {
+
+class BuiltinFunction : public Function {
+public:
+    explicit BuiltinFunction(Builtin fn) : fn(std::move(fn)) {}
+
+    Values call(State& state, Values& args) override { return fn(state, args); }
+
+private:
+    Builtin fn;
+};
+
+// Lexer.
+
+enum class Tok { Eof, Name, Keyword, Number, String, Symbol };
+
+struct Token {
+    Tok kind = Tok::Eof;
+    std::string text;
+    double number = 0;
+    int line = 1;
+};
+
+const char* const keywords[] = {"and", "break", "do", "else", "elseif", "end", "false", "for", "function", "if", "in",
+                                "local", "nil", "not", "or", "repeat", "return", "then", "true", "until", "while"};
+
+[[noreturn]] void syntaxError(int line, const std::string& msg) {
+    throw Error(Value("user_script:" + std::to_string(line) + ": " + msg));
+}
+
+class Lexer {
+public:
+    explicit Lexer(const std::string& src) : src(src) {}
+
+    Token next();
+
+private:
+    char peek(size_t ahead = 0) const { return pos + ahead < src.size() ? src[pos + ahead] : '\0'; }
+    bool atEnd() const { return pos >= src.size(); }
+    void skipSpaceAndComments();
+    // Returns the level of a long bracket starting at pos, or -1.
+    int longBracketLevel() const;
+    std::string readLongString(int level);
+    std::string readString(char quote);
+    Token readNumber();
+
+    const std::string& src;
+    size_t pos = 0;
+    int line = 1;
+};
+
+void Lexer::skipSpaceAndComments() {
+    while (!atEnd()) {
+        char c = peek();
+        if (c == '\n') {
+            line++;
+            pos++;
+        }
+        else if (isspace(static_cast<unsigned char>(c))) {
+            pos++;
+        }
+        else if (c == '-' && peek(1) == '-') {
+            pos += 2;
+            int level = longBracketLevel();
+            if (level >= 0) {
+                readLongString(level);
+                continue;
+            }
+            while (!atEnd() && peek() != '\n') {
+                pos++;
+            }
+        }
+        else {
+            return;
+        }
+    }
+}
+
+int Lexer::longBracketLevel() const {
+    if (peek() != '[') {
+        return -1;
+    }
+    size_t n = 1;
+    while (peek(n) == '=') {
+        n++;
+    }
+    return peek(n) == '[' ? static_cast<int>(n - 1) : -1;
+}
+
+std::string Lexer::readLongString(int level) {
+    int startLine = line;
+    pos += level + 2;
+    if (peek() == '\r') {
+        pos++;
+    }
+    if (peek() == '\n') {
+        line++;
+        pos++;
+    }
+
+    std::string out;
+    while (true) {
+        if (atEnd()) {
+            syntaxError(startLine, "unfinished long string");
+        }
+        char c = peek();
+        if (c == ']') {
+            int n = 1;
+            while (peek(n) == '=') {
+                n++;
+            }
+            if (n - 1 == level && peek(n) == ']') {
+                pos += n + 1;
+                return out;
+            }
+        }
+        if (c == '\n') {
+            line++;
+        }
+        out.push_back(c);
+        pos++;
+    }
+}
+
+std::string Lexer::readString(char quote) {
+    pos++;
+    std::string out;
+    while (true) {
+        if (atEnd() || peek() == '\n') {
+            syntaxError(line, "unfinished string");
+        }
+        char c = peek();
+        pos++;
+        if (c == quote) {
+            return out;
+        }
+        if (c != '\\') {
+            out.push_back(c);
+            continue;
+        }
+
+        c = peek();
+        pos++;
+        switch (c) {
+            case 'a': out.push_back('\a'); break;
+            case 'b': out.push_back('\b'); break;
+            case 'f': out.push_back('\f'); break;
+            case 'n': out.push_back('\n'); break;
+            case 'r': out.push_back('\r'); break;
+            case 't': out.push_back('\t'); break;
+            case 'v': out.push_back('\v'); break;
+            case '\\': out.push_back('\\'); break;
+            case '"': out.push_back('"'); break;
+            case '\'': out.push_back('\''); break;
+            case '\n':
+                line++;
+                out.push_back('\n');
+                break;
+            case 'x': {
+                int v = 0;
+                for (int i = 0; i < 2; i++) {
+                    if (!isxdigit(static_cast<unsigned char>(peek()))) {
+                        syntaxError(line, "hexadecimal digit expected");
+                    }
+                    char h = peek();
+                    pos++;
+                    v = v * 16 + (isdigit(static_cast<unsigned char>(h)) ? h - '0' : tolower(h) - 'a' + 10);
+                }
+                out.push_back(static_cast<char>(v));
+                break;
+            }
+            case 'z':
+                while (!atEnd() && isspace(static_cast<unsigned char>(peek()))) {
+                    line += peek() == '\n';
+                    pos++;
+                }
+                break;
+            default: {
+                if (!isdigit(static_cast<unsigned char>(c))) {
+                    syntaxError(line, "invalid escape sequence");
+                }
+                int v = c - '0';
+                for (int i = 0; i < 2 && isdigit(static_cast<unsigned char>(peek())); i++) {
+                    v = v * 10 + (peek() - '0');
+                    pos++;
+                }
+                if (v > 255) {
+                    syntaxError(line, "escape sequence too large");
+                }
+                out.push_back(static_cast<char>(v));
+            }
+        }
+    }
+}
+
+Token Lexer::readNumber() {
+    size_t start = pos;
+    bool hex = peek() == '0' && (peek(1) == 'x' || peek(1) == 'X');
+    if (hex) {
+        pos += 2;
+    }
+    while (isalnum(static_cast<unsigned char>(peek())) || peek() == '.' ||
+           (!hex && (peek() == '+' || peek() == '-') && (src[pos - 1] == 'e' || src[pos - 1] == 'E'))) {
+        pos++;
+    }
+
+    Token tok;
+    tok.kind = Tok::Number;
+    tok.line = line;
+    tok.text = src.substr(start, pos - start);
+    if (!parseNumber(tok.text, tok.number)) {
+        syntaxError(line, "malformed number near '" + tok.text + "'");
+    }
+    return tok;
+}
+
+Token Lexer::next() {
+    skipSpaceAndComments();
+    Token tok;
+    tok.line = line;
+    if (atEnd()) {
+        tok.kind = Tok::Eof;
+        tok.text = "<eof>";
+        return tok;
+    }
+
+    char c = peek();
+    if (isalpha(static_cast<unsigned char>(c)) || c == '_') {
+        size_t start = pos;
+        while (isalnum(static_cast<unsigned char>(peek())) || peek() == '_') {
+            pos++;
+        }
+        tok.text = src.substr(start, pos - start);
+        tok.kind = Tok::Name;
+        for (const char* kw : keywords) {
+            if (tok.text == kw) {
+                tok.kind = Tok::Keyword;
+                break;
+            }
+        }
+        return tok;
+    }
+    if (isdigit(static_cast<unsigned char>(c)) || (c == '.' && isdigit(static_cast<unsigned char>(peek(1))))) {
+        return readNumber();
+    }
+    if (c == '"' || c == '\'') {
+        tok.kind = Tok::String;
+        tok.text = readString(c);
+        return tok;
+    }
+    int level = longBracketLevel();
+    if (level >= 0) {
+        tok.kind = Tok::String;
+        tok.text = readLongString(level);
+        return tok;
+    }
+
+    static const char* const symbols[] = {"...", "..", "==", "~=", "<=", ">=", "+", "-", "*", "/", "%", "^", "#",
+                                          "<", ">", "=", "(", ")", "{", "}", "[", "]", ";", ":", ",", "."};
+    for (const char* sym : symbols) {
+        size_t len = strlen(sym);
+        if (src.compare(pos, len, sym) == 0) {
+            pos += len;
+            tok.kind = Tok::Symbol;
+            tok.text = sym;
+            return tok;
+        }
+    }
+
+    syntaxError(line, std::string("unexpected symbol near '") + c + "'");
+}
+
+// Syntax tree. Expressions and statements evaluate themselves against the
+// frame of the running function.
+
+struct Proto;
+
+struct Frame {
+    State& state;
+    std::vector<std::shared_ptr<Value>> slots;
+    const std::vector<std::shared_ptr<Value>>* upvals;
+    Values ret;
+    // Arguments past the named parameters of a vararg function.
+    Values varargs;
+};
+
+struct Expr {
+    explicit Expr(int line) : line(line) {}
+    virtual ~Expr() = default;
+
+    virtual Value eval(Frame& f) const = 0;
+    // Appends every value the expression yields; only calls and `...` yield
+    // several.
+    virtual void evalMulti(Frame& f, Values& out) const { out.push_back(eval(f)); }
+    virtual bool multi() const { return false; }
+    virtual bool assignable() const { return false; }
+    virtual void assign(Frame& f, Value v) const {
+        (void)v;
+        raise(f.state, "cannot assign");
+    }
+
+    int line;
+};
+
+using ExprPtr = std::unique_ptr<Expr>;
+using ExprList = std::vector<ExprPtr>;
+
+// Evaluates `exprs` into exactly `want` values, or all of them when `want`
+// is negative: the last expression expands, the others yield one value.
+void evalList(const ExprList& exprs, Frame& f, Values& out, int want = -1) {
+    for (size_t i = 0; i < exprs.size(); i++) {
+        if (i + 1 == exprs.size()) {
+            exprs[i]->evalMulti(f, out);
+        }
+        else {
+            out.push_back(exprs[i]->eval(f));
+        }
+    }
+    if (want >= 0) {
+        out.resize(want);
+    }
+}
+
+enum class Flow { Normal, Break, Return };
+
+struct Stat {
+    explicit Stat(int line) : line(line) {}
+    virtual ~Stat() = default;
+
+    virtual Flow exec(Frame& f) const = 0;
+
+    int line;
+};
+
+using Block = std::vector<std::unique_ptr<Stat>>;
+
+Flow execBlock(const Block& block, Frame& f) {
+    for (const auto& stat : block) {
+        f.state.line = stat->line;
+        Flow flow = stat->exec(f);
+        if (flow != Flow::Normal) {
+            return flow;
+        }
+    }
+    return Flow::Normal;
+}
+
+struct UpvalDesc {
+    bool fromParentLocal;
+    int index;
+};
+
+struct Proto {
+    int numParams = 0;
+    bool vararg = false;
+    // Slot of the `arg` table a vararg function that never uses `...` gets,
+    // as with LUA_COMPAT_VARARG; -1 for none.
+    int argSlot = -1;
+    int maxSlots = 0;
+    std::vector<UpvalDesc> upvals;
+    Block body;
+};
+
+class Closure : public Function {
+public:
+    Closure(std::shared_ptr<const Proto> proto, std::vector<std::shared_ptr<Value>> upvals)
+        : proto(std::move(proto)), upvals(std::move(upvals)) {}
+
+    Values call(State& state, Values& args) override {
+        struct Depth {
+            explicit Depth(State& s) : s(s) {
+                if (++s.depth > LUA_MAX_CALL_DEPTH || stackExhausted()) {
+                    s.depth--;
+                    raise(s, "stack overflow");
+                }
+            }
+            ~Depth() { s.depth--; }
+            State& s;
+        } depth(state);
+        tick(state);
+
+        Frame f{state, std::vector<std::shared_ptr<Value>>(proto->maxSlots), &upvals, {}, {}};
+        size_t numParams = static_cast<size_t>(proto->numParams);
+        for (size_t i = 0; i < numParams; i++) {
+            f.slots[i] = std::make_shared<Value>(i < args.size() ? args[i] : Value());
+        }
+        if (proto->vararg && args.size() > numParams) {
+            f.varargs.assign(args.begin() + numParams, args.end());
+        }
+        if (proto->argSlot >= 0) {
+            auto extra = std::make_shared<Table>();
+            double n = static_cast<double>(f.varargs.size());
+            extra->setList(std::move(f.varargs));
+            extra->set(std::string("n"), n);
+            f.slots[proto->argSlot] = std::make_shared<Value>(TablePtr(std::move(extra)));
+        }
+
+        if (execBlock(proto->body, f) == Flow::Return) {
+            return std::move(f.ret);
+        }
+        return {};
+    }
+
+private:
+    std::shared_ptr<const Proto> proto;
+    std::vector<std::shared_ptr<Value>> upvals;
+};
+
+// obj[key], following __index when a table lacks the key.
+Value index(State& state, const Value& obj, const Value& key) {
+    const Value* current = &obj;
+    Value handler;
+    for (int loop = 0; loop < LUA_MAX_TAG_LOOP; loop++) {
+        if (std::holds_alternative<std::string>(*current)) {
+            return stringLibrary().get(key);
+        }
+        if (!std::holds_alternative<TablePtr>(*current)) {
+            raise(state, "attempt to index a " + typeName(*current) + " value");
+        }
+
+        const Table& t = *std::get<TablePtr>(*current);
+        Value v = t.get(key);
+        if (t.metatable == nullptr || !std::holds_alternative<std::monostate>(v)) {
+            return v;
+        }
+        Value next = t.metatable->get(std::string("__index"));
+        if (std::holds_alternative<std::monostate>(next)) {
+            return v;
+        }
+        if (std::holds_alternative<FunctionPtr>(next)) {
+            return callMeta(state, next, {*current, key});
+        }
+        handler = std::move(next);
+        current = &handler;
+    }
+    raise(state, "loop in gettable");
+}
+
+void rawSet(State& state, Table& t, const Value& key, Value v) {
+    if (t.readonly) {
+        raise(state, "Attempt to modify a readonly table");
+    }
+    if (!t.set(key, std::move(v))) {
+        raise(state, std::holds_alternative<std::monostate>(key) ? "table index is nil"
+                                                                 : "table index must be a number or a string");
+    }
+}
+
+// obj[key] = v, following __newindex when a table lacks the key.
+void setIndex(State& state, const Value& obj, const Value& key, Value v) {
+    Value current = obj;
+    for (int loop = 0; loop < LUA_MAX_TAG_LOOP; loop++) {
+        if (!std::holds_alternative<TablePtr>(current)) {
+            raise(state, "attempt to index a " + typeName(current) + " value");
+        }
+
+        Table& t = *std::get<TablePtr>(current);
+        Value handler;
+        if (t.metatable != nullptr && std::holds_alternative<std::monostate>(t.get(key))) {
+            handler = t.metatable->get(std::string("__newindex"));
+        }
+        if (std::holds_alternative<std::monostate>(handler)) {
+            rawSet(state, t, key, std::move(v));
+            return;
+        }
+        if (std::holds_alternative<FunctionPtr>(handler)) {
+            Values args{current, key, std::move(v)};
+            call(state, handler, args);
+            return;
+        }
+        current = std::move(handler);
+    }
+    raise(state, "loop in settable");
+}
+
+struct ConstExpr : Expr {
+    ConstExpr(int line, Value v) : Expr(line), v(std::move(v)) {}
+    Value eval(Frame&) const override { return v; }
+    Value v;
+};
+
+struct LocalExpr : Expr {
+    LocalExpr(int line, int slot) : Expr(line), slot(slot) {}
+    Value eval(Frame& f) const override { return *f.slots[slot]; }
+    bool assignable() const override { return true; }
+    void assign(Frame& f, Value v) const override { *f.slots[slot] = std::move(v); }
+    int slot;
+};
+
+struct UpvalExpr : Expr {
+    UpvalExpr(int line, int idx) : Expr(line), idx(idx) {}
+    Value eval(Frame& f) const override { return *(*f.upvals)[idx]; }
+    bool assignable() const override { return true; }
+    void assign(Frame& f, Value v) const override { *(*f.upvals)[idx] = std::move(v); }
+    int idx;
+};
+
+struct GlobalExpr : Expr {
+    GlobalExpr(int line, std::string name) : Expr(line), name(std::move(name)) {}
+    Value eval(Frame& f) const override {
+        Value v = f.state.globals->get(name);
+        if (std::holds_alternative<std::monostate>(v)) {
+            raise(f.state, "Script attempted to access nonexistent global variable '" + name + "'");
+        }
+        return v;
+    }
+    bool assignable() const override { return true; }
+    void assign(Frame& f, Value) const override {
+        raise(f.state, "Script attempted to create global variable '" + name + "'");
+    }
+    std::string name;
+};
+
+struct IndexExpr : Expr {
+    IndexExpr(int line, ExprPtr obj, ExprPtr key) : Expr(line), obj(std::move(obj)), key(std::move(key)) {}
+    Value eval(Frame& f) const override {
+        Value o = obj->eval(f);
+        Value k = key->eval(f);
+        f.state.line = line;
+        return index(f.state, o, k);
+    }
+    bool assignable() const override { return true; }
+    void assign(Frame& f, Value v) const override {
+        Value o = obj->eval(f);
+        Value k = key->eval(f);
+        f.state.line = line;
+        setIndex(f.state, o, k, std::move(v));
+    }
+    ExprPtr obj, key;
+};
+
+struct CallExpr : Expr {
+    CallExpr(int line, ExprPtr fn, ExprList args) : Expr(line), fn(std::move(fn)), args(std::move(args)) {}
+    Value eval(Frame& f) const override {
+        Values out;
+        evalMulti(f, out);
+        return out.empty() ? Value() : std::move(out[0]);
+    }
+    void evalMulti(Frame& f, Values& out) const override {
+        Value fv = fn->eval(f);
+        Values a;
+        evalList(args, f, a);
+        f.state.line = line;
+        Values r = call(f.state, fv, a);
+        f.state.line = line;
+        out.insert(out.end(), std::make_move_iterator(r.begin()), std::make_move_iterator(r.end()));
+    }
+    bool multi() const override { return true; }
+    ExprPtr fn;
+    ExprList args;
+};
+
+struct MethodCallExpr : Expr {
+    MethodCallExpr(int line, ExprPtr obj, std::string name, ExprList args)
+        : Expr(line), obj(std::move(obj)), name(std::move(name)), args(std::move(args)) {}
+    Value eval(Frame& f) const override {
+        Values out;
+        evalMulti(f, out);
+        return out.empty() ? Value() : std::move(out[0]);
+    }
+    void evalMulti(Frame& f, Values& out) const override {
+        Value o = obj->eval(f);
+        f.state.line = line;
+        Value fv = index(f.state, o, Value(name));
+        Values a{o};
+        evalList(args, f, a);
+        f.state.line = line;
+        Values r = call(f.state, fv, a);
+        f.state.line = line;
+        out.insert(out.end(), std::make_move_iterator(r.begin()), std::make_move_iterator(r.end()));
+    }
+    bool multi() const override { return true; }
+    ExprPtr obj;
+    std::string name;
+    ExprList args;
+};
+
+// Truncates a call in parentheses to its first value.
+struct ParenExpr : Expr {
+    ParenExpr(int line, ExprPtr inner) : Expr(line), inner(std::move(inner)) {}
+    Value eval(Frame& f) const override { return inner->eval(f); }
+    ExprPtr inner;
+};
+
+// `...`: every extra argument of a vararg function.
+struct VarargExpr : Expr {
+    explicit VarargExpr(int line) : Expr(line) {}
+    Value eval(Frame& f) const override { return f.varargs.empty() ? Value() : f.varargs[0]; }
+    void evalMulti(Frame& f, Values& out) const override {
+        out.insert(out.end(), f.varargs.begin(), f.varargs.end());
+    }
+    bool multi() const override { return true; }
+};
+
+struct FunctionExpr : Expr {
+    FunctionExpr(int line, std::shared_ptr<const Proto> proto) : Expr(line), proto(std::move(proto)) {}
+    Value eval(Frame& f) const override {
+        std::vector<std::shared_ptr<Value>> captured;
+        captured.reserve(proto->upvals.size());
+        for (const UpvalDesc& desc : proto->upvals) {
+            captured.push_back(desc.fromParentLocal ? f.slots[desc.index] : (*f.upvals)[desc.index]);
+        }
+        return FunctionPtr(std::make_shared<Closure>(proto, std::move(captured)));
+    }
+    std::shared_ptr<const Proto> proto;
+};
+
+struct TableExpr : Expr {
+    struct Field {
+        ExprPtr key;  // null for positional items
+        ExprPtr value;
+    };
+
+    explicit TableExpr(int line) : Expr(line) {}
+    Value eval(Frame& f) const override {
+        auto t = std::make_shared<Table>();
+        Values list;
+        for (size_t i = 0; i < fields.size(); i++) {
+            const Field& field = fields[i];
+            if (field.key == nullptr) {
+                if (i + 1 == fields.size()) {
+                    field.value->evalMulti(f, list);
+                }
+                else {
+                    list.push_back(field.value->eval(f));
+                }
+                continue;
+            }
+            Value k = field.key->eval(f);
+            Value v = field.value->eval(f);
+            f.state.line = line;
+            setIndex(f.state, t, k, std::move(v));
+        }
+        if (!list.empty()) {
+            t->setList(std::move(list));
+        }
+        return t;
+    }
+    std::vector<Field> fields;
+};
+
+enum class BinOp { Add, Sub, Mul, Div, Mod, Pow, Concat, Eq, Ne, Lt, Le, Gt, Ge };
+
+// Metamethods of the arithmetic operators, in BinOp order.
+const char* const arithEvents[] = {"__add", "__sub", "__mul", "__div", "__mod", "__pow"};
+
+// `<=` tries __le and then `not (b < a)` with __lt, as Lua 5.1 does.
+bool lessOrEqual(State& state, const Value& a, const Value& b) {
+    if (std::holds_alternative<double>(a) && std::holds_alternative<double>(b)) {
+        return std::get<double>(a) <= std::get<double>(b);
+    }
+    if (std::holds_alternative<std::string>(a) && std::holds_alternative<std::string>(b)) {
+        return std::get<std::string>(a) <= std::get<std::string>(b);
+    }
+    if (a.index() == b.index()) {
+        Value handler = comparisonMeta(a, b, "__le");
+        if (!std::holds_alternative<std::monostate>(handler)) {
+            return truthy(callMeta(state, handler, {a, b}));
+        }
+        handler = comparisonMeta(b, a, "__lt");
+        if (!std::holds_alternative<std::monostate>(handler)) {
+            return !truthy(callMeta(state, handler, {b, a}));
+        }
+    }
+    compareError(state, a, b);
+}
+
+// Raw equality, or __eq for two distinct tables sharing the handler.
+bool equals(State& state, const Value& a, const Value& b) {
+    if (a == b) {
+        return true;
+    }
+    if (!std::holds_alternative<TablePtr>(a) || !std::holds_alternative<TablePtr>(b)) {
+        return false;
+    }
+    Value handler = comparisonMeta(a, b, "__eq");
+    return !std::holds_alternative<std::monostate>(handler) && truthy(callMeta(state, handler, {a, b}));
+}
+
+Value arith(State& state, BinOp op, const Value& a, const Value& b) {
+    double x, y;
+    if (toNumber(a, x) && toNumber(b, y)) {
+        switch (op) {
+            case BinOp::Add: return x + y;
+            case BinOp::Sub: return x - y;
+            case BinOp::Mul: return x * y;
+            case BinOp::Div: return x / y;
+            case BinOp::Mod: return x - std::floor(x / y) * y;
+            default: return std::pow(x, y);
+        }
+    }
+
+    Value handler = binaryMeta(a, b, arithEvents[static_cast<int>(op)]);
+    if (std::holds_alternative<std::monostate>(handler)) {
+        raise(state, "attempt to perform arithmetic on a " + typeName(toNumber(a, x) ? b : a) + " value");
+    }
+    return callMeta(state, handler, {a, b});
+}
+
+struct BinExpr : Expr {
+    BinExpr(int line, BinOp op, ExprPtr l, ExprPtr r) : Expr(line), op(op), l(std::move(l)), r(std::move(r)) {}
+    Value eval(Frame& f) const override {
+        Value a = l->eval(f);
+        Value b = r->eval(f);
+        if (op <= BinOp::Pow && std::holds_alternative<double>(a) && std::holds_alternative<double>(b)) {
+            double x = std::get<double>(a), y = std::get<double>(b);
+            switch (op) {
+                case BinOp::Add: return x + y;
+                case BinOp::Sub: return x - y;
+                case BinOp::Mul: return x * y;
+                default: break;
+            }
+        }
+
+        f.state.line = line;
+        switch (op) {
+            case BinOp::Concat: {
+                bool okA = std::holds_alternative<std::string>(a) || std::holds_alternative<double>(a);
+                bool okB = std::holds_alternative<std::string>(b) || std::holds_alternative<double>(b);
+                if (!okA || !okB) {
+                    Value handler = binaryMeta(a, b, "__concat");
+                    if (std::holds_alternative<std::monostate>(handler)) {
+                        raise(f.state, "attempt to concatenate a " + typeName(okA ? b : a) + " value");
+                    }
+                    return callMeta(f.state, handler, {a, b});
+                }
+                return toString(a) + toString(b);
+            }
+            case BinOp::Eq: return equals(f.state, a, b);
+            case BinOp::Ne: return !equals(f.state, a, b);
+            case BinOp::Lt: return less(f.state, a, b);
+            case BinOp::Le: return lessOrEqual(f.state, a, b);
+            case BinOp::Gt: return less(f.state, b, a);
+            case BinOp::Ge: return lessOrEqual(f.state, b, a);
+            default: return arith(f.state, op, a, b);
+        }
+    }
+    BinOp op;
+    ExprPtr l, r;
+};
+
+struct AndExpr : Expr {
+    AndExpr(int line, ExprPtr l, ExprPtr r) : Expr(line), l(std::move(l)), r(std::move(r)) {}
+    Value eval(Frame& f) const override {
+        Value a = l->eval(f);
+        return truthy(a) ? r->eval(f) : a;
+    }
+    ExprPtr l, r;
+};
+
+struct OrExpr : Expr {
+    OrExpr(int line, ExprPtr l, ExprPtr r) : Expr(line), l(std::move(l)), r(std::move(r)) {}
+    Value eval(Frame& f) const override {
+        Value a = l->eval(f);
+        return truthy(a) ? a : r->eval(f);
+    }
+    ExprPtr l, r;
+};
+
+enum class UnOp { Neg, Not, Len };
+
+struct UnExpr : Expr {
+    UnExpr(int line, UnOp op, ExprPtr e) : Expr(line), op(op), e(std::move(e)) {}
+    Value eval(Frame& f) const override {
+        Value v = e->eval(f);
+        f.state.line = line;
+        switch (op) {
+            case UnOp::Not:
+                return !truthy(v);
+            case UnOp::Neg: {
+                double d;
+                if (toNumber(v, d)) {
+                    return -d;
+                }
+                Value handler = metamethod(v, "__unm");
+                if (std::holds_alternative<std::monostate>(handler)) {
+                    raise(f.state, "attempt to perform arithmetic on a " + typeName(v) + " value");
+                }
+                return callMeta(f.state, handler, {v, v});
+            }
+            default:
+                if (std::holds_alternative<std::string>(v)) {
+                    return static_cast<double>(std::get<std::string>(v).size());
+                }
+                if (std::holds_alternative<TablePtr>(v)) {
+                    return static_cast<double>(std::get<TablePtr>(v)->length());
+                }
+                raise(f.state, "attempt to get length of a " + typeName(v) + " value");
+        }
+    }
+    UnOp op;
+    ExprPtr e;
+};
+
+// Statements.
+
+struct LocalStat : Stat {
+    LocalStat(int line, std::vector<int> slots, ExprList exprs)
+        : Stat(line), slots(std::move(slots)), exprs(std::move(exprs)) {}
+    Flow exec(Frame& f) const override {
+        Values values;
+        evalList(exprs, f, values, static_cast<int>(slots.size()));
+        for (size_t i = 0; i < slots.size(); i++) {
+            f.slots[slots[i]] = std::make_shared<Value>(std::move(values[i]));
+        }
+        return Flow::Normal;
+    }
+    std::vector<int> slots;
+    ExprList exprs;
+};
+
+struct LocalFunctionStat : Stat {
+    LocalFunctionStat(int line, int slot, ExprPtr fn) : Stat(line), slot(slot), fn(std::move(fn)) {}
+    Flow exec(Frame& f) const override {
+        // The cell exists before the closure so the function can call itself.
+        f.slots[slot] = std::make_shared<Value>();
+        *f.slots[slot] = fn->eval(f);
+        return Flow::Normal;
+    }
+    int slot;
+    ExprPtr fn;
+};
+
+struct AssignStat : Stat {
+    AssignStat(int line, ExprList targets, ExprList exprs)
+        : Stat(line), targets(std::move(targets)), exprs(std::move(exprs)) {}
+    Flow exec(Frame& f) const override {
+        if (targets.size() == 1 && exprs.size() == 1) {
+            targets[0]->assign(f, exprs[0]->eval(f));
+            return Flow::Normal;
+        }
+        Values values;
+        evalList(exprs, f, values, static_cast<int>(targets.size()));
+        for (size_t i = 0; i < targets.size(); i++) {
+            targets[i]->assign(f, std::move(values[i]));
+        }
+        return Flow::Normal;
+    }
+    ExprList targets;
+    ExprList exprs;
+};
+
+struct CallStat : Stat {
+    CallStat(int line, ExprPtr call) : Stat(line), call(std::move(call)) {}
+    Flow exec(Frame& f) const override {
+        Values discard;
+        call->evalMulti(f, discard);
+        return Flow::Normal;
+    }
+    ExprPtr call;
+};
+
+struct DoStat : Stat {
+    explicit DoStat(int line) : Stat(line) {}
+    Flow exec(Frame& f) const override { return execBlock(body, f); }
+    Block body;
+};
+
+struct WhileStat : Stat {
+    explicit WhileStat(int line) : Stat(line) {}
+    Flow exec(Frame& f) const override {
+        while (truthy(cond->eval(f))) {
+            tick(f.state);
+            Flow flow = execBlock(body, f);
+            if (flow == Flow::Break) {
+                break;
+            }
+            if (flow == Flow::Return) {
+                return flow;
+            }
+        }
+        return Flow::Normal;
+    }
+    ExprPtr cond;
+    Block body;
+};
+
+struct RepeatStat : Stat {
+    explicit RepeatStat(int line) : Stat(line) {}
+    Flow exec(Frame& f) const override {
+        do {
+            tick(f.state);
+            Flow flow = execBlock(body, f);
+            if (flow == Flow::Break) {
+                break;
+            }
+            if (flow == Flow::Return) {
+                return flow;
+            }
+        } while (!truthy(cond->eval(f)));
+        return Flow::Normal;
+    }
+    Block body;
+    ExprPtr cond;
+};
+
+struct IfStat : Stat {
+    explicit IfStat(int line) : Stat(line) {}
+    Flow exec(Frame& f) const override {
+        for (size_t i = 0; i < conds.size(); i++) {
+            if (truthy(conds[i]->eval(f))) {
+                return execBlock(blocks[i], f);
+            }
+        }
+        return execBlock(elseBlock, f);
+    }
+    ExprList conds;
+    std::vector<Block> blocks;
+    Block elseBlock;
+};
+
+struct NumForStat : Stat {
+    explicit NumForStat(int line) : Stat(line) {}
+    Flow exec(Frame& f) const override {
+        double from, to, by = 1;
+        if (!toNumber(start->eval(f), from)) {
+            raise(f.state, "'for' initial value must be a number");
+        }
+        if (!toNumber(limit->eval(f), to)) {
+            raise(f.state, "'for' limit must be a number");
+        }
+        if (step != nullptr && !toNumber(step->eval(f), by)) {
+            raise(f.state, "'for' step must be a number");
+        }
+
+        for (double v = from; by > 0 ? v <= to : v >= to; v += by) {
+            tick(f.state);
+            f.slots[slot] = std::make_shared<Value>(v);
+            Flow flow = execBlock(body, f);
+            if (flow == Flow::Break) {
+                break;
+            }
+            if (flow == Flow::Return) {
+                return flow;
+            }
+        }
+        return Flow::Normal;
+    }
+    int slot = 0;
+    ExprPtr start, limit, step;
+    Block body;
+};
+
+struct GenForStat : Stat {
+    explicit GenForStat(int line) : Stat(line) {}
+    Flow exec(Frame& f) const override {
+        Values init;
+        evalList(exprs, f, init, 3);
+        Value fn = init[0], state = init[1], control = init[2];
+        while (true) {
+            tick(f.state);
+            Values args{state, control};
+            f.state.line = line;
+            Values results = call(f.state, fn, args);
+            results.resize(std::max(results.size(), slots.size()));
+            if (std::holds_alternative<std::monostate>(results[0])) {
+                break;
+            }
+            control = results[0];
+            for (size_t i = 0; i < slots.size(); i++) {
+                f.slots[slots[i]] = std::make_shared<Value>(std::move(results[i]));
+            }
+
+            Flow flow = execBlock(body, f);
+            if (flow == Flow::Break) {
+                break;
+            }
+            if (flow == Flow::Return) {
+                return flow;
+            }
+        }
+        return Flow::Normal;
+    }
+    std::vector<int> slots;
+    ExprList exprs;
+    Block body;
+};
+
+struct ReturnStat : Stat {
+    ReturnStat(int line, ExprList exprs) : Stat(line), exprs(std::move(exprs)) {}
+    Flow exec(Frame& f) const override {
+        f.ret.clear();
+        evalList(exprs, f, f.ret);
+        return Flow::Return;
+    }
+    ExprList exprs;
+};
+
+struct BreakStat : Stat {
+    explicit BreakStat(int line) : Stat(line) {}
+    Flow exec(Frame&) const override { return Flow::Break; }
+};
+
+// Parser. Names are resolved while parsing: each function gets a frame of
+// numbered slots for its locals, and names from enclosing functions become
+// upvalues captured when the closure is created.
+
+struct FuncState {
+    FuncState* parent = nullptr;
+    Proto* proto = nullptr;
+    std::vector<std::pair<std::string, int>> actives;
+    std::vector<std::string> upvalNames;
+    int freeSlot = 0;
+    int loops = 0;
+    bool usesVarargs = false;
+};
+
+class Parser {
+public:
+    explicit Parser(const std::string& src) : lex(src) { tok = lex.next(); }
+
+    std::shared_ptr<Proto> parseChunk();
+
+private:
+    enum class NameKind { Local, Upval, Global };
+
+    // Token helpers.
+    void advance() {
+        if (hasAhead) {
+            tok = std::move(ahead);
+            hasAhead = false;
+        }
+        else {
+            tok = lex.next();
+        }
+    }
+    const Token& peekAhead() {
+        if (!hasAhead) {
+            ahead = lex.next();
+            hasAhead = true;
+        }
+        return ahead;
+    }
+    bool isSym(const char* s) const { return tok.kind == Tok::Symbol && tok.text == s; }
+    bool isKw(const char* s) const { return tok.kind == Tok::Keyword && tok.text == s; }
+    bool acceptSym(const char* s) {
+        if (isSym(s)) {
+            advance();
+            return true;
+        }
+        return false;
+    }
+    bool acceptKw(const char* s) {
+        if (isKw(s)) {
+            advance();
+            return true;
+        }
+        return false;
+    }
+    [[noreturn]] void fail(const std::string& msg) { syntaxError(tok.line, msg + " near '" + tok.text + "'"); }
+    void expectSym(const char* s) {
+        if (!acceptSym(s)) {
+            fail(std::string("'") + s + "' expected");
+        }
+    }
+    void expectKw(const char* s, const char* opener, int openLine) {
+        if (acceptKw(s)) {
+            return;
+        }
+        if (openLine == tok.line) {
+            fail(std::string("'") + s + "' expected");
+        }
+        fail(std::string("'") + s + "' expected (to close '" + opener + "' at line " + std::to_string(openLine) + ")");
+    }
+    std::string expectName() {
+        if (tok.kind != Tok::Name) {
+            fail("<name> expected");
+        }
+        std::string name = tok.text;
+        advance();
+        return name;
+    }
+
+    // Scopes.
+    int declareLocal(const std::string& name) {
+        int slot = fs->freeSlot++;
+        fs->proto->maxSlots = std::max(fs->proto->maxSlots, fs->freeSlot);
+        fs->actives.emplace_back(name, slot);
+        return slot;
+    }
+    NameKind resolve(FuncState* state, const std::string& name, int& index);
+    ExprPtr nameExpr(const std::string& name, int line);
+
+    bool blockFollow() const {
+        return tok.kind == Tok::Eof || isKw("else") || isKw("elseif") || isKw("end") || isKw("until");
+    }
+    Block block();
+    Block scopedBlock();
+    std::unique_ptr<Stat> statement();
+    std::unique_ptr<Stat> ifStat(int line);
+    std::unique_ptr<Stat> forStat(int line);
+    std::unique_ptr<Stat> functionStat(int line);
+    std::unique_ptr<Stat> localStat(int line);
+    std::unique_ptr<Stat> exprStat(int line);
+    std::shared_ptr<Proto> functionBody(bool method, int line);
+
+    ExprPtr expr(int limit = 0);
+    ExprPtr simpleExpr();
+    ExprPtr primaryExpr();
+    ExprPtr suffixedExpr();
+    ExprList exprList();
+    ExprList callArgs();
+    ExprPtr tableConstructor();
+
+    Lexer lex;
+    Token tok;
+    Token ahead;
+    bool hasAhead = false;
+    FuncState* fs = nullptr;
+    int depth = 0;
+};
+
+Parser::NameKind Parser::resolve(FuncState* state, const std::string& name, int& index) {
+    for (auto it = state->actives.rbegin(); it != state->actives.rend(); ++it) {
+        if (it->first == name) {
+            index = it->second;
+            return NameKind::Local;
+        }
+    }
+    for (size_t i = 0; i < state->upvalNames.size(); i++) {
+        if (state->upvalNames[i] == name) {
+            index = static_cast<int>(i);
+            return NameKind::Upval;
+        }
+    }
+    if (state->parent == nullptr) {
+        return NameKind::Global;
+    }
+
+    int parentIndex;
+    NameKind kind = resolve(state->parent, name, parentIndex);
+    if (kind == NameKind::Global) {
+        return kind;
+    }
+    state->proto->upvals.push_back({kind == NameKind::Local, parentIndex});
+    state->upvalNames.push_back(name);
+    index = static_cast<int>(state->upvalNames.size() - 1);
+    return NameKind::Upval;
+}
+
+ExprPtr Parser::nameExpr(const std::string& name, int line) {
+    int index;
+    switch (resolve(fs, name, index)) {
+        case NameKind::Local:
+            return std::make_unique<LocalExpr>(line, index);
+        case NameKind::Upval:
+            return std::make_unique<UpvalExpr>(line, index);
+        default:
+            return std::make_unique<GlobalExpr>(line, name);
+    }
+}
+
+std::shared_ptr<Proto> Parser::parseChunk() {
+    auto proto = std::make_shared<Proto>();
+    FuncState state;
+    state.proto = proto.get();
+    fs = &state;
+    proto->body = block();
+    if (tok.kind != Tok::Eof) {
+        fail("'<eof>' expected");
+    }
+    return proto;
+}
+
+Block Parser::block() {
+    Block stats;
+    while (!blockFollow()) {
+        if (isKw("return")) {
+            int line = tok.line;
+            advance();
+            ExprList exprs;
+            if (!blockFollow() && !isSym(";")) {
+                exprs = exprList();
+            }
+            acceptSym(";");
+            stats.push_back(std::make_unique<ReturnStat>(line, std::move(exprs)));
+            if (!blockFollow()) {
+                fail("'end' expected");
+            }
+            break;
+        }
+        std::unique_ptr<Stat> stat = statement();
+        if (stat != nullptr) {
+            stats.push_back(std::move(stat));
+        }
+    }
+    return stats;
+}
+
+// A block with its own scope: locals declared in it end with it.
+Block Parser::scopedBlock() {
+    size_t actives = fs->actives.size();
+    int freeSlot = fs->freeSlot;
+    Block b = block();
+    fs->actives.resize(actives);
+    fs->freeSlot = freeSlot;
+    return b;
+}
+
+std::unique_ptr<Stat> Parser::statement() {
+    int line = tok.line;
+    if (acceptSym(";")) {
+        return nullptr;
+    }
+    if (acceptKw("if")) {
+        return ifStat(line);
+    }
+    if (acceptKw("while")) {
+        auto stat = std::make_unique<WhileStat>(line);
+        stat->cond = expr();
+        expectKw("do", "while", line);
+        fs->loops++;
+        stat->body = scopedBlock();
+        fs->loops--;
+        expectKw("end", "while", line);
+        return stat;
+    }
+    if (acceptKw("do")) {
+        auto stat = std::make_unique<DoStat>(line);
+        stat->body = scopedBlock();
+        expectKw("end", "do", line);
+        return stat;
+    }
+    if (acceptKw("for")) {
+        return forStat(line);
+    }
+    if (acceptKw("repeat")) {
+        auto stat = std::make_unique<RepeatStat>(line);
+        // The condition sees the body's locals.
+        size_t actives = fs->actives.size();
+        int freeSlot = fs->freeSlot;
+        fs->loops++;
+        stat->body = block();
+        fs->loops--;
+        expectKw("until", "repeat", line);
+        stat->cond = expr();
+        fs->actives.resize(actives);
+        fs->freeSlot = freeSlot;
+        return stat;
+    }
+    if (acceptKw("function")) {
+        return functionStat(line);
+    }
+    if (acceptKw("local")) {
+        return localStat(line);
+    }
+    if (acceptKw("break")) {
+        if (fs->loops == 0) {
+            syntaxError(line, "no loop to break");
+        }
+        return std::make_unique<BreakStat>(line);
+    }
+    return exprStat(line);
+}
+
+std::unique_ptr<Stat> Parser::ifStat(int line) {
+    auto stat = std::make_unique<IfStat>(line);
+    stat->conds.push_back(expr());
+    expectKw("then", "if", line);
+    stat->blocks.push_back(scopedBlock());
+    while (true) {
+        if (acceptKw("elseif")) {
+            stat->conds.push_back(expr());
+            expectKw("then", "elseif", line);
+            stat->blocks.push_back(scopedBlock());
+        }
+        else if (acceptKw("else")) {
+            stat->elseBlock = scopedBlock();
+            expectKw("end", "if", line);
+            return stat;
+        }
+        else {
+            expectKw("end", "if", line);
+            return stat;
+        }
+    }
+}
+
+std::unique_ptr<Stat> Parser::forStat(int line) {
+    std::string first = expectName();
+    size_t actives = fs->actives.size();
+    int freeSlot = fs->freeSlot;
+    std::unique_ptr<Stat> result;
+    if (acceptSym("=")) {
+        auto stat = std::make_unique<NumForStat>(line);
+        stat->start = expr();
+        expectSym(",");
+        stat->limit = expr();
+        if (acceptSym(",")) {
+            stat->step = expr();
+        }
+        expectKw("do", "for", line);
+        stat->slot = declareLocal(first);
+        fs->loops++;
+        stat->body = scopedBlock();
+        fs->loops--;
+        result = std::move(stat);
+    }
+    else {
+        auto stat = std::make_unique<GenForStat>(line);
+        std::vector<std::string> names{first};
+        while (acceptSym(",")) {
+            names.push_back(expectName());
+        }
+        if (!acceptKw("in")) {
+            fail("'=' or 'in' expected");
+        }
+        stat->exprs = exprList();
+        expectKw("do", "for", line);
+        for (const std::string& name : names) {
+            stat->slots.push_back(declareLocal(name));
+        }
+        fs->loops++;
+        stat->body = scopedBlock();
+        fs->loops--;
+        result = std::move(stat);
+    }
+
+    expectKw("end", "for", line);
+    fs->actives.resize(actives);
+    fs->freeSlot = freeSlot;
+    return result;
+}
+
+std::unique_ptr<Stat> Parser::functionStat(int line) {
+    ExprPtr target = nameExpr(expectName(), line);
+    bool method = false;
+    while (isSym(".") || isSym(":")) {
+        method = isSym(":");
+        advance();
+        target = std::make_unique<IndexExpr>(line, std::move(target), std::make_unique<ConstExpr>(line, expectName()));
+        if (method) {
+            break;
+        }
+    }
+
+    ExprList targets;
+    targets.push_back(std::move(target));
+    ExprList exprs;
+    exprs.push_back(std::make_unique<FunctionExpr>(line, functionBody(method, line)));
+    return std::make_unique<AssignStat>(line, std::move(targets), std::move(exprs));
+}
+
+std::unique_ptr<Stat> Parser::localStat(int line) {
+    if (acceptKw("function")) {
+        int slot = declareLocal(expectName());
+        return std::make_unique<LocalFunctionStat>(line, slot, std::make_unique<FunctionExpr>(line, functionBody(false, line)));
+    }
+
+    std::vector<std::string> names{expectName()};
+    while (acceptSym(",")) {
+        names.push_back(expectName());
+    }
+    ExprList exprs;
+    if (acceptSym("=")) {
+        exprs = exprList();
+    }
+
+    // Declared only now, so the initializers still see outer variables.
+    std::vector<int> slots;
+    for (const std::string& name : names) {
+        slots.push_back(declareLocal(name));
+    }
+    return std::make_unique<LocalStat>(line, std::move(slots), std::move(exprs));
+}
+
+std::unique_ptr<Stat> Parser::exprStat(int line) {
+    ExprPtr first = suffixedExpr();
+    if (isSym("=") || isSym(",")) {
+        ExprList targets;
+        targets.push_back(std::move(first));
+        while (acceptSym(",")) {
+            targets.push_back(suffixedExpr());
+        }
+        for (const ExprPtr& target : targets) {
+            if (!target->assignable()) {
+                fail("syntax error");
+            }
+        }
+        expectSym("=");
+        return std::make_unique<AssignStat>(line, std::move(targets), exprList());
+    }
+
+    if (!first->multi()) {
+        fail("syntax error");
+    }
+    return std::make_unique<CallStat>(line, std::move(first));
+}
+
+std::shared_ptr<Proto> Parser::functionBody(bool method, int line) {
+    auto proto = std::make_shared<Proto>();
+    FuncState state;
+    state.parent = fs;
+    state.proto = proto.get();
+    fs = &state;
+
+    if (method) {
+        declareLocal("self");
+    }
+    expectSym("(");
+    if (!isSym(")")) {
+        do {
+            if (acceptSym("...")) {
+                proto->vararg = true;
+                break;
+            }
+            declareLocal(expectName());
+        } while (acceptSym(","));
+    }
+    expectSym(")");
+    proto->numParams = static_cast<int>(state.actives.size());
+    int argSlot = proto->vararg ? declareLocal("arg") : -1;
+    proto->body = block();
+    expectKw("end", "function", line);
+    if (!state.usesVarargs) {
+        proto->argSlot = argSlot;
+    }
+
+    fs = state.parent;
+    return proto;
+}
+
+ExprList Parser::exprList() {
+    ExprList list;
+    list.push_back(expr());
+    while (acceptSym(",")) {
+        list.push_back(expr());
+    }
+    return list;
+}
+
+ExprList Parser::callArgs() {
+    ExprList args;
+    if (tok.kind == Tok::String) {
+        args.push_back(std::make_unique<ConstExpr>(tok.line, tok.text));
+        advance();
+    }
+    else if (isSym("{")) {
+        args.push_back(tableConstructor());
+    }
+    else {
+        expectSym("(");
+        if (!isSym(")")) {
+            args = exprList();
+        }
+        expectSym(")");
+    }
+    return args;
+}
+
+ExprPtr Parser::tableConstructor() {
+    int line = tok.line;
+    expectSym("{");
+    auto table = std::make_unique<TableExpr>(line);
+    while (!isSym("}")) {
+        TableExpr::Field field;
+        if (acceptSym("[")) {
+            field.key = expr();
+            expectSym("]");
+            expectSym("=");
+        }
+        else if (tok.kind == Tok::Name && peekAhead().kind == Tok::Symbol && peekAhead().text == "=") {
+            field.key = std::make_unique<ConstExpr>(tok.line, tok.text);
+            advance();
+            advance();
+        }
+        field.value = expr();
+        table->fields.push_back(std::move(field));
+        if (!acceptSym(",") && !acceptSym(";")) {
+            break;
+        }
+    }
+    expectSym("}");
+    return table;
+}
+
+ExprPtr Parser::primaryExpr() {
+    int line = tok.line;
+    if (tok.kind == Tok::Name) {
+        return nameExpr(expectName(), line);
+    }
+    if (acceptSym("(")) {
+        ExprPtr inner = expr();
+        expectSym(")");
+        if (inner->multi()) {
+            return std::make_unique<ParenExpr>(line, std::move(inner));
+        }
+        return inner;
+    }
+    fail("unexpected symbol");
+}
+
+ExprPtr Parser::suffixedExpr() {
+    ExprPtr e = primaryExpr();
+    while (true) {
+        int line = tok.line;
+        if (acceptSym(".")) {
+            e = std::make_unique<IndexExpr>(line, std::move(e), std::make_unique<ConstExpr>(line, expectName()));
+        }
+        else if (acceptSym("[")) {
+            ExprPtr key = expr();
+            expectSym("]");
+            e = std::make_unique<IndexExpr>(line, std::move(e), std::move(key));
+        }
+        else if (acceptSym(":")) {
+            std::string name = expectName();
+            e = std::make_unique<MethodCallExpr>(line, std::move(e), name, callArgs());
+        }
+        else if (isSym("(") || isSym("{") || tok.kind == Tok::String) {
+            e = std::make_unique<CallExpr>(line, std::move(e), callArgs());
+        }
+        else {
+            return e;
+        }
+    }
+}
+
+ExprPtr Parser::simpleExpr() {
+    int line = tok.line;
+    switch (tok.kind) {
+        case Tok::Number: {
+            double d = tok.number;
+            advance();
+            return std::make_unique<ConstExpr>(line, d);
+        }
+        case Tok::String: {
+            std::string s = tok.text;
+            advance();
+            return std::make_unique<ConstExpr>(line, std::move(s));
+        }
+        default:
+            break;
+    }
+    if (acceptKw("nil")) {
+        return std::make_unique<ConstExpr>(line, Value());
+    }
+    if (acceptKw("true")) {
+        return std::make_unique<ConstExpr>(line, true);
+    }
+    if (acceptKw("false")) {
+        return std::make_unique<ConstExpr>(line, false);
+    }
+    if (isSym("...")) {
+        if (!fs->proto->vararg) {
+            fail("cannot use '...' outside a vararg function");
+        }
+        fs->usesVarargs = true;
+        advance();
+        return std::make_unique<VarargExpr>(line);
+    }
+    if (isSym("{")) {
+        return tableConstructor();
+    }
+    if (acceptKw("function")) {
+        return std::make_unique<FunctionExpr>(line, functionBody(false, line));
+    }
+    return suffixedExpr();
+}
+
+struct BinOpInfo {
+    const char* text;
+    bool keyword;
+    int left, right;
+};
+
+// Left and right priorities as in Lua 5.1; `..` and `^` are right
+// associative.
+const BinOpInfo binOps[] = {
+    {"or", true, 1, 1},   {"and", true, 2, 2},  {"<", false, 3, 3},   {">", false, 3, 3},   {"<=", false, 3, 3},
+    {">=", false, 3, 3},  {"~=", false, 3, 3},  {"==", false, 3, 3},  {"..", false, 5, 4},  {"+", false, 6, 6},
+    {"-", false, 6, 6},   {"*", false, 7, 7},   {"/", false, 7, 7},   {"%", false, 7, 7},   {"^", false, 10, 9},
+};
+const int unaryPriority = 8;
+
+ExprPtr Parser::expr(int limit) {
+    if (++depth > LUA_MAX_SYNTAX_DEPTH) {
+        fail("chunk has too many syntax levels");
+    }
+
+    int line = tok.line;
+    ExprPtr left;
+    if (isKw("not") || isSym("-") || isSym("#")) {
+        UnOp op = isKw("not") ? UnOp::Not : isSym("-") ? UnOp::Neg : UnOp::Len;
+        advance();
+        ExprPtr operand = expr(unaryPriority);
+        if (op == UnOp::Neg && dynamic_cast<ConstExpr*>(operand.get()) != nullptr &&
+            std::holds_alternative<double>(static_cast<ConstExpr*>(operand.get())->v)) {
+            left = std::make_unique<ConstExpr>(line, -std::get<double>(static_cast<ConstExpr*>(operand.get())->v));
+        }
+        else {
+            left = std::make_unique<UnExpr>(line, op, std::move(operand));
+        }
+    }
+    else {
+        left = simpleExpr();
+    }
+
+    while (true) {
+        const BinOpInfo* info = nullptr;
+        for (const BinOpInfo& candidate : binOps) {
+            if (candidate.keyword ? isKw(candidate.text) : isSym(candidate.text)) {
+                info = &candidate;
+                break;
+            }
+        }
+        if (info == nullptr || info->left <= limit) {
+            break;
+        }
+
+        std::string op = info->text;
+        int opLine = tok.line;
+        advance();
+        ExprPtr right = expr(info->right);
+        if (op == "or") {
+            left = std::make_unique<OrExpr>(opLine, std::move(left), std::move(right));
+        }
+        else if (op == "and") {
+            left = std::make_unique<AndExpr>(opLine, std::move(left), std::move(right));
+        }
+        else {
+            static const std::pair<const char*, BinOp> ops[] = {
+                {"+", BinOp::Add}, {"-", BinOp::Sub}, {"*", BinOp::Mul}, {"/", BinOp::Div}, {"%", BinOp::Mod},
+                {"^", BinOp::Pow}, {"..", BinOp::Concat}, {"==", BinOp::Eq}, {"~=", BinOp::Ne}, {"<", BinOp::Lt},
+                {"<=", BinOp::Le}, {">", BinOp::Gt}, {">=", BinOp::Ge}};
+            BinOp binOp = BinOp::Add;
+            for (const auto& [text, value] : ops) {
+                if (op == text) {
+                    binOp = value;
+                }
+            }
+            left = std::make_unique<BinExpr>(opLine, binOp, std::move(left), std::move(right));
+        }
+    }
+
+    depth--;
+    return left;
+}
+
+}
+
+class Chunk {
+public:
+    explicit Chunk(std::shared_ptr<const Proto> main) : main(std::move(main)) {}
+
+    std::shared_ptr<const Proto> main;
+};
+
+FunctionPtr makeBuiltin(Builtin fn) {
+    return std::make_shared<BuiltinFunction>(std::move(fn));
+}
+
+std::shared_ptr<const Chunk> compile(const std::string& source) {
+    Parser parser(source);
+    return std::make_shared<const Chunk>(parser.parseChunk());
+}
+
+Values run(const Chunk& chunk, State& state) {
+    Closure main(chunk.main, {});
+    Values args;
+    return main.call(state, args);
+}
+
+}
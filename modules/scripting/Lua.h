@@ -0,0 +1,165 @@
+#ifndef LUA_H
+#define LUA_H
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+// Nested calls, as LUAI_MAXCALLS in the reference implementation. Calls
+// also stop with "stack overflow" once the thread has less than
+// LUA_STACK_RESERVE bytes of stack left.
+#define LUA_MAX_CALL_DEPTH 20000
+#define LUA_STACK_RESERVE (256 * 1024)
+#define LUA_MAX_SYNTAX_DEPTH 200
+// Longest chain of __index or __newindex tables followed for one access.
+#define LUA_MAX_TAG_LOOP 100
+// Steps (loop iterations and function calls) between two calls of the
+// state's hook.
+#define LUA_HOOK_PERIOD 1024
+
+// An interpreter for the subset of Lua 5.1 that Redis scripts use.
+//
+// A script is compiled once into a tree whose names are already resolved to
+// frame slots, upvalues or globals, so running a cached script does no
+// parsing and no name lookups beyond globals. The subset covers every
+// statement, locals, closures, varargs, numeric and generic for, multiple
+// assignment and results, table constructors, method calls, metatables,
+// string/number coercion, the base, string (with Lua patterns), table and
+// math libraries minus anything nondeterministic, and the bit, cjson and
+// cmsgpack libraries Redis preloads. Coroutines are not supported, and
+// table keys must be numbers or strings.
+namespace lua {
+
+struct Table;
+class Function;
+struct State;
+
+using TablePtr = std::shared_ptr<Table>;
+using FunctionPtr = std::shared_ptr<Function>;
+
+// A light userdata: an opaque pointer compared by identity, such as
+// cjson.null.
+struct Userdata {
+    const void* ptr;
+
+    bool operator==(const Userdata& other) const { return ptr == other.ptr; }
+};
+
+using Value = std::variant<std::monostate, bool, double, std::string, TablePtr, FunctionPtr, Userdata>;
+using Values = std::vector<Value>;
+
+// A Lua error: raised by error(), by failed operations and by library
+// functions, and caught by pcall. Its value is usually a message string.
+class Error : public std::runtime_error {
+public:
+    explicit Error(Value value);
+
+    Value value;
+};
+
+// Stops a script outright; pcall does not catch it.
+class Abort : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Tables keep integer keys 1..n in an array part and other keys in maps.
+// Assigning nil leaves a hole rather than erasing, so clearing fields while
+// traversing with next() is safe, as in Lua.
+struct Table {
+    Value get(const Value& key) const;
+    Value get(const std::string& key) const;
+    // Returns false if `key` cannot index a table (nil, NaN, or not a
+    // number or string).
+    bool set(const Value& key, Value value);
+    void set(const std::string& key, Value value);
+    // t[1..n] = values, as a constructor's positional items do.
+    void setList(Values values);
+    size_t length() const { return array.size(); }
+    // The entry after `key` in traversal order, starting with nil. Returns
+    // false at the end; throws for a key that is not in the table.
+    bool next(const Value& key, Value& nextKey, Value& nextValue) const;
+
+    Values array;
+    std::map<double, Value> numbers;
+    std::unordered_map<std::string, Value> fields;
+    TablePtr metatable;
+    bool readonly = false;
+
+private:
+    void migrate();
+};
+
+class Function {
+public:
+    virtual ~Function() = default;
+    virtual Values call(State& state, Values& args) = 0;
+};
+
+using Builtin = std::function<Values(State& state, Values& args)>;
+FunctionPtr makeBuiltin(Builtin fn);
+
+// Everything one run of a script needs besides the compiled chunk.
+struct State {
+    const Table* globals = nullptr;
+    // Called every LUA_HOOK_PERIOD steps; may throw Abort.
+    std::function<void()> hook;
+    // Line of the statement being executed, for error messages.
+    int line = 0;
+    int depth = 0;
+    unsigned long steps = 0;
+};
+
+class Chunk;
+
+// Throws Error with a message naming the offending line.
+std::shared_ptr<const Chunk> compile(const std::string& source);
+Values run(const Chunk& chunk, State& state);
+
+// Helpers shared with library code.
+std::string typeName(const Value& v);
+std::string toString(const Value& v);
+bool toNumber(const Value& v, double& out);
+bool truthy(const Value& v);
+// Calls `fn`, or the __call metamethod of a table. May prepend to `args`.
+Values call(State& state, const Value& fn, Values& args);
+// The metamethod `event` of `v`, nil if it has none.
+Value metamethod(const Value& v, const std::string& event);
+// The `<` operator, with __lt for tables.
+bool less(State& state, const Value& a, const Value& b);
+// Raises an Error with the message prefixed by the current line.
+[[noreturn]] void raise(State& state, const std::string& msg);
+void tick(State& state);
+
+// Argument checking for library functions, with the messages of the
+// reference implementation. `i` counts from 0.
+[[noreturn]] void argError(State& state, size_t i, const char* fname, const std::string& msg);
+[[noreturn]] void typeError(State& state, const Values& args, size_t i, const char* fname, const char* expected);
+const Value& arg(const Values& args, size_t i);
+bool isNone(const Values& args, size_t i);
+double checkNumber(State& state, const Values& args, size_t i, const char* fname);
+long long checkInteger(State& state, const Values& args, size_t i, const char* fname);
+long long optInteger(State& state, const Values& args, size_t i, const char* fname, long long def);
+std::string checkString(State& state, const Values& args, size_t i, const char* fname);
+Table& checkTable(State& state, const Values& args, size_t i, const char* fname);
+void add(Table& lib, const char* name, Builtin fn);
+
+// Adds the base, string, table, math, bit, cjson and cmsgpack libraries to
+// `globals`, read-only.
+void openLibraries(Table& globals);
+// The library that string values index into, for s:method() calls.
+const Table& stringLibrary();
+
+// The libraries Redis adds to Lua's own, each in a file of its own.
+void openBit(Table& lib);
+void openCjson(Table& lib);
+void openCmsgpack(Table& lib);
+
+}
+
+#endif // LUA_H
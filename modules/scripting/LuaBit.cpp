@@ -0,0 +1,92 @@
+#include <cstdint>
+#include <cstring>
+#include "Lua.h"
+
+namespace lua {
+
+namespace {
+
+// The bit library (LuaBitOp): operations on numbers as 32-bit integers,
+// returning signed results.
+
+// Adding 2^52 + 2^51 moves the integer part of any number within range
+// into the low bits of the mantissa, which is how LuaBitOp wraps numbers
+// to 32 bits instead of saturating.
+uint32_t toBits(State& state, const Values& args, size_t i, const char* fname) {
+    double d = checkNumber(state, args, i, fname) + 6755399441055744.0;
+    uint64_t bits;
+    std::memcpy(&bits, &d, sizeof(bits));
+    return static_cast<uint32_t>(bits);
+}
+
+Values result(uint32_t b) {
+    return {static_cast<double>(static_cast<int32_t>(b))};
+}
+
+// band, bor and bxor fold over all their arguments.
+template <typename Op>
+Builtin fold(const char* fname, Op op) {
+    return [fname, op](State& state, Values& args) -> Values {
+        uint32_t b = toBits(state, args, 0, fname);
+        for (size_t i = 1; i < args.size(); i++) {
+            b = op(b, toBits(state, args, i, fname));
+        }
+        return result(b);
+    };
+}
+
+using Shift = uint32_t (*)(uint32_t, uint32_t);
+
+}
+
+void openBit(Table& lib) {
+    add(lib, "tobit", [](State& state, Values& args) -> Values {
+        return result(toBits(state, args, 0, "tobit"));
+    });
+    add(lib, "bnot", [](State& state, Values& args) -> Values {
+        return result(~toBits(state, args, 0, "bnot"));
+    });
+    add(lib, "band", fold("band", [](uint32_t a, uint32_t b) { return a & b; }));
+    add(lib, "bor", fold("bor", [](uint32_t a, uint32_t b) { return a | b; }));
+    add(lib, "bxor", fold("bxor", [](uint32_t a, uint32_t b) { return a ^ b; }));
+
+    const std::pair<const char*, Shift> shifts[] = {
+        {"lshift", [](uint32_t b, uint32_t n) { return b << n; }},
+        {"rshift", [](uint32_t b, uint32_t n) { return b >> n; }},
+        {"arshift", [](uint32_t b, uint32_t n) { return static_cast<uint32_t>(static_cast<int32_t>(b) >> n); }},
+        {"rol", [](uint32_t b, uint32_t n) { return n == 0 ? b : (b << n) | (b >> (32 - n)); }},
+        {"ror", [](uint32_t b, uint32_t n) { return n == 0 ? b : (b >> n) | (b << (32 - n)); }}};
+    for (const auto& [name, fn] : shifts) {
+        const char* fname = name;
+        Shift shift = fn;
+        add(lib, name, [fname, shift](State& state, Values& args) -> Values {
+            uint32_t b = toBits(state, args, 0, fname);
+            return result(shift(b, toBits(state, args, 1, fname) & 31));
+        });
+    }
+
+    add(lib, "bswap", [](State& state, Values& args) -> Values {
+        uint32_t b = toBits(state, args, 0, "bswap");
+        return result((b >> 24) | ((b >> 8) & 0xff00) | ((b & 0xff00) << 8) | (b << 24));
+    });
+    add(lib, "tohex", [](State& state, Values& args) -> Values {
+        uint32_t b = toBits(state, args, 0, "tohex");
+        int32_t n = isNone(args, 1) ? 8 : static_cast<int32_t>(toBits(state, args, 1, "tohex"));
+        const char* digits = "0123456789abcdef";
+        if (n < 0) {
+            n = -n;
+            digits = "0123456789ABCDEF";
+        }
+        if (n > 8) {
+            n = 8;
+        }
+        std::string out(static_cast<size_t>(n), '0');
+        for (int32_t i = n - 1; i >= 0; i--) {
+            out[i] = digits[b & 15];
+            b >>= 4;
+        }
+        return {out};
+    });
+}
+
+}
@@ -0,0 +1,440 @@
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include "Lua.h"
+
+// Tables nested deeper than this fail to encode or decode, as with
+// lua-cjson's default encode_max_depth and decode_max_depth.
+#define CJSON_MAX_DEPTH 1000
+// A table whose largest index is more than this many times its number of
+// items, and more than CJSON_SPARSE_SAFE, is refused as excessively sparse.
+#define CJSON_SPARSE_RATIO 2
+#define CJSON_SPARSE_SAFE 10
+
+namespace lua {
+
+namespace {
+
+// cjson.null, a light userdata like lua-cjson's.
+const Value null = Userdata{nullptr};
+
+// Encoding.
+
+class Encoder {
+public:
+    explicit Encoder(State& state) : state(state) {}
+
+    void value(const Value& v, int depth) {
+        switch (v.index()) {
+            case 0:
+                out += "null";
+                break;
+            case 1:
+                out += std::get<bool>(v) ? "true" : "false";
+                break;
+            case 2:
+                number(std::get<double>(v));
+                break;
+            case 3:
+                string(std::get<std::string>(v));
+                break;
+            case 4:
+                table(*std::get<TablePtr>(v), depth + 1);
+                break;
+            default:
+                if (v == null) {
+                    out += "null";
+                    break;
+                }
+                fail(typeName(v), "type not supported");
+        }
+    }
+
+    std::string out;
+
+private:
+    [[noreturn]] void fail(const std::string& type, const char* reason) {
+        raise(state, "Cannot serialise " + type + ": " + reason);
+    }
+
+    void number(double d) {
+        if (std::isnan(d) || std::isinf(d)) {
+            fail("number", "must not be NaN or Inf");
+        }
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.14g", d);
+        out += buf;
+    }
+
+    void string(const std::string& s) {
+        static const char hex[] = "0123456789abcdef";
+        out += '"';
+        for (char c : s) {
+            unsigned char u = static_cast<unsigned char>(c);
+            switch (c) {
+                case '"': out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '/': out += "\\/"; break;
+                case '\b': out += "\\b"; break;
+                case '\f': out += "\\f"; break;
+                case '\n': out += "\\n"; break;
+                case '\r': out += "\\r"; break;
+                case '\t': out += "\\t"; break;
+                default:
+                    if (u < 0x20 || u == 0x7f) {
+                        out += "\\u00";
+                        out += hex[u >> 4];
+                        out += hex[u & 15];
+                    }
+                    else {
+                        out += c;
+                    }
+            }
+        }
+        out += '"';
+    }
+
+    // The length to encode `t` as an array with, or -1 to encode it as an
+    // object: arrays have only positive integer keys.
+    double arrayLength(const Table& t) {
+        double max = 0;
+        double items = 0;
+        Value key, v, nextKey;
+        while (t.next(key, nextKey, v)) {
+            key = nextKey;
+            if (!std::holds_alternative<double>(key)) {
+                return -1;
+            }
+            double k = std::get<double>(key);
+            if (k < 1 || k != std::floor(k)) {
+                return -1;
+            }
+            max = std::max(max, k);
+            items++;
+        }
+        if (max > items * CJSON_SPARSE_RATIO && max > CJSON_SPARSE_SAFE) {
+            fail("table", "excessively sparse array");
+        }
+        return max;
+    }
+
+    void table(const Table& t, int depth) {
+        if (depth > CJSON_MAX_DEPTH) {
+            raise(state, "Cannot serialise, excessive nesting (" + std::to_string(depth) + ")");
+        }
+
+        double length = arrayLength(t);
+        if (length > 0) {
+            out += '[';
+            for (double i = 1; i <= length; i++) {
+                if (i > 1) {
+                    out += ',';
+                }
+                value(t.get(Value(i)), depth);
+            }
+            out += ']';
+            return;
+        }
+
+        out += '{';
+        bool first = true;
+        Value key, v, nextKey;
+        while (t.next(key, nextKey, v)) {
+            key = nextKey;
+            if (!first) {
+                out += ',';
+            }
+            first = false;
+            if (std::holds_alternative<std::string>(key)) {
+                string(std::get<std::string>(key));
+            }
+            else if (std::holds_alternative<double>(key)) {
+                out += '"';
+                number(std::get<double>(key));
+                out += '"';
+            }
+            else {
+                fail("table", "table key must be a number or string");
+            }
+            out += ':';
+            value(v, depth);
+        }
+        out += '}';
+    }
+
+    State& state;
+};
+
+// Decoding. Errors name the expected and found tokens and a 1-based
+// character position, as lua-cjson's do.
+
+class Decoder {
+public:
+    Decoder(State& state, const std::string& in) : state(state), in(in) {}
+
+    Value document() {
+        Value v = value(0);
+        skipSpace();
+        if (pos < in.size()) {
+            expected("the end", found());
+        }
+        return v;
+    }
+
+private:
+    [[noreturn]] void expected(const char* what, const std::string& got) {
+        raise(state, std::string("Expected ") + what + " but found " + got + " at character " +
+                         std::to_string(start + 1));
+    }
+
+    void skipSpace() {
+        while (pos < in.size() && (in[pos] == ' ' || in[pos] == '\t' || in[pos] == '\n' || in[pos] == '\r')) {
+            pos++;
+        }
+        start = pos;
+    }
+
+    // The name of the token at `pos`, for error messages.
+    std::string found() {
+        if (pos >= in.size()) {
+            return "T_END";
+        }
+        switch (in[pos]) {
+            case '{': return "T_OBJ_BEGIN";
+            case '}': return "T_OBJ_END";
+            case '[': return "T_ARR_BEGIN";
+            case ']': return "T_ARR_END";
+            case '"': return "T_STRING";
+            case ':': return "T_COLON";
+            case ',': return "T_COMMA";
+            default: break;
+        }
+        if (in[pos] == '-' || isdigit(static_cast<unsigned char>(in[pos]))) {
+            return "T_NUMBER";
+        }
+        if (in.compare(pos, 4, "true") == 0 || in.compare(pos, 5, "false") == 0) {
+            return "T_BOOLEAN";
+        }
+        return in.compare(pos, 4, "null") == 0 ? "T_NULL" : "invalid token";
+    }
+
+    bool accept(char c) {
+        if (pos < in.size() && in[pos] == c) {
+            pos++;
+            return true;
+        }
+        return false;
+    }
+
+    void descend(int depth) {
+        if (depth > CJSON_MAX_DEPTH) {
+            raise(state, "Found too many nested data structures (" + std::to_string(depth) + ") at character " +
+                             std::to_string(start + 1));
+        }
+    }
+
+    Value value(int depth) {
+        skipSpace();
+        if (accept('{')) {
+            return object(depth + 1);
+        }
+        if (accept('[')) {
+            return array(depth + 1);
+        }
+        if (pos < in.size() && in[pos] == '"') {
+            return string();
+        }
+        if (pos < in.size() && (in[pos] == '-' || isdigit(static_cast<unsigned char>(in[pos])))) {
+            char* end;
+            double d = strtod(in.c_str() + pos, &end);
+            if (end == in.c_str() + pos) {
+                expected("value", "invalid number");
+            }
+            pos = end - in.c_str();
+            return d;
+        }
+        for (const auto& [word, v] : {std::pair<const char*, Value>{"true", true}, {"false", false}, {"null", null}}) {
+            std::string w = word;
+            if (in.compare(pos, w.size(), w) == 0) {
+                pos += w.size();
+                return v;
+            }
+        }
+        expected("value", found());
+    }
+
+    Value object(int depth) {
+        descend(depth);
+        auto t = std::make_shared<Table>();
+        skipSpace();
+        if (accept('}')) {
+            return t;
+        }
+        for (;;) {
+            skipSpace();
+            if (pos >= in.size() || in[pos] != '"') {
+                expected("object key string", found());
+            }
+            Value key = string();
+            skipSpace();
+            if (!accept(':')) {
+                expected("colon", found());
+            }
+            t->set(key, value(depth));
+            skipSpace();
+            if (accept('}')) {
+                return t;
+            }
+            if (!accept(',')) {
+                expected("comma or object end", found());
+            }
+        }
+    }
+
+    Value array(int depth) {
+        descend(depth);
+        auto t = std::make_shared<Table>();
+        skipSpace();
+        if (accept(']')) {
+            return t;
+        }
+        Values items;
+        for (;;) {
+            items.push_back(value(depth));
+            skipSpace();
+            if (accept(']')) {
+                t->setList(std::move(items));
+                return t;
+            }
+            if (!accept(',')) {
+                expected("comma or array end", found());
+            }
+        }
+    }
+
+    int hexDigit(char c) {
+        if (c >= '0' && c <= '9') {
+            return c - '0';
+        }
+        c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+        return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+    }
+
+    // The code unit of a \uXXXX escape at `pos`, or -1.
+    long codeUnit() {
+        if (pos + 6 > in.size() || in[pos] != '\\' || in[pos + 1] != 'u') {
+            return -1;
+        }
+        long unit = 0;
+        for (size_t i = pos + 2; i < pos + 6; i++) {
+            int d = hexDigit(in[i]);
+            if (d < 0) {
+                return -1;
+            }
+            unit = unit * 16 + d;
+        }
+        pos += 6;
+        return unit;
+    }
+
+    static void appendUtf8(std::string& out, long cp) {
+        if (cp < 0x80) {
+            out += static_cast<char>(cp);
+        }
+        else if (cp < 0x800) {
+            out += static_cast<char>(0xc0 | (cp >> 6));
+            out += static_cast<char>(0x80 | (cp & 0x3f));
+        }
+        else if (cp < 0x10000) {
+            out += static_cast<char>(0xe0 | (cp >> 12));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+            out += static_cast<char>(0x80 | (cp & 0x3f));
+        }
+        else {
+            out += static_cast<char>(0xf0 | (cp >> 18));
+            out += static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+            out += static_cast<char>(0x80 | (cp & 0x3f));
+        }
+    }
+
+    std::string string() {
+        pos++;
+        std::string out;
+        for (;;) {
+            if (pos >= in.size()) {
+                expected("value", "unexpected end of string");
+            }
+            char c = in[pos];
+            if (c == '"') {
+                pos++;
+                return out;
+            }
+            if (c != '\\') {
+                out += c;
+                pos++;
+                continue;
+            }
+            if (pos + 1 >= in.size()) {
+                expected("value", "unexpected end of string");
+            }
+            char e = in[pos + 1];
+            if (e == 'u') {
+                long cp = codeUnit();
+                if (cp >= 0xd800 && cp <= 0xdbff) {
+                    long low = codeUnit();
+                    cp = low >= 0xdc00 && low <= 0xdfff ? 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00) : -1;
+                }
+                else if (cp >= 0xdc00 && cp <= 0xdfff) {
+                    cp = -1;
+                }
+                if (cp < 0) {
+                    expected("value", "invalid unicode escape code");
+                }
+                appendUtf8(out, cp);
+                continue;
+            }
+            const char* escapes = "\"\\/bfnrt";
+            const char* replacements = "\"\\/\b\f\n\r\t";
+            const char* match = e == '\0' ? nullptr : strchr(escapes, e);
+            if (match == nullptr) {
+                expected("value", "invalid escape code");
+            }
+            out += replacements[match - escapes];
+            pos += 2;
+        }
+    }
+
+    State& state;
+    const std::string& in;
+    size_t pos = 0;
+    // Where the token being read starts.
+    size_t start = 0;
+};
+
+}
+
+void openCjson(Table& lib) {
+    add(lib, "encode", [](State& state, Values& args) -> Values {
+        if (args.size() != 1) {
+            argError(state, 0, "encode", "expected 1 argument");
+        }
+        Encoder encoder(state);
+        encoder.value(args[0], 0);
+        return {std::move(encoder.out)};
+    });
+    add(lib, "decode", [](State& state, Values& args) -> Values {
+        if (args.size() != 1) {
+            argError(state, 0, "decode", "expected 1 argument");
+        }
+        std::string in = checkString(state, args, 0, "decode");
+        return {Decoder(state, in).document()};
+    });
+    lib.set(std::string("null"), null);
+    lib.set(std::string("_NAME"), std::string("cjson"));
+    lib.set(std::string("_VERSION"), std::string("2.1.0"));
+}
+
+}
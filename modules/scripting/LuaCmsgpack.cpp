@@ -0,0 +1,358 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include "Lua.h"
+
+// Tables nested deeper than this pack as nil, as in lua-cmsgpack.
+#define CMSGPACK_MAX_NESTING 16
+// Input nested deeper than this fails to unpack rather than exhausting the
+// stack.
+#define CMSGPACK_MAX_UNPACK_DEPTH 1000
+
+namespace lua {
+
+namespace {
+
+// Packing.
+
+void putBigEndian(std::string& out, uint64_t v, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--) {
+        out += static_cast<char>((v >> (i * 8)) & 0xff);
+    }
+}
+
+// A type byte followed by a length in the smallest of 1, 2 or 4 bytes;
+// `fixed` is the tag of the one-byte form with the length in its low bits
+// (0 if there is none), `fixedMax` the largest length it holds.
+void putHeader(std::string& out, size_t len, uint8_t fixed, size_t fixedMax, uint8_t tag8, uint8_t tag16,
+               uint8_t tag32) {
+    if (fixed != 0 && len <= fixedMax) {
+        out += static_cast<char>(fixed | len);
+    }
+    else if (tag8 != 0 && len <= 0xff) {
+        out += static_cast<char>(tag8);
+        putBigEndian(out, len, 1);
+    }
+    else if (len <= 0xffff) {
+        out += static_cast<char>(tag16);
+        putBigEndian(out, len, 2);
+    }
+    else {
+        out += static_cast<char>(tag32);
+        putBigEndian(out, len, 4);
+    }
+}
+
+void packInteger(std::string& out, int64_t n) {
+    if (n >= 0) {
+        uint64_t u = static_cast<uint64_t>(n);
+        if (u <= 127) {
+            out += static_cast<char>(u);
+        }
+        else if (u <= 0xff) {
+            out += '\xcc';
+            putBigEndian(out, u, 1);
+        }
+        else if (u <= 0xffff) {
+            out += '\xcd';
+            putBigEndian(out, u, 2);
+        }
+        else if (u <= 0xffffffffull) {
+            out += '\xce';
+            putBigEndian(out, u, 4);
+        }
+        else {
+            out += '\xcf';
+            putBigEndian(out, u, 8);
+        }
+        return;
+    }
+
+    uint64_t bits = static_cast<uint64_t>(n);
+    if (n >= -32) {
+        out += static_cast<char>(n);
+    }
+    else if (n >= INT8_MIN) {
+        out += '\xd0';
+        putBigEndian(out, bits, 1);
+    }
+    else if (n >= INT16_MIN) {
+        out += '\xd1';
+        putBigEndian(out, bits, 2);
+    }
+    else if (n >= INT32_MIN) {
+        out += '\xd2';
+        putBigEndian(out, bits, 4);
+    }
+    else {
+        out += '\xd3';
+        putBigEndian(out, bits, 8);
+    }
+}
+
+void packNumber(std::string& out, double d) {
+    if (!std::isinf(d) && d >= -9223372036854775808.0 && d < 9223372036854775808.0 &&
+        static_cast<double>(static_cast<int64_t>(d)) == d) {
+        packInteger(out, static_cast<int64_t>(d));
+        return;
+    }
+    float f = static_cast<float>(d);
+    if (static_cast<double>(f) == d) {
+        uint32_t bits;
+        std::memcpy(&bits, &f, sizeof(bits));
+        out += '\xca';
+        putBigEndian(out, bits, 4);
+    }
+    else {
+        uint64_t bits;
+        std::memcpy(&bits, &d, sizeof(bits));
+        out += '\xcb';
+        putBigEndian(out, bits, 8);
+    }
+}
+
+// Tables whose keys are exactly 1..n pack as arrays; the empty table too.
+bool isArray(const Table& t) {
+    double max = 0;
+    double count = 0;
+    Value key, nextKey, v;
+    while (t.next(key, nextKey, v)) {
+        key = nextKey;
+        if (!std::holds_alternative<double>(key)) {
+            return false;
+        }
+        double k = std::get<double>(key);
+        if (k <= 0 || k != std::floor(k)) {
+            return false;
+        }
+        max = std::max(max, k);
+        count++;
+    }
+    return max == count;
+}
+
+void pack(std::string& out, const Value& v, int level) {
+    switch (v.index()) {
+        case 1:
+            out += std::get<bool>(v) ? '\xc3' : '\xc2';
+            return;
+        case 2:
+            packNumber(out, std::get<double>(v));
+            return;
+        case 3: {
+            const std::string& s = std::get<std::string>(v);
+            putHeader(out, s.size(), 0xa0, 31, 0xd9, 0xda, 0xdb);
+            out += s;
+            return;
+        }
+        case 4:
+            if (level < CMSGPACK_MAX_NESTING) {
+                break;
+            }
+            [[fallthrough]];
+        default:
+            out += '\xc0';
+            return;
+    }
+
+    const Table& t = *std::get<TablePtr>(v);
+    if (isArray(t)) {
+        size_t n = t.length();
+        putHeader(out, n, 0x90, 15, 0, 0xdc, 0xdd);
+        for (size_t i = 1; i <= n; i++) {
+            pack(out, t.get(Value(static_cast<double>(i))), level + 1);
+        }
+        return;
+    }
+
+    size_t n = 0;
+    Value key, nextKey, item;
+    while (t.next(key, nextKey, item)) {
+        key = nextKey;
+        n++;
+    }
+    putHeader(out, n, 0x80, 15, 0, 0xde, 0xdf);
+    key = Value();
+    while (t.next(key, nextKey, item)) {
+        key = nextKey;
+        pack(out, key, level + 1);
+        pack(out, item, level + 1);
+    }
+}
+
+// Unpacking.
+
+class Unpacker {
+public:
+    Unpacker(State& state, const std::string& in, size_t pos) : state(state), in(in), pos(pos) {}
+
+    size_t left() const { return in.size() - pos; }
+
+    Value value(int depth) {
+        if (depth > CMSGPACK_MAX_UNPACK_DEPTH) {
+            raise(state, "Too many nested data structures in input.");
+        }
+        uint8_t tag = byte();
+        if (tag <= 0x7f) {
+            return static_cast<double>(tag);
+        }
+        if (tag >= 0xe0) {
+            return static_cast<double>(static_cast<int8_t>(tag));
+        }
+        if ((tag & 0xf0) == 0x80) {
+            return map(tag & 0x0f, depth);
+        }
+        if ((tag & 0xf0) == 0x90) {
+            return array(tag & 0x0f, depth);
+        }
+        if ((tag & 0xe0) == 0xa0) {
+            return bytes(tag & 0x1f);
+        }
+
+        switch (tag) {
+            case 0xc0: return Value();
+            case 0xc2: return false;
+            case 0xc3: return true;
+            case 0xca: {
+                uint32_t bits = static_cast<uint32_t>(bigEndian(4));
+                float f;
+                std::memcpy(&f, &bits, sizeof(f));
+                return static_cast<double>(f);
+            }
+            case 0xcb: {
+                uint64_t bits = bigEndian(8);
+                double d;
+                std::memcpy(&d, &bits, sizeof(d));
+                return d;
+            }
+            case 0xcc: return static_cast<double>(bigEndian(1));
+            case 0xcd: return static_cast<double>(bigEndian(2));
+            case 0xce: return static_cast<double>(bigEndian(4));
+            case 0xcf: return static_cast<double>(bigEndian(8));
+            case 0xd0: return static_cast<double>(static_cast<int8_t>(bigEndian(1)));
+            case 0xd1: return static_cast<double>(static_cast<int16_t>(bigEndian(2)));
+            case 0xd2: return static_cast<double>(static_cast<int32_t>(bigEndian(4)));
+            case 0xd3: return static_cast<double>(static_cast<int64_t>(bigEndian(8)));
+            case 0xd9: return bytes(bigEndian(1));
+            case 0xda: return bytes(bigEndian(2));
+            case 0xdb: return bytes(bigEndian(4));
+            case 0xdc: return array(bigEndian(2), depth);
+            case 0xdd: return array(bigEndian(4), depth);
+            case 0xde: return map(bigEndian(2), depth);
+            case 0xdf: return map(bigEndian(4), depth);
+            default: raise(state, "Bad data format in input.");
+        }
+    }
+
+private:
+    void need(uint64_t n) {
+        if (n > left()) {
+            raise(state, "Missing bytes in input.");
+        }
+    }
+
+    uint8_t byte() {
+        need(1);
+        return static_cast<uint8_t>(in[pos++]);
+    }
+
+    uint64_t bigEndian(int n) {
+        need(n);
+        uint64_t v = 0;
+        for (int i = 0; i < n; i++) {
+            v = (v << 8) | static_cast<uint8_t>(in[pos++]);
+        }
+        return v;
+    }
+
+    std::string bytes(uint64_t n) {
+        need(n);
+        std::string s = in.substr(pos, n);
+        pos += n;
+        return s;
+    }
+
+    Value array(uint64_t n, int depth) {
+        auto t = std::make_shared<Table>();
+        Values items;
+        for (uint64_t i = 0; i < n; i++) {
+            items.push_back(value(depth + 1));
+        }
+        t->setList(std::move(items));
+        return t;
+    }
+
+    Value map(uint64_t n, int depth) {
+        auto t = std::make_shared<Table>();
+        for (uint64_t i = 0; i < n; i++) {
+            Value key = value(depth + 1);
+            Value v = value(depth + 1);
+            t->set(key, std::move(v));
+        }
+        return t;
+    }
+
+    State& state;
+    const std::string& in;
+    size_t pos;
+};
+
+// Unpacks up to `limit` values (all if 0) starting at `offset`. With
+// `withOffset` the values are preceded by the offset after them, -1 once
+// the input is used up.
+Values unpack(State& state, const std::string& in, long long limit, long long offset, bool withOffset) {
+    if (offset < 0 || limit < 0) {
+        raise(state, "Invalid request to unpack with offset of " + std::to_string(offset) + " and limit of " +
+                         std::to_string(limit) + ".");
+    }
+    if (static_cast<unsigned long long>(offset) > in.size()) {
+        raise(state, "Start offset " + std::to_string(offset) + " greater than input length " +
+                         std::to_string(in.size()) + ".");
+    }
+
+    Unpacker unpacker(state, in, static_cast<size_t>(offset));
+    Values out;
+    if (withOffset) {
+        out.emplace_back();
+    }
+    while (unpacker.left() > 0 && (limit == 0 || static_cast<long long>(out.size()) - withOffset < limit)) {
+        out.push_back(unpacker.value(0));
+    }
+    if (withOffset) {
+        size_t left = unpacker.left();
+        out[0] = left == 0 ? -1.0 : static_cast<double>(in.size() - left);
+    }
+    return out;
+}
+
+}
+
+void openCmsgpack(Table& lib) {
+    add(lib, "pack", [](State& state, Values& args) -> Values {
+        if (args.empty()) {
+            raise(state, "MessagePack pack needs input.");
+        }
+        std::string out;
+        for (const Value& v : args) {
+            pack(out, v, 0);
+        }
+        return {std::move(out)};
+    });
+    add(lib, "unpack", [](State& state, Values& args) -> Values {
+        return unpack(state, checkString(state, args, 0, "unpack"), 0, 0, false);
+    });
+    add(lib, "unpack_one", [](State& state, Values& args) -> Values {
+        std::string in = checkString(state, args, 0, "unpack_one");
+        return unpack(state, in, 1, optInteger(state, args, 1, "unpack_one", 0), true);
+    });
+    add(lib, "unpack_limit", [](State& state, Values& args) -> Values {
+        std::string in = checkString(state, args, 0, "unpack_limit");
+        long long limit = checkInteger(state, args, 1, "unpack_limit");
+        return unpack(state, in, limit, optInteger(state, args, 2, "unpack_limit", 0), true);
+    });
+    lib.set(std::string("_NAME"), std::string("cmsgpack"));
+    lib.set(std::string("_VERSION"), std::string("lua-cmsgpack 0.4.0"));
+}
+
+}
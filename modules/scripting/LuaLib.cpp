@@ -0,0 +1,1141 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "Lua.h"
+
+namespace lua {
+
+// Argument checking, with the messages of the reference implementation.
+
+[[noreturn]] void argError(State& state, size_t i, const char* fname, const std::string& msg) {
+    raise(state, "bad argument #" + std::to_string(i + 1) + " to '" + fname + "' (" + msg + ")");
+}
+
+[[noreturn]] void typeError(State& state, const Values& args, size_t i, const char* fname, const char* expected) {
+    std::string got = i < args.size() ? typeName(args[i]) : "no value";
+    argError(state, i, fname, std::string(expected) + " expected, got " + got);
+}
+
+const Value& arg(const Values& args, size_t i) {
+    static const Value nil;
+    return i < args.size() ? args[i] : nil;
+}
+
+bool isNone(const Values& args, size_t i) {
+    return i >= args.size() || std::holds_alternative<std::monostate>(args[i]);
+}
+
+double checkNumber(State& state, const Values& args, size_t i, const char* fname) {
+    double d;
+    if (!toNumber(arg(args, i), d)) {
+        typeError(state, args, i, fname, "number");
+    }
+    return d;
+}
+
+long long checkInteger(State& state, const Values& args, size_t i, const char* fname) {
+    return static_cast<long long>(checkNumber(state, args, i, fname));
+}
+
+long long optInteger(State& state, const Values& args, size_t i, const char* fname, long long def) {
+    return isNone(args, i) ? def : checkInteger(state, args, i, fname);
+}
+
+std::string checkString(State& state, const Values& args, size_t i, const char* fname) {
+    const Value& v = arg(args, i);
+    if (std::holds_alternative<std::string>(v)) {
+        return std::get<std::string>(v);
+    }
+    if (std::holds_alternative<double>(v)) {
+        return toString(v);
+    }
+    typeError(state, args, i, fname, "string");
+}
+
+Table& checkTable(State& state, const Values& args, size_t i, const char* fname) {
+    const Value& v = arg(args, i);
+    if (!std::holds_alternative<TablePtr>(v)) {
+        typeError(state, args, i, fname, "table");
+    }
+    return *std::get<TablePtr>(v);
+}
+
+void add(Table& lib, const char* name, Builtin fn) {
+    lib.set(std::string(name), makeBuiltin(std::move(fn)));
+}
+
+namespace {
+
+Table& checkWritableTable(State& state, const Values& args, size_t i, const char* fname) {
+    Table& t = checkTable(state, args, i, fname);
+    if (t.readonly) {
+        raise(state, "Attempt to modify a readonly table");
+    }
+    return t;
+}
+
+void checkAny(State& state, const Values& args, size_t i, const char* fname) {
+    if (i >= args.size()) {
+        argError(state, i, fname, "value expected");
+    }
+}
+
+// Negative string positions count from the end.
+long long relativePosition(long long pos, size_t len) {
+    if (pos < 0) {
+        pos += static_cast<long long>(len) + 1;
+    }
+    return pos >= 0 ? pos : 0;
+}
+
+const TablePtr& stringMetatable();
+
+// Base library.
+
+Values next(State& state, Values& args) {
+    Table& t = checkTable(state, args, 0, "next");
+    Value key, value;
+    try {
+        if (!t.next(arg(args, 1), key, value)) {
+            return {Value()};
+        }
+    }
+    catch (const Error& e) {
+        raise(state, e.what());
+    }
+    return {key, value};
+}
+
+Values ipairsStep(State& state, Values& args) {
+    Table& t = checkTable(state, args, 0, "ipairs");
+    double i = checkNumber(state, args, 1, "ipairs") + 1;
+    Value v = t.get(Value(i));
+    if (std::holds_alternative<std::monostate>(v)) {
+        return {Value()};
+    }
+    return {i, v};
+}
+
+void openBase(Table& globals) {
+    static const FunctionPtr nextFn = makeBuiltin(next);
+    static const FunctionPtr ipairsFn = makeBuiltin(ipairsStep);
+
+    add(globals, "type", [](State& state, Values& args) -> Values {
+        checkAny(state, args, 0, "type");
+        return {typeName(args[0])};
+    });
+    add(globals, "tostring", [](State& state, Values& args) -> Values {
+        checkAny(state, args, 0, "tostring");
+        Value handler = metamethod(args[0], "__tostring");
+        if (!std::holds_alternative<std::monostate>(handler)) {
+            Values self{args[0]};
+            Values r = lua::call(state, handler, self);
+            return {r.empty() ? Value() : r[0]};
+        }
+        return {toString(args[0])};
+    });
+    add(globals, "tonumber", [](State& state, Values& args) -> Values {
+        checkAny(state, args, 0, "tonumber");
+        long long base = optInteger(state, args, 1, "tonumber", 10);
+        double d;
+        if (base == 10) {
+            return {toNumber(args[0], d) ? Value(d) : Value()};
+        }
+        if (base < 2 || base > 36) {
+            argError(state, 1, "tonumber", "base out of range");
+        }
+        std::string s = checkString(state, args, 0, "tonumber");
+        char* end;
+        unsigned long long n = strtoull(s.c_str(), &end, static_cast<int>(base));
+        if (end == s.c_str()) {
+            return {Value()};
+        }
+        while (isspace(static_cast<unsigned char>(*end))) {
+            end++;
+        }
+        return {*end == '\0' ? Value(static_cast<double>(n)) : Value()};
+    });
+    add(globals, "next", next);
+    add(globals, "pairs", [](State& state, Values& args) -> Values {
+        checkTable(state, args, 0, "pairs");
+        return {nextFn, args[0], Value()};
+    });
+    add(globals, "ipairs", [](State& state, Values& args) -> Values {
+        checkTable(state, args, 0, "ipairs");
+        return {ipairsFn, args[0], 0.0};
+    });
+    add(globals, "unpack", [](State& state, Values& args) -> Values {
+        Table& t = checkTable(state, args, 0, "unpack");
+        long long i = optInteger(state, args, 1, "unpack", 1);
+        long long j = isNone(args, 2) ? static_cast<long long>(t.length()) : checkInteger(state, args, 2, "unpack");
+        if (i > j) {
+            return {};
+        }
+        if (j - i >= 1000000) {
+            raise(state, "too many results to unpack");
+        }
+        Values out;
+        for (long long k = i; k <= j; k++) {
+            out.push_back(t.get(Value(static_cast<double>(k))));
+        }
+        return out;
+    });
+    add(globals, "error", [](State& state, Values& args) -> Values {
+        Value v = arg(args, 0);
+        long long level = optInteger(state, args, 1, "error", 1);
+        if (std::holds_alternative<std::string>(v) && level > 0) {
+            raise(state, std::get<std::string>(v));
+        }
+        throw Error(v);
+    });
+    add(globals, "assert", [](State& state, Values& args) -> Values {
+        checkAny(state, args, 0, "assert");
+        if (!truthy(args[0])) {
+            if (isNone(args, 1)) {
+                raise(state, "assertion failed!");
+            }
+            throw Error(args[1]);
+        }
+        return args;
+    });
+    add(globals, "pcall", [](State& state, Values& args) -> Values {
+        checkAny(state, args, 0, "pcall");
+        Value fn = args[0];
+        Values rest(args.begin() + 1, args.end());
+        int line = state.line;
+        try {
+            Values out = call(state, fn, rest);
+            out.insert(out.begin(), true);
+            return out;
+        }
+        catch (const Error& e) {
+            state.line = line;
+            return {false, e.value};
+        }
+    });
+    add(globals, "rawequal", [](State& state, Values& args) -> Values {
+        checkAny(state, args, 1, "rawequal");
+        return {args[0] == args[1]};
+    });
+    add(globals, "rawget", [](State& state, Values& args) -> Values {
+        Table& t = checkTable(state, args, 0, "rawget");
+        return {t.get(arg(args, 1))};
+    });
+    add(globals, "rawset", [](State& state, Values& args) -> Values {
+        Table& t = checkWritableTable(state, args, 0, "rawset");
+        checkAny(state, args, 2, "rawset");
+        if (!t.set(args[1], args[2])) {
+            raise(state, std::holds_alternative<std::monostate>(args[1]) ? "table index is nil"
+                                                                       : "table index must be a number or a string");
+        }
+        return {args[0]};
+    });
+    add(globals, "select", [](State& state, Values& args) -> Values {
+        long long n = static_cast<long long>(args.size());
+        const Value& first = arg(args, 0);
+        if (std::holds_alternative<std::string>(first) && std::get<std::string>(first) == "#") {
+            return {static_cast<double>(n - 1)};
+        }
+        long long i = checkInteger(state, args, 0, "select");
+        if (i < 0) {
+            i += n;
+        }
+        else if (i > n) {
+            i = n;
+        }
+        if (i < 1) {
+            argError(state, 0, "select", "index out of range");
+        }
+        return Values(args.begin() + i, args.end());
+    });
+    add(globals, "setmetatable", [](State& state, Values& args) -> Values {
+        Table& t = checkTable(state, args, 0, "setmetatable");
+        const Value& mt = arg(args, 1);
+        if (!std::holds_alternative<std::monostate>(mt) && !std::holds_alternative<TablePtr>(mt)) {
+            argError(state, 1, "setmetatable", "nil or table expected");
+        }
+        if (t.metatable != nullptr && !std::holds_alternative<std::monostate>(t.metatable->get(std::string("__metatable")))) {
+            raise(state, "cannot change a protected metatable");
+        }
+        if (t.readonly) {
+            raise(state, "Attempt to modify a readonly table");
+        }
+        t.metatable = std::holds_alternative<TablePtr>(mt) ? std::get<TablePtr>(mt) : nullptr;
+        return {args[0]};
+    });
+    add(globals, "getmetatable", [](State& state, Values& args) -> Values {
+        checkAny(state, args, 0, "getmetatable");
+        TablePtr mt;
+        if (std::holds_alternative<TablePtr>(args[0])) {
+            mt = std::get<TablePtr>(args[0])->metatable;
+        }
+        else if (std::holds_alternative<std::string>(args[0])) {
+            mt = stringMetatable();
+        }
+        if (mt == nullptr) {
+            return {Value()};
+        }
+        Value protectedValue = mt->get(std::string("__metatable"));
+        return {std::holds_alternative<std::monostate>(protectedValue) ? Value(mt) : protectedValue};
+    });
+}
+
+// Lua patterns, as in the reference lstrlib.
+
+#define LUA_MAXCAPTURES 32
+#define LUA_MAXMATCHDEPTH 200
+#define CAP_UNFINISHED (-1)
+#define CAP_POSITION (-2)
+
+struct MatchState {
+    // Both strings are NUL-terminated std::string data, so reading one past
+    // the end is safe, as the reference implementation relies on.
+    const char* srcInit;
+    const char* srcEnd;
+    const char* patEnd;
+    State* state;
+    int level;
+    int depth;
+    struct {
+        const char* init;
+        ptrdiff_t len;
+    } capture[LUA_MAXCAPTURES];
+};
+
+const char* doMatch(MatchState& ms, const char* s, const char* p);
+
+int checkCapture(MatchState& ms, int l) {
+    l -= '1';
+    if (l < 0 || l >= ms.level || ms.capture[l].len == CAP_UNFINISHED) {
+        raise(*ms.state, "invalid capture index");
+    }
+    return l;
+}
+
+int captureToClose(MatchState& ms) {
+    for (int level = ms.level - 1; level >= 0; level--) {
+        if (ms.capture[level].len == CAP_UNFINISHED) {
+            return level;
+        }
+    }
+    raise(*ms.state, "invalid pattern capture");
+}
+
+const char* classEnd(MatchState& ms, const char* p) {
+    switch (*p++) {
+        case '%':
+            if (p == ms.patEnd) {
+                raise(*ms.state, "malformed pattern (ends with '%')");
+            }
+            return p + 1;
+        case '[':
+            if (*p == '^') {
+                p++;
+            }
+            do {
+                if (p == ms.patEnd) {
+                    raise(*ms.state, "malformed pattern (missing ']')");
+                }
+                if (*(p++) == '%' && p < ms.patEnd) {
+                    p++;
+                }
+            } while (*p != ']');
+            return p + 1;
+        default:
+            return p;
+    }
+}
+
+bool matchClass(int c, int cl) {
+    bool res;
+    switch (tolower(cl)) {
+        case 'a': res = isalpha(c); break;
+        case 'c': res = iscntrl(c); break;
+        case 'd': res = isdigit(c); break;
+        case 'g': res = isgraph(c); break;
+        case 'l': res = islower(c); break;
+        case 'p': res = ispunct(c); break;
+        case 's': res = isspace(c); break;
+        case 'u': res = isupper(c); break;
+        case 'w': res = isalnum(c); break;
+        case 'x': res = isxdigit(c); break;
+        case 'z': res = c == 0; break;
+        default: return cl == c;
+    }
+    return isupper(cl) ? !res : res;
+}
+
+bool matchBracketClass(int c, const char* p, const char* ec) {
+    bool sig = true;
+    if (*(p + 1) == '^') {
+        sig = false;
+        p++;
+    }
+    while (++p < ec) {
+        if (*p == '%') {
+            p++;
+            if (matchClass(c, static_cast<unsigned char>(*p))) {
+                return sig;
+            }
+        }
+        else if (*(p + 1) == '-' && p + 2 < ec) {
+            p += 2;
+            if (static_cast<unsigned char>(*(p - 2)) <= c && c <= static_cast<unsigned char>(*p)) {
+                return sig;
+            }
+        }
+        else if (static_cast<unsigned char>(*p) == c) {
+            return sig;
+        }
+    }
+    return !sig;
+}
+
+bool singleMatch(MatchState& ms, const char* s, const char* p, const char* ep) {
+    if (s >= ms.srcEnd) {
+        return false;
+    }
+    int c = static_cast<unsigned char>(*s);
+    switch (*p) {
+        case '.': return true;
+        case '%': return matchClass(c, static_cast<unsigned char>(*(p + 1)));
+        case '[': return matchBracketClass(c, p, ep - 1);
+        default: return static_cast<unsigned char>(*p) == c;
+    }
+}
+
+const char* matchBalance(MatchState& ms, const char* s, const char* p) {
+    if (p >= ms.patEnd - 1) {
+        raise(*ms.state, "malformed pattern (missing arguments to '%b')");
+    }
+    if (s >= ms.srcEnd || *s != *p) {
+        return nullptr;
+    }
+    char b = *p, e = *(p + 1);
+    int cont = 1;
+    while (++s < ms.srcEnd) {
+        if (*s == e) {
+            if (--cont == 0) {
+                return s + 1;
+            }
+        }
+        else if (*s == b) {
+            cont++;
+        }
+    }
+    return nullptr;
+}
+
+const char* maxExpand(MatchState& ms, const char* s, const char* p, const char* ep) {
+    ptrdiff_t i = 0;
+    while (singleMatch(ms, s + i, p, ep)) {
+        i++;
+    }
+    for (; i >= 0; i--) {
+        const char* res = doMatch(ms, s + i, ep + 1);
+        if (res != nullptr) {
+            return res;
+        }
+    }
+    return nullptr;
+}
+
+const char* minExpand(MatchState& ms, const char* s, const char* p, const char* ep) {
+    while (true) {
+        const char* res = doMatch(ms, s, ep + 1);
+        if (res != nullptr) {
+            return res;
+        }
+        if (!singleMatch(ms, s, p, ep)) {
+            return nullptr;
+        }
+        s++;
+    }
+}
+
+const char* startCapture(MatchState& ms, const char* s, const char* p, int what) {
+    if (ms.level >= LUA_MAXCAPTURES) {
+        raise(*ms.state, "too many captures");
+    }
+    ms.capture[ms.level].init = s;
+    ms.capture[ms.level].len = what;
+    ms.level++;
+    const char* res = doMatch(ms, s, p);
+    if (res == nullptr) {
+        ms.level--;
+    }
+    return res;
+}
+
+const char* endCapture(MatchState& ms, const char* s, const char* p) {
+    int l = captureToClose(ms);
+    ms.capture[l].len = s - ms.capture[l].init;
+    const char* res = doMatch(ms, s, p);
+    if (res == nullptr) {
+        ms.capture[l].len = CAP_UNFINISHED;
+    }
+    return res;
+}
+
+const char* matchCapture(MatchState& ms, const char* s, int l) {
+    l = checkCapture(ms, l);
+    size_t len = ms.capture[l].len;
+    if (static_cast<size_t>(ms.srcEnd - s) >= len && memcmp(ms.capture[l].init, s, len) == 0) {
+        return s + len;
+    }
+    return nullptr;
+}
+
+const char* doMatch(MatchState& ms, const char* s, const char* p) {
+    if (ms.depth-- == 0) {
+        raise(*ms.state, "pattern too complex");
+    }
+    tick(*ms.state);
+
+    while (p != ms.patEnd) {
+        bool fallback = false;
+        switch (*p) {
+            case '(':
+                s = *(p + 1) == ')' ? startCapture(ms, s, p + 2, CAP_POSITION) : startCapture(ms, s, p + 1, CAP_UNFINISHED);
+                goto done;
+            case ')':
+                s = endCapture(ms, s, p + 1);
+                goto done;
+            case '$':
+                if (p + 1 != ms.patEnd) {
+                    fallback = true;
+                    break;
+                }
+                s = s == ms.srcEnd ? s : nullptr;
+                goto done;
+            case '%':
+                switch (*(p + 1)) {
+                    case 'b':
+                        s = matchBalance(ms, s, p + 2);
+                        if (s == nullptr) {
+                            goto done;
+                        }
+                        p += 4;
+                        continue;
+                    case 'f': {
+                        p += 2;
+                        if (*p != '[') {
+                            raise(*ms.state, "missing '[' after '%f' in pattern");
+                        }
+                        const char* ep = classEnd(ms, p);
+                        int previous = s == ms.srcInit ? 0 : static_cast<unsigned char>(*(s - 1));
+                        int current = s < ms.srcEnd ? static_cast<unsigned char>(*s) : 0;
+                        if (!matchBracketClass(previous, p, ep - 1) && matchBracketClass(current, p, ep - 1)) {
+                            p = ep;
+                            continue;
+                        }
+                        s = nullptr;
+                        goto done;
+                    }
+                    default:
+                        if (isdigit(static_cast<unsigned char>(*(p + 1)))) {
+                            s = matchCapture(ms, s, static_cast<unsigned char>(*(p + 1)));
+                            if (s == nullptr) {
+                                goto done;
+                            }
+                            p += 2;
+                            continue;
+                        }
+                        fallback = true;
+                }
+                break;
+            default:
+                fallback = true;
+        }
+
+        if (fallback) {
+            const char* ep = classEnd(ms, p);
+            if (!singleMatch(ms, s, p, ep)) {
+                if (*ep == '*' || *ep == '?' || *ep == '-') {
+                    p = ep + 1;
+                    continue;
+                }
+                s = nullptr;
+                goto done;
+            }
+            switch (*ep) {
+                case '?': {
+                    const char* res = doMatch(ms, s + 1, ep + 1);
+                    if (res != nullptr) {
+                        s = res;
+                        goto done;
+                    }
+                    p = ep + 1;
+                    continue;
+                }
+                case '+':
+                    s = maxExpand(ms, s + 1, p, ep);
+                    goto done;
+                case '*':
+                    s = maxExpand(ms, s, p, ep);
+                    goto done;
+                case '-':
+                    s = minExpand(ms, s, p, ep);
+                    goto done;
+                default:
+                    s++;
+                    p = ep;
+                    continue;
+            }
+        }
+    }
+
+done:
+    ms.depth++;
+    return s;
+}
+
+Value captureValue(MatchState& ms, int i, const char* s, const char* e) {
+    if (i >= ms.level) {
+        if (i != 0) {
+            raise(*ms.state, "invalid capture index");
+        }
+        return std::string(s, e - s);
+    }
+    ptrdiff_t len = ms.capture[i].len;
+    if (len == CAP_UNFINISHED) {
+        raise(*ms.state, "unfinished capture");
+    }
+    if (len == CAP_POSITION) {
+        return static_cast<double>(ms.capture[i].init - ms.srcInit + 1);
+    }
+    return std::string(ms.capture[i].init, len);
+}
+
+// The captures of a match, or the whole match if the pattern has none.
+Values captures(MatchState& ms, const char* s, const char* e) {
+    int n = ms.level == 0 && s != nullptr ? 1 : ms.level;
+    Values out;
+    for (int i = 0; i < n; i++) {
+        out.push_back(captureValue(ms, i, s, e));
+    }
+    return out;
+}
+
+void prepare(MatchState& ms, State& state, const std::string& src, const std::string& pat) {
+    ms.srcInit = src.data();
+    ms.srcEnd = src.data() + src.size();
+    ms.patEnd = pat.data() + pat.size();
+    ms.state = &state;
+    ms.level = 0;
+    ms.depth = LUA_MAXMATCHDEPTH;
+}
+
+Values findAux(State& state, Values& args, bool find) {
+    const char* fname = find ? "find" : "match";
+    std::string s = checkString(state, args, 0, fname);
+    std::string p = checkString(state, args, 1, fname);
+    long long init = relativePosition(optInteger(state, args, 2, fname, 1), s.size()) - 1;
+    if (init < 0) {
+        init = 0;
+    }
+    else if (static_cast<size_t>(init) > s.size()) {
+        init = static_cast<long long>(s.size());
+    }
+
+    if (find && (truthy(arg(args, 3)) || p.find_first_of("^$*+?.([%-") == std::string::npos)) {
+        size_t pos = s.find(p, init);
+        if (pos == std::string::npos) {
+            return {Value()};
+        }
+        return {static_cast<double>(pos + 1), static_cast<double>(pos + p.size())};
+    }
+
+    MatchState ms;
+    prepare(ms, state, s, p);
+    bool anchor = !p.empty() && p[0] == '^';
+    const char* pat = p.data() + (anchor ? 1 : 0);
+    const char* src = s.data() + init;
+    do {
+        ms.level = 0;
+        ms.depth = LUA_MAXMATCHDEPTH;
+        const char* e = doMatch(ms, src, pat);
+        if (e != nullptr) {
+            if (!find) {
+                return captures(ms, src, e);
+            }
+            Values out{static_cast<double>(src - s.data() + 1), static_cast<double>(e - s.data())};
+            Values caps = captures(ms, nullptr, nullptr);
+            out.insert(out.end(), caps.begin(), caps.end());
+            return out;
+        }
+    } while (src++ < ms.srcEnd && !anchor);
+
+    return {Value()};
+}
+
+// Iterator returned by string.gmatch.
+class GmatchIterator : public Function {
+public:
+    GmatchIterator(std::string src, std::string pat) : src(std::move(src)), pat(std::move(pat)) {}
+
+    Values call(State& state, Values&) override {
+        MatchState ms;
+        prepare(ms, state, src, pat);
+        for (const char* s = src.data() + pos; s <= ms.srcEnd; s++) {
+            ms.level = 0;
+            ms.depth = LUA_MAXMATCHDEPTH;
+            const char* e = doMatch(ms, s, pat.data());
+            if (e != nullptr) {
+                pos = e - src.data();
+                if (e == s) {
+                    pos++;
+                }
+                return captures(ms, s, e);
+            }
+        }
+        pos = src.size() + 1;
+        return {Value()};
+    }
+
+private:
+    std::string src;
+    std::string pat;
+    size_t pos = 0;
+};
+
+void addReplacement(MatchState& ms, std::string& out, const char* s, const char* e, const Value& repl) {
+    State& state = *ms.state;
+    Value value;
+    if (std::holds_alternative<std::string>(repl) || std::holds_alternative<double>(repl)) {
+        std::string r = toString(repl);
+        for (size_t i = 0; i < r.size(); i++) {
+            if (r[i] != '%') {
+                out.push_back(r[i]);
+                continue;
+            }
+            i++;
+            if (i >= r.size() || !isdigit(static_cast<unsigned char>(r[i]))) {
+                if (i < r.size()) {
+                    out.push_back(r[i]);
+                }
+                continue;
+            }
+            Value cap = r[i] == '0' ? Value(std::string(s, e - s)) : captureValue(ms, r[i] - '1', s, e);
+            out += toString(cap);
+        }
+        return;
+    }
+
+    Value first = captureValue(ms, 0, s, e);
+    if (std::holds_alternative<TablePtr>(repl)) {
+        value = std::get<TablePtr>(repl)->get(first);
+    }
+    else {
+        Values caps = captures(ms, s, e);
+        Values results = lua::call(state, repl, caps);
+        value = results.empty() ? Value() : results[0];
+    }
+
+    if (!truthy(value)) {
+        out.append(s, e - s);
+    }
+    else if (std::holds_alternative<std::string>(value) || std::holds_alternative<double>(value)) {
+        out += toString(value);
+    }
+    else {
+        raise(state, "invalid replacement value (a " + typeName(value) + ")");
+    }
+}
+
+Values gsub(State& state, Values& args) {
+    std::string s = checkString(state, args, 0, "gsub");
+    std::string p = checkString(state, args, 1, "gsub");
+    const Value& repl = arg(args, 2);
+    if (!(std::holds_alternative<std::string>(repl) || std::holds_alternative<double>(repl) ||
+          std::holds_alternative<TablePtr>(repl) || std::holds_alternative<FunctionPtr>(repl))) {
+        argError(state, 2, "gsub", "string/function/table expected");
+    }
+    long long maxN = optInteger(state, args, 3, "gsub", static_cast<long long>(s.size()) + 1);
+
+    MatchState ms;
+    prepare(ms, state, s, p);
+    bool anchor = !p.empty() && p[0] == '^';
+    const char* pat = p.data() + (anchor ? 1 : 0);
+    const char* src = s.data();
+    std::string out;
+    long long n = 0;
+    while (n < maxN) {
+        ms.level = 0;
+        ms.depth = LUA_MAXMATCHDEPTH;
+        const char* e = doMatch(ms, src, pat);
+        if (e != nullptr) {
+            n++;
+            addReplacement(ms, out, src, e, repl);
+        }
+        if (e != nullptr && e > src) {
+            src = e;
+        }
+        else if (src < ms.srcEnd) {
+            out.push_back(*src++);
+        }
+        else {
+            break;
+        }
+        if (anchor) {
+            break;
+        }
+    }
+    out.append(src, ms.srcEnd - src);
+    return {out, static_cast<double>(n)};
+}
+
+std::string quoted(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\0': out += "\\000"; break;
+            default: out.push_back(c);
+        }
+    }
+    out.push_back('"');
+    return out;
+}
+
+Values format(State& state, Values& args) {
+    std::string fmt = checkString(state, args, 0, "format");
+    std::string out;
+    size_t argi = 0;
+    for (size_t i = 0; i < fmt.size(); i++) {
+        if (fmt[i] != '%') {
+            out.push_back(fmt[i]);
+            continue;
+        }
+        if (++i < fmt.size() && fmt[i] == '%') {
+            out.push_back('%');
+            continue;
+        }
+
+        // Flags, then at most two digits each of width and precision.
+        size_t start = i;
+        while (i < fmt.size() && strchr("-+ #0", fmt[i]) != nullptr) {
+            i++;
+        }
+        if (i - start > 5) {
+            raise(state, "invalid format (repeated flags)");
+        }
+        for (int d = 0; d < 2 && i < fmt.size() && isdigit(static_cast<unsigned char>(fmt[i])); d++) {
+            i++;
+        }
+        if (i < fmt.size() && fmt[i] == '.') {
+            i++;
+            for (int d = 0; d < 2 && i < fmt.size() && isdigit(static_cast<unsigned char>(fmt[i])); d++) {
+                i++;
+            }
+        }
+        if (i >= fmt.size() || isdigit(static_cast<unsigned char>(fmt[i]))) {
+            raise(state, "invalid format (width or precision too long)");
+        }
+
+        std::string spec = "%" + fmt.substr(start, i - start);
+        char conv = fmt[i];
+        size_t index = ++argi;
+        char buf[512];
+        switch (conv) {
+            case 'c':
+                out.push_back(static_cast<char>(checkInteger(state, args, index, "format")));
+                continue;
+            case 'd':
+            case 'i':
+                snprintf(buf, sizeof(buf), (spec + "lld").c_str(), checkInteger(state, args, index, "format"));
+                break;
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+                snprintf(buf, sizeof(buf), (spec + "ll" + conv).c_str(),
+                         static_cast<unsigned long long>(checkInteger(state, args, index, "format")));
+                break;
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'g':
+            case 'G':
+                snprintf(buf, sizeof(buf), (spec + conv).c_str(), checkNumber(state, args, index, "format"));
+                break;
+            case 'q':
+                out += quoted(checkString(state, args, index, "format"));
+                continue;
+            case 's': {
+                std::string s = checkString(state, args, index, "format");
+                if (spec == "%" || (spec.find('.') == std::string::npos && s.size() >= 100)) {
+                    out += s;
+                    continue;
+                }
+                snprintf(buf, sizeof(buf), (spec + "s").c_str(), s.c_str());
+                break;
+            }
+            default:
+                raise(state, std::string("invalid option '%") + conv + "' to 'format'");
+        }
+        out += buf;
+    }
+    return {out};
+}
+
+void openString(Table& lib) {
+    add(lib, "len", [](State& state, Values& args) -> Values {
+        return {static_cast<double>(checkString(state, args, 0, "len").size())};
+    });
+    add(lib, "sub", [](State& state, Values& args) -> Values {
+        std::string s = checkString(state, args, 0, "sub");
+        long long i = relativePosition(optInteger(state, args, 1, "sub", 1), s.size());
+        long long j = relativePosition(optInteger(state, args, 2, "sub", -1), s.size());
+        i = std::max(i, 1LL);
+        j = std::min(j, static_cast<long long>(s.size()));
+        return {i <= j ? s.substr(i - 1, j - i + 1) : std::string()};
+    });
+    add(lib, "upper", [](State& state, Values& args) -> Values {
+        std::string s = checkString(state, args, 0, "upper");
+        std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return toupper(c); });
+        return {s};
+    });
+    add(lib, "lower", [](State& state, Values& args) -> Values {
+        std::string s = checkString(state, args, 0, "lower");
+        std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return tolower(c); });
+        return {s};
+    });
+    add(lib, "rep", [](State& state, Values& args) -> Values {
+        std::string s = checkString(state, args, 0, "rep");
+        long long n = checkInteger(state, args, 1, "rep");
+        if (n <= 0 || s.empty()) {
+            return {std::string()};
+        }
+        if (s.size() * static_cast<unsigned long long>(n) > (512ULL << 20)) {
+            raise(state, "resulting string too large");
+        }
+        std::string out;
+        out.reserve(s.size() * n);
+        for (long long i = 0; i < n; i++) {
+            out += s;
+        }
+        return {out};
+    });
+    add(lib, "reverse", [](State& state, Values& args) -> Values {
+        std::string s = checkString(state, args, 0, "reverse");
+        return {std::string(s.rbegin(), s.rend())};
+    });
+    add(lib, "byte", [](State& state, Values& args) -> Values {
+        std::string s = checkString(state, args, 0, "byte");
+        long long i = relativePosition(optInteger(state, args, 1, "byte", 1), s.size());
+        long long j = relativePosition(optInteger(state, args, 2, "byte", i), s.size());
+        i = std::max(i, 1LL);
+        j = std::min(j, static_cast<long long>(s.size()));
+        Values out;
+        for (long long k = i; k <= j; k++) {
+            out.push_back(static_cast<double>(static_cast<unsigned char>(s[k - 1])));
+        }
+        return out;
+    });
+    add(lib, "char", [](State& state, Values& args) -> Values {
+        std::string out;
+        for (size_t i = 0; i < args.size(); i++) {
+            long long c = checkInteger(state, args, i, "char");
+            if (c < 0 || c > 255) {
+                argError(state, i, "char", "invalid value");
+            }
+            out.push_back(static_cast<char>(c));
+        }
+        return {out};
+    });
+    add(lib, "format", format);
+    add(lib, "find", [](State& state, Values& args) { return findAux(state, args, true); });
+    add(lib, "match", [](State& state, Values& args) { return findAux(state, args, false); });
+    add(lib, "gmatch", [](State& state, Values& args) -> Values {
+        std::string s = checkString(state, args, 0, "gmatch");
+        std::string p = checkString(state, args, 1, "gmatch");
+        return {FunctionPtr(std::make_shared<GmatchIterator>(std::move(s), std::move(p)))};
+    });
+    add(lib, "gsub", gsub);
+}
+
+// Table library.
+
+bool sortLess(State& state, const Value& cmp, const Value& a, const Value& b) {
+    if (!std::holds_alternative<std::monostate>(cmp)) {
+        Values args{a, b};
+        Values r = lua::call(state, cmp, args);
+        return !r.empty() && truthy(r[0]);
+    }
+    return less(state, a, b);
+}
+
+// A plain merge sort: whatever the comparator returns, it stays in bounds
+// and terminates.
+void mergeSort(State& state, const Value& cmp, Values& v, Values& tmp, size_t lo, size_t hi) {
+    if (hi - lo < 2) {
+        return;
+    }
+    size_t mid = lo + (hi - lo) / 2;
+    mergeSort(state, cmp, v, tmp, lo, mid);
+    mergeSort(state, cmp, v, tmp, mid, hi);
+    size_t i = lo, j = mid, k = lo;
+    while (i < mid && j < hi) {
+        tick(state);
+        tmp[k++] = sortLess(state, cmp, v[j], v[i]) ? v[j++] : v[i++];
+    }
+    while (i < mid) {
+        tmp[k++] = v[i++];
+    }
+    while (j < hi) {
+        tmp[k++] = v[j++];
+    }
+    std::copy(tmp.begin() + lo, tmp.begin() + hi, v.begin() + lo);
+}
+
+void openTable(Table& lib) {
+    add(lib, "insert", [](State& state, Values& args) -> Values {
+        Table& t = checkWritableTable(state, args, 0, "insert");
+        double n = static_cast<double>(t.length());
+        if (args.size() == 2) {
+            t.set(Value(n + 1), args[1]);
+            return {};
+        }
+        if (args.size() != 3) {
+            raise(state, "wrong number of arguments to 'insert'");
+        }
+        double pos = static_cast<double>(checkInteger(state, args, 1, "insert"));
+        for (double i = n; i >= pos; i--) {
+            t.set(Value(i + 1), t.get(Value(i)));
+        }
+        if (!t.set(Value(pos), args[2])) {
+            raise(state, "table index is nil");
+        }
+        return {};
+    });
+    add(lib, "remove", [](State& state, Values& args) -> Values {
+        Table& t = checkWritableTable(state, args, 0, "remove");
+        double n = static_cast<double>(t.length());
+        double pos = isNone(args, 1) ? n : static_cast<double>(checkInteger(state, args, 1, "remove"));
+        if (n == 0) {
+            return {};
+        }
+        Value removed = t.get(Value(pos));
+        for (double i = pos; i < n; i++) {
+            t.set(Value(i), t.get(Value(i + 1)));
+        }
+        t.set(Value(n), Value());
+        return {removed};
+    });
+    add(lib, "concat", [](State& state, Values& args) -> Values {
+        Table& t = checkTable(state, args, 0, "concat");
+        std::string sep = isNone(args, 1) ? "" : checkString(state, args, 1, "concat");
+        long long i = optInteger(state, args, 2, "concat", 1);
+        long long j = isNone(args, 3) ? static_cast<long long>(t.length()) : checkInteger(state, args, 3, "concat");
+        std::string out;
+        for (long long k = i; k <= j; k++) {
+            Value v = t.get(Value(static_cast<double>(k)));
+            if (!std::holds_alternative<std::string>(v) && !std::holds_alternative<double>(v)) {
+                raise(state, "invalid value (at index " + std::to_string(k) + ") in table for 'concat'");
+            }
+            out += toString(v);
+            if (k != j) {
+                out += sep;
+            }
+        }
+        return {out};
+    });
+    add(lib, "sort", [](State& state, Values& args) -> Values {
+        Table& t = checkWritableTable(state, args, 0, "sort");
+        Value cmp = arg(args, 1);
+        if (!std::holds_alternative<std::monostate>(cmp) && !std::holds_alternative<FunctionPtr>(cmp)) {
+            typeError(state, args, 1, "sort", "function");
+        }
+        Values v = t.array;
+        Values tmp(v.size());
+        mergeSort(state, cmp, v, tmp, 0, v.size());
+        t.setList(std::move(v));
+        return {};
+    });
+    add(lib, "getn", [](State& state, Values& args) -> Values {
+        return {static_cast<double>(checkTable(state, args, 0, "getn").length())};
+    });
+}
+
+// Math library, without random numbers so that scripts stay deterministic.
+
+void openMath(Table& lib) {
+    using Unary = double (*)(double);
+    const std::pair<const char*, Unary> unary[] = {
+        {"abs", std::fabs}, {"ceil", std::ceil}, {"floor", std::floor}, {"sqrt", std::sqrt},
+        {"exp", std::exp},  {"log", std::log},   {"log10", std::log10}};
+    for (const auto& [name, fn] : unary) {
+        const char* fname = name;
+        Unary f = fn;
+        add(lib, name, [fname, f](State& state, Values& args) -> Values {
+            return {f(checkNumber(state, args, 0, fname))};
+        });
+    }
+    add(lib, "fmod", [](State& state, Values& args) -> Values {
+        return {std::fmod(checkNumber(state, args, 0, "fmod"), checkNumber(state, args, 1, "fmod"))};
+    });
+    add(lib, "pow", [](State& state, Values& args) -> Values {
+        return {std::pow(checkNumber(state, args, 0, "pow"), checkNumber(state, args, 1, "pow"))};
+    });
+    add(lib, "max", [](State& state, Values& args) -> Values {
+        double m = checkNumber(state, args, 0, "max");
+        for (size_t i = 1; i < args.size(); i++) {
+            m = std::max(m, checkNumber(state, args, i, "max"));
+        }
+        return {m};
+    });
+    add(lib, "min", [](State& state, Values& args) -> Values {
+        double m = checkNumber(state, args, 0, "min");
+        for (size_t i = 1; i < args.size(); i++) {
+            m = std::min(m, checkNumber(state, args, i, "min"));
+        }
+        return {m};
+    });
+    lib.set(std::string("huge"), HUGE_VAL);
+    lib.set(std::string("pi"), M_PI);
+}
+
+TablePtr makeLibrary(void (*open)(Table&)) {
+    auto lib = std::make_shared<Table>();
+    open(*lib);
+    lib->readonly = true;
+    return lib;
+}
+
+const TablePtr& stringTable() {
+    static const TablePtr lib = makeLibrary(openString);
+    return lib;
+}
+
+// What getmetatable returns for strings: {__index = string}.
+const TablePtr& stringMetatable() {
+    static const TablePtr mt = [] {
+        auto t = std::make_shared<Table>();
+        t->set(std::string("__index"), stringTable());
+        t->readonly = true;
+        return t;
+    }();
+    return mt;
+}
+
+}
+
+const Table& stringLibrary() {
+    return *stringTable();
+}
+
+void openLibraries(Table& globals) {
+    openBase(globals);
+    globals.set(std::string("string"), stringTable());
+    globals.set(std::string("table"), makeLibrary(openTable));
+    globals.set(std::string("math"), makeLibrary(openMath));
+    globals.set(std::string("bit"), makeLibrary(openBit));
+    globals.set(std::string("cjson"), makeLibrary(openCjson));
+    globals.set(std::string("cmsgpack"), makeLibrary(openCmsgpack));
+}
+
+}
@@ -0,0 +1,417 @@
+#include <chrono>
+#include <iostream>
+#include <shared_mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include "Scripting.h"
+#include "Lua.h"
+#include "commands/Handler.h"
+#include "config/Config.h"
+#include "core/Sha1.h"
+#include "data/LazyFree.h"
+#include "data/Store.h"
+#include "replication/Replication.h"
+#include "tracking/Tracking.h"
+
+namespace {
+
+using Cache = std::unordered_map<std::string, std::shared_ptr<const lua::Chunk>>;
+
+std::shared_mutex cacheMutex;
+Cache cache;
+
+// The script running on this thread, for redis.call().
+struct Context {
+    bool readOnly;
+    bool wrote;
+};
+
+thread_local Context* current = nullptr;
+
+// Keyless commands that read no keyspace state, allowed from scripts that
+// do not hold every shard.
+const std::unordered_set<std::string> keylessSafe = {"ping", "echo", "publish", "pubsub", "role"};
+
+std::shared_ptr<const lua::Chunk> cached(const std::string& sha) {
+    std::shared_lock<std::shared_mutex> lock(cacheMutex);
+    auto it = cache.find(sha);
+    return it == cache.end() ? nullptr : it->second;
+}
+
+// Compiles `source` unless cached. On a syntax error returns null with the
+// reply in `error`.
+std::shared_ptr<const lua::Chunk> load(const std::string& source, std::string& sha, std::string& error) {
+    sha = sha1Hex(source);
+    std::shared_ptr<const lua::Chunk> chunk = cached(sha);
+    if (chunk != nullptr) {
+        return chunk;
+    }
+
+    try {
+        chunk = lua::compile(source);
+    }
+    catch (const lua::Error& e) {
+        error = std::string("ERR Error compiling script (new function): ") + e.what();
+        return nullptr;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(cacheMutex);
+    return cache.emplace(sha, chunk).first->second;
+}
+
+lua::TablePtr field(const char* name, const std::string& value) {
+    auto t = std::make_shared<lua::Table>();
+    t->set(std::string(name), value);
+    return t;
+}
+
+// Reads one RESP reply into a Lua value the way Redis converts them:
+// integers to numbers, nulls to false, statuses and errors to tables with
+// an `ok` or `err` field.
+lua::Value fromReply(const std::string& in, size_t& pos) {
+    char type = in[pos];
+    size_t eol = in.find("\r\n", pos);
+    std::string line = in.substr(pos + 1, eol - pos - 1);
+    pos = eol + 2;
+    switch (type) {
+        case '+':
+            return field("ok", line);
+        case '-':
+            return field("err", line);
+        case ':':
+            return static_cast<double>(std::stoll(line));
+        case '$': {
+            long long len = std::stoll(line);
+            if (len < 0) {
+                return false;
+            }
+            std::string value = in.substr(pos, len);
+            pos += len + 2;
+            return value;
+        }
+        default: {
+            long long len = std::stoll(line);
+            if (len < 0) {
+                return false;
+            }
+            lua::Values items;
+            for (long long i = 0; i < len; i++) {
+                items.push_back(fromReply(in, pos));
+            }
+            auto t = std::make_shared<lua::Table>();
+            t->setList(std::move(items));
+            return t;
+        }
+    }
+}
+
+std::unique_ptr<resp::Response> toReply(const lua::Value& v) {
+    if (std::holds_alternative<bool>(v)) {
+        if (std::get<bool>(v)) {
+            return std::make_unique<resp::Integer>(1);
+        }
+        return std::make_unique<resp::NullString>();
+    }
+    if (std::holds_alternative<double>(v)) {
+        return std::make_unique<resp::Integer>(static_cast<int64_t>(std::get<double>(v)));
+    }
+    if (std::holds_alternative<std::string>(v)) {
+        return std::make_unique<resp::BulkString>(std::get<std::string>(v));
+    }
+    if (!std::holds_alternative<lua::TablePtr>(v)) {
+        return std::make_unique<resp::NullString>();
+    }
+
+    const lua::Table& t = *std::get<lua::TablePtr>(v);
+    lua::Value err = t.get(std::string("err"));
+    if (std::holds_alternative<std::string>(err)) {
+        return std::make_unique<resp::Error>(std::get<std::string>(err));
+    }
+    lua::Value ok = t.get(std::string("ok"));
+    if (std::holds_alternative<std::string>(ok)) {
+        return std::make_unique<resp::SimpleString>(std::get<std::string>(ok));
+    }
+
+    // Arrays end at the first nil.
+    auto arr = std::make_unique<resp::Array>();
+    for (const lua::Value& item : t.array) {
+        if (std::holds_alternative<std::monostate>(item)) {
+            break;
+        }
+        arr->addElement(toReply(item));
+    }
+    return arr;
+}
+
+// Checks that the command may run from the current script under the locks
+// it holds. Returns the error message, empty if allowed.
+std::string refuse(const Command& cmd, const std::vector<std::string>& req) {
+    if (cmd.flags & CMD_NOSCRIPT) {
+        return "This Redis command is not allowed from script";
+    }
+    if ((cmd.flags & CMD_WRITE) && current->readOnly) {
+        return "Write commands are not allowed from read-only scripts";
+    }
+
+    Store& store = Store::getInstance();
+    if (cmd.firstKey == 0) {
+        if (!store.isLockedAll() && keylessSafe.count(req[0]) == 0) {
+            return "Command '" + req[0] + "' needs the whole keyspace; call the script with numkeys 0";
+        }
+        return "";
+    }
+    for (const std::string& key : commandKeys(cmd, req)) {
+        if (!store.isLocked(key)) {
+            return "Script attempted to access key '" + key + "' not declared in KEYS";
+        }
+    }
+    return "";
+}
+
+// redis.call() and redis.pcall(): run a command and convert its reply.
+// Error replies raise with call() and are returned with pcall().
+lua::Values redisCall(lua::State& state, lua::Values& args, bool raiseErrors) {
+    if (args.empty()) {
+        lua::raise(state, "Please specify at least one argument for this redis lib call");
+    }
+
+    std::vector<std::string> req;
+    for (const lua::Value& arg : args) {
+        if (!std::holds_alternative<std::string>(arg) && !std::holds_alternative<double>(arg)) {
+            lua::raise(state, "Lua redis lib command arguments must be strings or integers");
+        }
+        req.push_back(lua::toString(arg));
+    }
+    req[0] = toLower(req[0]);
+
+    std::unique_ptr<resp::Response> output;
+    const Command* cmd = lookupCommand(req[0]);
+    std::string refused = cmd == nullptr ? "Unknown Redis command called from script" : refuse(*cmd, req);
+    if (!refused.empty()) {
+        output = std::make_unique<resp::Error>("ERR " + refused);
+    }
+    else if (!(cmd->flags & CMD_WRITE)) {
+        tracking::remember(commandKeys(*cmd, req));
+        output = cmd->func(req);
+    }
+    else {
+        // Nested in the scope of the EVAL itself, this buffers the write for
+        // the replication stream. CMD_EFFECTS commands buffer their effects
+        // in it themselves.
+        replication::WriteScope scope;
+        output = cmd->func(req);
+        if (output != nullptr && output->prefix() != "-") {
+            current->wrote = true;
+            if (!(cmd->flags & CMD_EFFECTS)) {
+                scope.propagate(req);
+            }
+        }
+    }
+    if (output == nullptr) {
+        output = std::make_unique<resp::Error>("ERR command failed inside script");
+    }
+
+    // Scripts see RESP2 types whatever the caller speaks.
+    size_t pos = 0;
+    lua::Value value = fromReply(output->serialize(2), pos);
+    if (raiseErrors && output->prefix() == "-") {
+        throw lua::Error(value);
+    }
+    return {value};
+}
+
+lua::TablePtr redisLibrary() {
+    auto lib = std::make_shared<lua::Table>();
+    lib->set(std::string("call"), lua::makeBuiltin([](lua::State& state, lua::Values& args) {
+        return redisCall(state, args, true);
+    }));
+    lib->set(std::string("pcall"), lua::makeBuiltin([](lua::State& state, lua::Values& args) {
+        return redisCall(state, args, false);
+    }));
+    lib->set(std::string("error_reply"), lua::makeBuiltin([](lua::State& state, lua::Values& args) -> lua::Values {
+        if (args.empty() || !std::holds_alternative<std::string>(args[0])) {
+            lua::raise(state, "wrong number or type of arguments");
+        }
+        return {field("err", std::get<std::string>(args[0]))};
+    }));
+    lib->set(std::string("status_reply"), lua::makeBuiltin([](lua::State& state, lua::Values& args) -> lua::Values {
+        if (args.empty() || !std::holds_alternative<std::string>(args[0])) {
+            lua::raise(state, "wrong number or type of arguments");
+        }
+        return {field("ok", std::get<std::string>(args[0]))};
+    }));
+    lib->set(std::string("sha1hex"), lua::makeBuiltin([](lua::State& state, lua::Values& args) -> lua::Values {
+        if (args.size() != 1 || !(std::holds_alternative<std::string>(args[0]) || std::holds_alternative<double>(args[0]))) {
+            lua::raise(state, "wrong number of arguments");
+        }
+        return {sha1Hex(lua::toString(args[0]))};
+    }));
+    lib->set(std::string("log"), lua::makeBuiltin([](lua::State& state, lua::Values& args) -> lua::Values {
+        double level;
+        if (args.size() < 2 || !lua::toNumber(args[0], level)) {
+            lua::raise(state, "redis.log() requires two arguments or more.");
+        }
+        std::string msg;
+        for (size_t i = 1; i < args.size(); i++) {
+            msg += (i > 1 ? " " : "") + lua::toString(args[i]);
+        }
+        std::cout << "Script log (" << static_cast<int>(level) << "): " << msg << std::endl;
+        return {};
+    }));
+    const std::pair<const char*, double> levels[] = {
+        {"LOG_DEBUG", 0}, {"LOG_VERBOSE", 1}, {"LOG_NOTICE", 2}, {"LOG_WARNING", 3}};
+    for (const auto& [name, level] : levels) {
+        lib->set(std::string(name), level);
+    }
+
+    lib->readonly = true;
+    return lib;
+}
+
+// Library globals, built once and shared read-only by every run.
+const lua::Table& baseGlobals() {
+    static const lua::Table globals = []() {
+        lua::Table t;
+        lua::openLibraries(t);
+        t.set(std::string("redis"), redisLibrary());
+        return t;
+    }();
+    return globals;
+}
+
+lua::TablePtr stringList(std::vector<std::string>::const_iterator begin, std::vector<std::string>::const_iterator end) {
+    lua::Values items(begin, end);
+    auto t = std::make_shared<lua::Table>();
+    t->setList(std::move(items));
+    return t;
+}
+
+std::unique_ptr<resp::Response> run(const lua::Chunk& chunk, const std::string& sha,
+                                    const std::vector<std::string>& keys, const std::vector<std::string>& req,
+                                    size_t argsFrom, bool readOnly) {
+    lua::Table globals = baseGlobals();
+    globals.set(std::string("KEYS"), stringList(keys.begin(), keys.end()));
+    globals.set(std::string("ARGV"), stringList(req.begin() + argsFrom, req.end()));
+
+    Context ctx{readOnly, false};
+    lua::State state;
+    state.globals = &globals;
+    long limitMs = config::GlobalConfig.luaTimeLimit;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(limitMs);
+    state.hook = [&ctx, limitMs, deadline]() {
+        if (limitMs > 0 && !ctx.wrote && std::chrono::steady_clock::now() > deadline) {
+            throw lua::Abort("ERR Script ran past lua_time_limit (" + std::to_string(limitMs) +
+                             " ms) and was aborted before writing");
+        }
+    };
+
+    std::unique_ptr<resp::Response> reply;
+    Store::getInstance().runLocked(keys, keys.empty(), [&]() {
+        struct Enter {
+            explicit Enter(Context* ctx) : saved(current) { current = ctx; }
+            ~Enter() { current = saved; }
+            Context* saved;
+        } enter(&ctx);
+
+        try {
+            lua::Values results = lua::run(chunk, state);
+            reply = toReply(results.empty() ? lua::Value() : results[0]);
+        }
+        catch (const lua::Error& e) {
+            if (std::holds_alternative<lua::TablePtr>(e.value)) {
+                lua::Value err = std::get<lua::TablePtr>(e.value)->get(std::string("err"));
+                if (std::holds_alternative<std::string>(err)) {
+                    reply = std::make_unique<resp::Error>(std::get<std::string>(err));
+                    return;
+                }
+            }
+            std::string msg = std::holds_alternative<std::string>(e.value) ? std::get<std::string>(e.value)
+                                                                          : "Unknown Lua error";
+            reply = std::make_unique<resp::Error>("ERR " + msg + " script: " + sha);
+        }
+        catch (const lua::Abort& e) {
+            reply = std::make_unique<resp::Error>(e.what());
+        }
+    });
+
+    return reply;
+}
+
+}
+
+std::unique_ptr<resp::Response> scripting::eval(const std::vector<std::string>& req, bool bySha, bool readOnly) {
+    if (req.size() < 3) {
+        return std::make_unique<resp::Error>("ERR wrong number of arguments for '" + req[0] + "' command");
+    }
+
+    long long numkeys;
+    try {
+        numkeys = std::stoll(req[2]);
+    }
+    catch (const std::exception& e) {
+        return std::make_unique<resp::Error>("ERR value is not an integer or out of range");
+    }
+    if (numkeys < 0) {
+        return std::make_unique<resp::Error>("ERR Number of keys can't be negative");
+    }
+    if (numkeys > static_cast<long long>(req.size()) - 3) {
+        return std::make_unique<resp::Error>("ERR Number of keys can't be greater than number of args");
+    }
+
+    std::string sha;
+    std::shared_ptr<const lua::Chunk> chunk;
+    if (bySha) {
+        sha = toLower(req[1]);
+        chunk = cached(sha);
+        if (chunk == nullptr) {
+            return std::make_unique<resp::Error>("NOSCRIPT No matching script. Please use EVAL.");
+        }
+    }
+    else {
+        std::string error;
+        chunk = load(req[1], sha, error);
+        if (chunk == nullptr) {
+            return std::make_unique<resp::Error>(error);
+        }
+    }
+
+    std::vector<std::string> keys(req.begin() + 3, req.begin() + 3 + numkeys);
+    return run(*chunk, sha, keys, req, 3 + numkeys, readOnly);
+}
+
+std::unique_ptr<resp::Response> scripting::script(const std::vector<std::string>& req) {
+    std::string sub = req.size() > 1 ? toLower(req[1]) : "";
+    if (sub == "load" && req.size() == 3) {
+        std::string sha, error;
+        if (load(req[2], sha, error) == nullptr) {
+            return std::make_unique<resp::Error>(error);
+        }
+        return std::make_unique<resp::BulkString>(sha);
+    }
+    if (sub == "exists" && req.size() > 2) {
+        auto arr = std::make_unique<resp::Array>();
+        for (size_t i = 2; i < req.size(); i++) {
+            arr->addElement(std::make_unique<resp::Integer>(cached(toLower(req[i])) != nullptr ? 1 : 0));
+        }
+        return arr;
+    }
+    if (sub == "flush" && req.size() <= 3) {
+        std::string mode = req.size() == 3 ? toLower(req[2]) : "sync";
+        if (mode != "sync" && mode != "async") {
+            return std::make_unique<resp::Error>("ERR SCRIPT FLUSH only support SYNC|ASYNC option");
+        }
+
+        auto dropped = std::make_shared<Cache>();
+        {
+            std::unique_lock<std::shared_mutex> lock(cacheMutex);
+            dropped->swap(cache);
+        }
+        if (mode == "async") {
+            lazyfree::enqueue([dropped]() mutable { dropped.reset(); });
+        }
+        return std::make_unique<resp::SimpleString>("OK");
+    }
+
+    return std::make_unique<resp::Error>("ERR Unknown subcommand or wrong number of arguments for '" +
+                                         (req.size() > 1 ? req[1] : std::string()) + "'");
+}
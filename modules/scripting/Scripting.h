@@ -0,0 +1,35 @@
+#ifndef SCRIPTING_H
+#define SCRIPTING_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "protocol/Response.h"
+
+// Server-side Lua scripts: EVAL, EVALSHA, their _RO variants, and SCRIPT.
+//
+// Scripts are compiled once and cached by the SHA1 of their source, so
+// EVALSHA and repeated EVALs skip parsing. A script runs atomically: it
+// holds the Store locks of the shards owning its declared KEYS for its
+// whole run, or of every shard when it declares none, and redis.call() may
+// only touch keys under those locks.
+//
+// Scripts are replicated by effects: each write a script performs through
+// redis.call() enters the replication stream, and a script with several
+// writes reaches replicas wrapped in MULTI/EXEC.
+//
+// A script that runs past lua_time_limit milliseconds is aborted if it has
+// not written yet; one that has written runs to completion, since its
+// effects cannot be rolled back.
+namespace scripting {
+
+// EVAL/EVALSHA script numkeys key... arg..., with `readOnly` for the _RO
+// variants.
+std::unique_ptr<resp::Response> eval(const std::vector<std::string>& req, bool bySha, bool readOnly);
+
+// SCRIPT LOAD|EXISTS|FLUSH.
+std::unique_ptr<resp::Response> script(const std::vector<std::string>& req);
+
+}
+
+#endif // SCRIPTING_H
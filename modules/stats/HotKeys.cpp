@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include "HotKeys.h"
+#include "config/Config.h"
+
+namespace hotkeys {
+
+namespace {
+
+struct Entry {
+    std::string key;
+    uint32_t count;
+};
+
+const size_t width = size_t(1) << HOTKEYS_SKETCH_BITS;
+
+std::atomic<uint32_t> sketch[HOTKEYS_SKETCH_DEPTH][size_t(1) << HOTKEYS_SKETCH_BITS];
+std::atomic<uint64_t> samples{0};
+
+std::mutex topMutex;
+std::vector<Entry> topKeys;
+// Estimate a key needs to enter the top list: 0 while it has room, else
+// the count of its coldest entry.
+std::atomic<uint32_t> floorCount{0};
+
+std::chrono::steady_clock::time_point lastDecay = std::chrono::steady_clock::now();
+
+// Counter of `key` in each row, by double hashing: row i takes
+// h1 + i * h2, with h2 odd so the rows differ.
+void slots(std::string_view key, std::atomic<uint32_t>* out[HOTKEYS_SKETCH_DEPTH]) {
+    uint64_t h1 = std::hash<std::string_view>()(key);
+    uint64_t h2 = ((h1 ^ (h1 >> 31)) * 0x9E3779B97F4A7C15ull) | 1;
+    for (size_t i = 0; i < HOTKEYS_SKETCH_DEPTH; i++) {
+        out[i] = &sketch[i][(h1 + i * h2) & (width - 1)];
+    }
+}
+
+uint32_t minimum(std::atomic<uint32_t>* counters[HOTKEYS_SKETCH_DEPTH]) {
+    uint32_t least = UINT32_MAX;
+    for (size_t i = 0; i < HOTKEYS_SKETCH_DEPTH; i++) {
+        least = std::min(least, counters[i]->load(std::memory_order_relaxed));
+    }
+    return least;
+}
+
+uint64_t scaled(uint64_t count) {
+    return count * std::max(config::GlobalConfig.hotkeysSampleRate, 1);
+}
+
+// Caller holds topMutex.
+void updateFloor() {
+    uint32_t least = 0;
+    if (topKeys.size() >= HOTKEYS_TOP_SIZE) {
+        least = UINT32_MAX;
+        for (const Entry& entry : topKeys) {
+            least = std::min(least, entry.count);
+        }
+    }
+    floorCount.store(least, std::memory_order_relaxed);
+}
+
+}
+
+bool sample() {
+    static thread_local bool seeded = false;
+    static thread_local uint32_t countdown = 0;
+    static thread_local uint64_t rng = 0x9E3779B97F4A7C15ull ^ reinterpret_cast<uintptr_t>(&countdown);
+    int rate = config::GlobalConfig.hotkeysSampleRate;
+    if (rate <= 0) {
+        return false;
+    }
+
+    // Random gaps, rather than every rate-th command, so that a client
+    // cycling through keys in step with the rate is not always seen on the
+    // same key. The first gap is random too, or every new connection would
+    // sample its first command.
+    auto gap = [&]() {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        return static_cast<uint32_t>(rng % (2 * static_cast<uint64_t>(rate) - 1));
+    };
+    if (!seeded) {
+        seeded = true;
+        countdown = gap();
+    }
+    if (countdown > 0) {
+        countdown--;
+        return false;
+    }
+    countdown = gap();
+    return true;
+}
+
+void record(std::string_view key) {
+    std::atomic<uint32_t>* counters[HOTKEYS_SKETCH_DEPTH];
+    slots(key, counters);
+    uint32_t count = minimum(counters);
+    if (count == UINT32_MAX) {
+        return;
+    }
+
+    // Lost updates between racing threads only make the estimate low by
+    // as much, which sampling does anyway.
+    count++;
+    for (size_t i = 0; i < HOTKEYS_SKETCH_DEPTH; i++) {
+        if (counters[i]->load(std::memory_order_relaxed) < count) {
+            counters[i]->store(count, std::memory_order_relaxed);
+        }
+    }
+    samples.fetch_add(1, std::memory_order_relaxed);
+
+    if (count <= floorCount.load(std::memory_order_relaxed)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(topMutex);
+    auto it = std::find_if(topKeys.begin(), topKeys.end(), [&](const Entry& entry) { return entry.key == key; });
+    if (it != topKeys.end()) {
+        it->count = std::max(it->count, count);
+    }
+    else if (topKeys.size() < HOTKEYS_TOP_SIZE) {
+        topKeys.push_back({std::string(key), count});
+    }
+    else {
+        auto coldest = std::min_element(topKeys.begin(), topKeys.end(), [](const Entry& a, const Entry& b) {
+            return a.count < b.count;
+        });
+        if (coldest->count >= count) {
+            return;
+        }
+        *coldest = {std::string(key), count};
+    }
+    updateFloor();
+}
+
+uint64_t estimate(std::string_view key) {
+    std::atomic<uint32_t>* counters[HOTKEYS_SKETCH_DEPTH];
+    slots(key, counters);
+    return scaled(minimum(counters));
+}
+
+std::vector<std::pair<std::string, uint64_t>> top(size_t count) {
+    std::vector<Entry> entries;
+    {
+        std::lock_guard<std::mutex> lock(topMutex);
+        entries = topKeys;
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.count > b.count;
+    });
+
+    std::vector<std::pair<std::string, uint64_t>> hottest;
+    for (size_t i = 0; i < entries.size() && i < count; i++) {
+        hottest.emplace_back(std::move(entries[i].key), scaled(entries[i].count));
+    }
+    return hottest;
+}
+
+uint64_t sampled() {
+    return samples.load(std::memory_order_relaxed);
+}
+
+void decay() {
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastDecay < std::chrono::seconds(HOTKEYS_DECAY_SECONDS)) {
+        return;
+    }
+    lastDecay = now;
+
+    for (auto& row : sketch) {
+        for (std::atomic<uint32_t>& counter : row) {
+            uint32_t count = counter.load(std::memory_order_relaxed);
+            if (count != 0) {
+                counter.store(count / 2, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(topMutex);
+    for (Entry& entry : topKeys) {
+        entry.count /= 2;
+    }
+    topKeys.erase(std::remove_if(topKeys.begin(), topKeys.end(), [](const Entry& entry) { return entry.count == 0; }),
+                  topKeys.end());
+    updateFloor();
+}
+
+void reset() {
+    for (auto& row : sketch) {
+        for (std::atomic<uint32_t>& counter : row) {
+            counter.store(0, std::memory_order_relaxed);
+        }
+    }
+    samples.store(0, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(topMutex);
+    topKeys.clear();
+    updateFloor();
+}
+
+}
@@ -0,0 +1,55 @@
+#ifndef HOTKEYS_H
+#define HOTKEYS_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Count-min sketch of HOTKEYS_SKETCH_DEPTH rows of 2^HOTKEYS_SKETCH_BITS
+// counters.
+#define HOTKEYS_SKETCH_DEPTH 4
+#define HOTKEYS_SKETCH_BITS 14
+// Keys kept in the top list.
+#define HOTKEYS_TOP_SIZE 32
+// Every count is halved this often.
+#define HOTKEYS_DECAY_SECONDS 10
+
+// Hot-key detection for OBJECT FREQ and HOTKEYS.
+//
+// The keys of one in hotkeys_sample_rate commands, picked by each client
+// thread at random intervals averaging that rate, are counted in a
+// count-min sketch: a few rows of counters, each indexed by a different
+// hash of the key, of which a key's estimate is the smallest. Estimates can
+// only overshoot, by the share of collisions, and updates only raise the
+// counters already at the minimum (conservative update) to keep that small.
+// A key whose estimate beats the coldest of the top list replaces it there.
+// Counters are relaxed atomics and the top list, under a mutex, is only
+// touched by keys hot enough to enter it, so the command path pays a
+// countdown per command and, when sampled, a few counter updates per key.
+//
+// The maintenance thread halves every count each HOTKEYS_DECAY_SECONDS,
+// so estimates reflect the last few tens of seconds rather than all time.
+namespace hotkeys {
+
+// Whether to count the keys of this command; call once per command.
+bool sample();
+void record(std::string_view key);
+
+// Estimated accesses to `key`, sampling undone.
+uint64_t estimate(std::string_view key);
+// Up to `count` of the hottest keys with their estimates, hottest first.
+std::vector<std::pair<std::string, uint64_t>> top(size_t count);
+// Samples counted since start or the last reset.
+uint64_t sampled();
+
+// Halves every count if HOTKEYS_DECAY_SECONDS have passed since it last
+// did. Called by the maintenance thread.
+void decay();
+// CONFIG RESETSTAT.
+void reset();
+
+}
+
+#endif // HOTKEYS_H
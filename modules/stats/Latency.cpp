@@ -0,0 +1,90 @@
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include "Latency.h"
+#include "config/Config.h"
+
+namespace {
+
+struct Event {
+    std::vector<latency::Sample> samples;   // ring of LATENCY_HISTORY_LEN
+    size_t next = 0;
+    uint64_t maxMillis = 0;
+};
+
+// Events are rare by definition, so a mutex is cheap here.
+std::mutex eventsMutex;
+std::map<std::string, Event> events;
+
+}
+
+void latency::record(const char* event, uint64_t millis) {
+    int threshold = config::GlobalConfig.latencyMonitorThreshold;
+    if (threshold <= 0 || millis < static_cast<uint64_t>(threshold)) {
+        return;
+    }
+
+    std::time_t now = std::time(nullptr);
+    std::lock_guard<std::mutex> lock(eventsMutex);
+    Event& e = events[event];
+    e.maxMillis = std::max(e.maxMillis, millis);
+    if (!e.samples.empty()) {
+        Sample& last = e.samples[(e.next + e.samples.size() - 1) % e.samples.size()];
+        if (last.time == now) {
+            last.millis = std::max(last.millis, millis);
+            return;
+        }
+    }
+
+    if (e.samples.size() < LATENCY_HISTORY_LEN) {
+        e.samples.push_back({now, millis});
+    }
+    else {
+        e.samples[e.next] = {now, millis};
+        e.next = (e.next + 1) % LATENCY_HISTORY_LEN;
+    }
+}
+
+latency::Timer::~Timer() {
+    record(event, std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+std::vector<latency::EventStats> latency::latest() {
+    std::vector<EventStats> result;
+    std::lock_guard<std::mutex> lock(eventsMutex);
+    for (const auto& [name, e] : events) {
+        const Sample& last = e.samples[(e.next + e.samples.size() - 1) % e.samples.size()];
+        result.push_back({name, last, e.maxMillis});
+    }
+
+    return result;
+}
+
+std::vector<latency::Sample> latency::history(const std::string& event) {
+    std::vector<Sample> result;
+    std::lock_guard<std::mutex> lock(eventsMutex);
+    auto it = events.find(event);
+    if (it != events.end()) {
+        const Event& e = it->second;
+        for (size_t i = 0; i < e.samples.size(); i++) {
+            result.push_back(e.samples[(e.next + i) % e.samples.size()]);
+        }
+    }
+
+    return result;
+}
+
+size_t latency::reset(const std::vector<std::string>& names) {
+    std::lock_guard<std::mutex> lock(eventsMutex);
+    if (names.empty()) {
+        size_t count = events.size();
+        events.clear();
+        return count;
+    }
+
+    size_t count = 0;
+    for (const std::string& name : names) {
+        count += events.erase(name);
+    }
+    return count;
+}
@@ -0,0 +1,63 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+
+// Samples kept per event, one per second at most.
+#define LATENCY_HISTORY_LEN 160
+
+// Latency monitor (LATENCY LATEST/HISTORY/RESET).
+//
+// Code paths that can stall clients report how long they took under an
+// event name: a slow command, a snapshot save, an expire or defrag cycle, a
+// hash table rehash, the replication sync freeze, and waits for a
+// contended Store shard lock. Only durations of at least
+// latency_monitor_threshold milliseconds are kept, as a short history per
+// event plus the all-time maximum. Samples within the same second are
+// merged, keeping the larger.
+//
+// Reporting below the threshold costs a comparison, so callers report
+// unconditionally.
+namespace latency {
+
+struct Sample {
+    std::time_t time;
+    uint64_t millis;
+};
+
+struct EventStats {
+    std::string name;
+    Sample latest;
+    uint64_t maxMillis;
+};
+
+void record(const char* event, uint64_t millis);
+
+// Reports the lifetime of the scope under `event`.
+class Timer {
+public:
+    explicit Timer(const char* event) : event(event), start(std::chrono::steady_clock::now()) {}
+    ~Timer();
+
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+
+private:
+    const char* event;
+    std::chrono::steady_clock::time_point start;
+};
+
+// LATENCY LATEST, in event name order.
+std::vector<EventStats> latest();
+// LATENCY HISTORY event, oldest first.
+std::vector<Sample> history(const std::string& event);
+// LATENCY RESET; every event without names. Returns the events reset.
+size_t reset(const std::vector<std::string>& events);
+
+}
+
+#endif // LATENCY_H
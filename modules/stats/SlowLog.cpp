@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <atomic>
+#include "SlowLog.h"
+#include "config/Config.h"
+#include "data/Epoch.h"
+#include "network/Connection.h"
+
+namespace {
+
+std::atomic<slowlog::Entry*> ring[SLOWLOG_CAPACITY];
+std::atomic<uint64_t> nextId{0};
+// Entries below this id were cleared by SLOWLOG RESET.
+std::atomic<uint64_t> firstId{0};
+
+size_t ringLength() {
+    return std::clamp<long>(config::GlobalConfig.slowlogMaxLen, 1, SLOWLOG_CAPACITY);
+}
+
+void freeEntry(void* entry) {
+    delete static_cast<slowlog::Entry*>(entry);
+}
+
+std::vector<std::string> truncated(const std::vector<std::string>& req) {
+    size_t kept = req.size() > SLOWLOG_MAX_ARGS ? SLOWLOG_MAX_ARGS - 1 : req.size();
+    std::vector<std::string> args;
+    for (size_t i = 0; i < kept; i++) {
+        if (req[i].size() > SLOWLOG_MAX_ARG_LEN) {
+            args.push_back(req[i].substr(0, SLOWLOG_MAX_ARG_LEN) + "... (" +
+                           std::to_string(req[i].size() - SLOWLOG_MAX_ARG_LEN) + " more bytes)");
+        }
+        else {
+            args.push_back(req[i]);
+        }
+    }
+    if (kept < req.size()) {
+        args.push_back("... (" + std::to_string(req.size() - kept) + " more arguments)");
+    }
+
+    return args;
+}
+
+// Calls `fn` on the live entries, newest first, until it returns false.
+// Caller is inside an epoch::Guard.
+template <typename Fn>
+void walk(Fn fn) {
+    size_t length = ringLength();
+    uint64_t end = nextId.load(std::memory_order_acquire);
+    uint64_t begin = std::max(firstId.load(std::memory_order_acquire), end > length ? end - length : 0);
+    for (uint64_t id = end; id > begin; id--) {
+        // Ids still being written, or already overwritten, are skipped.
+        const slowlog::Entry* entry = ring[(id - 1) % length].load(std::memory_order_acquire);
+        if (entry != nullptr && entry->id == id - 1 && !fn(*entry)) {
+            return;
+        }
+    }
+}
+
+}
+
+void slowlog::record(const std::vector<std::string>& req, uint64_t micros) {
+    long threshold = config::GlobalConfig.slowlogLogSlowerThan;
+    if (threshold < 0 || micros < static_cast<uint64_t>(threshold)) {
+        return;
+    }
+
+    Connection* conn = Connection::current();
+    Entry* entry = new Entry{nextId.fetch_add(1, std::memory_order_acq_rel), std::time(nullptr), micros,
+                             truncated(req), conn != nullptr ? conn->peerAddress() : ""};
+
+    // Guarded: `old` may be displaced and retired by another writer.
+    epoch::Guard guard;
+    std::atomic<Entry*>& slot = ring[entry->id % ringLength()];
+    Entry* old = slot.load(std::memory_order_acquire);
+    do {
+        if (old != nullptr && old->id > entry->id) {
+            delete entry;
+            return;
+        }
+    } while (!slot.compare_exchange_weak(old, entry, std::memory_order_acq_rel, std::memory_order_acquire));
+
+    if (old != nullptr) {
+        epoch::retire(old, freeEntry);
+    }
+}
+
+std::vector<slowlog::Entry> slowlog::get(size_t count) {
+    std::vector<Entry> entries;
+    epoch::Guard guard;
+    walk([&](const Entry& entry) {
+        if (entries.size() >= count) {
+            return false;
+        }
+        entries.push_back(entry);
+        return true;
+    });
+
+    return entries;
+}
+
+size_t slowlog::len() {
+    size_t count = 0;
+    epoch::Guard guard;
+    walk([&count](const Entry&) {
+        count++;
+        return true;
+    });
+
+    return count;
+}
+
+void slowlog::reset() {
+    firstId.store(nextId.load(std::memory_order_acquire), std::memory_order_release);
+}
@@ -0,0 +1,44 @@
+#ifndef SLOWLOG_H
+#define SLOWLOG_H
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+
+// Ring slots allocated; slowlog_max_len is capped to it.
+#define SLOWLOG_CAPACITY 1024
+// Arguments kept per entry, and bytes kept per argument.
+#define SLOWLOG_MAX_ARGS 32
+#define SLOWLOG_MAX_ARG_LEN 128
+
+// SLOWLOG: the last slowlog_max_len commands that ran for at least
+// slowlog_log_slower_than microseconds.
+//
+// Entries live in a fixed ring of atomic pointers. A writer takes the next
+// id with one fetch_add and swaps its entry into slot id % length; the
+// entry it displaces is retired through epoch reclamation, so readers walk
+// the ring under an epoch::Guard without locks and writers never wait for
+// each other. A writer that finds its slot already holding a newer entry
+// (it lost a race a whole lap behind) drops its own.
+namespace slowlog {
+
+struct Entry {
+    uint64_t id;
+    std::time_t time;
+    uint64_t micros;
+    std::vector<std::string> args;
+    std::string client;
+};
+
+// Logs `req` if `micros` reaches the threshold.
+void record(const std::vector<std::string>& req, uint64_t micros);
+
+// Up to `count` entries, newest first.
+std::vector<Entry> get(size_t count);
+size_t len();
+void reset();
+
+}
+
+#endif // SLOWLOG_H
@@ -0,0 +1,186 @@
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include "Stats.h"
+
+namespace {
+
+constexpr uint64_t HALF = uint64_t(1) << (STATS_HISTOGRAM_SUB_BITS - 1);
+constexpr size_t BUCKETS = (STATS_HISTOGRAM_MAX_BITS - STATS_HISTOGRAM_SUB_BITS + 2) * HALF;
+
+// Values below 2^SUB_BITS get a bucket each. Above, a value with its top
+// bit at position b keeps its SUB_BITS leading bits, and the buckets of
+// each power of two follow those of the one below.
+size_t bucketOf(uint64_t value) {
+    value = std::min(value, (uint64_t(1) << STATS_HISTOGRAM_MAX_BITS) - 1);
+    if (value < 2 * HALF) {
+        return value;
+    }
+    int shift = 63 - __builtin_clzll(value) - STATS_HISTOGRAM_SUB_BITS + 1;
+    return shift * HALF + (value >> shift);
+}
+
+// Midpoint of the values that map to `bucket`.
+uint64_t valueOf(size_t bucket) {
+    if (bucket < 2 * HALF) {
+        return bucket;
+    }
+    int shift = bucket / HALF - 1;
+    uint64_t leading = bucket - shift * HALF;
+    return (leading << shift) + (uint64_t(1) << shift) / 2;
+}
+
+// Written only by the thread owning the recorder, so updates are plain
+// load/store pairs rather than read-modify-writes.
+struct Counters {
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> nanos{0};
+    std::atomic<uint64_t> failed{0};
+    std::atomic<uint64_t> rejected{0};
+    std::atomic<uint64_t> histogram[BUCKETS] = {};
+};
+
+void bump(std::atomic<uint64_t>& counter, uint64_t by) {
+    counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+}
+
+// One recorder per live client thread. As with epoch participants,
+// recorders are never freed, only handed to the next thread when theirs
+// exits, so readers walk the list without synchronizing with threads
+// coming and going, and the counts of exited threads are kept.
+struct Recorder {
+    std::atomic<Counters*> commands[STATS_MAX_COMMANDS] = {};
+    std::atomic<bool> inUse{true};
+    Recorder* next = nullptr;
+};
+
+std::atomic<Recorder*> recorders{nullptr};
+
+// What the counters had reached at the last CONFIG RESETSTAT.
+std::mutex baselineMutex;
+std::vector<stats::CommandStats> baseline(STATS_MAX_COMMANDS);
+
+Recorder* acquireRecorder() {
+    for (Recorder* r = recorders.load(std::memory_order_acquire); r != nullptr; r = r->next) {
+        bool expected = false;
+        if (!r->inUse.load(std::memory_order_relaxed) &&
+            r->inUse.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+            return r;
+        }
+    }
+
+    Recorder* r = new Recorder();
+    Recorder* head = recorders.load(std::memory_order_relaxed);
+    do {
+        r->next = head;
+    } while (!recorders.compare_exchange_weak(head, r, std::memory_order_release, std::memory_order_relaxed));
+
+    return r;
+}
+
+struct ThreadState {
+    Recorder* recorder = nullptr;
+
+    ~ThreadState() {
+        if (recorder != nullptr) {
+            recorder->inUse.store(false, std::memory_order_release);
+        }
+    }
+};
+
+thread_local ThreadState threadState;
+
+Counters& countersFor(int id) {
+    ThreadState& state = threadState;
+    if (state.recorder == nullptr) {
+        state.recorder = acquireRecorder();
+    }
+
+    std::atomic<Counters*>& slot = state.recorder->commands[id];
+    Counters* counters = slot.load(std::memory_order_relaxed);
+    if (counters == nullptr) {
+        counters = new Counters();
+        slot.store(counters, std::memory_order_release);
+    }
+    return *counters;
+}
+
+stats::CommandStats total(int id) {
+    stats::CommandStats sum;
+    sum.histogram.assign(BUCKETS, 0);
+    for (Recorder* r = recorders.load(std::memory_order_acquire); r != nullptr; r = r->next) {
+        const Counters* counters = r->commands[id].load(std::memory_order_acquire);
+        if (counters == nullptr) {
+            continue;
+        }
+        sum.calls += counters->calls.load(std::memory_order_relaxed);
+        sum.nanos += counters->nanos.load(std::memory_order_relaxed);
+        sum.failed += counters->failed.load(std::memory_order_relaxed);
+        sum.rejected += counters->rejected.load(std::memory_order_relaxed);
+        for (size_t b = 0; b < BUCKETS; b++) {
+            sum.histogram[b] += counters->histogram[b].load(std::memory_order_relaxed);
+        }
+    }
+
+    return sum;
+}
+
+}
+
+uint64_t stats::CommandStats::percentile(double p) const {
+    uint64_t count = 0;
+    for (uint64_t n : histogram) {
+        count += n;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    // The smallest value with at least p% of the calls at or below it.
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(p / 100 * count + 0.5));
+    uint64_t seen = 0;
+    for (size_t b = 0; b < histogram.size(); b++) {
+        seen += histogram[b];
+        if (seen >= rank) {
+            return valueOf(b);
+        }
+    }
+    return valueOf(histogram.size() - 1);
+}
+
+void stats::record(int id, uint64_t nanos, bool failed) {
+    Counters& counters = countersFor(id);
+    bump(counters.calls, 1);
+    bump(counters.nanos, nanos);
+    bump(counters.histogram[bucketOf(nanos)], 1);
+    if (failed) {
+        bump(counters.failed, 1);
+    }
+}
+
+void stats::reject(int id) {
+    bump(countersFor(id).rejected, 1);
+}
+
+stats::CommandStats stats::command(int id) {
+    CommandStats sum = total(id);
+    std::lock_guard<std::mutex> lock(baselineMutex);
+    const CommandStats& base = baseline[id];
+    // Each counter only grows, so none falls below its baseline.
+    sum.calls -= base.calls;
+    sum.nanos -= base.nanos;
+    sum.failed -= base.failed;
+    sum.rejected -= base.rejected;
+    for (size_t b = 0; b < base.histogram.size(); b++) {
+        sum.histogram[b] -= base.histogram[b];
+    }
+
+    return sum;
+}
+
+void stats::reset() {
+    std::lock_guard<std::mutex> lock(baselineMutex);
+    for (int id = 0; id < STATS_MAX_COMMANDS; id++) {
+        baseline[id] = total(id);
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstdint>
+#include <vector>
+
+// Upper bound on command ids; the command table numbers its entries from 0.
+#define STATS_MAX_COMMANDS 256
+// Latency histograms keep 2^STATS_HISTOGRAM_SUB_BITS buckets per power of
+// two, i.e. values within about 3% of their true value.
+#define STATS_HISTOGRAM_SUB_BITS 5
+// Largest latency told apart, as a power of two of nanoseconds (~68s).
+// Slower calls land in the last bucket.
+#define STATS_HISTOGRAM_MAX_BITS 36
+
+// Per-command statistics for INFO commandstats and latencystats.
+//
+// Every client thread counts into its own block of counters, so recording
+// a call is a few relaxed stores to memory no other thread writes: no
+// locks and no contended cache lines on the command path. Latencies go
+// into HDR-style log-linear histograms over nanoseconds, which keep a fixed
+// relative precision from sub-microsecond GETs to multi-second scripts in
+// a few kilobytes per command. A thread allocates the block of a command
+// the first time it runs it.
+//
+// Readers add up the blocks of every thread. Blocks outlive their thread
+// and are taken over by the next one, so the counts of clients that have
+// disconnected are kept. Counters a thread is updating may be read a call
+// behind, which is fine for monitoring.
+namespace stats {
+
+struct CommandStats {
+    uint64_t calls = 0;
+    uint64_t nanos = 0;
+    uint64_t failed = 0;    // replied with an error
+    uint64_t rejected = 0;  // refused before running
+    std::vector<uint64_t> histogram;
+
+    // Latency at percentile `p` (0-100) in nanoseconds, 0 with no calls.
+    uint64_t percentile(double p) const;
+};
+
+// Records one call of command `id` that ran for `nanos`.
+void record(int id, uint64_t nanos, bool failed);
+void reject(int id);
+
+CommandStats command(int id);
+
+// CONFIG RESETSTAT. The counters themselves are never written by other
+// threads; readers subtract what they had reached at the last reset.
+void reset();
+
+}
+
+#endif // STATS_H
@@ -0,0 +1,234 @@
+#include <atomic>
+#include <memory>
+#include <shared_mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include "Tracking.h"
+#include "network/Connection.h"
+#include "protocol/Response.h"
+
+namespace {
+
+struct Tracker {
+    Connection* conn;
+    tracking::Options options;
+};
+
+// Prefixes hang off the node their last character leads to, so a write
+// walks the trie along its key and notifies everyone met on the way.
+struct PrefixNode {
+    std::unordered_map<char, std::unique_ptr<PrefixNode>> children;
+    std::unordered_set<uint64_t> clients;
+};
+
+// Writers skip all of this while nobody tracks.
+std::atomic<size_t> trackerCount{0};
+
+std::shared_mutex registryMutex;
+std::unordered_map<uint64_t, Tracker> trackers;
+// Default mode. Entries may name clients that have gone away since; they
+// are skipped when the key is invalidated.
+std::unordered_map<std::string, std::unordered_set<uint64_t>> keyTable;
+PrefixNode prefixRoot;
+
+thread_local bool trackingOn = false;
+thread_local tracking::Options myOptions;
+
+std::shared_ptr<const std::string> encode(const std::string* key) {
+    resp::Push push;
+    push.addElement(std::make_unique<resp::BulkString>("invalidate"));
+    if (key == nullptr) {
+        push.addElement(std::make_unique<resp::Null>());
+    }
+    else {
+        auto keys = std::make_unique<resp::Array>();
+        keys->addElement(std::make_unique<resp::BulkString>(*key));
+        push.addElement(std::move(keys));
+    }
+
+    return std::make_shared<const std::string>(push.serialize(3));
+}
+
+// The id of the client writing on this thread, to honour NOLOOP.
+uint64_t writerId() {
+    Connection* conn = Connection::current();
+    return conn == nullptr ? 0 : conn->id();
+}
+
+// Caller holds registryMutex.
+void notify(uint64_t id, uint64_t writer, std::shared_ptr<const std::string>& msg, const std::string* key) {
+    auto it = trackers.find(id);
+    if (it == trackers.end() || (id == writer && it->second.options.noloop)) {
+        return;
+    }
+    if (msg == nullptr) {
+        msg = encode(key);
+    }
+
+    it->second.conn->send(msg);
+}
+
+// Caller holds registryMutex exclusively.
+void addPrefix(const std::string& prefix, uint64_t id) {
+    PrefixNode* node = &prefixRoot;
+    for (char c : prefix) {
+        std::unique_ptr<PrefixNode>& child = node->children[c];
+        if (child == nullptr) {
+            child = std::make_unique<PrefixNode>();
+        }
+        node = child.get();
+    }
+
+    node->clients.insert(id);
+}
+
+// Caller holds registryMutex exclusively. Returns whether `node` is left
+// empty, so the parent can prune it.
+bool removePrefix(PrefixNode* node, const std::string& prefix, size_t depth, uint64_t id) {
+    if (depth == prefix.size()) {
+        node->clients.erase(id);
+    }
+    else {
+        auto child = node->children.find(prefix[depth]);
+        if (child != node->children.end() && removePrefix(child->second.get(), prefix, depth + 1, id)) {
+            node->children.erase(child);
+        }
+    }
+
+    return node->clients.empty() && node->children.empty();
+}
+
+}
+
+void tracking::enable(const Options& options) {
+    disable();
+    Connection* conn = Connection::current();
+    if (conn == nullptr) {
+        return;
+    }
+
+    myOptions = options;
+    if (myOptions.bcast && myOptions.prefixes.empty()) {
+        myOptions.prefixes.push_back("");
+    }
+
+    std::unique_lock<std::shared_mutex> lock(registryMutex);
+    trackers[conn->id()] = {conn, myOptions};
+    if (myOptions.bcast) {
+        for (const std::string& prefix : myOptions.prefixes) {
+            addPrefix(prefix, conn->id());
+        }
+    }
+    trackingOn = true;
+    trackerCount.fetch_add(1);
+}
+
+void tracking::disable() {
+    if (!trackingOn) {
+        return;
+    }
+
+    uint64_t id = Connection::current()->id();
+    {
+        std::unique_lock<std::shared_mutex> lock(registryMutex);
+        trackers.erase(id);
+        if (myOptions.bcast) {
+            for (const std::string& prefix : myOptions.prefixes) {
+                removePrefix(&prefixRoot, prefix, 0, id);
+            }
+        }
+    }
+
+    trackerCount.fetch_sub(1);
+    trackingOn = false;
+    myOptions = {};
+}
+
+bool tracking::enabled() {
+    return trackingOn;
+}
+
+tracking::Options tracking::options() {
+    return myOptions;
+}
+
+void tracking::remember(const std::vector<std::string>& keys) {
+    if (!trackingOn || myOptions.bcast || keys.empty()) {
+        return;
+    }
+
+    uint64_t id = Connection::current()->id();
+    uint64_t writer = writerId();
+    std::unique_lock<std::shared_mutex> lock(registryMutex);
+    for (const std::string& key : keys) {
+        keyTable[key].insert(id);
+    }
+
+    // Over the cap, entries are dropped as if their keys were written, so
+    // their clients stop trusting the cached values.
+    while (keyTable.size() > TRACKING_TABLE_MAX_KEYS) {
+        auto victim = keyTable.begin();
+        std::shared_ptr<const std::string> msg;
+        for (uint64_t client : victim->second) {
+            notify(client, writer, msg, &victim->first);
+        }
+        keyTable.erase(victim);
+    }
+}
+
+void tracking::invalidate(const std::string& key) {
+    if (trackerCount.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+
+    uint64_t writer = writerId();
+    std::shared_ptr<const std::string> msg;
+    bool remembered;
+    {
+        std::shared_lock<std::shared_mutex> lock(registryMutex);
+        const PrefixNode* node = &prefixRoot;
+        for (size_t depth = 0; node != nullptr; depth++) {
+            for (uint64_t client : node->clients) {
+                notify(client, writer, msg, &key);
+            }
+            if (depth == key.size()) {
+                break;
+            }
+            auto child = node->children.find(key[depth]);
+            node = child == node->children.end() ? nullptr : child->second.get();
+        }
+        remembered = keyTable.find(key) != keyTable.end();
+    }
+    if (!remembered) {
+        return;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(registryMutex);
+    auto it = keyTable.find(key);
+    if (it == keyTable.end()) {
+        return;
+    }
+    for (uint64_t client : it->second) {
+        notify(client, writer, msg, &key);
+    }
+    keyTable.erase(it);
+}
+
+void tracking::invalidateAll() {
+    if (trackerCount.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+
+    uint64_t writer = writerId();
+    std::shared_ptr<const std::string> msg;
+    std::unique_lock<std::shared_mutex> lock(registryMutex);
+    for (const auto& [id, tracker] : trackers) {
+        notify(id, writer, msg, nullptr);
+    }
+    keyTable.clear();
+}
+
+size_t tracking::trackedKeys() {
+    std::shared_lock<std::shared_mutex> lock(registryMutex);
+    return keyTable.size();
+}
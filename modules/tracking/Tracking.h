@@ -0,0 +1,57 @@
+#ifndef TRACKING_H
+#define TRACKING_H
+
+#include <string>
+#include <vector>
+
+// Keys remembered for default-mode tracking before the oldest are evicted,
+// each eviction sending its invalidation early.
+#define TRACKING_TABLE_MAX_KEYS 1000000
+
+// Server-assisted client-side caching (CLIENT TRACKING).
+//
+// In the default mode the server remembers which keys each tracking client
+// read, in an invalidation table from key to client ids, and the first
+// write to such a key sends those clients an `invalidate` push and forgets
+// the entry: a client has to read a key again to hear about it again. In
+// BCAST mode nothing is remembered; clients register key prefixes in a
+// trie, and every write to a key under one of them notifies them.
+//
+// The Store reports every written key, including expiries, from under the
+// shard lock of the write, so an invalidation is queued before any client
+// can read the new value. Flushes send a single null invalidation.
+//
+// Invalidations are RESP3 push messages on the tracking connection itself,
+// so tracking needs HELLO 3. Tracking state belongs to the connection and
+// is kept per client thread.
+namespace tracking {
+
+struct Options {
+    bool bcast = false;
+    bool noloop = false;
+    std::vector<std::string> prefixes;
+};
+
+// CLIENT TRACKING ON/OFF for the current connection. Turning it on again
+// replaces the previous options.
+void enable(const Options& options);
+void disable();
+
+// Whether the current connection has tracking on, and with which options.
+bool enabled();
+Options options();
+
+// Default mode: records that the current connection is about to read
+// `keys`. Registering before the read means a concurrent write can only
+// cause a spurious invalidation, never a missed one.
+void remember(const std::vector<std::string>& keys);
+
+// Called by the Store for each written key, and once after a flush.
+void invalidate(const std::string& key);
+void invalidateAll();
+
+size_t trackedKeys();
+
+}
+
+#endif // TRACKING_H
@@ -0,0 +1,179 @@
+#include <optional>
+#include "Transaction.h"
+#include "commands/Handler.h"
+#include "data/Store.h"
+#include "replication/Replication.h"
+#include "tracking/Tracking.h"
+
+namespace {
+
+struct Watch {
+    std::string key;
+    uint64_t version;
+};
+
+thread_local bool inMulti = false;
+thread_local bool failed = false;
+thread_local std::vector<std::vector<std::string>> queued;
+thread_local std::vector<Watch> watches;
+
+void reset() {
+    inMulti = false;
+    failed = false;
+    queued.clear();
+}
+
+// Collects the keys the commands touch; `all` is set if any of them has no
+// keys, like a keyless command or a script declaring none, and the whole
+// keyspace has to be locked.
+std::vector<std::string> involvedKeys(const std::vector<std::vector<std::string>>& block, bool& all) {
+    std::vector<std::string> keys;
+    all = false;
+    for (const std::vector<std::string>& req : block) {
+        const Command* cmd = lookupCommand(req[0]);
+        if (cmd == nullptr) {
+            continue;
+        }
+        std::vector<std::string> cmdKeys = commandKeys(*cmd, req);
+        if (cmdKeys.empty()) {
+            all = true;
+            continue;
+        }
+        keys.insert(keys.end(), cmdKeys.begin(), cmdKeys.end());
+    }
+
+    return keys;
+}
+
+CmdResult run(const std::vector<std::string>& req) {
+    const Command* cmd = lookupCommand(req[0]);
+    if (cmd == nullptr) {
+        return std::make_unique<resp::Error>("ERR unknown command '" + req[0] + "'");
+    }
+
+    if (!(cmd->flags & CMD_WRITE)) {
+        tracking::remember(commandKeys(*cmd, req));
+    }
+    sampleKeys(*cmd, req);
+    try {
+        CmdResult output = cmd->func(req);
+        if (output != nullptr) {
+            return output;
+        }
+    }
+    catch (const std::exception& e) {
+    }
+
+    return std::make_unique<resp::Error>("ERR command failed inside transaction");
+}
+
+}
+
+bool transaction::active() {
+    return inMulti;
+}
+
+bool transaction::begin() {
+    if (inMulti) {
+        return false;
+    }
+
+    inMulti = true;
+    return true;
+}
+
+void transaction::queue(const std::vector<std::string>& req) {
+    queued.push_back(req);
+}
+
+void transaction::fail() {
+    failed = true;
+}
+
+std::unique_ptr<resp::Response> transaction::exec() {
+    std::vector<std::vector<std::string>> block = std::move(queued);
+    bool aborted = failed;
+    reset();
+    if (aborted) {
+        unwatch();
+        return std::make_unique<resp::Error>("EXECABORT Transaction discarded because of previous errors.");
+    }
+
+    bool all;
+    std::vector<std::string> keys = involvedKeys(block, all);
+    bool writes = false;
+    for (const std::vector<std::string>& req : block) {
+        const Command* cmd = lookupCommand(req[0]);
+        writes |= cmd != nullptr && (cmd->flags & CMD_WRITE);
+    }
+    for (const Watch& w : watches) {
+        keys.push_back(w.key);
+    }
+
+    // The write scope is taken before the shard locks, as for any write.
+    // It sends the writes to replicas as one MULTI/EXEC block when it closes.
+    std::optional<replication::WriteScope> scope;
+    if (writes) {
+        scope.emplace();
+    }
+
+    bool intact = true;
+    auto replies = std::make_unique<resp::Array>();
+    Store& store = Store::getInstance();
+    store.runLocked(keys, all, [&]() {
+        for (const Watch& w : watches) {
+            if (store.keyVersion(w.key) != w.version) {
+                intact = false;
+                return;
+            }
+        }
+
+        for (const std::vector<std::string>& req : block) {
+            CmdResult output = run(req);
+            const Command* cmd = lookupCommand(req[0]);
+            // Scripts propagate their own writes.
+            if (scope && cmd != nullptr && (cmd->flags & CMD_WRITE) && !(cmd->flags & CMD_EFFECTS) &&
+                output->prefix() != "-") {
+                scope->propagate(req);
+            }
+            replies->addElement(std::move(output));
+        }
+    });
+
+    unwatch();
+    if (!intact) {
+        return std::make_unique<resp::NullArray>();
+    }
+
+    return replies;
+}
+
+void transaction::discard() {
+    reset();
+    unwatch();
+}
+
+void transaction::watch(const std::vector<std::string>& keys) {
+    Store& store = Store::getInstance();
+    for (const std::string& key : keys) {
+        watches.push_back({key, store.watch(key)});
+    }
+}
+
+void transaction::unwatch() {
+    Store& store = Store::getInstance();
+    for (const Watch& w : watches) {
+        store.unwatch(w.key);
+    }
+    watches.clear();
+}
+
+void transaction::apply(const std::vector<std::vector<std::string>>& block) {
+    bool all;
+    std::vector<std::string> keys = involvedKeys(block, all);
+    Store::getInstance().runLocked(keys, all, [&block]() {
+        for (const std::vector<std::string>& req : block) {
+            run(req);
+        }
+    });
+}
@@ -0,0 +1,52 @@
+#ifndef TRANSACTION_H
+#define TRANSACTION_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "protocol/Response.h"
+
+// MULTI/EXEC transactions with optimistic locking through WATCH.
+//
+// Commands queued after MULTI run back to back on EXEC while the Store
+// holds the locks of every shard they touch, taken in ascending shard order
+// before the first one runs, so no other client sees or interleaves with a
+// transaction halfway. A queued command without key arguments locks the
+// whole keyspace.
+//
+// WATCH takes no lock: it records the version of each key, and EXEC
+// compares them under the transaction's locks, replying with a null array
+// if any watched key was written meanwhile.
+//
+// On a primary, the writes of a transaction reach the replication stream
+// wrapped in MULTI and EXEC, and replicas apply the block the same way.
+//
+// Transaction state belongs to the connection and is kept per client
+// thread.
+namespace transaction {
+
+// Whether the current connection is between MULTI and EXEC/DISCARD.
+bool active();
+
+// MULTI. Returns false if a transaction is already open.
+bool begin();
+
+void queue(const std::vector<std::string>& req);
+
+// Marks the open transaction as failed after a command could not be
+// queued, so that EXEC discards it.
+void fail();
+
+// EXEC and DISCARD. Both end the transaction and drop the watched keys.
+std::unique_ptr<resp::Response> exec();
+void discard();
+
+void watch(const std::vector<std::string>& keys);
+void unwatch();
+
+// Replica side: runs a MULTI/EXEC block read from the replication stream.
+void apply(const std::vector<std::vector<std::string>>& block);
+
+}
+
+#endif // TRANSACTION_H